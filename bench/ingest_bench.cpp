@@ -0,0 +1,318 @@
+#include "ingest_bench.hpp"
+#include "heartbeats.hpp"
+#include "services/app.hpp"
+#include "services/data_submission.hpp"
+#include "services/metric_db.hpp"
+#include "services/metric_streamer.hpp"
+#include "stats/registry.hpp"
+#include "stats/trace.hpp"
+#include <atomic>
+#include <chrono>
+#include <crate/common/common.hpp>
+#include <crate/externals/aixlog/logger.hpp>
+#include <crate/metrics/helper.hpp>
+#include <crate/metrics/streams/stream_data_v1.hpp>
+#include <crate/networking/message_receiver_if.hpp>
+#include <crate/networking/message_server.hpp>
+#include <crate/registrar/node_v1.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace monolith {
+namespace bench {
+
+namespace {
+
+using namespace std::chrono_literals;
+
+// Destination updates are applied by the streamer on an interval
+constexpr auto STREAMER_SETTLE_TIME = 3s;
+constexpr auto DRAIN_POLL_INTERVAL = 100ms;
+constexpr uint32_t SLOW_TRACE_MS = 60'000;
+
+std::atomic<uint64_t> received_readings{0};
+
+class stream_counter_c : public crate::networking::message_receiver_if {
+ public:
+   virtual void receive_message(std::string message) override final {
+      crate::metrics::streams::stream_data_v1_c data;
+      if (!data.decode_from(message)) {
+         return;
+      }
+      auto [timestamp, sequence, metric_data] = data.get_data();
+      received_readings.fetch_add(metric_data.size());
+   }
+};
+
+// Reads a "Field:   1234 kB" line out of /proc/self/status
+uint64_t read_status_kb(const std::string &field) {
+   std::ifstream status("/proc/self/status");
+   std::string line;
+   while (std::getline(status, line)) {
+      if (line.rfind(field + ":", 0) == 0) {
+         std::istringstream values(line.substr(field.size() + 1));
+         uint64_t kb{0};
+         values >> kb;
+         return kb;
+      }
+   }
+   return 0;
+}
+
+latency_s summarize(const monolith::stats::histogram_c &histogram) {
+   return {.count = histogram.count(),
+           .p50 = histogram.percentile(50),
+           .p99 = histogram.percentile(99),
+           .p999 = histogram.percentile(99.9),
+           .max = histogram.percentile(100)};
+}
+
+monolith::stats::histogram_c &stage_latency(const char *stage) {
+   return monolith::stats::registry().histogram(
+       "monolith_ingest_stage_latency_us", "", {{"stage", stage}});
+}
+
+uint64_t stored_readings() {
+   return monolith::stats::registry()
+       .histogram("monolith_db_insert_duration_us", "")
+       .count();
+}
+
+const char *mode_name(ingest_mode_e mode) {
+   return mode == ingest_mode_e::HTTP ? "http" : "direct";
+}
+
+void render_latency(std::stringstream &ss, const latency_s &latency) {
+   ss << "{\"count\":" << latency.count << ",\"p50\":" << latency.p50
+      << ",\"p99\":" << latency.p99 << ",\"p999\":" << latency.p999
+      << ",\"max\":" << latency.max << "}";
+}
+
+} // namespace
+
+bool run_ingest_bench(const scenario_s &scenario, result_s &result) {
+
+   namespace fs = std::filesystem;
+
+   fs::remove_all(scenario.work_dir);
+   fs::create_directories(scenario.work_dir);
+   auto registrar_path = fs::path(scenario.work_dir) / "registrar.db";
+   auto metrics_path = fs::path(scenario.work_dir) / "metrics.db";
+
+   crate::common::setup_logger(
+       (fs::path(scenario.work_dir) / "monolith_bench").string(),
+       AixLog::Severity::error);
+
+   monolith::stats::tracer().configure(scenario.trace_every, SLOW_TRACE_MS);
+   received_readings.store(0);
+   result.rss_start_kb = read_status_kb("VmRSS");
+
+   // ---------- Bring up the pipeline ----------
+
+   auto registrar = new monolith::db::kv_c(registrar_path.string());
+   auto database = new monolith::services::metric_db_c(metrics_path.string(), 0);
+   auto streamer = new monolith::services::metric_streamer_c();
+   monolith::heartbeats_c heartbeats;
+   auto submission = new monolith::services::data_submission_c(
+       registrar, streamer, database, nullptr, &heartbeats);
+   monolith::services::app_c *app{nullptr};
+   if (scenario.mode == ingest_mode_e::HTTP) {
+      app = new monolith::services::app_c(
+          monolith::networking::ipv4_host_port_s{scenario.address,
+                                                 scenario.http_port},
+          registrar, streamer, submission, database, &heartbeats, nullptr);
+   }
+
+   stream_counter_c stream_counter;
+   crate::networking::message_server_c stream_server(
+       scenario.address, scenario.stream_port, &stream_counter);
+
+   auto teardown = [&]() {
+      stream_server.stop();
+      if (app) {
+         app->stop();
+      }
+      submission->stop();
+      streamer->stop();
+      database->stop();
+      delete app;
+      delete submission;
+      delete streamer;
+      delete database;
+      delete registrar;
+      fs::remove_all(scenario.work_dir);
+   };
+
+   if (!stream_server.start() || !database->start() || !streamer->start() ||
+       !submission->start() || (app && !app->start())) {
+      LOG(ERROR) << TAG("run_ingest_bench") << "Failed to start pipeline\n";
+      teardown();
+      return false;
+   }
+
+   // ---------- Register the synthetic nodes ----------
+
+   struct series_s {
+      std::string node_id;
+      std::string sensor_id;
+   };
+   std::vector<series_s> series;
+   series.reserve(scenario.nodes * scenario.sensors_per_node);
+
+   for (uint32_t n = 0; n < scenario.nodes; n++) {
+      crate::registrar::node_v1_c node;
+      auto node_id = "bench-node-" + std::to_string(n);
+      node.set_id(node_id);
+
+      for (uint32_t s = 0; s < scenario.sensors_per_node; s++) {
+         crate::registrar::node_v1_c::sensor sensor;
+         sensor.id = "sensor-" + std::to_string(s);
+         sensor.description = "synthetic";
+         sensor.type = "bench";
+         node.add_sensor(sensor);
+         series.push_back({node_id, sensor.id});
+      }
+
+      std::string encoded;
+      if (!node.encode_to(encoded) || !registrar->store(node_id, encoded)) {
+         LOG(ERROR) << TAG("run_ingest_bench") << "Failed to register "
+                    << node_id << "\n";
+         teardown();
+         return false;
+      }
+   }
+
+   streamer->add_destination(scenario.address, scenario.stream_port);
+   std::this_thread::sleep_for(STREAMER_SETTLE_TIME);
+
+   // ---------- Drive the load ----------
+
+   std::atomic<uint64_t> sent{0};
+   std::atomic<uint64_t> send_failures{0};
+   auto clients = std::max<uint32_t>(scenario.clients, 1);
+   auto start = std::chrono::steady_clock::now();
+   auto deadline = start + std::chrono::seconds(scenario.duration_sec);
+
+   auto client = [&](uint32_t client_id) {
+      std::unique_ptr<crate::metrics::helper_c> http;
+      if (scenario.mode == ingest_mode_e::HTTP) {
+         http = std::make_unique<crate::metrics::helper_c>(
+             crate::metrics::helper_c::endpoint_type_e::HTTP, scenario.address,
+             scenario.http_port);
+      }
+
+      // Each client paces its share of the offered rate
+      std::chrono::nanoseconds interval{0};
+      if (scenario.rate) {
+         interval = std::chrono::nanoseconds(1'000'000'000ull * clients /
+                                             scenario.rate);
+      }
+
+      auto next_send = std::chrono::steady_clock::now();
+      for (size_t i = client_id; std::chrono::steady_clock::now() < deadline;
+           i += clients) {
+
+         if (interval.count()) {
+            next_send += interval;
+            std::this_thread::sleep_until(next_send);
+         }
+
+         auto &target = series[i % series.size()];
+         crate::metrics::sensor_reading_v1_c reading(
+             0, target.node_id, target.sensor_id, static_cast<double>(i));
+         reading.stamp();
+
+         bool okay{true};
+         if (http) {
+            okay = http->submit(reading) ==
+                   crate::metrics::helper_c::result::SUCCESS;
+         } else {
+            submission->submit_data(reading);
+         }
+
+         if (okay) {
+            sent.fetch_add(1, std::memory_order_relaxed);
+         } else {
+            send_failures.fetch_add(1, std::memory_order_relaxed);
+         }
+      }
+   };
+
+   std::vector<std::thread> client_threads;
+   for (uint32_t c = 0; c < clients; c++) {
+      client_threads.emplace_back(client, c);
+   }
+   for (auto &thread : client_threads) {
+      thread.join();
+   }
+
+   result.elapsed_sec = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+   result.sent = sent.load();
+   result.send_failures = send_failures.load();
+   result.sustained_rate = result.sent / result.elapsed_sec;
+
+   // ---------- Let the pipeline catch up ----------
+
+   auto drain_deadline =
+       std::chrono::steady_clock::now() + std::chrono::seconds(scenario.drain_sec);
+   while (std::chrono::steady_clock::now() < drain_deadline &&
+          (stored_readings() < result.sent ||
+           received_readings.load() < result.sent)) {
+      std::this_thread::sleep_for(DRAIN_POLL_INTERVAL);
+   }
+
+   result.stored = stored_readings();
+   result.streamed = received_readings.load();
+   result.stream_dropped = streamer->get_overflow_stats().dropped;
+   result.storage_latency = summarize(stage_latency("db_insert"));
+   result.stream_latency = summarize(stage_latency("stream_send"));
+   result.rss_end_kb = read_status_kb("VmRSS");
+   result.rss_peak_kb = read_status_kb("VmHWM");
+
+   teardown();
+   return true;
+}
+
+std::string to_json(const scenario_s &scenario, const result_s &result) {
+
+   std::stringstream ss;
+   ss << "{\"scenario\":{"
+      << "\"mode\":\"" << mode_name(scenario.mode) << "\""
+      << ",\"nodes\":" << scenario.nodes
+      << ",\"sensors_per_node\":" << scenario.sensors_per_node
+      << ",\"rate\":" << scenario.rate
+      << ",\"duration_sec\":" << scenario.duration_sec
+      << ",\"clients\":" << scenario.clients
+      << ",\"trace_every\":" << scenario.trace_every << "}"
+      << ",\"sent\":" << result.sent
+      << ",\"send_failures\":" << result.send_failures
+      << ",\"elapsed_sec\":" << result.elapsed_sec
+      << ",\"sustained_rate\":" << result.sustained_rate
+      << ",\"stored\":" << result.stored
+      << ",\"streamed\":" << result.streamed
+      << ",\"dropped\":{\"storage\":"
+      << (result.sent > result.stored ? result.sent - result.stored : 0)
+      << ",\"stream\":"
+      << (result.sent > result.streamed ? result.sent - result.streamed : 0)
+      << ",\"stream_overflow\":" << result.stream_dropped << "}"
+      << ",\"latency_us\":{\"storage\":";
+   render_latency(ss, result.storage_latency);
+   ss << ",\"stream\":";
+   render_latency(ss, result.stream_latency);
+   ss << "},\"memory_kb\":{\"rss_start\":" << result.rss_start_kb
+      << ",\"rss_end\":" << result.rss_end_kb
+      << ",\"rss_peak\":" << result.rss_peak_kb
+      << ",\"growth\":"
+      << static_cast<int64_t>(result.rss_end_kb) -
+             static_cast<int64_t>(result.rss_start_kb)
+      << "}}";
+   return ss.str();
+}
+
+} // namespace bench
+} // namespace monolith
@@ -0,0 +1,78 @@
+#ifndef MONOLITH_BENCH_INGEST_BENCH_HPP
+#define MONOLITH_BENCH_INGEST_BENCH_HPP
+
+#include <cstdint>
+#include <string>
+
+/*
+   ABOUT:
+      Drives synthetic readings through a full ingest pipeline (registrar,
+   data submission, metric database, metric streamer, and the app for http)
+   running in this process and measures what comes out the other end.
+
+   Latency to storage and to the stream receivers is taken from the ingest
+   traces (see stats/trace.hpp) so every reading, or one in
+   `trace_every`, is timed from the moment it is handed to monolith.
+*/
+
+namespace monolith {
+namespace bench {
+
+//! \brief How readings get into monolith
+enum class ingest_mode_e {
+   DIRECT, //! data_submission_c::submit_data, skipping the network
+   HTTP    //! The app's /metric/submit endpoint
+};
+
+//! \brief A single benchmark run
+struct scenario_s {
+   ingest_mode_e mode{ingest_mode_e::DIRECT};
+   uint32_t nodes{1'000};
+   uint32_t sensors_per_node{4};
+   uint32_t rate{0};         //! Readings per second offered (0 = unbounded)
+   uint32_t duration_sec{10};
+   uint32_t drain_sec{5};    //! Time given to the pipeline to catch up
+   uint32_t clients{4};      //! Sending threads
+   uint32_t trace_every{1};  //! Trace one in this many readings
+   std::string address{"127.0.0.1"};
+   uint32_t http_port{18080};
+   uint32_t stream_port{15042};
+   std::string work_dir{"monolith_bench"};
+};
+
+//! \brief Latency summary in microseconds
+struct latency_s {
+   uint64_t count{0};
+   uint64_t p50{0};
+   uint64_t p99{0};
+   uint64_t p999{0};
+   uint64_t max{0};
+};
+
+//! \brief What a run measured
+struct result_s {
+   uint64_t sent{0};
+   uint64_t send_failures{0};
+   double elapsed_sec{0};
+   double sustained_rate{0}; //! Readings per second accepted
+   uint64_t stored{0};
+   uint64_t streamed{0};
+   uint64_t stream_dropped{0}; //! Dropped by the streamer's overflow handling
+   latency_s storage_latency;
+   latency_s stream_latency;
+   uint64_t rss_start_kb{0};
+   uint64_t rss_end_kb{0};
+   uint64_t rss_peak_kb{0};
+};
+
+//! \brief Run a scenario
+//! \returns true iff the pipeline could be brought up and torn down
+bool run_ingest_bench(const scenario_s &scenario, result_s &result);
+
+//! \brief Render a scenario and its result as json
+std::string to_json(const scenario_s &scenario, const result_s &result);
+
+} // namespace bench
+} // namespace monolith
+
+#endif
@@ -0,0 +1,135 @@
+#include "ingest_bench.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+
+/*
+   monolith-bench
+
+   Runs one ingest scenario and prints the results as json (or writes them
+   to --out). Every option is `--name value`:
+
+      --mode direct|http   How readings are submitted         (direct)
+      --nodes N            Synthetic nodes to register         (1000)
+      --sensors N          Sensors per node                    (4)
+      --rate N             Readings per second, 0 = unbounded  (0)
+      --duration N         Seconds to drive load for           (10)
+      --drain N            Seconds to wait for the pipeline    (5)
+      --clients N          Sending threads                     (4)
+      --trace-every N      Time one in this many readings      (1)
+      --http-port N        Port for the app                    (18080)
+      --stream-port N      Port for the stream receiver        (15042)
+      --work-dir PATH      Scratch directory, removed after    (monolith_bench)
+      --out PATH           Write json here instead of stdout
+*/
+
+namespace {
+
+void usage(const char *name) {
+   std::cerr << "usage: " << name
+             << " [--mode direct|http] [--nodes N] [--sensors N] [--rate N]"
+                " [--duration N] [--drain N] [--clients N] [--trace-every N]"
+                " [--http-port N] [--stream-port N] [--work-dir PATH]"
+                " [--out PATH]\n";
+}
+
+std::optional<uint32_t> to_u32(const std::string &value) {
+   char *end{nullptr};
+   auto parsed = std::strtoul(value.c_str(), &end, 10);
+   if (value.empty() || *end != '\0' || parsed > UINT32_MAX) {
+      return std::nullopt;
+   }
+   return static_cast<uint32_t>(parsed);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+   monolith::bench::scenario_s scenario;
+   std::string out;
+
+   for (int i = 1; i < argc; i++) {
+      std::string option = argv[i];
+      if (option == "--help" || option == "-h" || i + 1 >= argc) {
+         usage(argv[0]);
+         return option == "--help" || option == "-h" ? 0 : 1;
+      }
+      std::string value = argv[++i];
+
+      if (option == "--mode") {
+         if (value == "direct") {
+            scenario.mode = monolith::bench::ingest_mode_e::DIRECT;
+         } else if (value == "http") {
+            scenario.mode = monolith::bench::ingest_mode_e::HTTP;
+         } else {
+            std::cerr << "Unknown mode: " << value << "\n";
+            return 1;
+         }
+         continue;
+      }
+
+      if (option == "--work-dir") {
+         scenario.work_dir = value;
+         continue;
+      }
+
+      if (option == "--out") {
+         out = value;
+         continue;
+      }
+
+      auto number = to_u32(value);
+      if (!number.has_value()) {
+         std::cerr << "Expected a number for " << option << "\n";
+         return 1;
+      }
+
+      if (option == "--nodes") {
+         scenario.nodes = *number;
+      } else if (option == "--sensors") {
+         scenario.sensors_per_node = *number;
+      } else if (option == "--rate") {
+         scenario.rate = *number;
+      } else if (option == "--duration") {
+         scenario.duration_sec = *number;
+      } else if (option == "--drain") {
+         scenario.drain_sec = *number;
+      } else if (option == "--clients") {
+         scenario.clients = *number;
+      } else if (option == "--trace-every") {
+         scenario.trace_every = *number;
+      } else if (option == "--http-port") {
+         scenario.http_port = *number;
+      } else if (option == "--stream-port") {
+         scenario.stream_port = *number;
+      } else {
+         std::cerr << "Unknown option: " << option << "\n";
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   if (!scenario.nodes || !scenario.sensors_per_node) {
+      std::cerr << "Need at least one node and one sensor\n";
+      return 1;
+   }
+
+   monolith::bench::result_s result;
+   if (!monolith::bench::run_ingest_bench(scenario, result)) {
+      std::cerr << "Benchmark failed\n";
+      return 1;
+   }
+
+   auto json = monolith::bench::to_json(scenario, result);
+   if (out.empty()) {
+      std::cout << json << "\n";
+      return 0;
+   }
+
+   std::ofstream file(out);
+   file << json << "\n";
+   return file.good() ? 0 : 1;
+}
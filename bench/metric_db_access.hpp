@@ -0,0 +1,77 @@
+#ifndef MONOLITH_BENCH_METRIC_DB_ACCESS_HPP
+#define MONOLITH_BENCH_METRIC_DB_ACCESS_HPP
+
+#include "services/metric_db.hpp"
+#include <string>
+#include <vector>
+
+namespace monolith {
+namespace bench {
+
+//! \brief Drives the private storage paths of metric_db_c directly so they
+//!        can be timed without going through the service thread
+//! \note  The database must be started. The service thread never touches
+//!        the database while its queue is empty and nothing expires, so
+//!        these are safe to call alongside it
+class metric_db_access_c {
+ public:
+   using db_t = monolith::services::metric_db_c;
+
+   //! \brief Insert a single reading
+   static void store(db_t &db, crate::metrics::sensor_reading_v1_c &reading) {
+      db.store_metric(reading);
+   }
+
+   //! \brief Insert a set of readings within one transaction
+   static void
+   store_batch(db_t &db,
+               std::vector<crate::metrics::sensor_reading_v1_c> &readings) {
+      db._db->execute("BEGIN TRANSACTION;");
+      for (auto &reading : readings) {
+         db.store_metric(reading);
+      }
+      db._db->execute("COMMIT;");
+   }
+
+   //! \brief Run a fetch_nodes, returning the json result
+   static std::string fetch_nodes(db_t &db) {
+      db_t::fetch_response_s response;
+      db_t::fetch_nodes_s fetch{fetch_of(response)};
+      db.fetch_metric(fetch);
+      return response.fetch_result;
+   }
+
+   //! \brief Run a fetch_sensors, returning the json result
+   static std::string fetch_sensors(db_t &db, const std::string &node_id) {
+      db_t::fetch_response_s response;
+      db_t::fetch_sensors_s fetch{fetch_of(response), node_id};
+      db.fetch_metric(fetch);
+      return response.fetch_result;
+   }
+
+   //! \brief Run a fetch_range, returning the json result
+   static std::string fetch_range(db_t &db, const std::string &node_id,
+                                  int64_t start, int64_t end) {
+      db_t::fetch_response_s response;
+      db_t::fetch_range_s fetch{fetch_of(response), node_id, start, end};
+      db.fetch_metric(fetch);
+      return response.fetch_result;
+   }
+
+   //! \brief Purge every metric stamped before the given time
+   //! \note  Only the delete is run, the service thread's own purge
+   //!        schedule is left alone
+   static void purge(db_t &db, uint64_t cutoff) {
+      db.purge_metrics_before(cutoff);
+   }
+
+ private:
+   static db_t::fetch_s fetch_of(db_t::fetch_response_s &response) {
+      return {.callback = nullptr, .callback_data = &response};
+   }
+};
+
+} // namespace bench
+} // namespace monolith
+
+#endif
@@ -0,0 +1,340 @@
+#include "metric_db_access.hpp"
+#include "alert/alert.hpp"
+#include "db/kv.hpp"
+#include "heartbeats.hpp"
+#include "networking/router.hpp"
+#include "rules/runtime.hpp"
+#include "rules/script_cache.hpp"
+#include "services/metric_db.hpp"
+#include <benchmark/benchmark.h>
+#include <crate/common/common.hpp>
+#include <crate/externals/aixlog/logger.hpp>
+#include <crate/metrics/reading_v1.hpp>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+/*
+   monolith-microbench
+
+   Per component timings of the hot paths readings take through monolith.
+   Every benchmark draws its data from a generator with a fixed seed and
+   uses fixed data sizes so numbers can be compared run to run. Anything
+   that needs a file works inside a scratch directory that is removed once
+   the run completes. Any google benchmark flag can be given, for instance
+   --benchmark_filter=store or --benchmark_format=json
+*/
+
+namespace {
+
+constexpr uint32_t SEED = 0x6d6f6e6f;
+constexpr size_t NODES = 1'000;
+constexpr size_t SENSORS_PER_NODE = 4;
+constexpr size_t KV_KEYS = 10'000;
+
+std::filesystem::path work_dir() {
+   return std::filesystem::temp_directory_path() / "monolith_microbench";
+}
+
+std::string scratch_file(const std::string &name) {
+   auto path = work_dir() / name;
+   std::filesystem::remove_all(path);
+   return path.string();
+}
+
+std::string node_id(size_t n) { return "bench-node-" + std::to_string(n); }
+std::string sensor_id(size_t s) { return "sensor-" + std::to_string(s); }
+
+// Readings spread over the synthetic fleet, identical every run
+std::vector<crate::metrics::sensor_reading_v1_c> make_readings(size_t count) {
+   std::mt19937 rng(SEED);
+   std::uniform_int_distribution<size_t> node(0, NODES - 1);
+   std::uniform_int_distribution<size_t> sensor(0, SENSORS_PER_NODE - 1);
+   std::uniform_real_distribution<double> value(-100.0, 100.0);
+
+   std::vector<crate::metrics::sensor_reading_v1_c> readings;
+   readings.reserve(count);
+   for (size_t i = 0; i < count; i++) {
+      readings.emplace_back(1'700'000'000 + i, node_id(node(rng)),
+                            sensor_id(sensor(rng)), value(rng));
+   }
+   return readings;
+}
+
+// ---------- sensor_reading_v1_c ----------
+
+void reading_encode(benchmark::State &state) {
+   auto readings = make_readings(1'024);
+   std::string encoded;
+   size_t i{0};
+   for (auto _ : state) {
+      benchmark::DoNotOptimize(readings[i++ % readings.size()].encode_to(encoded));
+   }
+   state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(reading_encode);
+
+void reading_decode(benchmark::State &state) {
+   auto readings = make_readings(1'024);
+   std::vector<std::string> encoded(readings.size());
+   for (size_t i = 0; i < readings.size(); i++) {
+      readings[i].encode_to(encoded[i]);
+   }
+
+   crate::metrics::sensor_reading_v1_c decoded;
+   size_t i{0};
+   for (auto _ : state) {
+      benchmark::DoNotOptimize(decoded.decode_from(encoded[i++ % encoded.size()]));
+   }
+   state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(reading_decode);
+
+// ---------- kv_c ----------
+
+void kv_load(benchmark::State &state, bool hit) {
+   monolith::db::kv_c kv(scratch_file("kv"));
+   std::string value(256, 'x');
+   for (size_t i = 0; i < KV_KEYS; i++) {
+      kv.store(node_id(i), value);
+   }
+
+   std::mt19937 rng(SEED);
+   std::uniform_int_distribution<size_t> key(0, KV_KEYS - 1);
+   std::vector<std::string> keys;
+   for (size_t i = 0; i < 1'024; i++) {
+      keys.push_back(hit ? node_id(key(rng)) : "missing-" + node_id(key(rng)));
+   }
+
+   size_t i{0};
+   for (auto _ : state) {
+      benchmark::DoNotOptimize(kv.load(keys[i++ % keys.size()]));
+   }
+   state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(kv_load, hit, true);
+BENCHMARK_CAPTURE(kv_load, miss, false);
+
+// ---------- metric_db_c ----------
+
+void store_metric_per_row(benchmark::State &state) {
+   monolith::services::metric_db_c db(scratch_file("store_per_row.db"), 0);
+   if (!db.start()) {
+      state.SkipWithError("Failed to open database");
+      return;
+   }
+
+   auto readings = make_readings(1'024);
+   size_t i{0};
+   for (auto _ : state) {
+      monolith::bench::metric_db_access_c::store(db,
+                                                 readings[i++ % readings.size()]);
+   }
+   state.SetItemsProcessed(state.iterations());
+   db.stop();
+}
+BENCHMARK(store_metric_per_row);
+
+void store_metric_batched(benchmark::State &state) {
+   monolith::services::metric_db_c db(scratch_file("store_batched.db"), 0);
+   if (!db.start()) {
+      state.SkipWithError("Failed to open database");
+      return;
+   }
+
+   auto readings = make_readings(state.range(0));
+   for (auto _ : state) {
+      monolith::bench::metric_db_access_c::store_batch(db, readings);
+   }
+   state.SetItemsProcessed(state.iterations() * state.range(0));
+   db.stop();
+}
+BENCHMARK(store_metric_batched)->Arg(10)->Arg(100)->Arg(1'000);
+
+void fetch_metric_json(benchmark::State &state) {
+   monolith::services::metric_db_c db(scratch_file("fetch.db"), 0);
+   if (!db.start()) {
+      state.SkipWithError("Failed to open database");
+      return;
+   }
+
+   // One node holding the requested number of rows, among other traffic
+   std::vector<crate::metrics::sensor_reading_v1_c> readings;
+   for (int64_t i = 0; i < state.range(0); i++) {
+      readings.emplace_back(1'700'000'000 + i, "fetched-node",
+                            sensor_id(i % SENSORS_PER_NODE),
+                            static_cast<double>(i));
+   }
+   auto background = make_readings(10'000);
+   readings.insert(readings.end(), background.begin(), background.end());
+   monolith::bench::metric_db_access_c::store_batch(db, readings);
+
+   size_t bytes{0};
+   for (auto _ : state) {
+      auto json = monolith::bench::metric_db_access_c::fetch_range(
+          db, "fetched-node", 0, INT32_MAX);
+      bytes += json.size();
+   }
+   state.SetItemsProcessed(state.iterations() * state.range(0));
+   state.SetBytesProcessed(bytes);
+   db.stop();
+}
+BENCHMARK(fetch_metric_json)->Arg(10)->Arg(100)->Arg(1'000)->Arg(10'000);
+
+// ---------- heartbeats_c ----------
+
+monolith::heartbeats_c shared_heartbeats;
+
+void heartbeats_submit(benchmark::State &state) {
+   std::mt19937 rng(SEED + state.thread_index());
+   std::uniform_int_distribution<size_t> node(0, NODES - 1);
+   std::vector<std::string> ids;
+   for (size_t i = 0; i < 1'024; i++) {
+      ids.push_back(node_id(node(rng)));
+   }
+
+   size_t i{0};
+   for (auto _ : state) {
+      shared_heartbeats.submit(ids[i++ % ids.size()]);
+   }
+   state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(heartbeats_submit)->Threads(1)->Threads(4)->Threads(8);
+
+// ---------- Lua rule call ----------
+
+void rule_call(benchmark::State &state) {
+   auto file = scratch_file("rule.lua");
+   {
+      std::ofstream script(file);
+      script << "local seen = 0\n"
+                "function accept_reading_v1_from_monolith(timestamp, node_id, "
+                "sensor_id, value)\n"
+                "   if value > 50.0 then seen = seen + 1 end\n"
+                "end\n";
+   }
+
+   monolith::rules::script_cache_c cache;
+   auto compiled = cache.compile(file);
+   if (!compiled) {
+      state.SkipWithError("Failed to compile rule script");
+      return;
+   }
+
+   monolith::heartbeats_c heartbeats;
+   monolith::alert::alert_manager_c alert_manager({});
+   monolith::rules::environment_s environment{
+       .alert_manager = &alert_manager,
+       .action_dispatcher = nullptr,
+       .heartbeats = &heartbeats};
+   monolith::rules::runtime_c runtime(&environment);
+   if (!runtime.load(*compiled)) {
+      state.SkipWithError("Failed to load rule script");
+      return;
+   }
+
+   auto readings = make_readings(1'024);
+   size_t i{0};
+   for (auto _ : state) {
+      benchmark::DoNotOptimize(
+          runtime.accept_reading(readings[i++ % readings.size()]));
+   }
+   state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(rule_call);
+
+// ---------- HTTP routing ----------
+
+// The app's routes, as regexes the way httplib matches them and as router
+// patterns, in registration order
+const std::vector<std::pair<std::string, std::string>> ROUTES = {
+    {"/", "/"},
+    {"/version", "/version"},
+    {"/metrics", "/metrics"},
+    {"/debug/traces", "/debug/traces"},
+    {R"(/metric/stream/add/(.*?)/(\d+))", "/metric/stream/add/:address/:port"},
+    {R"(/metric/stream/delete/(.*?)/(\d+))",
+     "/metric/stream/delete/:address/:port"},
+    {"/metric/stream/live", "/metric/stream/live"},
+    {R"(/registrar/probe/(.*?))", "/registrar/probe/*key"},
+    {R"(/registrar/add/(.*?)/(.*?))", "/registrar/add/:key/*value"},
+    {R"(/registrar/fetch/(.*?))", "/registrar/fetch/*key"},
+    {R"(/registrar/delete/(.*?))", "/registrar/delete/*key"},
+    {R"(/metric/submit/(.*?))", "/metric/submit/*metric"},
+    {R"(/metric/heartbeat/(.*?))", "/metric/heartbeat/*heartbeat"},
+    {R"(/metric/fetch/nodes)", "/metric/fetch/nodes"},
+    {R"(/metric/fetch/(.*?)/sensors)", "/metric/fetch/:node/sensors"},
+    {R"(/metric/fetch/(.*?)/range/(.*?)/(.*?))",
+     "/metric/fetch/:node/range/:start/:end"},
+    {R"(/metric/fetch/(.*?)/after/(.*?))", "/metric/fetch/:node/after/:time"},
+    {R"(/metric/fetch/(.*?)/before/(.*?))",
+     "/metric/fetch/:node/before/:time"}};
+
+// Ingest heavy, like the traffic the app sees
+const std::vector<std::string> ROUTED_PATHS = {
+    "/metric/submit/{\"timestamp\":1700000000,\"node_id\":\"bench-node-1\","
+    "\"sensor_id\":\"sensor-0\",\"value\":21.5}",
+    "/metric/heartbeat/{\"id\":\"bench-node-1\"}",
+    "/registrar/probe/bench-node-1",
+    "/metric/fetch/bench-node-1/range/1700000000/1700003600",
+    "/version"};
+
+void route_regex(benchmark::State &state) {
+   std::vector<std::regex> routes;
+   for (auto &[regex, pattern] : ROUTES) {
+      routes.emplace_back(regex);
+   }
+
+   size_t i{0};
+   std::smatch matches;
+   for (auto _ : state) {
+      auto &path = ROUTED_PATHS[i++ % ROUTED_PATHS.size()];
+      for (auto &route : routes) {
+         if (std::regex_match(path, matches, route)) {
+            break;
+         }
+      }
+      benchmark::DoNotOptimize(matches);
+   }
+   state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(route_regex);
+
+void route_trie(benchmark::State &state) {
+   monolith::networking::router_c router;
+   for (size_t id = 0; id < ROUTES.size(); id++) {
+      router.add(ROUTES[id].second, id);
+   }
+
+   size_t i{0};
+   monolith::networking::route_params_c params;
+   for (auto _ : state) {
+      auto &path = ROUTED_PATHS[i++ % ROUTED_PATHS.size()];
+      benchmark::DoNotOptimize(router.match(path, params));
+   }
+   state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(route_trie);
+
+} // namespace
+
+int main(int argc, char **argv) {
+   benchmark::Initialize(&argc, argv);
+   if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+      return 1;
+   }
+
+   std::filesystem::remove_all(work_dir());
+   std::filesystem::create_directories(work_dir());
+   crate::common::setup_logger((work_dir() / "monolith_microbench").string(),
+                               AixLog::Severity::error);
+
+   benchmark::RunSpecifiedBenchmarks();
+   benchmark::Shutdown();
+
+   std::filesystem::remove_all(work_dir());
+   return 0;
+}
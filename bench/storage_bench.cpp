@@ -0,0 +1,298 @@
+#include "storage_bench.hpp"
+#include "metric_db_access.hpp"
+#include <algorithm>
+#include <chrono>
+#include <crate/common/common.hpp>
+#include <crate/externals/aixlog/logger.hpp>
+#include <filesystem>
+#include <numeric>
+#include <random>
+#include <sstream>
+
+namespace monolith {
+namespace bench {
+
+namespace {
+
+using steady_clock_t = std::chrono::steady_clock;
+
+constexpr uint32_t SEED = 0x6d6f6e6f;
+constexpr size_t LOAD_BATCH = 10'000;
+constexpr int64_t SECONDS_PER_HOUR = 3'600;
+constexpr int64_t SECONDS_PER_DAY = 86'400;
+
+int64_t now_sec() {
+   return std::chrono::duration_cast<std::chrono::seconds>(
+              std::chrono::system_clock::now().time_since_epoch())
+       .count();
+}
+
+uint64_t elapsed_us(steady_clock_t::time_point start) {
+   return std::chrono::duration_cast<std::chrono::microseconds>(
+              steady_clock_t::now() - start)
+       .count();
+}
+
+std::string node_id(size_t n) { return "bench-node-" + std::to_string(n); }
+std::string sensor_id(size_t s) { return "sensor-" + std::to_string(s); }
+
+// The database along with anything sqlite keeps beside it
+uint64_t disk_bytes(const std::filesystem::path &file) {
+   uint64_t total{0};
+   for (auto suffix : {"", "-journal", "-wal", "-shm"}) {
+      std::error_code ec;
+      auto size = std::filesystem::file_size(file.string() + suffix, ec);
+      if (!ec) {
+         total += size;
+      }
+   }
+   return total;
+}
+
+distribution_s summarize(std::vector<uint64_t> samples) {
+   distribution_s result;
+   if (samples.empty()) {
+      return result;
+   }
+   std::sort(samples.begin(), samples.end());
+   auto at = [&](double percentile) {
+      auto index = static_cast<size_t>(percentile / 100.0 * (samples.size() - 1));
+      return samples[index];
+   };
+   result.count = samples.size();
+   result.min = samples.front();
+   result.p50 = at(50);
+   result.p90 = at(90);
+   result.p99 = at(99);
+   result.max = samples.back();
+   result.mean =
+       std::accumulate(samples.begin(), samples.end(), uint64_t{0}) /
+       samples.size();
+   return result;
+}
+
+// Readings for every series at every interval, oldest first, written in
+// transactions of LOAD_BATCH rows
+void load(metric_db_access_c::db_t &db, const storage_scenario_s &scenario,
+          int64_t start, int64_t end, storage_result_s &result) {
+
+   std::mt19937 rng(SEED);
+   std::uniform_real_distribution<double> value(-100.0, 100.0);
+   std::vector<crate::metrics::sensor_reading_v1_c> batch;
+   batch.reserve(LOAD_BATCH);
+
+   auto load_start = steady_clock_t::now();
+   for (int64_t ts = start; ts < end; ts += scenario.interval_sec) {
+      for (uint32_t n = 0; n < scenario.nodes; n++) {
+         for (uint32_t s = 0; s < scenario.sensors_per_node; s++) {
+
+            // Spread the series over the interval like independent nodes
+            auto offset = (n * scenario.sensors_per_node + s) %
+                          scenario.interval_sec;
+            batch.emplace_back(ts + offset, node_id(n), sensor_id(s),
+                               value(rng));
+
+            if (batch.size() == LOAD_BATCH) {
+               metric_db_access_c::store_batch(db, batch);
+               result.rows += batch.size();
+               batch.clear();
+            }
+         }
+      }
+   }
+   if (!batch.empty()) {
+      metric_db_access_c::store_batch(db, batch);
+      result.rows += batch.size();
+   }
+
+   result.load_sec =
+       std::chrono::duration<double>(steady_clock_t::now() - load_start)
+           .count();
+   result.load_rate = result.rows / result.load_sec;
+}
+
+void render_distribution(std::stringstream &ss, const distribution_s &dist) {
+   ss << "{\"count\":" << dist.count << ",\"min\":" << dist.min
+      << ",\"p50\":" << dist.p50 << ",\"p90\":" << dist.p90
+      << ",\"p99\":" << dist.p99 << ",\"max\":" << dist.max
+      << ",\"mean\":" << dist.mean << "}";
+}
+
+} // namespace
+
+bool run_storage_bench(const storage_scenario_s &scenario,
+                       storage_result_s &result) {
+
+   namespace fs = std::filesystem;
+   using db_t = metric_db_access_c::db_t;
+
+   fs::remove_all(scenario.work_dir);
+   fs::create_directories(scenario.work_dir);
+   auto file = fs::path(scenario.work_dir) / "metrics.db";
+
+   crate::common::setup_logger(
+       (fs::path(scenario.work_dir) / "monolith_storage_bench").string(),
+       AixLog::Severity::error);
+
+   auto span = static_cast<int64_t>(scenario.days) * SECONDS_PER_DAY;
+   auto data_end = now_sec();
+   auto data_start = data_end - span;
+
+   // ---------- Synthesise the retention window ----------
+
+   {
+      db_t db(file.string(), 0);
+      if (!db.start()) {
+         LOG(ERROR) << TAG("run_storage_bench") << "Failed to open " << file
+                    << "\n";
+         fs::remove_all(scenario.work_dir);
+         return false;
+      }
+      load(db, scenario, data_start, data_end, result);
+      db.stop();
+   }
+   result.disk_bytes_loaded = disk_bytes(file);
+
+   // ---------- Startup, with nothing to purge ----------
+
+   {
+      db_t db(file.string(), 0);
+      auto start = steady_clock_t::now();
+      if (!db.start()) {
+         fs::remove_all(scenario.work_dir);
+         return false;
+      }
+      result.startup_us = elapsed_us(start);
+
+      // ---------- Queries ----------
+
+      std::mt19937 rng(SEED);
+      std::uniform_int_distribution<uint32_t> node(0, scenario.nodes - 1);
+
+      std::vector<uint64_t> samples;
+      for (uint32_t i = 0; i < scenario.samples; i++) {
+         auto query_start = steady_clock_t::now();
+         metric_db_access_c::fetch_nodes(db);
+         samples.push_back(elapsed_us(query_start));
+      }
+      result.fetch_nodes = summarize(samples);
+
+      samples.clear();
+      for (uint32_t i = 0; i < scenario.samples; i++) {
+         auto id = node_id(node(rng));
+         auto query_start = steady_clock_t::now();
+         metric_db_access_c::fetch_sensors(db, id);
+         samples.push_back(elapsed_us(query_start));
+      }
+      result.fetch_sensors = summarize(samples);
+
+      int64_t last_width{0};
+      for (auto width : {SECONDS_PER_HOUR, SECONDS_PER_DAY, span}) {
+         if (width > span || width <= last_width) {
+            continue;
+         }
+         last_width = width;
+
+         std::uniform_int_distribution<int64_t> end(data_start + width,
+                                                    data_end);
+         range_result_s range{.width_sec = static_cast<uint64_t>(width)};
+         uint64_t bytes{0};
+
+         samples.clear();
+         for (uint32_t i = 0; i < scenario.samples; i++) {
+            auto id = node_id(node(rng));
+            auto range_end = end(rng);
+            auto query_start = steady_clock_t::now();
+            bytes += metric_db_access_c::fetch_range(db, id, range_end - width,
+                                                     range_end)
+                         .size();
+            samples.push_back(elapsed_us(query_start));
+         }
+         range.latency = summarize(samples);
+         range.mean_result_bytes = scenario.samples ? bytes / scenario.samples : 0;
+         result.fetch_range.push_back(range);
+      }
+      db.stop();
+   }
+
+   // ---------- Startup, with the oldest hour expired ----------
+
+   {
+      auto expiration = now_sec() - (data_start + SECONDS_PER_HOUR);
+      db_t db(file.string(), std::max<int64_t>(expiration, 1));
+      auto start = steady_clock_t::now();
+      if (!db.start()) {
+         fs::remove_all(scenario.work_dir);
+         return false;
+      }
+      result.startup_preflight_us = elapsed_us(start);
+      db.stop();
+   }
+
+   // ---------- Periodic purges, an hour at a time ----------
+
+   {
+      db_t db(file.string(), 0);
+      if (!db.start()) {
+         fs::remove_all(scenario.work_dir);
+         return false;
+      }
+
+      std::vector<uint64_t> samples;
+      for (uint32_t slice = 2; slice <= scenario.purge_slices + 1; slice++) {
+         auto cutoff = data_start + slice * SECONDS_PER_HOUR;
+         if (cutoff >= data_end) {
+            break;
+         }
+         auto purge_start = steady_clock_t::now();
+         metric_db_access_c::purge(db, cutoff);
+         samples.push_back(elapsed_us(purge_start));
+      }
+      result.purge = summarize(samples);
+      db.stop();
+   }
+   result.disk_bytes_purged = disk_bytes(file);
+
+   fs::remove_all(scenario.work_dir);
+   return true;
+}
+
+std::string to_json(const storage_scenario_s &scenario,
+                    const storage_result_s &result) {
+
+   std::stringstream ss;
+   ss << "{\"scenario\":{"
+      << "\"nodes\":" << scenario.nodes
+      << ",\"sensors_per_node\":" << scenario.sensors_per_node
+      << ",\"interval_sec\":" << scenario.interval_sec
+      << ",\"days\":" << scenario.days
+      << ",\"samples\":" << scenario.samples
+      << ",\"purge_slices\":" << scenario.purge_slices << "}"
+      << ",\"rows\":" << result.rows
+      << ",\"load_sec\":" << result.load_sec
+      << ",\"load_rate\":" << result.load_rate
+      << ",\"disk_bytes\":{\"loaded\":" << result.disk_bytes_loaded
+      << ",\"purged\":" << result.disk_bytes_purged << "}"
+      << ",\"latency_us\":{\"startup\":" << result.startup_us
+      << ",\"startup_preflight_purge\":" << result.startup_preflight_us
+      << ",\"fetch_nodes\":";
+   render_distribution(ss, result.fetch_nodes);
+   ss << ",\"fetch_sensors\":";
+   render_distribution(ss, result.fetch_sensors);
+   ss << ",\"fetch_range\":[";
+   for (size_t i = 0; i < result.fetch_range.size(); i++) {
+      auto &range = result.fetch_range[i];
+      ss << (i ? "," : "") << "{\"width_sec\":" << range.width_sec
+         << ",\"mean_result_bytes\":" << range.mean_result_bytes
+         << ",\"latency\":";
+      render_distribution(ss, range.latency);
+      ss << "}";
+   }
+   ss << "],\"purge\":";
+   render_distribution(ss, result.purge);
+   ss << "}}";
+   return ss.str();
+}
+
+} // namespace bench
+} // namespace monolith
@@ -0,0 +1,78 @@
+#ifndef MONOLITH_BENCH_STORAGE_BENCH_HPP
+#define MONOLITH_BENCH_STORAGE_BENCH_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+   ABOUT:
+      Fills a metric database with a retention window's worth of synthetic
+   readings (a week, a month, ..) and times the queries the app runs
+   against it, the periodic purge, and opening the database at startup,
+   including the pre-flight purge.
+
+   Queries are run directly against the database (see metric_db_access.hpp)
+   so the timings don't include the service's request polling.
+*/
+
+namespace monolith {
+namespace bench {
+
+//! \brief The dataset to build and how hard to query it
+struct storage_scenario_s {
+   uint32_t nodes{100};
+   uint32_t sensors_per_node{4};
+   uint32_t interval_sec{60}; //! Time between readings of a sensor
+   uint32_t days{7};          //! Span of the synthesised data
+   uint32_t samples{50};      //! Times each query is run
+   uint32_t purge_slices{24}; //! Hour long slices purged from the oldest data
+   std::string work_dir{"monolith_storage_bench"};
+};
+
+//! \brief Distribution of a set of timings in microseconds
+struct distribution_s {
+   uint64_t count{0};
+   uint64_t min{0};
+   uint64_t p50{0};
+   uint64_t p90{0};
+   uint64_t p99{0};
+   uint64_t max{0};
+   uint64_t mean{0};
+};
+
+//! \brief fetch_range timings for one width of range
+struct range_result_s {
+   uint64_t width_sec{0};
+   distribution_s latency;
+   uint64_t mean_result_bytes{0};
+};
+
+//! \brief What a run measured
+struct storage_result_s {
+   uint64_t rows{0};
+   double load_sec{0};
+   double load_rate{0}; //! Rows per second while synthesising
+   uint64_t disk_bytes_loaded{0};
+   uint64_t disk_bytes_purged{0}; //! After all purges
+   uint64_t startup_us{0};           //! Opening the database
+   uint64_t startup_preflight_us{0}; //! Opening it with a pre-flight purge
+   distribution_s fetch_nodes;
+   distribution_s fetch_sensors;
+   std::vector<range_result_s> fetch_range;
+   distribution_s purge;
+};
+
+//! \brief Run a scenario
+//! \returns true iff the database could be built and opened
+bool run_storage_bench(const storage_scenario_s &scenario,
+                       storage_result_s &result);
+
+//! \brief Render a scenario and its result as json
+std::string to_json(const storage_scenario_s &scenario,
+                    const storage_result_s &result);
+
+} // namespace bench
+} // namespace monolith
+
+#endif
@@ -0,0 +1,114 @@
+#include "storage_bench.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+
+/*
+   monolith-storage-bench
+
+   Builds a metric database holding a retention window of synthetic data,
+   times queries, purges and startup against it, and prints the results as
+   json (or writes them to --out). Every option is `--name value`:
+
+      --nodes N            Synthetic nodes                      (100)
+      --sensors N          Sensors per node                     (4)
+      --interval N         Seconds between readings of a sensor (60)
+      --days N             Days of data to synthesise           (7)
+      --samples N          Times each query is run              (50)
+      --purge-slices N     Hours purged, one at a time          (24)
+      --work-dir PATH      Scratch directory, removed after     (monolith_storage_bench)
+      --out PATH           Write json here instead of stdout
+*/
+
+namespace {
+
+void usage(const char *name) {
+   std::cerr << "usage: " << name
+             << " [--nodes N] [--sensors N] [--interval N] [--days N]"
+                " [--samples N] [--purge-slices N] [--work-dir PATH]"
+                " [--out PATH]\n";
+}
+
+std::optional<uint32_t> to_u32(const std::string &value) {
+   char *end{nullptr};
+   auto parsed = std::strtoul(value.c_str(), &end, 10);
+   if (value.empty() || *end != '\0' || parsed > UINT32_MAX) {
+      return std::nullopt;
+   }
+   return static_cast<uint32_t>(parsed);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+   monolith::bench::storage_scenario_s scenario;
+   std::string out;
+
+   for (int i = 1; i < argc; i++) {
+      std::string option = argv[i];
+      if (option == "--help" || option == "-h" || i + 1 >= argc) {
+         usage(argv[0]);
+         return option == "--help" || option == "-h" ? 0 : 1;
+      }
+      std::string value = argv[++i];
+
+      if (option == "--work-dir") {
+         scenario.work_dir = value;
+         continue;
+      }
+
+      if (option == "--out") {
+         out = value;
+         continue;
+      }
+
+      auto number = to_u32(value);
+      if (!number.has_value()) {
+         std::cerr << "Expected a number for " << option << "\n";
+         return 1;
+      }
+
+      if (option == "--nodes") {
+         scenario.nodes = *number;
+      } else if (option == "--sensors") {
+         scenario.sensors_per_node = *number;
+      } else if (option == "--interval") {
+         scenario.interval_sec = *number;
+      } else if (option == "--days") {
+         scenario.days = *number;
+      } else if (option == "--samples") {
+         scenario.samples = *number;
+      } else if (option == "--purge-slices") {
+         scenario.purge_slices = *number;
+      } else {
+         std::cerr << "Unknown option: " << option << "\n";
+         usage(argv[0]);
+         return 1;
+      }
+   }
+
+   if (!scenario.nodes || !scenario.sensors_per_node ||
+       !scenario.interval_sec || !scenario.days) {
+      std::cerr << "Nodes, sensors, interval and days must be non-zero\n";
+      return 1;
+   }
+
+   monolith::bench::storage_result_s result;
+   if (!monolith::bench::run_storage_bench(scenario, result)) {
+      std::cerr << "Benchmark failed\n";
+      return 1;
+   }
+
+   auto json = monolith::bench::to_json(scenario, result);
+   if (out.empty()) {
+      std::cout << json << "\n";
+      return 0;
+   }
+
+   std::ofstream file(out);
+   file << json << "\n";
+   return file.good() ? 0 : 1;
+}
@@ -8,4 +8,54 @@ function accept_reading_v1_from_monolith(timestamp, node_id, sensor_id, value)
 
    --monolith_trigger_alert(0, "Alert message")
    --monolith_dispatch_action("controller_id", "action_id", 42.314)
-end
\ No newline at end of file
+end
+-- Optionally, a script can receive readings in batches instead. When this function exists the
+-- rule_executor hands over every queued reading in a single call, which is much cheaper than a
+-- call per reading. Columns are indexed 1..batch.count; the table is reused between calls so
+-- anything past batch.count is stale and the table should not be kept around
+--
+--function accept_readings_batch_v1_from_monolith(batch)
+--   for i = 1, batch.count do
+--      print("Lua got metric reading| ts:" .. batch.timestamp[i] .. ", node:" .. batch.node_id[i] ..
+--            ", sensor:" .. batch.sensor_id[i] .. ", value:" .. batch.value[i])
+--   end
+--end
+
+-- Scripts that only care about specific series can subscribe to them instead. The handler is
+-- only called for readings that match, and readings nothing subscribed to never enter Lua.
+-- Either id can be "*" to match anything. Subscriptions can only be made while the script loads
+--
+--monolith_subscribe("*", "some_sensor_id", function(timestamp, node_id, sensor_id, value)
+--   print("Lua got a reading for some_sensor_id from " .. node_id .. ": " .. value)
+--end)
+
+-- Windowed aggregates are computed natively. monolith_window(size, ["sliding"|"tumbling"], [alpha])
+-- creates a window holding `size` samples; push(timestamp, value) returns true when a tumbling
+-- window fills up. Aggregates: mean, min, max, stddev, rate, ewma (plus count, capacity, full)
+--
+--local temperature = monolith_window(60)
+--monolith_subscribe("*", "some_sensor_id", function(timestamp, node_id, sensor_id, value)
+--   temperature:push(timestamp, value)
+--   if temperature:full() and temperature:mean() > 80.0 then
+--      monolith_trigger_alert(0, "Average temperature is over 80")
+--   end
+--end)
+
+-- Scripts can also run code on a timer. monolith_schedule(delay_ms, fn) calls fn once and
+-- monolith_every(interval_ms, fn) calls it repeatedly; both return an id for monolith_cancel(id).
+-- Timers fire on the rule executor thread in between readings. monolith_sec_since_contact(id)
+-- returns the seconds since a heartbeat was last seen from id, or nil if one never was
+--
+--monolith_every(60000, function(timer_id)
+--   local silent = monolith_sec_since_contact("some_node_id")
+--   if silent == nil or silent > 300 then
+--      monolith_trigger_alert(0, "some_node_id has been silent for over 5 minutes")
+--   end
+--end)
+
+-- Actions go out in priority lanes that are always drained highest first. The optional fourth
+-- argument of monolith_dispatch_action is one of MONOLITH_PRIORITY_LOW, _NORMAL (the default),
+-- _HIGH or _CRITICAL. An optional fifth argument gives a deadline in ms; actions sent after their
+-- deadline are logged and counted as missed
+--
+--monolith_dispatch_action("controller_id", "shutoff_valve", 1.0, MONOLITH_PRIORITY_CRITICAL, 100)
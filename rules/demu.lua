@@ -71,45 +71,44 @@ function MotionSensorMonitor:report(value)
    self.current_value = value
 end
 
--- Helper function
-local function string_is_empty(s)
-   return s == nil or s == ''
-end
-
 -- Create the monitor objects
 local light_monitor = LightSensorMonitor:new()
 local motion_monitor = MotionSensorMonitor:new()
 
--- Called by monolith
-function accept_reading_v1_from_monolith(timestamp, node_id, sensor_id, value)
+-- Called by monolith on the script being replaced during a reload, whatever
+-- is returned is handed to the new script's migrate_state
+function export_state()
+   return { light = light_monitor.current_value, motion = motion_monitor.current_value }
+end
 
-   if string_is_empty(sensor_id) then
-      print("Received an empty sensor id?")
+-- Called by monolith on the new script during a reload so monitors pick up
+-- where the old script left off instead of re-alerting
+function migrate_state(old)
+   if old == nil then
       return
    end
+   light_monitor.current_value = old.light or light_monitor.current_value
+   motion_monitor.current_value = old.motion or motion_monitor.current_value
+end
 
-   -- Check light
-   if sensor_id == sensor_id_light then
-      light_monitor:report(value)
-      return
-   end
+-- Route readings from each sensor (on any node) straight to the code that
+-- cares about them. Readings from sensors without a subscription are never
+-- handed to Lua
+monolith_subscribe("*", sensor_id_light, function(timestamp, node_id, sensor_id, value)
+   light_monitor:report(value)
+end)
 
-   -- Check motion
-   if sensor_id == sensor_id_motion then
-      motion_monitor:report(value)
-      return
-   end
-   
-   -- Check flame
-   if sensor_id == sensor_id_flame then
-      if value > 0 then
+monolith_subscribe("*", sensor_id_motion, function(timestamp, node_id, sensor_id, value)
+   motion_monitor:report(value)
+end)
 
-         -- Send a text saying something is on fire
-         monolith_trigger_alert(2, "There is literally a fire detected. Intensity: " .. value .. "> Turning on fire extinguisher")
+monolith_subscribe("*", sensor_id_flame, function(timestamp, node_id, sensor_id, value)
+   if value > 0 then
 
-         -- Turn on fire extinquisher
-         monolith_dispatch_action("fire_extinguisher", "toggle_extinguisher", 1.0)
-      end
-      return
+      -- Send a text saying something is on fire
+      monolith_trigger_alert(2, "There is literally a fire detected. Intensity: " .. value .. "> Turning on fire extinguisher")
+
+      -- Turn on fire extinquisher
+      monolith_dispatch_action("fire_extinguisher", "toggle_extinguisher", 1.0, MONOLITH_PRIORITY_CRITICAL, 250)
    end
-end
\ No newline at end of file
+end)
@@ -97,46 +97,21 @@ function InternalHumiditySensorMonitor:report(value)
    end
 end
 
--- Helper function
-local function string_is_empty(s)
-   return s == nil or s == ''
-end
-
 -- Create the monitor objects
 local light_monitor = InternalLightSensorMonitor:new()
 local motion_monitor = InternalMotionSensorMonitor:new()
 local temperature_monitor = InternaltemperatureSensorMonitor:new()
 local humidity_monitor = InternalHumiditySensorMonitor:new()
 
--- Called by monolith
-function accept_reading_v1_from_monolith(timestamp, node_id, sensor_id, value)
-
-   if string_is_empty(sensor_id) then
-      print("Received an empty sensor id?")
-      return
-   end
-
-   -- Check light
-   if sensor_id == sensor_id_internal_light then
-      light_monitor:report(value)
-      return
-   end
+-- Route readings from each sensor (on any node) straight to its monitor.
+-- Readings from sensors without a subscription are never handed to Lua
+local function route(sensor_id, monitor)
+   monolith_subscribe("*", sensor_id, function(timestamp, node_id, sensor_id, value)
+      monitor:report(value)
+   end)
+end
 
-   -- Check motion
-   if sensor_id == sensor_id_internal_motion then
-      motion_monitor:report(value)
-      return
-   end
-   
-   -- Check temperature
-   if sensor_id == sensor_id_internal_temperature then
-      temperature_monitor:report(value)
-      return
-   end
-   
-   -- Check humidity
-   if sensor_id == sensor_id_internal_motion then
-      humidity_monitor:report(value)
-      return
-   end
-end
\ No newline at end of file
+route(sensor_id_internal_light, light_monitor)
+route(sensor_id_internal_motion, motion_monitor)
+route(sensor_id_internal_temperature, temperature_monitor)
+route(sensor_id_internal_humidity, humidity_monitor)
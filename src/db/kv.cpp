@@ -38,7 +38,11 @@ bool kv_c::store(const std::string &key, const std::string &value) {
    }
 
    rocksdb::Status status = _db->Put(rocksdb::WriteOptions(), key, value);
-   return status.ok();
+   if (!status.ok()) {
+      return false;
+   }
+   notify_write(key);
+   return true;
 }
 
 std::optional<std::string> kv_c::load(const std::string &key) {
@@ -65,7 +69,30 @@ bool kv_c::remove(const std::string &key) {
    }
 
    rocksdb::Status status = _db->Delete(rocksdb::WriteOptions(), key);
-   return status.ok();
+   if (!status.ok()) {
+      return false;
+   }
+   notify_write(key);
+   return true;
+}
+
+uint64_t kv_c::add_write_listener(write_listener_t listener) {
+   const std::lock_guard<std::mutex> lock(_listeners_mutex);
+   auto id = _next_listener_id++;
+   _write_listeners[id] = std::move(listener);
+   return id;
+}
+
+void kv_c::remove_write_listener(uint64_t id) {
+   const std::lock_guard<std::mutex> lock(_listeners_mutex);
+   _write_listeners.erase(id);
+}
+
+void kv_c::notify_write(const std::string &key) {
+   const std::lock_guard<std::mutex> lock(_listeners_mutex);
+   for (auto &[id, listener] : _write_listeners) {
+      listener(key);
+   }
 }
 
 bool kv_c::ensure_open() {
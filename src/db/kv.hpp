@@ -1,8 +1,11 @@
 #ifndef MONOLITH_DB_KV_HPP
 #define MONOLITH_DB_KV_HPP
 
+#include <functional>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <unordered_map>
 
 #include <rocksdb/db.h>
 
@@ -12,6 +15,9 @@ namespace db {
 //! \brief A key/value database
 class kv_c {
  public:
+   //! \brief Called with the key of every item stored or removed
+   using write_listener_t = std::function<void(const std::string &key)>;
+
    kv_c() = delete;
 
    //! \brief Open/Create a database
@@ -42,10 +48,24 @@ class kv_c {
    //! \note Attempting to delete a non-existing key can return true
    bool remove(const std::string &key);
 
+   //! \brief Add a listener for writes to the database
+   //! \param listener The listener to call after a key is stored or removed
+   //! \returns An id that can be used to remove the listener
+   //! \note Listeners are called on the thread doing the write
+   uint64_t add_write_listener(write_listener_t listener);
+
+   //! \brief Remove a write listener
+   //! \param id The id given when the listener was added
+   void remove_write_listener(uint64_t id);
+
  private:
    bool ensure_open();
+   void notify_write(const std::string &key);
    std::string _db_location;
    rocksdb::DB *_db{nullptr};
+   std::mutex _listeners_mutex;
+   uint64_t _next_listener_id{0};
+   std::unordered_map<uint64_t, write_listener_t> _write_listeners;
 };
 
 } // namespace db
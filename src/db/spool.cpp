@@ -0,0 +1,213 @@
+#include "spool.hpp"
+#include <crate/externals/aixlog/logger.hpp>
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace monolith {
+namespace db {
+
+spool_c::spool_c(const std::string &file, uint64_t max_bytes)
+    : _file(file), _capacity(max_bytes) {}
+
+spool_c::~spool_c() {
+   if (_map) {
+      msync(_map, _capacity, MS_SYNC);
+      munmap(_map, _capacity);
+   }
+   if (_fd >= 0) {
+      close(_fd);
+   }
+}
+
+bool spool_c::open() {
+
+   if (_map) {
+      return true;
+   }
+
+   if (_capacity <= sizeof(header_s)) {
+      LOG(ERROR) << TAG("spool_c::open") << "Spool size of " << _capacity
+                 << " bytes is too small\n";
+      return false;
+   }
+
+   _fd = ::open(_file.c_str(), O_RDWR | O_CREAT, 0644);
+   if (_fd < 0) {
+      LOG(ERROR) << TAG("spool_c::open") << "Unable to open spool file : "
+                 << _file << "\n";
+      return false;
+   }
+
+   struct stat st;
+   if (fstat(_fd, &st) != 0) {
+      close(_fd);
+      _fd = -1;
+      return false;
+   }
+   uint64_t existing_size = st.st_size;
+
+   if (ftruncate(_fd, _capacity) != 0) {
+      LOG(ERROR) << TAG("spool_c::open") << "Unable to size spool file : "
+                 << _file << "\n";
+      close(_fd);
+      _fd = -1;
+      return false;
+   }
+
+   void *map =
+       mmap(nullptr, _capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+   if (map == MAP_FAILED) {
+      LOG(ERROR) << TAG("spool_c::open") << "Unable to map spool file : "
+                 << _file << "\n";
+      close(_fd);
+      _fd = -1;
+      return false;
+   }
+
+   _map = static_cast<char *>(map);
+   _header = reinterpret_cast<header_s *>(_map);
+
+   // Pick up where a previous run left off as long as the header makes sense
+   // for the size we have been given, otherwise start fresh
+   //
+   if (existing_size >= sizeof(header_s) && _header->magic == MAGIC &&
+       _header->read_offset >= sizeof(header_s) &&
+       _header->read_offset <= _capacity &&
+       _header->write_offset >= sizeof(header_s) &&
+       _header->write_offset <= _capacity &&
+       _header->bytes <= _capacity - sizeof(header_s)) {
+      LOG(INFO) << TAG("spool_c::open") << "Recovered " << _header->records
+                << " spooled records from : " << _file << "\n";
+      return true;
+   }
+
+   _header->magic = MAGIC;
+   reset();
+   return true;
+}
+
+void spool_c::reset() {
+   _header->read_offset = sizeof(header_s);
+   _header->write_offset = sizeof(header_s);
+   _header->records = 0;
+   _header->bytes = 0;
+}
+
+/*
+   The writer has gone back to the front of the file while the reader is
+   still working through the records at the end of it. When both offsets
+   meet with records held the spool is completely full
+*/
+bool spool_c::wrapped() const {
+   return _header->write_offset < _header->read_offset ||
+          (_header->records && _header->write_offset == _header->read_offset);
+}
+
+void spool_c::write_record(const std::string &record) {
+   uint32_t length = record.size();
+   std::memcpy(_map + _header->write_offset, &length, sizeof(length));
+   std::memcpy(_map + _header->write_offset + sizeof(length), record.data(),
+               length);
+   _header->write_offset += sizeof(length) + length;
+   _header->bytes += sizeof(length) + length;
+   _header->records++;
+}
+
+bool spool_c::append(const std::string &record) {
+
+   if (!_map || record.size() >= WRAP_MARKER) {
+      return false;
+   }
+
+   uint64_t needed = sizeof(uint32_t) + record.size();
+
+   if (!_header->records) {
+      reset();
+   }
+
+   // Once wrapped, the space up to the oldest unread record is all there is
+   //
+   if (wrapped()) {
+      if (_header->write_offset + needed > _header->read_offset) {
+         return false;
+      }
+      write_record(record);
+      return true;
+   }
+
+   // Records are never split, one that doesn't fit in what is left at the
+   // end of the file goes to the front if the reader has freed enough there.
+   // A marker tells the reader to follow it, unless there isn't even room
+   // for a length in which case the reader knows to wrap on its own
+   //
+   if (_header->write_offset + needed > _capacity) {
+      if (sizeof(header_s) + needed > _header->read_offset) {
+         return false;
+      }
+      if (_capacity - _header->write_offset >= sizeof(WRAP_MARKER)) {
+         std::memcpy(_map + _header->write_offset, &WRAP_MARKER,
+                     sizeof(WRAP_MARKER));
+      }
+      _header->write_offset = sizeof(header_s);
+   }
+
+   write_record(record);
+   return true;
+}
+
+bool spool_c::read(std::string &record) {
+
+   if (empty()) {
+      return false;
+   }
+
+   // Follow the writer back to the front of the file if it wrapped here
+   //
+   uint32_t length{0};
+   if (_capacity - _header->read_offset < sizeof(length)) {
+      _header->read_offset = sizeof(header_s);
+   }
+   std::memcpy(&length, _map + _header->read_offset, sizeof(length));
+   if (length == WRAP_MARKER) {
+      _header->read_offset = sizeof(header_s);
+      std::memcpy(&length, _map + _header->read_offset, sizeof(length));
+   }
+
+   // Records end before the writer unless the reader is behind a wrap
+   //
+   uint64_t limit = wrapped() ? _capacity : _header->write_offset;
+   if (_header->read_offset + sizeof(length) + length > limit ||
+       sizeof(length) + length > _header->bytes) {
+      LOG(ERROR) << TAG("spool_c::read") << "Corrupt record in spool file : "
+                 << _file << " (dropping " << _header->records
+                 << " records)\n";
+      reset();
+      return false;
+   }
+
+   record.assign(_map + _header->read_offset + sizeof(length), length);
+   _header->read_offset += sizeof(length) + length;
+   _header->bytes -= sizeof(length) + length;
+   _header->records--;
+
+   // Once everything has been read the whole file is free again
+   if (!_header->records) {
+      reset();
+   }
+   return true;
+}
+
+bool spool_c::empty() const { return !_map || !_header->records; }
+
+uint64_t spool_c::size() const { return _map ? _header->records : 0; }
+
+uint64_t spool_c::bytes_used() const {
+   return _map ? _header->bytes : 0;
+}
+
+} // namespace db
+} // namespace monolith
@@ -0,0 +1,77 @@
+#ifndef MONOLITH_DB_SPOOL_HPP
+#define MONOLITH_DB_SPOOL_HPP
+
+#include <cstdint>
+#include <string>
+
+namespace monolith {
+namespace db {
+
+//! \brief A bounded, append-only record spool backed by a memory mapped file
+//! \note  Records are read back in the order they were appended. The file is
+//!        used as a ring so space freed by reads is reused without moving
+//!        the records still waiting. The spool is not thread safe, callers
+//!        are expected to guard it themselves
+class spool_c {
+ public:
+   spool_c() = delete;
+
+   //! \brief Create the spool
+   //! \param file The file to back the spool with
+   //! \param max_bytes Maximum size of the file on disk
+   spool_c(const std::string &file, uint64_t max_bytes);
+
+   //! \brief Flush and close the spool
+   ~spool_c();
+
+   //! \brief Open (or create) the backing file
+   //! \returns true iff the file could be opened and mapped
+   //! \note If the file holds records from a previous run they are kept
+   bool open();
+
+   //! \brief Append a record
+   //! \param record The record to append
+   //! \returns true iff the record was stored, false if the spool is full
+   bool append(const std::string &record);
+
+   //! \brief Read the oldest record out of the spool
+   //! \param record The record read
+   //! \returns true iff a record was read
+   bool read(std::string &record);
+
+   //! \brief Check if the spool has no records in it
+   bool empty() const;
+
+   //! \brief Retrieve the number of records held
+   uint64_t size() const;
+
+   //! \brief Retrieve the number of bytes held by records
+   uint64_t bytes_used() const;
+
+ private:
+   static constexpr uint64_t MAGIC = 0x4d4f4e4f53504c32; // "MONOSPL2"
+   static constexpr uint32_t WRAP_MARKER = 0xFFFFFFFF;
+
+   struct header_s {
+      uint64_t magic;
+      uint64_t read_offset;
+      uint64_t write_offset;
+      uint64_t records;
+      uint64_t bytes;
+   };
+
+   std::string _file;
+   uint64_t _capacity{0};
+   int _fd{-1};
+   char *_map{nullptr};
+   header_s *_header{nullptr};
+
+   void reset();
+   bool wrapped() const;
+   void write_record(const std::string &record);
+};
+
+} // namespace db
+} // namespace monolith
+
+#endif
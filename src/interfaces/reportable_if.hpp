@@ -0,0 +1,17 @@
+#ifndef MONOLITH_REPORTABLE_INTERFACE_HPP
+#define MONOLITH_REPORTABLE_INTERFACE_HPP
+
+#include <string>
+
+namespace monolith {
+
+//! \brief An interface representing something that can report on itself
+class reportable_if {
+public:
+   //! \brief Build a human readable report
+   virtual std::string report() = 0;
+};
+
+} // namespace monolith
+
+#endif
@@ -22,6 +22,7 @@
 #include "services/metric_streamer.hpp"
 #include "services/rule_executor.hpp"
 #include "services/telnet.hpp"
+#include "stats/trace.hpp"
 
 #include "version.hpp"
 #include "host_info.hpp"
@@ -38,6 +39,8 @@ struct app_configuration_s {
    std::string log_file_name;
    std::string registration_db_path;
    std::string rule_script;
+   size_t rule_shards{1};
+   monolith::rules::budget_s rule_budget;
 };
 app_configuration_s app_config;
 
@@ -53,6 +56,11 @@ struct networking_configuration_s {
 };
 networking_configuration_s network_config;
 
+/*
+      HTTP server configuration
+*/
+monolith::services::app_c::configuration_c http_config;
+
 /*
       Database configuration
 */
@@ -61,7 +69,9 @@ struct metrics_configuration_c {
    bool stream_metrics{false};
    uint64_t metric_expiration_time_sec{0};
    std::string database_path;
-
+   monolith::services::metric_streamer_c::configuration_c streamer_config;
+   uint32_t trace_sample_every{0};
+   uint32_t trace_slow_ms{100};
 };
 metrics_configuration_c metrics_config;
 
@@ -70,6 +80,11 @@ metrics_configuration_c metrics_config;
 */
 monolith::alert::alert_manager_c::configuration_c alerts_config;
 
+/*
+      Action dispatch configuration
+*/
+monolith::services::action_dispatch_c::configuration_c actions_config;
+
 /*
       Main app control atomics
 */
@@ -182,6 +197,39 @@ void load_configs(std::string file) {
       std::exit(1);
    }
 
+   std::optional<int64_t> rule_shards =
+       tbl["monolith"]["rule_shards"].value<int64_t>();
+   if (rule_shards.has_value()) {
+      if (*rule_shards < 1) {
+         LOG(ERROR) << TAG("load_config")
+                    << "Config 'rule_shards' must be at least 1\n";
+         std::exit(1);
+      }
+      app_config.rule_shards = *rule_shards;
+   }
+
+   std::optional<int64_t> rule_instruction_budget =
+       tbl["monolith"]["rule_instruction_budget"].value<int64_t>();
+   if (rule_instruction_budget.has_value()) {
+      if (*rule_instruction_budget < 0) {
+         LOG(ERROR) << TAG("load_config")
+                    << "Config 'rule_instruction_budget' can not be negative\n";
+         std::exit(1);
+      }
+      app_config.rule_budget.max_instructions = *rule_instruction_budget;
+   }
+
+   std::optional<int64_t> rule_time_budget_ms =
+       tbl["monolith"]["rule_time_budget_ms"].value<int64_t>();
+   if (rule_time_budget_ms.has_value()) {
+      if (*rule_time_budget_ms < 0) {
+         LOG(ERROR) << TAG("load_config")
+                    << "Config 'rule_time_budget_ms' can not be negative\n";
+         std::exit(1);
+      }
+      app_config.rule_budget.max_time_ms = *rule_time_budget_ms;
+   }
+
    if (!std::filesystem::is_regular_file(app_config.rule_script)) {
       LOG(ERROR) << TAG("load_config")
                  << "Given rule script: " << app_config.rule_script
@@ -245,6 +293,93 @@ void load_configs(std::string file) {
       }
    }
 
+   /*
+         Optional tuning of the http server
+   */
+   std::optional<uint32_t> http_workers =
+      tbl["networking"]["http_workers"].value<uint32_t>();
+   if (http_workers.has_value()) {
+      http_config.workers = *http_workers;
+   }
+
+   std::optional<uint32_t> http_max_queued =
+      tbl["networking"]["http_max_queued"].value<uint32_t>();
+   if (http_max_queued.has_value()) {
+      http_config.max_queued = *http_max_queued;
+   }
+
+   std::optional<uint32_t> http_keep_alive_max_count =
+      tbl["networking"]["http_keep_alive_max_count"].value<uint32_t>();
+   if (http_keep_alive_max_count.has_value()) {
+      if (*http_keep_alive_max_count == 0) {
+         LOG(ERROR) << TAG("load_config") << "Networking config 'http_keep_alive_max_count' must be > 0\n";
+         std::exit(1);
+      }
+      http_config.keep_alive_max_count = *http_keep_alive_max_count;
+   }
+
+   std::optional<uint32_t> http_keep_alive_timeout_sec =
+      tbl["networking"]["http_keep_alive_timeout_sec"].value<uint32_t>();
+   if (http_keep_alive_timeout_sec.has_value()) {
+      http_config.keep_alive_timeout_sec = *http_keep_alive_timeout_sec;
+   }
+
+   std::optional<uint32_t> http_read_timeout_sec =
+      tbl["networking"]["http_read_timeout_sec"].value<uint32_t>();
+   if (http_read_timeout_sec.has_value()) {
+      if (*http_read_timeout_sec == 0) {
+         LOG(ERROR) << TAG("load_config") << "Networking config 'http_read_timeout_sec' must be > 0\n";
+         std::exit(1);
+      }
+      http_config.read_timeout_sec = *http_read_timeout_sec;
+   }
+
+   std::optional<uint32_t> http_write_timeout_sec =
+      tbl["networking"]["http_write_timeout_sec"].value<uint32_t>();
+   if (http_write_timeout_sec.has_value()) {
+      if (*http_write_timeout_sec == 0) {
+         LOG(ERROR) << TAG("load_config") << "Networking config 'http_write_timeout_sec' must be > 0\n";
+         std::exit(1);
+      }
+      http_config.write_timeout_sec = *http_write_timeout_sec;
+   }
+
+   std::optional<uint64_t> http_payload_max_bytes =
+      tbl["networking"]["http_payload_max_bytes"].value<uint64_t>();
+   if (http_payload_max_bytes.has_value()) {
+      http_config.payload_max_bytes = *http_payload_max_bytes;
+   }
+
+   std::optional<uint32_t> ingest_port =
+      tbl["networking"]["ingest_port"].value<uint32_t>();
+   if (ingest_port.has_value()) {
+      if (*ingest_port && *ingest_port == network_config.http_port) {
+         LOG(ERROR) << TAG("load_config") << "Networking config 'ingest_port' must differ from 'http_port'\n";
+         std::exit(1);
+      }
+      http_config.ingest_port = *ingest_port;
+   }
+
+   std::optional<uint32_t> ingest_reactors =
+      tbl["networking"]["ingest_reactors"].value<uint32_t>();
+   if (ingest_reactors.has_value()) {
+      if (*ingest_reactors == 0) {
+         LOG(ERROR) << TAG("load_config") << "Networking config 'ingest_reactors' must be > 0\n";
+         std::exit(1);
+      }
+      http_config.ingest_reactors = *ingest_reactors;
+   }
+
+   std::optional<uint32_t> ingest_idle_timeout_sec =
+      tbl["networking"]["ingest_idle_timeout_sec"].value<uint32_t>();
+   if (ingest_idle_timeout_sec.has_value()) {
+      if (*ingest_idle_timeout_sec == 0) {
+         LOG(ERROR) << TAG("load_config") << "Networking config 'ingest_idle_timeout_sec' must be > 0\n";
+         std::exit(1);
+      }
+      http_config.ingest_idle_timeout_sec = *ingest_idle_timeout_sec;
+   }
+
    /*
 
          Load metrics configurations
@@ -268,6 +403,59 @@ void load_configs(std::string file) {
       std::exit(1);
    }
 
+   if (metrics_config.stream_metrics) {
+
+      // Stream batching is optional, defaults are used for anything not given
+      std::optional<uint32_t> stream_batch_max_readings =
+         tbl["metrics"]["stream_batch_max_readings"].value<uint32_t>();
+      if (stream_batch_max_readings.has_value()) {
+         if (*stream_batch_max_readings == 0) {
+            LOG(ERROR) << TAG("load_config") << "Metric config 'stream_batch_max_readings' must be > 0\n";
+            std::exit(1);
+         }
+         metrics_config.streamer_config.max_batch_readings = *stream_batch_max_readings;
+      }
+
+      std::optional<uint64_t> stream_batch_max_bytes =
+         tbl["metrics"]["stream_batch_max_bytes"].value<uint64_t>();
+      if (stream_batch_max_bytes.has_value()) {
+         if (*stream_batch_max_bytes == 0) {
+            LOG(ERROR) << TAG("load_config") << "Metric config 'stream_batch_max_bytes' must be > 0\n";
+            std::exit(1);
+         }
+         metrics_config.streamer_config.max_batch_bytes = *stream_batch_max_bytes;
+      }
+
+      std::optional<uint32_t> stream_batch_max_latency_ms =
+         tbl["metrics"]["stream_batch_max_latency_ms"].value<uint32_t>();
+      if (stream_batch_max_latency_ms.has_value()) {
+         metrics_config.streamer_config.max_batch_latency_ms = *stream_batch_max_latency_ms;
+      }
+
+      std::optional<uint32_t> stream_max_queued_metrics =
+         tbl["metrics"]["stream_max_queued_metrics"].value<uint32_t>();
+      if (stream_max_queued_metrics.has_value()) {
+         if (*stream_max_queued_metrics == 0) {
+            LOG(ERROR) << TAG("load_config") << "Metric config 'stream_max_queued_metrics' must be > 0\n";
+            std::exit(1);
+         }
+         metrics_config.streamer_config.max_queued_metrics = *stream_max_queued_metrics;
+      }
+
+      // An overflow spool is only used if a path for it is given
+      std::optional<std::string> stream_spool_path =
+         tbl["metrics"]["stream_spool_path"].value<std::string>();
+      if (stream_spool_path.has_value()) {
+         metrics_config.streamer_config.spool_path = *stream_spool_path;
+      }
+
+      std::optional<uint64_t> stream_spool_max_bytes =
+         tbl["metrics"]["stream_spool_max_bytes"].value<uint64_t>();
+      if (stream_spool_max_bytes.has_value()) {
+         metrics_config.streamer_config.spool_max_bytes = *stream_spool_max_bytes;
+      }
+   }
+
    if (metrics_config.save_metrics) {
 
       std::optional<uint64_t> metric_expiration_time_sec = tbl["metrics"]["metric_expiration_time_sec"].value<uint64_t>();
@@ -289,6 +477,18 @@ void load_configs(std::string file) {
       }
    }
 
+   std::optional<uint32_t> trace_sample_every =
+      tbl["metrics"]["trace_sample_every"].value<uint32_t>();
+   if (trace_sample_every.has_value()) {
+      metrics_config.trace_sample_every = *trace_sample_every;
+   }
+
+   std::optional<uint32_t> trace_slow_ms =
+      tbl["metrics"]["trace_slow_ms"].value<uint32_t>();
+   if (trace_slow_ms.has_value()) {
+      metrics_config.trace_slow_ms = *trace_slow_ms;
+   }
+
    /*
 
          Load alert configurations
@@ -314,6 +514,96 @@ void load_configs(std::string file) {
       std::exit(1);
    }
 
+   /*
+
+         Load optional action dispatch configurations
+
+   */
+   if (tbl["actions"]) {
+
+      std::optional<uint32_t> workers =
+         tbl["actions"]["workers"].value<uint32_t>();
+      if (workers.has_value()) {
+         if (*workers == 0) {
+            LOG(ERROR) << TAG("load_config") << "Actions config 'workers' must be > 0\n";
+            std::exit(1);
+         }
+         actions_config.workers = *workers;
+      }
+
+      std::optional<uint32_t> max_attempts =
+         tbl["actions"]["max_attempts"].value<uint32_t>();
+      if (max_attempts.has_value()) {
+         if (*max_attempts == 0) {
+            LOG(ERROR) << TAG("load_config") << "Actions config 'max_attempts' must be > 0\n";
+            std::exit(1);
+         }
+         actions_config.max_attempts = *max_attempts;
+      }
+
+      std::optional<uint32_t> backoff_base_ms =
+         tbl["actions"]["backoff_base_ms"].value<uint32_t>();
+      if (backoff_base_ms.has_value()) {
+         actions_config.backoff_base_ms = *backoff_base_ms;
+      }
+
+      std::optional<uint32_t> backoff_max_ms =
+         tbl["actions"]["backoff_max_ms"].value<uint32_t>();
+      if (backoff_max_ms.has_value()) {
+         actions_config.backoff_max_ms = *backoff_max_ms;
+      }
+
+      if (actions_config.backoff_max_ms < actions_config.backoff_base_ms) {
+         LOG(ERROR) << TAG("load_config")
+                    << "Actions config 'backoff_max_ms' must be >= 'backoff_base_ms'\n";
+         std::exit(1);
+      }
+
+      std::optional<uint32_t> coalesce_window_ms =
+         tbl["actions"]["coalesce_window_ms"].value<uint32_t>();
+      if (coalesce_window_ms.has_value()) {
+         actions_config.coalesce_window_ms = *coalesce_window_ms;
+      }
+
+      std::optional<double> rate_limit_per_sec =
+         tbl["actions"]["rate_limit_per_sec"].value<double>();
+      if (rate_limit_per_sec.has_value()) {
+         if (*rate_limit_per_sec < 0.0) {
+            LOG(ERROR) << TAG("load_config") << "Actions config 'rate_limit_per_sec' must be >= 0\n";
+            std::exit(1);
+         }
+         actions_config.rate_limit_per_sec = *rate_limit_per_sec;
+      }
+
+      std::optional<uint32_t> rate_limit_burst =
+         tbl["actions"]["rate_limit_burst"].value<uint32_t>();
+      if (rate_limit_burst.has_value()) {
+         actions_config.rate_limit_burst = *rate_limit_burst;
+      }
+
+      std::optional<uint32_t> max_queued =
+         tbl["actions"]["max_queued"].value<uint32_t>();
+      if (max_queued.has_value()) {
+         if (*max_queued == 0) {
+            LOG(ERROR) << TAG("load_config") << "Actions config 'max_queued' must be > 0\n";
+            std::exit(1);
+         }
+         actions_config.max_queued = *max_queued;
+      }
+
+      std::optional<uint32_t> high_deadline_ms =
+         tbl["actions"]["high_deadline_ms"].value<uint32_t>();
+      if (high_deadline_ms.has_value()) {
+         actions_config.high_deadline_ms = *high_deadline_ms;
+      }
+
+      std::optional<uint32_t> critical_deadline_ms =
+         tbl["actions"]["critical_deadline_ms"].value<uint32_t>();
+      if (critical_deadline_ms.has_value()) {
+         actions_config.critical_deadline_ms = *critical_deadline_ms;
+      }
+   }
+
    /*
 
          Load optional twilio configurations
@@ -448,9 +738,13 @@ void start_services() {
    registrar_database =
        new monolith::db::kv_c(app_config.registration_db_path);
 
+   monolith::stats::tracer().configure(metrics_config.trace_sample_every,
+                                       metrics_config.trace_slow_ms);
+
    // Start the metric streamer if its enabled
    if (metrics_config.stream_metrics) {
-      metric_streamer = new monolith::services::metric_streamer_c();
+      metric_streamer = new monolith::services::metric_streamer_c(
+         metrics_config.streamer_config);
 
       if (!metric_streamer->start()) {
          LOG(ERROR) << TAG("start_services")
@@ -473,7 +767,8 @@ void start_services() {
    }
 
    action_dispatch =
-       new monolith::services::action_dispatch_c(registrar_database);
+       new monolith::services::action_dispatch_c(registrar_database,
+                                                 actions_config);
 
    if (!action_dispatch->start()) {
       LOG(ERROR) << TAG("start_services")
@@ -483,7 +778,8 @@ void start_services() {
    }
 
    rule_executor = new monolith::services::rule_executor_c(
-       app_config.rule_script, alerts_config, action_dispatch);
+       app_config.rule_script, alerts_config, action_dispatch,
+       &heartbeat_manager, app_config.rule_budget, app_config.rule_shards);
    if (!rule_executor->open()) {
       LOG(ERROR) << TAG("start_services")
                  << "Failed to open rule executor script\n";
@@ -517,7 +813,8 @@ void start_services() {
 
       telnet = new monolith::services::telnet_c(network_config.telnet_access_code, 
          monolith::networking::ipv4_host_port_s(network_config.ipv4_address, network_config.telnet_port),
-         rule_executor
+         rule_executor,
+         std::vector<monolith::reportable_if*>{rule_executor, action_dispatch}
       );
 
       if (!telnet->start()) {
@@ -534,7 +831,7 @@ void start_services() {
        monolith::networking::ipv4_host_port_s{network_config.ipv4_address,
                                               network_config.http_port},
        registrar_database, metric_streamer, data_submission, metric_database,
-       &heartbeat_manager, portal);
+       &heartbeat_manager, portal, http_config);
 
    app_service->serve_static_resources(true);
 
@@ -0,0 +1,685 @@
+#include "ingest_server.hpp"
+#include "stats/registry.hpp"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <crate/externals/aixlog/logger.hpp>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace monolith {
+namespace networking {
+
+namespace {
+
+bool iequals(std::string_view a, std::string_view b) {
+   if (a.size() != b.size()) {
+      return false;
+   }
+   for (size_t i = 0; i < a.size(); i++) {
+      if (std::tolower(static_cast<unsigned char>(a[i])) !=
+          std::tolower(static_cast<unsigned char>(b[i]))) {
+         return false;
+      }
+   }
+   return true;
+}
+
+bool icontains(std::string_view haystack, std::string_view needle) {
+   if (needle.size() > haystack.size()) {
+      return false;
+   }
+   for (size_t i = 0; i + needle.size() <= haystack.size(); i++) {
+      if (iequals(haystack.substr(i, needle.size()), needle)) {
+         return true;
+      }
+   }
+   return false;
+}
+
+std::string_view trim(std::string_view value) {
+   while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+      value.remove_prefix(1);
+   }
+   while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+      value.remove_suffix(1);
+   }
+   return value;
+}
+
+int hex_value(char c) {
+   if (c >= '0' && c <= '9') {
+      return c - '0';
+   }
+   if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+   }
+   if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+   }
+   return -1;
+}
+
+/*
+   Decode percent escapes the same way httplib does for the path and query
+   so handlers see the same request from either server. Malformed escapes
+   are kept as they are
+*/
+std::string decode_url(std::string_view value, bool plus_as_space) {
+   std::string decoded;
+   decoded.reserve(value.size());
+   for (size_t i = 0; i < value.size(); i++) {
+      if (value[i] == '%' && i + 2 < value.size() &&
+          hex_value(value[i + 1]) >= 0 && hex_value(value[i + 2]) >= 0) {
+         decoded.push_back(static_cast<char>(hex_value(value[i + 1]) * 16 +
+                                             hex_value(value[i + 2])));
+         i += 2;
+      } else if (value[i] == '+' && plus_as_space) {
+         decoded.push_back(' ');
+      } else {
+         decoded.push_back(value[i]);
+      }
+   }
+   return decoded;
+}
+
+void parse_query(std::string_view query, httplib::Params &params) {
+   while (!query.empty()) {
+      auto amp = query.find('&');
+      auto pair = query.substr(0, amp);
+      if (!pair.empty()) {
+         auto eq = pair.find('=');
+         auto key = pair.substr(0, eq);
+         auto value = eq == std::string_view::npos ? std::string_view()
+                                                   : pair.substr(eq + 1);
+         params.emplace(decode_url(key, true), decode_url(value, true));
+      }
+      if (amp == std::string_view::npos) {
+         break;
+      }
+      query.remove_prefix(amp + 1);
+   }
+}
+
+const char *status_reason(int status) {
+   switch (status) {
+   case 200:
+      return "OK";
+   case 400:
+      return "Bad Request";
+   case 404:
+      return "Not Found";
+   case 413:
+      return "Payload Too Large";
+   case 500:
+      return "Internal Server Error";
+   case 501:
+      return "Not Implemented";
+   case 503:
+      return "Service Unavailable";
+   case 504:
+      return "Gateway Timeout";
+   default:
+      return "";
+   }
+}
+
+} // namespace
+
+ingest_server_c::ingest_server_c(ipv4_host_port_s host_port,
+                                 handler_f handler, configuration_c config)
+    : _host_port(host_port), _handler(handler), _config(config) {
+
+   if (!_config.reactors) {
+      _config.reactors = 1;
+   }
+
+   auto &stats = monolith::stats::registry();
+   _stat_connections = &stats.gauge("monolith_ingest_connections",
+                                    "Connections open on the ingest server");
+   _stat_requests = &stats.counter("monolith_ingest_requests_total",
+                                   "Requests served by the ingest server");
+   _stat_bad_requests =
+       &stats.counter("monolith_ingest_bad_requests_total",
+                      "Requests the ingest server could not parse");
+}
+
+ingest_server_c::~ingest_server_c() {
+   if (p_running.load()) {
+      stop();
+   }
+}
+
+bool ingest_server_c::start() {
+
+   if (p_running.load()) {
+      LOG(INFO) << TAG("ingest_server_c::start")
+                << "Ingest server already running\n";
+      return false;
+   }
+
+   _reactors.clear();
+   for (uint32_t i = 0; i < _config.reactors; i++) {
+      auto reactor = std::make_unique<reactor_s>();
+      if (!open_reactor(*reactor)) {
+         close_reactor(*reactor);
+         for (auto &opened : _reactors) {
+            close_reactor(*opened);
+         }
+         _reactors.clear();
+         return false;
+      }
+      _reactors.push_back(std::move(reactor));
+   }
+
+   p_running.store(true);
+   for (auto &reactor : _reactors) {
+      reactor->thread = std::thread(&ingest_server_c::run, this,
+                                    std::ref(*reactor));
+   }
+
+   LOG(INFO) << TAG("ingest_server_c::start") << "Ingest server started ["
+             << _host_port.address << ":" << _host_port.port << "] with "
+             << _reactors.size() << " reactors\n";
+   return true;
+}
+
+bool ingest_server_c::stop() {
+
+   if (!p_running.load()) {
+      LOG(INFO) << TAG("ingest_server_c::stop")
+                << "Ingest server not running\n";
+      return false;
+   }
+
+   // Reactors notice within one sweep interval
+   p_running.store(false);
+   for (auto &reactor : _reactors) {
+      if (reactor->thread.joinable()) {
+         reactor->thread.join();
+      }
+      close_reactor(*reactor);
+   }
+   _reactors.clear();
+   return true;
+}
+
+bool ingest_server_c::open_reactor(reactor_s &reactor) {
+
+   sockaddr_in addr{};
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(static_cast<uint16_t>(_host_port.port));
+   if (inet_pton(AF_INET, _host_port.address.c_str(), &addr.sin_addr) != 1) {
+      LOG(ERROR) << TAG("ingest_server_c::open_reactor")
+                 << "Invalid ipv4 address: " << _host_port.address << "\n";
+      return false;
+   }
+
+   reactor.listen_fd =
+       socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if (reactor.listen_fd < 0) {
+      LOG(ERROR) << TAG("ingest_server_c::open_reactor")
+                 << "Failed to create socket: " << std::strerror(errno)
+                 << "\n";
+      return false;
+   }
+
+   int enable = 1;
+   setsockopt(reactor.listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable,
+              sizeof(enable));
+   if (setsockopt(reactor.listen_fd, SOL_SOCKET, SO_REUSEPORT, &enable,
+                  sizeof(enable)) < 0) {
+      LOG(ERROR) << TAG("ingest_server_c::open_reactor")
+                 << "Failed to set SO_REUSEPORT: " << std::strerror(errno)
+                 << "\n";
+      return false;
+   }
+
+   if (bind(reactor.listen_fd, reinterpret_cast<sockaddr *>(&addr),
+            sizeof(addr)) < 0 ||
+       listen(reactor.listen_fd, SOMAXCONN) < 0) {
+      LOG(ERROR) << TAG("ingest_server_c::open_reactor") << "Failed to listen ["
+                 << _host_port.address << ":" << _host_port.port
+                 << "]: " << std::strerror(errno) << "\n";
+      return false;
+   }
+
+   reactor.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   if (reactor.epoll_fd < 0) {
+      LOG(ERROR) << TAG("ingest_server_c::open_reactor")
+                 << "Failed to create epoll instance: "
+                 << std::strerror(errno) << "\n";
+      return false;
+   }
+
+   epoll_event event{};
+   event.events = EPOLLIN | EPOLLET;
+   event.data.fd = reactor.listen_fd;
+   if (epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, reactor.listen_fd, &event) <
+       0) {
+      LOG(ERROR) << TAG("ingest_server_c::open_reactor")
+                 << "Failed to watch listening socket: "
+                 << std::strerror(errno) << "\n";
+      return false;
+   }
+   return true;
+}
+
+void ingest_server_c::close_reactor(reactor_s &reactor) {
+
+   while (!reactor.connections.empty()) {
+      close_connection(reactor, reactor.connections.begin()->first);
+   }
+   if (reactor.epoll_fd >= 0) {
+      close(reactor.epoll_fd);
+      reactor.epoll_fd = -1;
+   }
+   if (reactor.listen_fd >= 0) {
+      close(reactor.listen_fd);
+      reactor.listen_fd = -1;
+   }
+}
+
+void ingest_server_c::run(reactor_s &reactor) {
+
+   epoll_event events[MAX_EVENTS];
+   auto last_sweep = steady_clock_t::now();
+
+   while (p_running.load()) {
+      auto ready = epoll_wait(reactor.epoll_fd, events, MAX_EVENTS,
+                              static_cast<int>(SWEEP_INTERVAL.count()));
+      if (ready < 0 && errno != EINTR) {
+         LOG(ERROR) << TAG("ingest_server_c::run")
+                    << "epoll_wait failed: " << std::strerror(errno) << "\n";
+         break;
+      }
+
+      for (int i = 0; i < ready; i++) {
+         auto fd = events[i].data.fd;
+         if (fd == reactor.listen_fd) {
+            accept_all(reactor);
+            continue;
+         }
+
+         auto it = reactor.connections.find(fd);
+         if (it == reactor.connections.end()) {
+            continue;
+         }
+         auto &conn = it->second;
+
+         if (events[i].events & EPOLLERR) {
+            close_connection(reactor, fd);
+            continue;
+         }
+
+         if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+            receive(conn);
+         }
+
+         if (!serve(conn)) {
+            close_connection(reactor, fd);
+         }
+      }
+
+      auto now = steady_clock_t::now();
+      if (now - last_sweep >= SWEEP_INTERVAL) {
+         sweep(reactor);
+         last_sweep = now;
+      }
+   }
+}
+
+void ingest_server_c::accept_all(reactor_s &reactor) {
+
+   while (true) {
+      sockaddr_in addr{};
+      socklen_t addr_len = sizeof(addr);
+      auto fd = accept4(reactor.listen_fd, reinterpret_cast<sockaddr *>(&addr),
+                        &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (fd < 0) {
+         if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+         }
+         if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG(WARNING) << TAG("ingest_server_c::accept_all")
+                         << "accept failed: " << std::strerror(errno)
+                         << "\n";
+         }
+         return;
+      }
+
+      epoll_event event{};
+      event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+      event.data.fd = fd;
+      if (epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+         close(fd);
+         continue;
+      }
+
+      char address[INET_ADDRSTRLEN]{};
+      inet_ntop(AF_INET, &addr.sin_addr, address, sizeof(address));
+
+      auto &conn = reactor.connections[fd];
+      conn.fd = fd;
+      conn.remote_addr = address;
+      conn.last_active = steady_clock_t::now();
+      _stat_connections->add(1);
+   }
+}
+
+void ingest_server_c::receive(connection_s &conn) {
+
+   // Edge triggered, so everything readable is read now unless the input
+   // is already at its limit. Reading then resumes from serve() once the
+   // requests buffered have been answered. A hang up still leaves what was
+   // sent before it to serve
+   auto limit = _config.max_request_bytes + READ_CHUNK;
+   conn.read_paused = false;
+
+   while (true) {
+      if (conn.in.size() >= limit) {
+         conn.read_paused = true;
+         break;
+      }
+      auto offset = conn.in.size();
+      auto chunk = std::min(READ_CHUNK, limit - offset);
+      conn.in.resize(offset + chunk);
+      auto n = recv(conn.fd, conn.in.data() + offset, chunk, 0);
+      conn.in.resize(offset + (n > 0 ? n : 0));
+      if (n > 0) {
+         continue;
+      }
+      if (n == 0) {
+         conn.peer_closed = true;
+      } else if (errno == EINTR) {
+         continue;
+      } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+         conn.closing = true;
+         conn.in.clear();
+      }
+      break;
+   }
+   conn.last_active = steady_clock_t::now();
+}
+
+bool ingest_server_c::serve(connection_s &conn) {
+
+   // Requests are only parsed while the client keeps up with the responses
+   // so a pipelining client can't grow the output without bound, and only
+   // read while there is room for them so it can't grow the input either
+   while (true) {
+      auto backed_up = process(conn);
+      if (!flush(conn)) {
+         return false;
+      }
+      if (!conn.out.empty()) {
+         return true; // Resumed once the socket is writable
+      }
+      if (conn.closing) {
+         return false;
+      }
+      if (backed_up) {
+         continue;
+      }
+      if (conn.read_paused) {
+         receive(conn);
+         continue;
+      }
+
+      // Every complete request has been answered by now
+      return !conn.peer_closed;
+   }
+}
+
+bool ingest_server_c::process(connection_s &conn) {
+
+   size_t offset = 0;
+   bool backed_up = false;
+
+   while (offset < conn.in.size()) {
+      if (conn.out.size() - conn.out_offset >= MAX_PENDING_OUTPUT) {
+         backed_up = true;
+         break;
+      }
+
+      httplib::Request req;
+      bool keep_alive = false;
+      size_t consumed = 0;
+      auto result =
+          parse_request(std::string_view(conn.in).substr(offset),
+                        _config.max_request_bytes, req, keep_alive, consumed);
+
+      if (result == parse_result_e::INCOMPLETE) {
+         break;
+      }
+
+      if (result != parse_result_e::COMPLETE) {
+         _stat_bad_requests->add();
+         respond_error(conn, result == parse_result_e::TOO_LARGE ? 413
+                             : result == parse_result_e::UNSUPPORTED ? 501
+                                                                     : 400);
+         offset = conn.in.size();
+         break;
+      }
+      offset += consumed;
+
+      req.remote_addr = conn.remote_addr;
+      httplib::Response res;
+      if (!_handler(req, res)) {
+         res = httplib::Response();
+         res.status = 404;
+      }
+      _stat_requests->add();
+      respond(conn, req, res, keep_alive);
+
+      if (conn.closing) {
+         offset = conn.in.size();
+         break;
+      }
+   }
+
+   conn.in.erase(0, offset);
+   return backed_up;
+}
+
+bool ingest_server_c::flush(connection_s &conn) {
+
+   while (conn.out_offset < conn.out.size()) {
+      auto n = send(conn.fd, conn.out.data() + conn.out_offset,
+                    conn.out.size() - conn.out_offset, MSG_NOSIGNAL);
+      if (n > 0) {
+         conn.out_offset += n;
+         conn.last_active = steady_clock_t::now();
+         continue;
+      }
+      if (n < 0 && errno == EINTR) {
+         continue;
+      }
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+         return true;
+      }
+      return false;
+   }
+   conn.out.clear();
+   conn.out_offset = 0;
+   return true;
+}
+
+void ingest_server_c::respond(connection_s &conn, const httplib::Request &req,
+                              httplib::Response &res, bool keep_alive) {
+
+   auto status = res.status == -1 ? 200 : res.status;
+
+   for (auto &[name, value] : res.headers) {
+      if (iequals(name, "Connection") && icontains(value, "close")) {
+         keep_alive = false;
+      }
+   }
+   if (!keep_alive) {
+      conn.closing = true;
+   }
+
+   auto &out = conn.out;
+   out.reserve(out.size() + 128 + res.body.size());
+   out += "HTTP/1.1 ";
+   out += std::to_string(status);
+   out += ' ';
+   out += status_reason(status);
+   out += "\r\n";
+   for (auto &[name, value] : res.headers) {
+      if (iequals(name, "Connection") || iequals(name, "Content-Length")) {
+         continue;
+      }
+      out += name;
+      out += ": ";
+      out += value;
+      out += "\r\n";
+   }
+   out += "Content-Length: ";
+   out += std::to_string(res.body.size());
+   out += keep_alive ? "\r\nConnection: keep-alive\r\n\r\n"
+                     : "\r\nConnection: close\r\n\r\n";
+   if (req.method != "HEAD") {
+      out += res.body;
+   }
+}
+
+void ingest_server_c::respond_error(connection_s &conn, int status) {
+   httplib::Request req;
+   httplib::Response res;
+   res.status = status;
+   respond(conn, req, res, false);
+}
+
+void ingest_server_c::close_connection(reactor_s &reactor, int fd) {
+
+   // Closing the descriptor removes it from the epoll set
+   close(fd);
+   reactor.connections.erase(fd);
+   _stat_connections->add(-1);
+}
+
+void ingest_server_c::sweep(reactor_s &reactor) {
+
+   auto now = steady_clock_t::now();
+   auto timeout = std::chrono::seconds(_config.idle_timeout_sec);
+
+   std::vector<int> idle;
+   for (auto &[fd, conn] : reactor.connections) {
+      if (now - conn.last_active >= timeout) {
+         idle.push_back(fd);
+      }
+   }
+   for (auto fd : idle) {
+      close_connection(reactor, fd);
+   }
+}
+
+ingest_server_c::parse_result_e
+ingest_server_c::parse_request(std::string_view data, size_t max_bytes,
+                               httplib::Request &req, bool &keep_alive,
+                               size_t &consumed) {
+
+   auto head_end = data.find("\r\n\r\n");
+   if (head_end == std::string_view::npos) {
+      return data.size() > max_bytes ? parse_result_e::TOO_LARGE
+                                     : parse_result_e::INCOMPLETE;
+   }
+   auto head_size = head_end + 4;
+   if (head_size > max_bytes) {
+      return parse_result_e::TOO_LARGE;
+   }
+
+   // Request line
+   auto head = data.substr(0, head_end);
+   auto line_end = head.find("\r\n");
+   auto line = head.substr(0, line_end);
+
+   auto method_end = line.find(' ');
+   if (method_end == std::string_view::npos || method_end == 0) {
+      return parse_result_e::BAD_REQUEST;
+   }
+   auto target_end = line.find(' ', method_end + 1);
+   if (target_end == std::string_view::npos) {
+      return parse_result_e::BAD_REQUEST;
+   }
+   auto method = line.substr(0, method_end);
+   auto target = line.substr(method_end + 1, target_end - method_end - 1);
+   auto version = line.substr(target_end + 1);
+
+   if (target.empty() || target.front() != '/') {
+      return parse_result_e::BAD_REQUEST;
+   }
+   if (version == "HTTP/1.1") {
+      keep_alive = true;
+   } else if (version == "HTTP/1.0") {
+      keep_alive = false;
+   } else {
+      return parse_result_e::BAD_REQUEST;
+   }
+
+   // Headers
+   size_t content_length = 0;
+   auto headers = line_end == std::string_view::npos
+                      ? std::string_view()
+                      : head.substr(line_end + 2);
+   while (!headers.empty()) {
+      auto end = headers.find("\r\n");
+      auto header = headers.substr(0, end);
+      headers = end == std::string_view::npos ? std::string_view()
+                                              : headers.substr(end + 2);
+
+      auto colon = header.find(':');
+      if (colon == std::string_view::npos || colon == 0) {
+         return parse_result_e::BAD_REQUEST;
+      }
+      auto name = header.substr(0, colon);
+      auto value = trim(header.substr(colon + 1));
+
+      if (iequals(name, "Content-Length")) {
+         auto [ptr, ec] = std::from_chars(
+             value.data(), value.data() + value.size(), content_length);
+         if (ec != std::errc() || ptr != value.data() + value.size()) {
+            return parse_result_e::BAD_REQUEST;
+         }
+      } else if (iequals(name, "Transfer-Encoding")) {
+         if (!iequals(value, "identity")) {
+            return parse_result_e::UNSUPPORTED;
+         }
+      } else if (iequals(name, "Connection")) {
+         if (icontains(value, "close")) {
+            keep_alive = false;
+         } else if (icontains(value, "keep-alive")) {
+            keep_alive = true;
+         }
+      }
+      req.headers.emplace(std::string(name), std::string(value));
+   }
+
+   // Body
+   if (content_length > max_bytes - head_size) {
+      return parse_result_e::TOO_LARGE;
+   }
+   if (data.size() < head_size + content_length) {
+      return parse_result_e::INCOMPLETE;
+   }
+
+   req.method = std::string(method);
+   auto query_start = target.find('?');
+   req.path = decode_url(target.substr(0, query_start), false);
+   if (query_start != std::string_view::npos) {
+      parse_query(target.substr(query_start + 1), req.params);
+   }
+   req.body = std::string(data.substr(head_size, content_length));
+
+   consumed = head_size + content_length;
+   return parse_result_e::COMPLETE;
+}
+
+} // namespace networking
+} // namespace monolith
@@ -0,0 +1,141 @@
+#ifndef MONOLITH_NETWORKING_INGEST_SERVER_HPP
+#define MONOLITH_NETWORKING_INGEST_SERVER_HPP
+
+#include "interfaces/service_if.hpp"
+#include "networking/types.hpp"
+#include "stats/stats.hpp"
+#include <chrono>
+#include <functional>
+#include <httplib.h>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/*
+   ABOUT:
+      Event driven HTTP/1.1 listener for the small, frequent requests nodes
+   make (submissions, heartbeats, probes). httplib serves a connection on a
+   thread for as long as it is kept alive, so every idle node holds a thread.
+   Here a fixed number of reactor threads each run an edge triggered epoll
+   loop over their own listening socket (SO_REUSEPORT lets the kernel spread
+   new connections between them) and every connection they accepted, so an
+   idle connection only costs its buffers.
+
+   Requests are parsed into httplib requests and given to a handler that
+   runs on the reactor, so handlers must not block. Responses are written
+   back in order, requests pipelined on a connection included. Only requests
+   with a Content-Length (or without a body) are understood, chunked bodies
+   are answered with a 501.
+*/
+
+namespace monolith {
+namespace networking {
+
+//! \brief Epoll based HTTP/1.1 server
+class ingest_server_c : public service_if {
+ public:
+   //! \brief Handler for parsed requests
+   //! \returns false if the request was not handled (answered with a 404)
+   using handler_f =
+       std::function<bool(const httplib::Request &, httplib::Response &)>;
+
+   //! \brief Server configuration
+   struct configuration_c {
+      uint32_t reactors{2};          //! Threads running an epoll loop
+      uint32_t idle_timeout_sec{60}; //! Close connections idle this long
+      size_t max_request_bytes{65'536}; //! Largest request (head and body)
+   };
+
+   //! \brief Outcome of parsing a request from a buffer
+   enum class parse_result_e {
+      INCOMPLETE,  //! More data is needed
+      COMPLETE,    //! A request was parsed
+      BAD_REQUEST, //! The data is not a valid request
+      TOO_LARGE,   //! The request is over the size limit
+      UNSUPPORTED  //! The request uses something not understood
+   };
+
+   ingest_server_c() = delete;
+
+   //! \brief Create the server
+   //! \param host_port The address and port to listen on
+   //! \param handler The handler given every parsed request
+   //! \param config The server configuration
+   ingest_server_c(ipv4_host_port_s host_port, handler_f handler,
+                   configuration_c config);
+
+   //! \brief Stop the server (if running)
+   virtual ~ingest_server_c() override;
+
+   // From service_if
+   virtual bool start() override final;
+   virtual bool stop() override final;
+
+   //! \brief Parse the first request in a buffer
+   //! \param data The received data
+   //! \param max_bytes The largest request accepted
+   //! \param req The request to populate
+   //! \param keep_alive Set to whether the connection should be kept open
+   //! \param consumed Set to the bytes the request took up when complete
+   static parse_result_e parse_request(std::string_view data, size_t max_bytes,
+                                       httplib::Request &req,
+                                       bool &keep_alive, size_t &consumed);
+
+ private:
+   static constexpr int MAX_EVENTS = 256;
+   static constexpr size_t READ_CHUNK = 16'384;
+   static constexpr size_t MAX_PENDING_OUTPUT = 65'536;
+   static constexpr std::chrono::milliseconds SWEEP_INTERVAL{1'000};
+
+   using steady_clock_t = std::chrono::steady_clock;
+
+   struct connection_s {
+      int fd{-1};
+      std::string remote_addr;
+      std::string in;
+      std::string out;
+      size_t out_offset{0};
+      bool closing{false};     // Close once everything queued is written
+      bool peer_closed{false}; // The client is done sending
+      bool read_paused{false}; // Input is full, stopped before EAGAIN
+      steady_clock_t::time_point last_active;
+   };
+
+   struct reactor_s {
+      int listen_fd{-1};
+      int epoll_fd{-1};
+      std::thread thread;
+      std::unordered_map<int, connection_s> connections;
+   };
+
+   ipv4_host_port_s _host_port;
+   handler_f _handler;
+   configuration_c _config;
+   std::vector<std::unique_ptr<reactor_s>> _reactors;
+
+   monolith::stats::gauge_c *_stat_connections{nullptr};
+   monolith::stats::counter_c *_stat_requests{nullptr};
+   monolith::stats::counter_c *_stat_bad_requests{nullptr};
+
+   bool open_reactor(reactor_s &reactor);
+   void close_reactor(reactor_s &reactor);
+   void run(reactor_s &reactor);
+   void accept_all(reactor_s &reactor);
+   void receive(connection_s &conn);
+   bool serve(connection_s &conn);
+   bool process(connection_s &conn);
+   bool flush(connection_s &conn);
+   void respond(connection_s &conn, const httplib::Request &req,
+                httplib::Response &res, bool keep_alive);
+   void respond_error(connection_s &conn, int status);
+   void close_connection(reactor_s &reactor, int fd);
+   void sweep(reactor_s &reactor);
+};
+
+} // namespace networking
+} // namespace monolith
+
+#endif
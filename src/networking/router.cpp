@@ -0,0 +1,127 @@
+#include "router.hpp"
+
+namespace monolith {
+namespace networking {
+
+bool router_c::add(const std::string &pattern, size_t id) {
+
+   if (pattern.empty() || pattern.front() != '/') {
+      return false;
+   }
+
+   auto node = &_root;
+   std::string_view remaining(pattern);
+   remaining.remove_prefix(1);
+
+   while (true) {
+      auto slash = remaining.find('/');
+      auto segment = remaining.substr(0, slash);
+      auto last = slash == std::string_view::npos;
+
+      if (!segment.empty() && segment.front() == '*') {
+         if (!last || node->rest ||
+             node->params >= route_params_c::MAX_PARAMS) {
+            return false;
+         }
+         node->rest = id;
+         return true;
+      }
+
+      if (!segment.empty() && segment.front() == ':') {
+         if (node->params >= route_params_c::MAX_PARAMS) {
+            return false;
+         }
+         if (!node->param) {
+            node->param = std::make_unique<node_s>();
+            node->param->params = node->params + 1;
+         }
+         node = node->param.get();
+      } else {
+         node_s *child{nullptr};
+         for (auto &[literal, literal_node] : node->literals) {
+            if (literal == segment) {
+               child = literal_node.get();
+               break;
+            }
+         }
+         if (!child) {
+            node->literals.emplace_back(std::string(segment),
+                                        std::make_unique<node_s>());
+            child = node->literals.back().second.get();
+            child->params = node->params;
+         }
+         node = child;
+      }
+
+      if (last) {
+         break;
+      }
+      remaining.remove_prefix(slash + 1);
+   }
+
+   if (node->route) {
+      return false;
+   }
+   node->route = id;
+   return true;
+}
+
+std::optional<size_t> router_c::match(std::string_view path,
+                                      route_params_c &params) const {
+   if (path.empty() || path.front() != '/') {
+      return std::nullopt;
+   }
+   params._count = 0;
+   path.remove_prefix(1);
+   return match(_root, path, params);
+}
+
+std::optional<size_t> router_c::match(const node_s &node,
+                                      std::string_view path,
+                                      route_params_c &params) const {
+
+   auto slash = path.find('/');
+   auto segment = path.substr(0, slash);
+   auto last = slash == std::string_view::npos;
+   auto remaining = last ? std::string_view() : path.substr(slash + 1);
+
+   for (auto &[literal, child] : node.literals) {
+      if (literal != segment) {
+         continue;
+      }
+      if (last && child->route) {
+         params._count = child->params;
+         return child->route;
+      }
+      if (!last) {
+         if (auto id = match(*child, remaining, params)) {
+            return id;
+         }
+      }
+      break;
+   }
+
+   if (node.param) {
+      params._params[node.params] = segment;
+      if (last && node.param->route) {
+         params._count = node.param->params;
+         return node.param->route;
+      }
+      if (!last) {
+         if (auto id = match(*node.param, remaining, params)) {
+            return id;
+         }
+      }
+   }
+
+   if (node.rest) {
+      params._params[node.params] = path;
+      params._count = node.params + 1;
+      return node.rest;
+   }
+
+   return std::nullopt;
+}
+
+} // namespace networking
+} // namespace monolith
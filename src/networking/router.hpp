@@ -0,0 +1,110 @@
+#ifndef MONOLITH_NETWORKING_ROUTER_HPP
+#define MONOLITH_NETWORKING_ROUTER_HPP
+
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+   ABOUT:
+      Routes request paths to route ids with a trie of path segments, so a
+   request is matched in a single walk of its path instead of being tried
+   against every route's regex in turn.
+
+   Patterns are made of '/' separated segments:
+
+      literal     Matches the segment exactly
+      :name       Matches any one segment, captured as a parameter
+      *name       Matches the rest of the path, '/'s and all, captured as a
+                  parameter. Must be the last segment
+
+   When more than one route could match, literal segments are preferred
+   over parameters, and parameters over the rest of the path, so
+   "/metric/fetch/nodes" wins over "/metric/fetch/:node" for that path.
+*/
+
+namespace monolith {
+namespace networking {
+
+//! \brief Parameters captured while matching a route, in pattern order
+//! \note  Parameters view the matched path, which must outlive them
+class route_params_c {
+ public:
+   static constexpr size_t MAX_PARAMS = 8;
+
+   //! \brief Number of parameters captured
+   size_t size() const { return _count; }
+
+   //! \brief Retrieve a parameter as it appeared in the path
+   std::string_view operator[](size_t index) const { return _params[index]; }
+
+   //! \brief Retrieve a parameter as a string
+   std::string str(size_t index) const {
+      return std::string(_params[index]);
+   }
+
+   //! \brief Retrieve a parameter as a number
+   //! \returns The number, nothing if the whole parameter isn't one that
+   //!          fits in T
+   template <class T> std::optional<T> as(size_t index) const {
+      static_assert(std::is_integral_v<T>, "Parameters convert to integers");
+      auto param = _params[index];
+      T value{};
+      auto [end, ec] =
+          std::from_chars(param.data(), param.data() + param.size(), value);
+      if (param.empty() || ec != std::errc() ||
+          end != param.data() + param.size()) {
+         return std::nullopt;
+      }
+      return value;
+   }
+
+ private:
+   friend class router_c;
+   std::array<std::string_view, MAX_PARAMS> _params;
+   size_t _count{0};
+};
+
+//! \brief Segment trie mapping path patterns to route ids
+class router_c {
+ public:
+   //! \brief Add a route
+   //! \param pattern The path pattern (see above)
+   //! \param id The id to return when a path matches the pattern
+   //! \returns true iff the pattern is valid and not already routed
+   bool add(const std::string &pattern, size_t id);
+
+   //! \brief Match a path
+   //! \param path The request path, starting with '/'
+   //! \param params Filled with the parameters of the matched route
+   //! \returns The id of the matched route, if any
+   std::optional<size_t> match(std::string_view path,
+                               route_params_c &params) const;
+
+ private:
+   struct node_s {
+      // Routes have few literal children, a linear scan beats hashing
+      std::vector<std::pair<std::string, std::unique_ptr<node_s>>> literals;
+      std::unique_ptr<node_s> param;
+      std::optional<size_t> rest;  // Route capturing the rest of the path
+      std::optional<size_t> route; // Route ending at this node
+      size_t params{0};            // Parameters captured to reach the node
+   };
+
+   node_s _root;
+
+   std::optional<size_t> match(const node_s &node, std::string_view path,
+                               route_params_c &params) const;
+};
+
+} // namespace networking
+} // namespace monolith
+
+#endif
@@ -0,0 +1,142 @@
+#include "task_queue.hpp"
+#include "stats/registry.hpp"
+#include <algorithm>
+
+namespace monolith {
+namespace networking {
+
+namespace {
+thread_local bool serving_rejected{false};
+}
+
+bounded_task_queue_c::bounded_task_queue_c(size_t workers, size_t max_queued)
+    : _max_queued(max_queued) {
+
+   auto &stats = monolith::stats::registry();
+   _stat_queue_depth = &monolith::stats::queue_depth("http");
+   _stat_workers = &stats.gauge("monolith_http_workers",
+                                "Threads serving http connections");
+   _stat_busy = &stats.gauge("monolith_http_workers_busy",
+                             "Threads currently serving a connection");
+   _stat_connections =
+       &stats.counter("monolith_http_connections_total",
+                      "Connections handed to the http workers");
+   _stat_rejected = &stats.counter(
+       "monolith_http_rejected_total",
+       "Connections turned away because too many were waiting");
+   _stat_accept_stalls = &stats.counter(
+       "monolith_http_accept_stalls_total",
+       "Times accepting stopped because too many connections were waiting");
+
+   workers = std::max<size_t>(workers, 1);
+   _stat_workers->set(workers);
+
+   for (size_t i = 0; i < workers; i++) {
+      _workers.emplace_back(&bounded_task_queue_c::work, this);
+   }
+   for (size_t i = 0; i < REJECTERS; i++) {
+      _rejecters.emplace_back(&bounded_task_queue_c::reject, this);
+   }
+}
+
+bounded_task_queue_c::~bounded_task_queue_c() { shutdown(); }
+
+void bounded_task_queue_c::enqueue(std::function<void()> fn) {
+   {
+      std::unique_lock<std::mutex> lock(_mutex);
+      if (!has_room()) {
+         _stat_accept_stalls->add();
+         _space_cv.wait(lock, [this] { return has_room(); });
+      }
+
+      if (_max_queued && _tasks.size() >= _max_queued) {
+         _rejected.push_back(std::move(fn));
+         _stat_rejected->add();
+      } else {
+         _tasks.push_back(std::move(fn));
+         _stat_connections->add();
+         _stat_queue_depth->set(_tasks.size());
+      }
+   }
+   _cv.notify_all();
+}
+
+void bounded_task_queue_c::shutdown() {
+   {
+      const std::lock_guard<std::mutex> lock(_mutex);
+      if (_shutdown) {
+         return;
+      }
+      _shutdown = true;
+   }
+   _cv.notify_all();
+   _space_cv.notify_all();
+
+   for (auto &worker : _workers) {
+      if (worker.joinable()) {
+         worker.join();
+      }
+   }
+   for (auto &rejecter : _rejecters) {
+      if (rejecter.joinable()) {
+         rejecter.join();
+      }
+   }
+   _stat_workers->set(0);
+}
+
+bool bounded_task_queue_c::rejecting() { return serving_rejected; }
+
+// Expects the mutex to be held
+//
+bool bounded_task_queue_c::has_room() const {
+   return _shutdown || !_max_queued || _tasks.size() < _max_queued ||
+          _rejected.size() < MAX_REJECTED;
+}
+
+void bounded_task_queue_c::work() {
+
+   while (true) {
+      std::function<void()> task;
+      {
+         std::unique_lock<std::mutex> lock(_mutex);
+         _cv.wait(lock, [this] { return _shutdown || !_tasks.empty(); });
+
+         // Tasks already queued are still run so their sockets get closed
+         if (_tasks.empty()) {
+            return;
+         }
+         task = std::move(_tasks.front());
+         _tasks.pop_front();
+         _stat_queue_depth->set(_tasks.size());
+      }
+      _space_cv.notify_one();
+
+      _stat_busy->add(1);
+      task();
+      _stat_busy->add(-1);
+   }
+}
+
+void bounded_task_queue_c::reject() {
+
+   serving_rejected = true;
+
+   while (true) {
+      std::function<void()> task;
+      {
+         std::unique_lock<std::mutex> lock(_mutex);
+         _cv.wait(lock, [this] { return _shutdown || !_rejected.empty(); });
+         if (_rejected.empty()) {
+            return;
+         }
+         task = std::move(_rejected.front());
+         _rejected.pop_front();
+      }
+      _space_cv.notify_one();
+      task();
+   }
+}
+
+} // namespace networking
+} // namespace monolith
@@ -0,0 +1,83 @@
+#ifndef MONOLITH_NETWORKING_TASK_QUEUE_HPP
+#define MONOLITH_NETWORKING_TASK_QUEUE_HPP
+
+#include "stats/stats.hpp"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <httplib.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+   ABOUT:
+      Task queue for httplib servers with a fixed number of workers and a
+   bound on the connections left waiting for one. httplib hands every
+   accepted connection to the queue as a task, and a worker serves that
+   connection (every request on it, while it is kept alive) before taking
+   the next.
+
+   A connection that arrives while the queue is full can't simply be
+   dropped, its socket belongs to the task. It is instead served by one of a
+   few rejecting threads, on which rejecting() is true, so the server can
+   answer it with a 503 and close it straight away. The rejected backlog is
+   bounded too; once it is full enqueue() blocks the accepting thread until
+   there is room, leaving further connections in the kernel's listen backlog
+   instead of holding a descriptor each.
+*/
+
+namespace monolith {
+namespace networking {
+
+//! \brief Bounded task queue for httplib
+class bounded_task_queue_c : public httplib::TaskQueue {
+ public:
+   bounded_task_queue_c() = delete;
+
+   //! \brief Create the queue and start its workers
+   //! \param workers Number of worker threads (minimum of 1)
+   //! \param max_queued Tasks allowed to wait for a worker (0 = no limit)
+   bounded_task_queue_c(size_t workers, size_t max_queued);
+
+   //! \brief Shut down (if not already) and join all threads
+   virtual ~bounded_task_queue_c() override;
+
+   // From httplib::TaskQueue
+   virtual void enqueue(std::function<void()> fn) override;
+   virtual void shutdown() override;
+
+   //! \brief Check if the calling thread is serving a rejected connection
+   static bool rejecting();
+
+ private:
+   static constexpr size_t REJECTERS = 4;
+   static constexpr size_t MAX_REJECTED = 64;
+
+   size_t _max_queued{0};
+   bool _shutdown{false};
+
+   std::mutex _mutex;
+   std::condition_variable _cv;       // Tasks or rejections to run
+   std::condition_variable _space_cv; // Room for enqueue() to continue
+   std::deque<std::function<void()>> _tasks;
+   std::deque<std::function<void()>> _rejected;
+   std::vector<std::thread> _workers;
+   std::vector<std::thread> _rejecters;
+
+   monolith::stats::gauge_c *_stat_queue_depth{nullptr};
+   monolith::stats::gauge_c *_stat_workers{nullptr};
+   monolith::stats::gauge_c *_stat_busy{nullptr};
+   monolith::stats::counter_c *_stat_connections{nullptr};
+   monolith::stats::counter_c *_stat_rejected{nullptr};
+   monolith::stats::counter_c *_stat_accept_stalls{nullptr};
+
+   bool has_room() const;
+   void work();
+   void reject();
+};
+
+} // namespace networking
+} // namespace monolith
+
+#endif
@@ -0,0 +1,70 @@
+#include "profile.hpp"
+#include <algorithm>
+#include <bit>
+#include <iomanip>
+#include <sstream>
+
+namespace monolith {
+namespace rules {
+
+void handler_profile_s::record(uint64_t us) {
+   calls++;
+   total_us += us;
+   max_us = std::max(max_us, us);
+
+   size_t bucket = std::bit_width(us);
+   latency_us[std::min(bucket, LATENCY_BUCKETS - 1)]++;
+}
+
+void handler_profile_s::merge(const handler_profile_s &other) {
+   calls += other.calls;
+   errors += other.errors;
+   over_budget += other.over_budget;
+   sampled_instructions += other.sampled_instructions;
+   total_us += other.total_us;
+   max_us = std::max(max_us, other.max_us);
+   for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+      latency_us[i] += other.latency_us[i];
+   }
+}
+
+uint64_t handler_profile_s::percentile_us(double percentile) const {
+   if (calls == 0) {
+      return 0;
+   }
+
+   uint64_t target = static_cast<uint64_t>(calls * (percentile / 100.0));
+   uint64_t seen{0};
+   for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+      seen += latency_us[i];
+      if (seen > target || seen == calls) {
+         return (i == LATENCY_BUCKETS - 1) ? max_us : (1ull << i);
+      }
+   }
+   return max_us;
+}
+
+std::string render_profiles(const profiles_t &profiles) {
+
+   std::stringstream ss;
+   ss << std::left << std::setw(40) << "handler" << std::right
+      << std::setw(12) << "calls" << std::setw(8) << "errors" << std::setw(8)
+      << "budget" << std::setw(10) << "mean_us" << std::setw(10) << "p50_us"
+      << std::setw(10) << "p99_us" << std::setw(10) << "max_us"
+      << std::setw(14) << "instructions"
+      << "\n";
+
+   for (auto &[name, profile] : profiles) {
+      uint64_t mean = profile.calls ? profile.total_us / profile.calls : 0;
+      ss << std::left << std::setw(40) << name << std::right << std::setw(12)
+         << profile.calls << std::setw(8) << profile.errors << std::setw(8)
+         << profile.over_budget << std::setw(10) << mean << std::setw(10)
+         << profile.percentile_us(50) << std::setw(10)
+         << profile.percentile_us(99) << std::setw(10) << profile.max_us
+         << std::setw(14) << profile.sampled_instructions << "\n";
+   }
+   return ss.str();
+}
+
+} // namespace rules
+} // namespace monolith
@@ -0,0 +1,54 @@
+#ifndef MONOLITH_RULES_PROFILE_HPP
+#define MONOLITH_RULES_PROFILE_HPP
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace monolith {
+namespace rules {
+
+//! \brief Limits placed on every call into a rule script
+//! \note  A value of 0 means no limit
+struct budget_s {
+   uint64_t max_instructions{0};
+   uint64_t max_time_ms{0};
+};
+
+//! \brief Call statistics for a single rule handler
+struct handler_profile_s {
+   //! Latency buckets are powers of two in microseconds, bucket N counts
+   //! calls that took less than 2^N us. The last bucket takes the rest
+   static constexpr size_t LATENCY_BUCKETS = 24;
+
+   uint64_t calls{0};
+   uint64_t errors{0};
+   uint64_t over_budget{0};
+   uint64_t sampled_instructions{0};
+   uint64_t total_us{0};
+   uint64_t max_us{0};
+   std::array<uint64_t, LATENCY_BUCKETS> latency_us{};
+
+   //! \brief Record the latency of a call
+   void record(uint64_t us);
+
+   //! \brief Add the statistics of another profile to this one
+   void merge(const handler_profile_s &other);
+
+   //! \brief Estimate a latency percentile from the histogram
+   //! \param percentile Within [0, 100]
+   //! \returns The upper bound, in us, of the bucket the percentile is in
+   uint64_t percentile_us(double percentile) const;
+};
+
+//! \brief Profiles keyed by handler name
+using profiles_t = std::map<std::string, handler_profile_s>;
+
+//! \brief Render profiles as a human readable table
+std::string render_profiles(const profiles_t &profiles);
+
+} // namespace rules
+} // namespace monolith
+
+#endif
@@ -0,0 +1,975 @@
+#include "runtime.hpp"
+#include "window.hpp"
+#include "stats/registry.hpp"
+#include <crate/externals/aixlog/logger.hpp>
+#include <functional>
+#include <new>
+
+extern "C" {
+#include <lua5.3/lauxlib.h>
+#include <lua5.3/lua.h>
+#include <lua5.3/lualib.h>
+} // extern "C"
+
+namespace monolith {
+namespace rules {
+
+namespace {
+
+const std::string WILDCARD_ID = "*";
+
+constexpr char LUA_WINDOW_METATABLE[] = "monolith.window";
+
+// Timers run off of the steady clock
+uint64_t steady_ms() {
+   return std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now().time_since_epoch())
+       .count();
+}
+
+constexpr char LUA_FUNC_ACCEPT_READING_V1[] = "accept_reading_v1_from_monolith";
+constexpr char LUA_FUNC_ACCEPT_READINGS_BATCH_V1[] =
+    "accept_readings_batch_v1_from_monolith";
+constexpr char LUA_FUNC_EXPORT_STATE[] = "export_state";
+constexpr char LUA_FUNC_MIGRATE_STATE[] = "migrate_state";
+
+// Deepest table nesting carried over on reload
+constexpr int MAX_MIGRATION_DEPTH = 64;
+
+// Shared by every runtime, per handler detail is kept in the profiles
+monolith::stats::histogram_c &lua_call_duration_us() {
+   static auto &histogram = monolith::stats::registry().histogram(
+       "monolith_lua_call_duration_us", "Time taken by calls into rule scripts");
+   return histogram;
+}
+
+// Check if the given global is a function
+bool has_function(lua_State *L, const char *name) {
+   lua_getglobal(L, name);
+   bool found = lua_isfunction(L, -1);
+   lua_pop(L, 1);
+   return found;
+}
+
+// Check return from LUA to ensure that it is LUA_OK
+bool check_lua(lua_State *L, int r) {
+   if (r != LUA_OK) {
+      std::string err = lua_tostring(L, -1);
+      LOG(ERROR) << TAG("check_lua") << "Error: " << err << "\n";
+      lua_pop(L, 1);
+      return false;
+   }
+   return true;
+}
+
+// Every state keeps a pointer to the runtime that owns it in its extra space
+// so functions called from Lua can find their way back to the environment
+runtime_c *get_runtime(lua_State *L) {
+   return *static_cast<runtime_c **>(lua_getextraspace(L));
+}
+
+// Functions called from Lua hand back a negative error code on failure and
+// nothing on success
+
+// Send an alert to the alert system
+int lua_monolith_trigger_alert(lua_State *L) {
+
+   if (!lua_isnumber(L, 1)) {
+      LOG(ERROR) << TAG("lua_monolith_trigger_alert")
+                 << "Error: Expected first parameter to be a number \n";
+      lua_pushinteger(L, -1);
+      return 1;
+   }
+
+   if (!lua_isstring(L, 2)) {
+      LOG(ERROR) << TAG("lua_monolith_trigger_alert")
+                 << "Error: Expected second parameter to be a string \n";
+      lua_pushinteger(L, -2);
+      return 1;
+   }
+
+   int alert_id = lua_tonumber(L, 1);
+   std::string message = lua_tostring(L, 2);
+   get_runtime(L)->get_environment()->alert_manager->trigger(alert_id,
+                                                             message);
+   return 0;
+}
+
+int lua_monolith_dispatch_action(lua_State *L) {
+
+   if (!lua_isstring(L, 1)) {
+      LOG(ERROR) << TAG("lua_monolith_dispatch_action")
+                 << "Error: Expected first parameter to be a string \n";
+      lua_pushinteger(L, -1);
+      return 1;
+   }
+
+   if (!lua_isstring(L, 2)) {
+      LOG(ERROR) << TAG("lua_monolith_dispatch_action")
+                 << "Error: Expected second parameter to be a string \n";
+      lua_pushinteger(L, -2);
+      return 1;
+   }
+
+   if (!lua_isnumber(L, 3)) {
+      LOG(ERROR) << TAG("lua_monolith_dispatch_action")
+                 << "Error: Expected third parameter to be a number \n";
+      lua_pushinteger(L, -3);
+      return 1;
+   }
+
+   using priority_e = monolith::services::action_dispatch_c::priority_e;
+
+   // Optional priority and deadline
+   auto priority = priority_e::NORMAL;
+   if (!lua_isnoneornil(L, 4)) {
+      lua_Integer given = lua_isinteger(L, 4) ? lua_tointeger(L, 4) : -1;
+      if (given < 0 || given >= static_cast<lua_Integer>(
+                                     monolith::services::action_dispatch_c::
+                                         NUM_PRIORITIES)) {
+         LOG(ERROR) << TAG("lua_monolith_dispatch_action")
+                    << "Error: Expected fourth parameter to be a priority \n";
+         lua_pushinteger(L, -6);
+         return 1;
+      }
+      priority = static_cast<priority_e>(given);
+   }
+
+   uint32_t deadline_ms{0};
+   if (!lua_isnoneornil(L, 5)) {
+      if (!lua_isinteger(L, 5) || lua_tointeger(L, 5) < 0) {
+         LOG(ERROR) << TAG("lua_monolith_dispatch_action")
+                    << "Error: Expected fifth parameter to be a deadline in ms \n";
+         lua_pushinteger(L, -7);
+         return 1;
+      }
+      deadline_ms = static_cast<uint32_t>(lua_tointeger(L, 5));
+   }
+
+   std::string controller_id = lua_tostring(L, 1);
+   std::string action_id = lua_tostring(L, 2);
+   double value = lua_tonumber(L, 3);
+
+   LOG(TRACE) << TAG("lua_monolith_dispatch_action")
+              << "Issue action |  cid: " << controller_id
+              << " | aid: " << action_id << " | value: " << value
+              << " | priority: " << static_cast<int>(priority) << "\n";
+
+   auto action_dispatcher =
+       get_runtime(L)->get_environment()->action_dispatcher;
+   if (action_dispatcher) {
+      if (!action_dispatcher->dispatch(controller_id, action_id, value,
+                                       priority, deadline_ms)) {
+         LOG(ERROR) << TAG("lua_monolith_dispatch_action")
+                    << "Failed to enqueue action\n";
+         lua_pushinteger(L, -4);
+         return 1;
+      }
+   } else {
+      LOG(ERROR) << TAG("lua_monolith_dispatch_action")
+                 << "Action dispatcher not set \n";
+      lua_pushinteger(L, -5);
+      return 1;
+   }
+
+   return 0;
+}
+
+// Register a handler for readings from a node / sensor pair
+int lua_monolith_subscribe(lua_State *L) {
+
+   if (!lua_isstring(L, 1)) {
+      LOG(ERROR) << TAG("lua_monolith_subscribe")
+                 << "Error: Expected first parameter to be a string \n";
+      lua_pushinteger(L, -1);
+      return 1;
+   }
+
+   if (!lua_isstring(L, 2)) {
+      LOG(ERROR) << TAG("lua_monolith_subscribe")
+                 << "Error: Expected second parameter to be a string \n";
+      lua_pushinteger(L, -2);
+      return 1;
+   }
+
+   if (!lua_isfunction(L, 3)) {
+      LOG(ERROR) << TAG("lua_monolith_subscribe")
+                 << "Error: Expected third parameter to be a function \n";
+      lua_pushinteger(L, -3);
+      return 1;
+   }
+
+   std::string node_id = lua_tostring(L, 1);
+   std::string sensor_id = lua_tostring(L, 2);
+
+   lua_pushvalue(L, 3);
+   int handler_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+   if (!get_runtime(L)->subscribe(node_id, sensor_id, handler_ref)) {
+      luaL_unref(L, LUA_REGISTRYINDEX, handler_ref);
+      lua_pushinteger(L, -4);
+      return 1;
+   }
+   return 0;
+}
+
+// Shared by monolith_schedule and monolith_every
+int schedule_handler(lua_State *L, const char *name, bool repeating) {
+
+   if (!lua_isinteger(L, 1) || lua_tointeger(L, 1) < 0) {
+      LOG(ERROR) << TAG(name)
+                 << "Error: Expected first parameter to be a positive integer \n";
+      lua_pushinteger(L, -1);
+      return 1;
+   }
+
+   if (!lua_isfunction(L, 2)) {
+      LOG(ERROR) << TAG(name)
+                 << "Error: Expected second parameter to be a function \n";
+      lua_pushinteger(L, -2);
+      return 1;
+   }
+
+   uint64_t ms = lua_tointeger(L, 1);
+   if (repeating && ms == 0) {
+      LOG(ERROR) << TAG(name) << "Error: Interval must be greater than 0 \n";
+      lua_pushinteger(L, -3);
+      return 1;
+   }
+
+   lua_pushvalue(L, 2);
+   int handler_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+   auto id = get_runtime(L)->schedule(ms, repeating ? ms : 0, handler_ref);
+   lua_pushinteger(L, id);
+   return 1;
+}
+
+// Call a function once after a delay, returns the timer id
+int lua_monolith_schedule(lua_State *L) {
+   return schedule_handler(L, "lua_monolith_schedule", false);
+}
+
+// Call a function at an interval, returns the timer id
+int lua_monolith_every(lua_State *L) {
+   return schedule_handler(L, "lua_monolith_every", true);
+}
+
+// Cancel a timer from monolith_schedule or monolith_every
+int lua_monolith_cancel(lua_State *L) {
+
+   if (!lua_isinteger(L, 1)) {
+      LOG(ERROR) << TAG("lua_monolith_cancel")
+                 << "Error: Expected first parameter to be an integer \n";
+      lua_pushinteger(L, -1);
+      return 1;
+   }
+
+   if (!get_runtime(L)->cancel(lua_tointeger(L, 1))) {
+      lua_pushinteger(L, -2);
+      return 1;
+   }
+   return 0;
+}
+
+// Seconds since a heartbeat was last seen from the given id, nil if never
+int lua_monolith_sec_since_contact(lua_State *L) {
+
+   if (!lua_isstring(L, 1)) {
+      LOG(ERROR) << TAG("lua_monolith_sec_since_contact")
+                 << "Error: Expected first parameter to be a string \n";
+      lua_pushnil(L);
+      return 1;
+   }
+
+   auto heartbeats = get_runtime(L)->get_environment()->heartbeats;
+   if (!heartbeats) {
+      LOG(ERROR) << TAG("lua_monolith_sec_since_contact")
+                 << "Heartbeat manager not set \n";
+      lua_pushnil(L);
+      return 1;
+   }
+
+   auto seconds = heartbeats->sec_since_contact(lua_tostring(L, 1));
+   if (!seconds.has_value()) {
+      lua_pushnil(L);
+      return 1;
+   }
+
+   lua_pushinteger(L, *seconds);
+   return 1;
+}
+
+//
+//  Windows are handed to Lua as full userdata holding a window_c, so they
+//  live and die with the Lua state that created them
+//
+window_c *check_window(lua_State *L) {
+   return static_cast<window_c *>(luaL_checkudata(L, 1, LUA_WINDOW_METATABLE));
+}
+
+// Create a window: monolith_window(size, ["sliding"|"tumbling"], [alpha])
+int lua_monolith_window(lua_State *L) {
+
+   if (!lua_isinteger(L, 1) || lua_tointeger(L, 1) < 1) {
+      LOG(ERROR) << TAG("lua_monolith_window")
+                 << "Error: Expected first parameter to be a positive integer \n";
+      lua_pushnil(L);
+      return 1;
+   }
+
+   if (lua_tointeger(L, 1) >
+       static_cast<lua_Integer>(window_c::MAX_CAPACITY)) {
+      LOG(ERROR) << TAG("lua_monolith_window")
+                 << "Error: Window size can not be over "
+                 << window_c::MAX_CAPACITY << " \n";
+      lua_pushnil(L);
+      return 1;
+   }
+
+   auto kind = window_c::kind_e::SLIDING;
+   if (!lua_isnoneornil(L, 2)) {
+      std::string kind_name = lua_isstring(L, 2) ? lua_tostring(L, 2) : "";
+      if (kind_name == "tumbling") {
+         kind = window_c::kind_e::TUMBLING;
+      } else if (kind_name != "sliding") {
+         LOG(ERROR) << TAG("lua_monolith_window")
+                    << "Error: Expected second parameter to be 'sliding' or "
+                       "'tumbling' \n";
+         lua_pushnil(L);
+         return 1;
+      }
+   }
+
+   double alpha = 0.1;
+   if (!lua_isnoneornil(L, 3)) {
+      if (!lua_isnumber(L, 3)) {
+         LOG(ERROR) << TAG("lua_monolith_window")
+                    << "Error: Expected third parameter to be a number \n";
+         lua_pushnil(L);
+         return 1;
+      }
+      alpha = lua_tonumber(L, 3);
+      if (!(alpha > 0.0 && alpha <= 1.0)) {
+         LOG(ERROR) << TAG("lua_monolith_window")
+                    << "Error: Expected third parameter to be within (0, 1] \n";
+         lua_pushnil(L);
+         return 1;
+      }
+   }
+
+   size_t capacity = lua_tointeger(L, 1);
+   void *memory = lua_newuserdata(L, sizeof(window_c));
+   new (memory) window_c(kind, capacity, alpha);
+   luaL_setmetatable(L, LUA_WINDOW_METATABLE);
+   return 1;
+}
+
+int lua_window_gc(lua_State *L) {
+   check_window(L)->~window_c();
+   return 0;
+}
+
+// window:push(timestamp, value) -> true if a tumbling window completed
+int lua_window_push(lua_State *L) {
+   auto window = check_window(L);
+   double timestamp = luaL_checknumber(L, 2);
+   double value = luaL_checknumber(L, 3);
+   lua_pushboolean(L, window->push(timestamp, value));
+   return 1;
+}
+
+int lua_window_reset(lua_State *L) {
+   check_window(L)->reset();
+   return 0;
+}
+
+int lua_window_count(lua_State *L) {
+   lua_pushinteger(L, check_window(L)->count());
+   return 1;
+}
+
+int lua_window_capacity(lua_State *L) {
+   lua_pushinteger(L, check_window(L)->capacity());
+   return 1;
+}
+
+int lua_window_full(lua_State *L) {
+   lua_pushboolean(L, check_window(L)->full());
+   return 1;
+}
+
+template <double (window_c::*aggregate)() const>
+int lua_window_aggregate(lua_State *L) {
+   lua_pushnumber(L, (check_window(L)->*aggregate)());
+   return 1;
+}
+
+const luaL_Reg LUA_WINDOW_METHODS[] = {
+    {"push", lua_window_push},
+    {"reset", lua_window_reset},
+    {"count", lua_window_count},
+    {"capacity", lua_window_capacity},
+    {"full", lua_window_full},
+    {"mean", lua_window_aggregate<&window_c::mean>},
+    {"min", lua_window_aggregate<&window_c::min>},
+    {"max", lua_window_aggregate<&window_c::max>},
+    {"stddev", lua_window_aggregate<&window_c::stddev>},
+    {"rate", lua_window_aggregate<&window_c::rate>},
+    {"ewma", lua_window_aggregate<&window_c::ewma>},
+    {nullptr, nullptr}};
+
+void register_window(lua_State *L) {
+   luaL_newmetatable(L, LUA_WINDOW_METATABLE);
+   lua_newtable(L);
+   luaL_setfuncs(L, LUA_WINDOW_METHODS, 0);
+   lua_setfield(L, -2, "__index");
+   lua_pushcfunction(L, lua_window_gc);
+   lua_setfield(L, -2, "__gc");
+   lua_pop(L, 1);
+   lua_register(L, "monolith_window", lua_monolith_window);
+}
+
+void register_priorities(lua_State *L) {
+   using priority_e = monolith::services::action_dispatch_c::priority_e;
+   static constexpr std::pair<const char *, priority_e> PRIORITIES[] = {
+       {"MONOLITH_PRIORITY_LOW", priority_e::LOW},
+       {"MONOLITH_PRIORITY_NORMAL", priority_e::NORMAL},
+       {"MONOLITH_PRIORITY_HIGH", priority_e::HIGH},
+       {"MONOLITH_PRIORITY_CRITICAL", priority_e::CRITICAL}};
+
+   for (auto &[name, priority] : PRIORITIES) {
+      lua_pushinteger(L, static_cast<lua_Integer>(priority));
+      lua_setglobal(L, name);
+   }
+}
+
+// Log and count a value that copy_value can not move between states
+bool leave_behind(lua_State *from, int idx, size_t &left_behind) {
+   LOG(WARNING) << TAG("copy_value") << "Can not migrate a "
+                << luaL_typename(from, idx) << ", leaving it behind\n";
+   left_behind++;
+   return false;
+}
+
+// Copy the value at `idx` in `from` onto the top of the stack of `to`.
+// `memo` is a table on the stack of `to` mapping tables already copied
+// (by their address in `from`) to their copy so shared and cyclic
+// references survive. Returns false, leaving nothing pushed, for values
+// that can not be moved between states. Each of those is logged and counted
+// in `left_behind`
+bool copy_value(lua_State *from, int idx, lua_State *to, int memo, int depth,
+                size_t &left_behind) {
+
+   if (!lua_checkstack(to, 4) || !lua_checkstack(from, 3)) {
+      return leave_behind(from, idx, left_behind);
+   }
+
+   switch (lua_type(from, idx)) {
+   case LUA_TNIL:
+      lua_pushnil(to);
+      return true;
+   case LUA_TBOOLEAN:
+      lua_pushboolean(to, lua_toboolean(from, idx));
+      return true;
+   case LUA_TNUMBER:
+      if (lua_isinteger(from, idx)) {
+         lua_pushinteger(to, lua_tointeger(from, idx));
+      } else {
+         lua_pushnumber(to, lua_tonumber(from, idx));
+      }
+      return true;
+   case LUA_TSTRING: {
+      size_t length{0};
+      const char *data = lua_tolstring(from, idx, &length);
+      lua_pushlstring(to, data, length);
+      return true;
+   }
+   case LUA_TUSERDATA: {
+      auto window = static_cast<window_c *>(
+          luaL_testudata(from, idx, LUA_WINDOW_METATABLE));
+      if (!window) {
+         return leave_behind(from, idx, left_behind);
+      }
+      void *memory = lua_newuserdata(to, sizeof(window_c));
+      new (memory) window_c(*window);
+      luaL_setmetatable(to, LUA_WINDOW_METATABLE);
+      return true;
+   }
+   case LUA_TTABLE:
+      break;
+   default:
+      return leave_behind(from, idx, left_behind);
+   }
+
+   if (depth >= MAX_MIGRATION_DEPTH) {
+      LOG(WARNING) << TAG("copy_value")
+                   << "State nested too deeply, truncating\n";
+      left_behind++;
+      return false;
+   }
+
+   // Already copied
+   const void *source = lua_topointer(from, idx);
+   lua_rawgetp(to, memo, source);
+   if (!lua_isnil(to, -1)) {
+      return true;
+   }
+   lua_pop(to, 1);
+
+   lua_newtable(to);
+   lua_pushvalue(to, -1);
+   lua_rawsetp(to, memo, source);
+   int dest = lua_gettop(to);
+
+   idx = lua_absindex(from, idx);
+   lua_pushnil(from);
+   while (lua_next(from, idx)) {
+      if (copy_value(from, -2, to, memo, depth + 1, left_behind)) {
+         if (copy_value(from, -1, to, memo, depth + 1, left_behind)) {
+            lua_rawset(to, dest);
+         } else {
+            lua_pop(to, 1);
+         }
+      }
+      lua_pop(from, 1);
+   }
+   return true;
+}
+
+} // namespace
+
+runtime_c::runtime_c(environment_s *environment)
+    : _environment(environment), _timers(steady_ms()) {
+   _state = luaL_newstate();
+   *static_cast<runtime_c **>(lua_getextraspace(_state)) = this;
+   luaL_openlibs(_state);
+   lua_register(_state, "monolith_trigger_alert", lua_monolith_trigger_alert);
+   lua_register(_state, "monolith_dispatch_action",
+                lua_monolith_dispatch_action);
+   lua_register(_state, "monolith_subscribe", lua_monolith_subscribe);
+   lua_register(_state, "monolith_schedule", lua_monolith_schedule);
+   lua_register(_state, "monolith_every", lua_monolith_every);
+   lua_register(_state, "monolith_cancel", lua_monolith_cancel);
+   lua_register(_state, "monolith_sec_since_contact",
+                lua_monolith_sec_since_contact);
+   register_window(_state);
+   register_priorities(_state);
+   lua_sethook(_state, budget_hook, LUA_MASKCOUNT, HOOK_INSTRUCTIONS);
+}
+
+runtime_c::~runtime_c() {
+   lua_close(_state);
+   _state = nullptr;
+}
+
+bool runtime_c::load(const compiled_script_s &script) {
+
+   // Source is never accepted here, scripts are parsed once by the cache
+   const auto &file = script.name;
+   _loading = true;
+   bool loaded =
+       check_lua(_state, luaL_loadbufferx(_state, script.bytecode.data(),
+                                          script.bytecode.size(),
+                                          script.name.c_str(), "b")) &&
+       check_lua(_state, lua_pcall(_state, 0, 0, 0));
+   _loading = false;
+
+   if (!loaded) {
+      LOG(FATAL) << TAG("runtime_c::load")
+                 << "Failed to load lua script: " << file << "\n";
+      return false;
+   }
+
+   //
+   //  Check to make sure required function exist within the script
+   //
+   _has_reading_handler = has_function(_state, LUA_FUNC_ACCEPT_READING_V1);
+   _has_batch_handler =
+       has_function(_state, LUA_FUNC_ACCEPT_READINGS_BATCH_V1);
+   _reading_profile = get_profile(LUA_FUNC_ACCEPT_READING_V1);
+   _batch_profile = get_profile(LUA_FUNC_ACCEPT_READINGS_BATCH_V1);
+
+   if (!_has_reading_handler && !_has_batch_handler &&
+       _num_subscriptions == 0) {
+      LOG(FATAL) << TAG("runtime_c::load") << "Given lua script: " << file
+                 << " does not contain function to receive reading_v1 data ("
+                 << LUA_FUNC_ACCEPT_READING_V1 << " or "
+                 << LUA_FUNC_ACCEPT_READINGS_BATCH_V1
+                 << ") and did not subscribe to any readings\n";
+      return false;
+   }
+
+   if (_has_batch_handler) {
+
+      // Build the batch table once, it is refilled for every call
+      lua_createtable(_state, 0, 5);
+      for (auto column : {"timestamp", "node_id", "sensor_id", "value"}) {
+         lua_createtable(_state, BATCH_PREALLOCATION, 0);
+         lua_setfield(_state, -2, column);
+      }
+      lua_pushinteger(_state, 0);
+      lua_setfield(_state, -2, "count");
+      _batch_ref = luaL_ref(_state, LUA_REGISTRYINDEX);
+   }
+   return true;
+}
+
+bool runtime_c::subscribe(const std::string &node_id,
+                          const std::string &sensor_id, int handler_ref) {
+
+   if (!_loading) {
+      LOG(ERROR) << TAG("runtime_c::subscribe")
+                 << "Subscriptions can only be made while the script loads\n";
+      return false;
+   }
+
+   if (node_id.empty() || sensor_id.empty()) {
+      LOG(ERROR) << TAG("runtime_c::subscribe")
+                 << "Node and sensor ids can not be empty\n";
+      return false;
+   }
+
+   _subscriptions[node_id][sensor_id].push_back(
+       {handler_ref, get_profile("subscribe:" + node_id + "/" + sensor_id)});
+   _num_subscriptions++;
+   return true;
+}
+
+bool runtime_c::migrate_from(runtime_c &previous) {
+
+   if (!has_function(_state, LUA_FUNC_MIGRATE_STATE)) {
+      return true;
+   }
+
+   lua_getglobal(_state, LUA_FUNC_MIGRATE_STATE);
+
+   // Pull the state out of the previous script, if it offers any
+   bool okay{true};
+   lua_State *from = previous._state;
+   if (has_function(from, LUA_FUNC_EXPORT_STATE)) {
+      lua_getglobal(from, LUA_FUNC_EXPORT_STATE);
+      okay = check_lua(from, lua_pcall(from, 0, 1, 0));
+      if (!okay) {
+         lua_pushnil(from);
+      }
+   } else {
+      lua_pushnil(from);
+   }
+
+   // Whatever can be copied is still handed over, but losing any part of
+   // the state counts as a failed migration
+   size_t left_behind{0};
+   lua_newtable(_state);
+   int memo = lua_gettop(_state);
+   if (!copy_value(from, -1, _state, memo, 0, left_behind)) {
+      lua_pushnil(_state);
+   }
+   lua_remove(_state, memo);
+   lua_pop(from, 1);
+
+   if (left_behind) {
+      LOG(WARNING) << TAG("runtime_c::migrate_from") << left_behind
+                   << " exported value(s) could not be migrated\n";
+   }
+
+   // Stack is now [migrate_state, old]
+   return check_lua(_state, lua_pcall(_state, 1, 0, 0)) && okay &&
+          left_behind == 0;
+}
+
+uint64_t runtime_c::schedule(uint64_t delay_ms, uint64_t interval_ms,
+                             int handler_ref) {
+   _timer_profiles[handler_ref] =
+       get_profile("timer:" + describe_function(handler_ref));
+   return _timers.schedule(steady_ms(), delay_ms, interval_ms, handler_ref);
+}
+
+bool runtime_c::cancel(uint64_t id) {
+   auto handler_ref = _timers.cancel(id);
+   if (!handler_ref.has_value()) {
+      return false;
+   }
+   luaL_unref(_state, LUA_REGISTRYINDEX, *handler_ref);
+   _timer_profiles.erase(*handler_ref);
+   return true;
+}
+
+bool runtime_c::run_timers() {
+
+   _expired_timers.clear();
+   _timers.advance(steady_ms(), _expired_timers);
+
+   bool okay{true};
+   for (auto &timer : _expired_timers) {
+
+      // A repeating timer can come due more than once in a single advance,
+      // one of its earlier calls may have cancelled it since
+      if (timer.repeating && !_timers.pending(timer.id)) {
+         continue;
+      }
+
+      lua_rawgeti(_state, LUA_REGISTRYINDEX, timer.handler);
+      lua_pushinteger(_state, timer.id);
+      okay = invoke(1, _timer_profiles[timer.handler]) && okay;
+
+      if (!timer.repeating) {
+         luaL_unref(_state, LUA_REGISTRYINDEX, timer.handler);
+         _timer_profiles.erase(timer.handler);
+      }
+   }
+   return okay;
+}
+
+std::optional<std::chrono::steady_clock::time_point>
+runtime_c::next_timer() const {
+   auto expiry = _timers.next_expiry_ms();
+   if (!expiry.has_value()) {
+      return {};
+   }
+   return std::chrono::steady_clock::time_point(
+       std::chrono::milliseconds(*expiry));
+}
+
+bool runtime_c::accept_reading(crate::metrics::sensor_reading_v1_c &reading) {
+
+   bool okay = dispatch_to_subscribers(reading);
+
+   if (_has_reading_handler) {
+      okay = accept_single(reading) && okay;
+   } else if (_has_batch_handler) {
+      std::vector<crate::metrics::sensor_reading_v1_c> readings{reading};
+      okay = accept_batch(readings) && okay;
+   }
+   return okay;
+}
+
+bool runtime_c::accept_readings(
+    std::vector<crate::metrics::sensor_reading_v1_c> &readings) {
+
+   if (readings.empty()) {
+      return true;
+   }
+
+   bool okay{true};
+   for (auto &reading : readings) {
+      okay = dispatch_to_subscribers(reading) && okay;
+   }
+
+   if (_has_batch_handler) {
+      return accept_batch(readings) && okay;
+   }
+
+   if (_has_reading_handler) {
+      for (auto &reading : readings) {
+         okay = accept_single(reading) && okay;
+      }
+   }
+   return okay;
+}
+
+bool runtime_c::dispatch_to_subscribers(
+    crate::metrics::sensor_reading_v1_c &reading) {
+
+   if (_num_subscriptions == 0) {
+      return true;
+   }
+
+   auto [timestamp, node_id, sensor_id, value] = reading.get_data();
+
+   // Check the exact node and the wildcard node, and within each of those
+   // the exact sensor and the wildcard sensor. An id that is itself "*"
+   // only has the one key, looking it up twice would call its handlers twice
+   const std::string *node_keys[] = {&node_id, &WILDCARD_ID};
+   const std::string *sensor_keys[] = {&sensor_id, &WILDCARD_ID};
+   size_t num_node_keys = node_id == WILDCARD_ID ? 1 : 2;
+   size_t num_sensor_keys = sensor_id == WILDCARD_ID ? 1 : 2;
+
+   bool okay{true};
+   for (size_t n = 0; n < num_node_keys; n++) {
+      auto node = _subscriptions.find(*node_keys[n]);
+      if (node == _subscriptions.end()) {
+         continue;
+      }
+      for (size_t s = 0; s < num_sensor_keys; s++) {
+         auto handlers = node->second.find(*sensor_keys[s]);
+         if (handlers != node->second.end()) {
+            okay = call_handlers(handlers->second, timestamp, node_id,
+                                 sensor_id, value) &&
+                   okay;
+         }
+      }
+   }
+   return okay;
+}
+
+bool runtime_c::call_handlers(const std::vector<handler_s> &handlers,
+                              uint64_t timestamp, const std::string &node_id,
+                              const std::string &sensor_id, double value) {
+   bool okay{true};
+   for (auto &handler : handlers) {
+      lua_rawgeti(_state, LUA_REGISTRYINDEX, handler.ref);
+      lua_pushnumber(_state, timestamp);
+      lua_pushlstring(_state, node_id.data(), node_id.size());
+      lua_pushlstring(_state, sensor_id.data(), sensor_id.size());
+      lua_pushnumber(_state, value);
+      okay = invoke(4, handler.profile) && okay;
+   }
+   return okay;
+}
+
+bool runtime_c::accept_single(crate::metrics::sensor_reading_v1_c &reading) {
+
+   // Retrieve the lua function we are going to call
+   lua_getglobal(_state, LUA_FUNC_ACCEPT_READING_V1);
+
+   // Double check it exists as a function
+   if (!lua_isfunction(_state, -1)) {
+      LOG(FATAL) << TAG("runtime_c::accept_single") << "Expected "
+                 << LUA_FUNC_ACCEPT_READING_V1
+                 << " to exist in given lua script as a function\n";
+      lua_pop(_state, 1);
+      return false;
+   }
+
+   // Peel the reading apart
+   auto [timestamp, node_id, sensor_id, value] = reading.get_data();
+
+   // Load data into lua
+   lua_pushnumber(_state, timestamp);
+   lua_pushstring(_state, node_id.c_str());
+   lua_pushstring(_state, sensor_id.c_str());
+   lua_pushnumber(_state, value);
+
+   // Call the function that we got for reading v1s. A script error only
+   // costs us this reading rather than the whole process
+   return invoke(4, _reading_profile);
+}
+
+bool runtime_c::accept_batch(
+    std::vector<crate::metrics::sensor_reading_v1_c> &readings) {
+
+   lua_getglobal(_state, LUA_FUNC_ACCEPT_READINGS_BATCH_V1);
+   lua_rawgeti(_state, LUA_REGISTRYINDEX, _batch_ref);
+   int batch = lua_gettop(_state);
+
+   lua_getfield(_state, batch, "timestamp");
+   lua_getfield(_state, batch, "node_id");
+   lua_getfield(_state, batch, "sensor_id");
+   lua_getfield(_state, batch, "value");
+
+   // Fill the columns in place
+   lua_Integer idx{0};
+   for (auto &reading : readings) {
+      auto [timestamp, node_id, sensor_id, value] = reading.get_data();
+      idx++;
+      lua_pushnumber(_state, timestamp);
+      lua_rawseti(_state, batch + 1, idx);
+      lua_pushlstring(_state, node_id.data(), node_id.size());
+      lua_rawseti(_state, batch + 2, idx);
+      lua_pushlstring(_state, sensor_id.data(), sensor_id.size());
+      lua_rawseti(_state, batch + 3, idx);
+      lua_pushnumber(_state, value);
+      lua_rawseti(_state, batch + 4, idx);
+   }
+
+   // Clear whatever a larger batch before this one left past the count, so
+   // the columns are proper sequences of `count` entries
+   for (auto row = idx + 1; row <= _batch_rows; row++) {
+      for (int column = batch + 1; column <= batch + 4; column++) {
+         lua_pushnil(_state);
+         lua_rawseti(_state, column, row);
+      }
+   }
+   _batch_rows = idx;
+   lua_pop(_state, 4);
+
+   lua_pushinteger(_state, idx);
+   lua_setfield(_state, batch, "count");
+
+   // Stack is now [function, batch]
+   return invoke(1, _batch_profile);
+}
+
+void runtime_c::collect_profiles(profiles_t &into) const {
+   for (auto &[name, profile] : _profiles) {
+      if (profile.calls) {
+         into[name].merge(profile);
+      }
+   }
+}
+
+runtime_c::profile_entry_t *runtime_c::get_profile(const std::string &name) {
+   return &*_profiles.try_emplace(name).first;
+}
+
+std::string runtime_c::describe_function(int ref) {
+   lua_Debug ar;
+   lua_rawgeti(_state, LUA_REGISTRYINDEX, ref);
+   if (!lua_getinfo(_state, ">S", &ar)) {
+      return "unknown";
+   }
+   return std::string(ar.short_src) + ":" + std::to_string(ar.linedefined);
+}
+
+bool runtime_c::invoke(int nargs, profile_entry_t *profile) {
+
+   _invocation_instructions = 0;
+   _over_budget = false;
+   _invocation_start = std::chrono::steady_clock::now();
+
+   _in_invocation = true;
+   int result = lua_pcall(_state, nargs, 0, 0);
+   _in_invocation = false;
+
+   auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now() - _invocation_start)
+                      .count();
+   auto &stats = profile->second;
+   stats.record(elapsed);
+   lua_call_duration_us().record(elapsed);
+   stats.sampled_instructions += _invocation_instructions;
+
+   if (result == LUA_OK) {
+      return true;
+   }
+
+   if (_over_budget) {
+      stats.over_budget++;
+      LOG(WARNING) << TAG("runtime_c::invoke") << "Aborted " << profile->first
+                   << " for exceeding its budget\n";
+      lua_pop(_state, 1);
+      return false;
+   }
+
+   stats.errors++;
+   return check_lua(_state, result);
+}
+
+// Runs every HOOK_INSTRUCTIONS VM instructions
+void runtime_c::budget_hook(lua_State *L, lua_Debug *ar) {
+
+   auto runtime = get_runtime(L);
+   if (!runtime->_in_invocation) {
+      return;
+   }
+
+   runtime->_invocation_instructions += HOOK_INSTRUCTIONS;
+
+   auto &budget = runtime->_environment->budget;
+   bool over = budget.max_instructions &&
+               runtime->_invocation_instructions > budget.max_instructions;
+
+   if (!over && budget.max_time_ms) {
+      auto elapsed = std::chrono::steady_clock::now() - runtime->_invocation_start;
+      over = elapsed > std::chrono::milliseconds(budget.max_time_ms);
+   }
+
+   if (over) {
+      runtime->_over_budget = true;
+      luaL_error(L, "rule exceeded its budget");
+   }
+}
+
+} // namespace rules
+} // namespace monolith
@@ -0,0 +1,177 @@
+#ifndef MONOLITH_RULES_RUNTIME_HPP
+#define MONOLITH_RULES_RUNTIME_HPP
+
+#include "alert/alert.hpp"
+#include "heartbeats.hpp"
+#include "rules/profile.hpp"
+#include "rules/script_cache.hpp"
+#include "rules/timer_wheel.hpp"
+#include "services/action_dispatch.hpp"
+#include <chrono>
+#include <crate/metrics/reading_v1.hpp>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct lua_State;
+struct lua_Debug;
+
+namespace monolith {
+namespace rules {
+
+//! \brief The parts of monolith that rule scripts are able to reach
+struct environment_s {
+   monolith::alert::alert_manager_c *alert_manager{nullptr};
+   monolith::services::action_dispatch_c *action_dispatcher{nullptr};
+   monolith::heartbeats_c *heartbeats{nullptr};
+   budget_s budget;
+};
+
+//! \brief A single, independent Lua state loaded with a rule script
+//! \note  A runtime must only ever be used from one thread at a time
+class runtime_c {
+ public:
+   runtime_c() = delete;
+
+   //! \brief Create the runtime
+   //! \param environment The environment exposed to the script
+   runtime_c(environment_s *environment);
+
+   //! \brief Close the Lua state
+   ~runtime_c();
+
+   //! \brief Load a compiled rule script into the runtime
+   //! \param script The script to load
+   //! \returns true iff the file was loaded and contains the required
+   //!          function(s) to interact with
+   //! \note  A script must define accept_reading_v1_from_monolith,
+   //!        accept_readings_batch_v1_from_monolith, or register at least
+   //!        one handler with monolith_subscribe while it loads
+   bool load(const compiled_script_s &script);
+
+   //! \brief Hand a reading to the script
+   //! \param reading The reading to hand over
+   //! \returns true iff the script handled the reading without error
+   //! \note  The reading is handed to every handler subscribed to its
+   //!        series and to the catch-all function(s), if any. A reading
+   //!        nothing is interested in never enters Lua
+   bool accept_reading(crate::metrics::sensor_reading_v1_c &reading);
+
+   //! \brief Hand a set of readings to the script
+   //! \param readings The readings to hand over
+   //! \returns true iff the script handled every reading without error
+   //! \note  If the script defines accept_readings_batch_v1_from_monolith
+   //!        the readings are handed over in a single call as a columnar
+   //!        table { count, timestamp, node_id, sensor_id, value }. The
+   //!        table is reused between calls, entries past count are cleared
+   //!        so each column holds exactly count entries. The script must
+   //!        not hold on to it. Otherwise each reading is handed to
+   //!        accept_reading_v1_from_monolith
+   bool accept_readings(std::vector<crate::metrics::sensor_reading_v1_c> &readings);
+
+   //! \brief Register a Lua handler for a series
+   //! \param node_id The node to match, or "*" for any node
+   //! \param sensor_id The sensor to match, or "*" for any sensor
+   //! \param handler_ref Registry reference to the Lua handler function
+   //! \returns true iff the handler was registered
+   //! \note  Handlers can only be registered while the script loads
+   bool subscribe(const std::string &node_id, const std::string &sensor_id,
+                  int handler_ref);
+
+   //! \brief Carry script state over from the runtime this one replaces
+   //! \param previous The runtime being replaced
+   //! \note  If this script defines migrate_state(old) it is called with a
+   //!        copy of whatever the previous script's export_state() returns
+   //!        (nil if it has no export_state). Tables, strings, numbers,
+   //!        booleans and windows are copied. Anything else (functions,
+   //!        timers, other userdata) is left behind and logged, the rest
+   //!        is still handed over
+   //! \returns true iff migration ran without error and nothing was left
+   //!          behind
+   bool migrate_from(runtime_c &previous);
+
+   //! \brief Schedule a Lua handler to be called later
+   //! \param delay_ms Time until the handler is called
+   //! \param interval_ms If non-zero the handler is called repeatedly at
+   //!        this interval
+   //! \param handler_ref Registry reference to the Lua handler function
+   //! \returns The id of the timer
+   uint64_t schedule(uint64_t delay_ms, uint64_t interval_ms, int handler_ref);
+
+   //! \brief Cancel a scheduled handler
+   //! \param id The id of the timer
+   //! \returns true iff the timer was pending
+   bool cancel(uint64_t id);
+
+   //! \brief Call the handlers of every timer that has come due
+   //! \returns true iff every handler ran without error
+   bool run_timers();
+
+   //! \brief Retrieve when the next timer is due, if any are pending
+   std::optional<std::chrono::steady_clock::time_point> next_timer() const;
+
+   //! \brief Add this runtime's handler profiles to a set of profiles
+   //! \param into The profiles to add to
+   void collect_profiles(profiles_t &into) const;
+
+   //! \brief Retrieve the environment the runtime was created with
+   environment_s *get_environment() { return _environment; }
+
+ private:
+   static constexpr int BATCH_PREALLOCATION = 128;
+
+   // How often (in VM instructions) the budget is checked and the
+   // instruction count of the running handler is sampled
+   static constexpr int HOOK_INSTRUCTIONS = 1000;
+
+   using profile_entry_t = profiles_t::value_type;
+
+   struct handler_s {
+      int ref;
+      profile_entry_t *profile;
+   };
+
+   // node id -> sensor id -> handlers
+   using handler_map_t = std::unordered_map<
+       std::string, std::unordered_map<std::string, std::vector<handler_s>>>;
+
+   lua_State *_state{nullptr};
+   environment_s *_environment{nullptr};
+   bool _has_reading_handler{false};
+   bool _has_batch_handler{false};
+   int _batch_ref{0};
+   int64_t _batch_rows{0}; // Rows filled by the last batch
+   bool _loading{false};
+   timer_wheel_c _timers;
+   std::vector<timer_wheel_c::expired_s> _expired_timers;
+   handler_map_t _subscriptions;
+   size_t _num_subscriptions{0};
+
+   profiles_t _profiles;
+   profile_entry_t *_reading_profile{nullptr};
+   profile_entry_t *_batch_profile{nullptr};
+   std::unordered_map<int, profile_entry_t *> _timer_profiles;
+
+   bool _in_invocation{false};
+   bool _over_budget{false};
+   uint64_t _invocation_instructions{0};
+   std::chrono::steady_clock::time_point _invocation_start;
+
+   static void budget_hook(lua_State *L, lua_Debug *ar);
+   profile_entry_t *get_profile(const std::string &name);
+   std::string describe_function(int ref);
+   bool invoke(int nargs, profile_entry_t *profile);
+   bool accept_batch(std::vector<crate::metrics::sensor_reading_v1_c> &readings);
+   bool accept_single(crate::metrics::sensor_reading_v1_c &reading);
+   bool call_handlers(const std::vector<handler_s> &handlers,
+                      uint64_t timestamp,
+                      const std::string &node_id,
+                      const std::string &sensor_id, double value);
+   bool dispatch_to_subscribers(crate::metrics::sensor_reading_v1_c &reading);
+};
+
+} // namespace rules
+} // namespace monolith
+
+#endif
@@ -0,0 +1,118 @@
+#include "script_cache.hpp"
+#include <crate/externals/aixlog/logger.hpp>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+
+extern "C" {
+#include <lua5.3/lauxlib.h>
+#include <lua5.3/lua.h>
+} // extern "C"
+
+namespace monolith {
+namespace rules {
+
+namespace {
+
+// FNV-1a, the source and its name are both hashed so the same source
+// under two names keeps its own chunk name
+uint64_t hash_script(const std::string &name, const std::string &source) {
+   uint64_t hash = 0xcbf29ce484222325;
+   for (auto &part : {name, source}) {
+      for (unsigned char c : part) {
+         hash ^= c;
+         hash *= 0x100000001b3;
+      }
+      hash ^= 0xff;
+      hash *= 0x100000001b3;
+   }
+   return hash;
+}
+
+// What luaL_loadfilex skips before handing a file to the parser: a UTF-8
+// byte order mark, then a first line starting with `#`. The newline ending
+// that line is kept so line numbers still match the file
+std::string_view skip_preamble(std::string_view source) {
+   static constexpr std::string_view BOM = "\xEF\xBB\xBF";
+   if (source.starts_with(BOM)) {
+      source.remove_prefix(BOM.size());
+   }
+   if (source.starts_with('#')) {
+      auto newline = source.find('\n');
+      source.remove_prefix(newline == std::string_view::npos ? source.size()
+                                                             : newline);
+   }
+   return source;
+}
+
+int bytecode_writer(lua_State *L, const void *data, size_t size, void *ud) {
+   static_cast<std::string *>(ud)->append(static_cast<const char *>(data),
+                                          size);
+   return 0;
+}
+
+} // namespace
+
+std::shared_ptr<const compiled_script_s>
+script_cache_c::compile(const std::string &file) {
+
+   std::ifstream in(file, std::ios::binary);
+   if (!in.is_open()) {
+      LOG(ERROR) << TAG("script_cache_c::compile")
+                 << "Unable to open script: " << file << "\n";
+      return nullptr;
+   }
+   std::stringstream source;
+   source << in.rdbuf();
+
+   auto compiled = std::make_shared<compiled_script_s>();
+   compiled->name = "@" + file;
+
+   auto source_text = source.str();
+   auto key = hash_script(compiled->name, source_text);
+   {
+      const std::lock_guard<std::mutex> lock(_mutex);
+      auto entry = _entries.find(key);
+      if (entry != _entries.end() && entry->second.name == compiled->name &&
+          entry->second.source == source_text) {
+         LOG(DEBUG) << TAG("script_cache_c::compile")
+                    << "Using cached bytecode for " << file << "\n";
+         return entry->second.script;
+      }
+   }
+
+   // Parse into a throwaway state and dump the function it produced. Debug
+   // information is kept so errors still carry line numbers
+   lua_State *L = luaL_newstate();
+   auto chunk = skip_preamble(source_text);
+   if (luaL_loadbuffer(L, chunk.data(), chunk.size(),
+                       compiled->name.c_str()) != LUA_OK) {
+      LOG(ERROR) << TAG("script_cache_c::compile")
+                 << "Error: " << lua_tostring(L, -1) << "\n";
+      lua_close(L);
+      return nullptr;
+   }
+   lua_dump(L, bytecode_writer, &compiled->bytecode, 0);
+   lua_close(L);
+
+   // A colliding entry is replaced, it keeps its place in the order
+   const std::lock_guard<std::mutex> lock(_mutex);
+   auto [entry, inserted] = _entries.insert_or_assign(
+       key, entry_s{compiled->name, std::move(source_text), compiled});
+   if (inserted) {
+      _insertion_order.push_back(key);
+   }
+   while (_insertion_order.size() > MAX_ENTRIES) {
+      _entries.erase(_insertion_order.front());
+      _insertion_order.pop_front();
+   }
+   return compiled;
+}
+
+size_t script_cache_c::size() {
+   const std::lock_guard<std::mutex> lock(_mutex);
+   return _entries.size();
+}
+
+} // namespace rules
+} // namespace monolith
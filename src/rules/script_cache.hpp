@@ -0,0 +1,55 @@
+#ifndef MONOLITH_RULES_SCRIPT_CACHE_HPP
+#define MONOLITH_RULES_SCRIPT_CACHE_HPP
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace monolith {
+namespace rules {
+
+//! \brief Compiled rule script
+struct compiled_script_s {
+   std::string name;     //! Chunk name used in Lua error messages
+   std::string bytecode; //! Output of lua_dump
+};
+
+//! \brief Cache of compiled rule scripts keyed by a hash of their source
+//! \note  A script is parsed once and the resulting bytecode is loaded into
+//!        every runtime, reloading an unchanged script skips parsing
+//!        entirely. Entries keep the source they were compiled from so a
+//!        hash collision is never mistaken for a hit. Like luaL_loadfile, a
+//!        leading byte order mark and `#` line (e.g. a shebang) are skipped.
+//!        Safe to use from multiple threads
+class script_cache_c {
+ public:
+   //! \brief Compile a script, or retrieve it from the cache
+   //! \param file The Lua file to compile
+   //! \returns The compiled script, nullptr if the file could not be read
+   //!          or failed to compile
+   std::shared_ptr<const compiled_script_s> compile(const std::string &file);
+
+   //! \brief Retrieve the number of scripts held
+   size_t size();
+
+ private:
+   static constexpr size_t MAX_ENTRIES = 4;
+
+   struct entry_s {
+      std::string name;
+      std::string source;
+      std::shared_ptr<const compiled_script_s> script;
+   };
+
+   std::mutex _mutex;
+   std::unordered_map<uint64_t, entry_s> _entries;
+   std::deque<uint64_t> _insertion_order;
+};
+
+} // namespace rules
+} // namespace monolith
+
+#endif
@@ -0,0 +1,161 @@
+#include "timer_wheel.hpp"
+#include <algorithm>
+
+namespace monolith {
+namespace rules {
+
+timer_wheel_c::timer_wheel_c(uint64_t now_ms, uint64_t tick_ms)
+    : _tick_ms(std::max<uint64_t>(tick_ms, 1)) {
+   _now_tick = to_tick(now_ms);
+}
+
+uint64_t timer_wheel_c::schedule(uint64_t now_ms, uint64_t delay_ms,
+                                 uint64_t interval_ms, int handler) {
+
+   // Bring the wheel up to date first so the delay is measured from now
+   // rather than from the last time the wheel was advanced
+   if (to_tick(now_ms) > _now_tick && _timers.empty()) {
+      _now_tick = to_tick(now_ms);
+   }
+
+   // Always fire at least one tick out so a timer never fires within the
+   // call that scheduled it
+   uint64_t delay_ticks = std::max<uint64_t>(to_ticks_ceil(delay_ms), 1);
+   uint64_t interval_ticks = 0;
+   if (interval_ms) {
+      interval_ticks = std::max<uint64_t>(to_ticks_ceil(interval_ms), 1);
+   }
+
+   uint64_t id = _next_id++;
+   uint64_t expiry_tick = std::max(to_tick(now_ms), _now_tick) + delay_ticks;
+   _timers[id] = {expiry_tick, interval_ticks, handler};
+   place(id, expiry_tick);
+   return id;
+}
+
+std::optional<int> timer_wheel_c::cancel(uint64_t id) {
+
+   auto timer = _timers.find(id);
+   if (timer == _timers.end()) {
+      return {};
+   }
+
+   int handler = timer->second.handler;
+   _timers.erase(timer);
+   return handler;
+}
+
+void timer_wheel_c::advance(uint64_t now_ms, std::vector<expired_s> &expired) {
+
+   uint64_t target = to_tick(now_ms);
+
+   while (_now_tick < target) {
+
+      // Nothing pending, no reason to walk the slots
+      if (_timers.empty()) {
+         _now_tick = target;
+         break;
+      }
+
+      _now_tick++;
+
+      // Pull timers down from the higher levels as their slots come around,
+      // highest first so they can land in a lower slot handled this tick
+      uint64_t top = 0;
+      while (top + 1 < LEVELS &&
+             !(_now_tick & ((1ull << (SLOT_BITS * (top + 1))) - 1))) {
+         top++;
+      }
+      for (uint64_t level = top; level > 0; level--) {
+         cascade(level);
+      }
+
+      auto &slot = _wheels[0][_now_tick & SLOT_MASK];
+      if (slot.empty()) {
+         continue;
+      }
+
+      std::vector<uint64_t> ids;
+      ids.swap(slot);
+
+      // Ids are handed out in increasing order so sorting keeps timers
+      // that expire on the same tick in the order they were scheduled
+      std::sort(ids.begin(), ids.end());
+
+      for (auto id : ids) {
+         auto timer = _timers.find(id);
+         if (timer == _timers.end()) {
+            continue;
+         }
+
+         // Timers beyond the span of the wheel were clamped when placed
+         if (timer->second.expiry_tick > _now_tick) {
+            place(id, timer->second.expiry_tick);
+            continue;
+         }
+
+         bool repeating = timer->second.interval_ticks > 0;
+         expired.push_back({id, timer->second.handler, repeating});
+
+         if (repeating) {
+            timer->second.expiry_tick =
+                _now_tick + timer->second.interval_ticks;
+            place(id, timer->second.expiry_tick);
+         } else {
+            _timers.erase(timer);
+         }
+      }
+   }
+}
+
+std::optional<uint64_t> timer_wheel_c::next_expiry_ms() const {
+
+   if (_timers.empty()) {
+      return {};
+   }
+
+   uint64_t earliest = UINT64_MAX;
+   for (auto &[id, timer] : _timers) {
+      earliest = std::min(earliest, timer.expiry_tick);
+   }
+   return earliest * _tick_ms;
+}
+
+void timer_wheel_c::place(uint64_t id, uint64_t expiry_tick) {
+
+   uint64_t delta = (expiry_tick > _now_tick) ? expiry_tick - _now_tick : 0;
+
+   // Find the lowest level that spans the delay, anything further out
+   // than the whole wheel sits in the top level and is re-placed when
+   // its slot comes around
+   uint64_t level = 0;
+   while (level < LEVELS - 1 &&
+          delta >= (1ull << (SLOT_BITS * (level + 1)))) {
+      level++;
+   }
+
+   uint64_t span = 1ull << (SLOT_BITS * LEVELS);
+   uint64_t tick = (delta >= span) ? _now_tick + span - 1 : _now_tick + delta;
+   _wheels[level][(tick >> (SLOT_BITS * level)) & SLOT_MASK].push_back(id);
+}
+
+void timer_wheel_c::cascade(uint64_t level) {
+
+   auto &slot = _wheels[level][(_now_tick >> (SLOT_BITS * level)) & SLOT_MASK];
+   if (slot.empty()) {
+      return;
+   }
+
+   std::vector<uint64_t> ids;
+   ids.swap(slot);
+
+   for (auto id : ids) {
+      auto timer = _timers.find(id);
+      if (timer != _timers.end()) {
+         place(id, timer->second.expiry_tick);
+      }
+   }
+}
+
+} // namespace rules
+} // namespace monolith
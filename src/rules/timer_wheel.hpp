@@ -0,0 +1,97 @@
+#ifndef MONOLITH_RULES_TIMER_WHEEL_HPP
+#define MONOLITH_RULES_TIMER_WHEEL_HPP
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace monolith {
+namespace rules {
+
+//! \brief A hierarchical timing wheel
+//! \note  Timers are kept in LEVELS wheels of SLOTS slots each, every level
+//!        covering SLOTS times the span of the one below it. Scheduling and
+//!        cancelling are O(1) and timers are cascaded down a level as their
+//!        slot comes around. Time is supplied by the caller in milliseconds
+//!        and is resolved to `tick_ms`. The wheel is not thread safe
+class timer_wheel_c {
+ public:
+   //! \brief A timer that has come due
+   struct expired_s {
+      uint64_t id;
+      int handler;
+      bool repeating;
+   };
+
+   timer_wheel_c() = delete;
+
+   //! \brief Create the wheel
+   //! \param now_ms The current time
+   //! \param tick_ms The resolution of the wheel (minimum 1)
+   timer_wheel_c(uint64_t now_ms, uint64_t tick_ms = 10);
+
+   //! \brief Schedule a timer
+   //! \param now_ms The current time
+   //! \param delay_ms How long until the timer fires
+   //! \param interval_ms If non-zero the timer repeats at this interval
+   //! \param handler Caller data handed back when the timer fires
+   //! \returns The id of the timer
+   uint64_t schedule(uint64_t now_ms, uint64_t delay_ms, uint64_t interval_ms,
+                     int handler);
+
+   //! \brief Cancel a timer
+   //! \param id The id of the timer to cancel
+   //! \returns The handler of the timer iff it was pending
+   std::optional<int> cancel(uint64_t id);
+
+   //! \brief Move the wheel forward, collecting every timer that came due
+   //! \param now_ms The current time
+   //! \param expired Populated with due timers in the order they expired
+   //! \post  Repeating timers are rescheduled before being handed back
+   void advance(uint64_t now_ms, std::vector<expired_s> &expired);
+
+   //! \brief Check if a timer is still pending
+   bool pending(uint64_t id) const { return _timers.contains(id); }
+
+   //! \brief Retrieve the number of pending timers
+   size_t size() const { return _timers.size(); }
+
+   //! \brief Retrieve the earliest time any pending timer is due
+   //! \note  Scans the pending timers, meant to be called once per wakeup
+   std::optional<uint64_t> next_expiry_ms() const;
+
+ private:
+   static constexpr uint64_t LEVELS = 4;
+   static constexpr uint64_t SLOT_BITS = 6;
+   static constexpr uint64_t SLOTS = 1 << SLOT_BITS;
+   static constexpr uint64_t SLOT_MASK = SLOTS - 1;
+
+   struct timer_s {
+      uint64_t expiry_tick;
+      uint64_t interval_ticks;
+      int handler;
+   };
+
+   uint64_t _tick_ms{10};
+   uint64_t _now_tick{0};
+   uint64_t _next_id{1};
+   std::unordered_map<uint64_t, timer_s> _timers;
+
+   // Slots hold timer ids, ids whose timer has been cancelled are
+   // skipped when their slot is processed
+   std::array<std::array<std::vector<uint64_t>, SLOTS>, LEVELS> _wheels;
+
+   uint64_t to_tick(uint64_t ms) const { return ms / _tick_ms; }
+   uint64_t to_ticks_ceil(uint64_t ms) const {
+      return (ms + _tick_ms - 1) / _tick_ms;
+   }
+   void place(uint64_t id, uint64_t expiry_tick);
+   void cascade(uint64_t level);
+};
+
+} // namespace rules
+} // namespace monolith
+
+#endif
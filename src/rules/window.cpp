@@ -0,0 +1,141 @@
+#include "window.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace monolith {
+namespace rules {
+
+window_c::window_c(kind_e kind, size_t capacity, double ewma_alpha)
+    : _kind(kind), _alpha(ewma_alpha), _ring(std::max<size_t>(capacity, 1)) {
+
+   if (!(_alpha > 0.0 && _alpha <= 1.0)) {
+      _alpha = 0.1;
+   }
+}
+
+bool window_c::push(double timestamp, double value) {
+
+   // A completed tumbling window is kept around for one push so its
+   // aggregates can be read, the next sample starts a fresh window
+   if (_completed) {
+      clear_samples();
+   }
+
+   if (full()) {
+      // Sliding, the oldest sample is overwritten
+      auto &old = _ring[_head];
+      _sum -= old.value;
+      _sum_sq -= old.value * old.value;
+   } else {
+      _count++;
+   }
+
+   _ring[_head] = {timestamp, value};
+   _sum += value;
+   _sum_sq += value * value;
+   _head = (_head + 1) % _ring.size();
+
+   // Running sums drift as values are added and removed. Rebuild them
+   // from the ring every time it wraps so the error stays bounded
+   if (_head == 0 && _kind == kind_e::SLIDING) {
+      recompute_sums();
+   }
+
+   if (_has_ewma) {
+      _ewma += _alpha * (value - _ewma);
+   } else {
+      _ewma = value;
+      _has_ewma = true;
+   }
+
+   if (_kind == kind_e::TUMBLING && full()) {
+      _completed = true;
+   }
+   return _completed;
+}
+
+void window_c::reset() {
+   clear_samples();
+   _ewma = 0.0;
+   _has_ewma = false;
+}
+
+double window_c::mean() const {
+   if (_count == 0) {
+      return 0.0;
+   }
+   return _sum / _count;
+}
+
+double window_c::min() const {
+   if (_count == 0) {
+      return 0.0;
+   }
+   double result = newest().value;
+   for (size_t i = 0; i < _count; i++) {
+      result = std::min(result, _ring[i].value);
+   }
+   return result;
+}
+
+double window_c::max() const {
+   if (_count == 0) {
+      return 0.0;
+   }
+   double result = newest().value;
+   for (size_t i = 0; i < _count; i++) {
+      result = std::max(result, _ring[i].value);
+   }
+   return result;
+}
+
+double window_c::stddev() const {
+   if (_count == 0) {
+      return 0.0;
+   }
+   double m = mean();
+   double variance = (_sum_sq / _count) - (m * m);
+   return (variance > 0.0) ? std::sqrt(variance) : 0.0;
+}
+
+double window_c::rate() const {
+   if (_count < 2) {
+      return 0.0;
+   }
+   auto &first = oldest();
+   auto &last = newest();
+   double elapsed = last.timestamp - first.timestamp;
+   if (elapsed == 0.0) {
+      return 0.0;
+   }
+   return (last.value - first.value) / elapsed;
+}
+
+const window_c::sample_s &window_c::oldest() const {
+   // Until the ring is full the samples start at the front
+   return full() ? _ring[_head] : _ring[0];
+}
+
+const window_c::sample_s &window_c::newest() const {
+   return _ring[(_head + _ring.size() - 1) % _ring.size()];
+}
+
+void window_c::clear_samples() {
+   _head = 0;
+   _count = 0;
+   _sum = 0.0;
+   _sum_sq = 0.0;
+   _completed = false;
+}
+
+void window_c::recompute_sums() {
+   _sum = 0.0;
+   _sum_sq = 0.0;
+   for (size_t i = 0; i < _count; i++) {
+      _sum += _ring[i].value;
+      _sum_sq += _ring[i].value * _ring[i].value;
+   }
+}
+
+} // namespace rules
+} // namespace monolith
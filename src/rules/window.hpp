@@ -0,0 +1,99 @@
+#ifndef MONOLITH_RULES_WINDOW_HPP
+#define MONOLITH_RULES_WINDOW_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace monolith {
+namespace rules {
+
+//! \brief A fixed size window of samples with running aggregates
+//! \note  All storage is allocated when the window is created, pushing a
+//!        sample never allocates. The window is not thread safe
+class window_c {
+ public:
+   //! \brief How the window moves as samples are pushed
+   enum class kind_e {
+      SLIDING, //! Always holds the most recent `capacity` samples
+      TUMBLING //! Fills up to `capacity` samples then starts over
+   };
+
+   //! \brief Largest capacity scripts may ask for. All of a window's
+   //!        storage is allocated up front (16 bytes a sample), so this
+   //!        bounds what a single monolith_window call can allocate
+   static constexpr size_t MAX_CAPACITY = 1'000'000;
+
+   window_c() = delete;
+
+   //! \brief Create the window
+   //! \param kind The kind of window
+   //! \param capacity The number of samples the window holds (minimum 1)
+   //! \param ewma_alpha Smoothing factor for the EWMA, within (0, 1]
+   window_c(kind_e kind, size_t capacity, double ewma_alpha = 0.1);
+
+   //! \brief Push a sample into the window
+   //! \param timestamp Time of the sample
+   //! \param value Value of the sample
+   //! \returns true iff the sample completed a tumbling window. The
+   //!          aggregates then describe that complete window until the
+   //!          next sample is pushed, which starts a new one
+   bool push(double timestamp, double value);
+
+   //! \brief Drop every sample and reset the EWMA
+   void reset();
+
+   //! \brief Retrieve the number of samples in the window
+   size_t count() const { return _count; }
+
+   //! \brief Retrieve the number of samples the window holds when full
+   size_t capacity() const { return _ring.size(); }
+
+   //! \brief Check if the window is holding `capacity` samples
+   bool full() const { return _count == _ring.size(); }
+
+   //! \brief Aggregates over the samples in the window
+   //! \note  All return 0 when the window is empty
+   double mean() const;
+   double min() const;
+   double max() const;
+   double stddev() const;
+
+   //! \brief Change in value per unit of time between the oldest and
+   //!        newest sample in the window
+   //! \note  Returns 0 if there are less than two samples or no time
+   //!        has passed between them
+   double rate() const;
+
+   //! \brief Exponentially weighted moving average of every sample pushed
+   //!        since creation / the last reset
+   //! \note  Not bounded by the window
+   double ewma() const { return _ewma; }
+
+ private:
+   struct sample_s {
+      double timestamp;
+      double value;
+   };
+
+   kind_e _kind;
+   double _alpha;
+   std::vector<sample_s> _ring;
+   size_t _head{0};
+   size_t _count{0};
+   bool _completed{false};
+   double _sum{0.0};
+   double _sum_sq{0.0};
+   double _ewma{0.0};
+   bool _has_ewma{false};
+
+   const sample_s &oldest() const;
+   const sample_s &newest() const;
+   void clear_samples();
+   void recompute_sums();
+};
+
+} // namespace rules
+} // namespace monolith
+
+#endif
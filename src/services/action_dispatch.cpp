@@ -1,11 +1,12 @@
 #include "action_dispatch.hpp"
+#include "stats/registry.hpp"
+#include <algorithm>
 #include <crate/externals/aixlog/logger.hpp>
-#include <crate/networking/message_writer.hpp>
+#include <iomanip>
+#include <sstream>
 #include <crate/registrar/controller_v1.hpp>
 #include <vector>
 
-using namespace std::chrono_literals;
-
 namespace monolith {
 namespace services {
 
@@ -19,14 +20,59 @@ uint64_t stamp() {
 
 } // namespace
 
-action_dispatch_c::action_dispatch_c(monolith::db::kv_c *registrar_db)
-    : _registrar_db(registrar_db) {}
+action_dispatch_c::action_dispatch_c(monolith::db::kv_c *registrar_db,
+                                     configuration_c config)
+    : _config(config), _registrar_db(registrar_db) {
+
+   if (_config.workers == 0) {
+      _config.workers = 1;
+   }
+
+   if (_config.max_attempts == 0) {
+      _config.max_attempts = 1;
+   }
+
+   if (_config.max_queued == 0) {
+      _config.max_queued = 1;
+   }
+
+   if (rate_limited() && _config.rate_limit_burst == 0) {
+      _config.rate_limit_burst =
+          std::max<uint32_t>(1, static_cast<uint32_t>(_config.rate_limit_per_sec));
+   }
+
+   _stat_queue_depth = &monolith::stats::queue_depth("action_dispatch");
+   _stat_burst_size = &monolith::stats::burst_size("action_dispatch");
+   _stat_burst_duration =
+       &monolith::stats::burst_duration_us("action_dispatch");
+
+   _registrar_listener_id = _registrar_db->add_write_listener(
+       [this](const std::string &key) { invalidate_controller(key); });
+}
+
+action_dispatch_c::~action_dispatch_c() {
+
+   stop();
+
+   _registrar_db->remove_write_listener(_registrar_listener_id);
+
+   for (auto &[id, controller] : _controllers) {
+      delete controller.writer;
+      controller.writer = nullptr;
+   }
+}
 
 bool action_dispatch_c::start() {
 
+   if (p_running.load()) {
+      return true;
+   }
+
    p_running.store(true);
 
-   p_thread = std::thread(&action_dispatch_c::run, this);
+   for (uint32_t i = 0; i < _config.workers; i++) {
+      _workers.emplace_back(&action_dispatch_c::run, this);
+   }
 
    return true;
 }
@@ -34,130 +80,543 @@ bool action_dispatch_c::start() {
 bool action_dispatch_c::stop() {
 
    p_running.store(false);
+   _controllers_cv.notify_all();
 
-   if (p_thread.joinable()) {
-      p_thread.join();
+   for (auto &worker : _workers) {
+      if (worker.joinable()) {
+         worker.join();
+      }
    }
+   _workers.clear();
 
    return true;
 }
 
 void action_dispatch_c::run() {
+
    while (p_running.load()) {
-      std::this_thread::sleep_for(10ms);
-      burst();
+
+      std::string controller_id;
+      {
+         std::unique_lock<std::mutex> lock(_controllers_mutex);
+         auto wake = steady_clock_t::now() + MAX_IDLE_WAIT;
+         controller_id = claim(wake);
+         if (controller_id.empty()) {
+            _controllers_cv.wait_until(lock, wake);
+            continue;
+         }
+      }
+
+      burst(controller_id);
    }
 }
 
-void action_dispatch_c::burst() {
+bool action_dispatch_c::rate_limited() const {
+   return _config.rate_limit_per_sec > 0.0;
+}
 
-   {
-      const std::lock_guard<std::mutex> lock(_action_queue_mutex);
-      if (_action_queue.empty()) {
-         return;
+// Must be called with _controllers_mutex held
+void action_dispatch_c::refill(controller_s &controller,
+                               steady_clock_t::time_point now) {
+
+   if (!rate_limited()) {
+      return;
+   }
+
+   // A controller starts out with a full bucket
+   if (controller.refilled_at == steady_clock_t::time_point()) {
+      controller.tokens = _config.rate_limit_burst;
+   } else {
+      std::chrono::duration<double> elapsed = now - controller.refilled_at;
+      controller.tokens =
+          std::min<double>(_config.rate_limit_burst,
+                           controller.tokens +
+                               elapsed.count() * _config.rate_limit_per_sec);
+   }
+   controller.refilled_at = now;
+}
+
+// Must be called with _controllers_mutex held. Returns when the controller
+// will next have an action it is allowed to send, or nothing if its queue is
+// empty, and sets `ready_lane` to the highest lane holding an action that is
+// out of its coalescing window. Expects the controller's bucket to have just
+// been refilled
+std::optional<action_dispatch_c::steady_clock_t::time_point>
+action_dispatch_c::next_ready(controller_s &controller,
+                              steady_clock_t::time_point now,
+                              size_t &ready_lane) {
+
+   if (!controller.queued) {
+      return std::nullopt;
+   }
+
+   auto ready = steady_clock_t::time_point::max();
+   for (size_t lane = NUM_PRIORITIES; lane-- > 0 && ready > now;) {
+      for (auto &pending : controller.lanes[lane]) {
+         if (pending.ready_at <= now) {
+            ready = now;
+            ready_lane = lane;
+            break;
+         }
+         ready = std::min(ready, pending.ready_at);
       }
    }
 
-   LOG(TRACE) << TAG("action_dispatch_c::burst") << "Starting dispatch\n";
+   ready = std::max(ready, controller.retry_at);
+
+   if (rate_limited() && controller.tokens < 1.0) {
+      std::chrono::duration<double> wait(
+          (1.0 - controller.tokens) / _config.rate_limit_per_sec);
+      ready = std::max(
+          ready,
+          now + std::chrono::duration_cast<steady_clock_t::duration>(wait));
+   }
+   return ready;
+}
+
+// Must be called with _controllers_mutex held. Claims the controller with
+// the highest priority action ready to send, or returns an empty id and
+// brings `wake` forward to the earliest time a controller will have
+// something to send.
+//
+// Map order only changes when the map rehashes, so a lane's turn is kept by
+// taking the first ready controller found after the one that lane was last
+// claimed for, wrapping around to the first one found before it
+std::string action_dispatch_c::claim(steady_clock_t::time_point &wake) {
+
+   auto now = steady_clock_t::now();
+   controller_s *best{nullptr};
+   const std::string *best_id{nullptr};
+   size_t best_lane{0};
+   bool best_in_turn{false};
+   std::array<bool, NUM_PRIORITIES> past_last{};
+   for (auto &[id, controller] : _controllers) {
+      for (size_t lane = 0; lane < NUM_PRIORITIES; lane++) {
+         past_last[lane] = past_last[lane] || id == _last_claimed[lane];
+      }
+      if (controller.busy) {
+         continue;
+      }
+
+      refill(controller, now);
+      size_t lane{0};
+      auto ready = next_ready(controller, now, lane);
+      if (!ready.has_value()) {
+         continue;
+      }
 
-   // Setup a vevtor and counter we can copy some actions into
-   // to make sure we don't keep the mutex during all the dispatch sends
+      if (*ready > now) {
+         wake = std::min(wake, *ready);
+         continue;
+      }
 
-   uint32_t num_actions{0};
-   std::vector<queued_action_s> selected_actions;
-   selected_actions.reserve(MAX_BURST);
+      // The controller claimed last time only gets another turn when no
+      // other controller in its lane is ready
+      bool in_turn = past_last[lane] && id != _last_claimed[lane];
+      if (!best || lane > best_lane ||
+          (lane == best_lane && in_turn && !best_in_turn)) {
+         best = &controller;
+         best_id = &id;
+         best_lane = lane;
+         best_in_turn = in_turn;
+      }
+   }
 
+   if (!best) {
+      return {};
+   }
+   best->busy = true;
+   _last_claimed[best_lane] = *best_id;
+   return *best_id;
+}
+
+void action_dispatch_c::burst(const std::string &controller_id) {
+
+   // Take a set of actions out of the controller's queue so we don't hold
+   // the mutex during all the sends
+   std::vector<pending_action_s> selected_actions;
+   std::vector<size_t> selected_lanes;
+   crate::networking::message_writer_c *writer{nullptr};
    {
-      const std::lock_guard<std::mutex> lock(_action_queue_mutex);
-      while (!_action_queue.empty() && num_actions++ < MAX_BURST) {
-         selected_actions.push_back(_action_queue.front());
-         _action_queue.pop();
+      const std::lock_guard<std::mutex> lock(_controllers_mutex);
+      auto &controller = _controllers[controller_id];
+      auto now = steady_clock_t::now();
+
+      size_t limit = MAX_BURST;
+      if (rate_limited()) {
+         limit = std::min(limit, static_cast<size_t>(controller.tokens));
       }
+
+      // Drain the lanes highest first. Actions held back by the coalescing
+      // window keep their place
+      bool ready_left{false};
+      for (size_t lane = NUM_PRIORITIES; lane-- > 0;) {
+         auto &queue = controller.lanes[lane];
+         auto pending = queue.begin();
+         while (pending != queue.end() && selected_actions.size() < limit) {
+            if (pending->ready_at > now) {
+               ++pending;
+               continue;
+            }
+            if (_config.coalesce_window_ms) {
+               controller.last_sent[pending->action_id] = now;
+            }
+            selected_actions.push_back(std::move(*pending));
+            selected_lanes.push_back(lane);
+            pending = queue.erase(pending);
+            controller.queued--;
+            _stat_queue_depth->add(-1);
+         }
+         ready_left = ready_left ||
+                      std::any_of(pending, queue.end(), [now](auto &p) {
+                         return p.ready_at <= now;
+                      });
+      }
+
+      if (rate_limited()) {
+         controller.tokens -= selected_actions.size();
+         if (ready_left) {
+            _throttled.fetch_add(1, std::memory_order_relaxed);
+         }
+      }
+
+      if (!controller.writer || controller.reconnect) {
+         delete controller.writer;
+         controller.writer = new crate::networking::message_writer_c(
+             controller.address, controller.port);
+         controller.reconnect = false;
+      }
+      writer = controller.writer;
    }
 
-   // Go through the selected actions and send them out
+   LOG(TRACE) << TAG("action_dispatch_c::burst") << "Sending "
+              << selected_actions.size() << " action(s) to " << controller_id
+              << "\n";
+
+   _stat_burst_size->record(selected_actions.size());
+   auto send_start = steady_clock_t::now();
 
-   for (auto &action_entry : selected_actions) {
+   // Send until the first failure, whatever is left goes back in the queue
+   size_t sent{0};
+   for (size_t i = 0; i < selected_actions.size(); i++) {
+      auto &pending = selected_actions[i];
 
-      // Encode the action to a string
       std::string encoded_action;
-      if (!action_entry.action.encode_to(encoded_action)) {
+      if (!pending.action.encode_to(encoded_action)) {
          LOG(FATAL) << TAG("action_dispatch_c::burst")
-                    << "Failed to decode selected action\n";
+                    << "Failed to encode selected action\n";
+         _dropped_failed.fetch_add(1, std::memory_order_relaxed);
+         sent++;
          continue;
       }
 
-      crate::networking::message_writer_c writer(action_entry.address,
-                                                 action_entry.port);
-
-      bool sent{false};
       bool write_okay{true};
-      uint8_t attempts{0};
+      if (writer->write(encoded_action, write_okay) !=
+              encoded_action.length() ||
+          !write_okay) {
+         break;
+      }
+
+      auto lane = selected_lanes[i];
+      _sent[lane].fetch_add(1, std::memory_order_relaxed);
+      if (pending.deadline.has_value() &&
+          steady_clock_t::now() > *pending.deadline) {
+         _deadline_missed[lane].fetch_add(1, std::memory_order_relaxed);
+         LOG(WARNING) << TAG("action_dispatch_c::burst") << "Action "
+                      << pending.action_id << " to " << controller_id
+                      << " missed its deadline (priority " << lane << ")\n";
+      }
+      sent++;
+   }
+
+   _stat_burst_duration->record(
+       std::chrono::duration_cast<std::chrono::microseconds>(
+           steady_clock_t::now() - send_start)
+           .count());
+
+   const std::lock_guard<std::mutex> lock(_controllers_mutex);
+   auto &controller = _controllers[controller_id];
+   controller.busy = false;
 
-      while (!sent && write_okay && attempts++ < MAX_RETRIES) {
+   if (sent == selected_actions.size()) {
+      controller.failures = 0;
+      controller.retry_at = steady_clock_t::time_point();
+   } else {
+      controller.failures++;
 
-         // Attempt to write the data and then check the number of
-         // bytes written against how many we expected to write
-         if ((writer.write(encoded_action, write_okay) ==
-              encoded_action.length())) {
-            sent = true;
+      // Give up on the action that keeps failing, the rest get their turn
+      if (controller.failures >= _config.max_attempts) {
+         LOG(FATAL) << TAG("action_dispatch_c::burst")
+                    << "Failed to write action to " << controller_id
+                    << " after " << controller.failures
+                    << " attempts, dropping it\n";
+         _dropped_failed.fetch_add(1, std::memory_order_relaxed);
+         sent++;
+         controller.failures = 0;
+      }
+
+      // Tokens are only spent on actions that made it out
+      if (rate_limited()) {
+         controller.tokens =
+             std::min<double>(_config.rate_limit_burst,
+                              controller.tokens + selected_actions.size() - sent);
+      }
+
+      // Put the unsent actions back in front of their lanes, unless a newer
+      // value for the same action was dispatched while we were sending
+      for (size_t i = selected_actions.size(); i-- > sent;) {
+         auto &unsent = selected_actions[i];
+         if (_config.coalesce_window_ms &&
+             std::any_of(controller.lanes.begin(), controller.lanes.end(),
+                         [&unsent](auto &queue) {
+                            return std::any_of(
+                                queue.begin(), queue.end(), [&unsent](auto &p) {
+                                   return p.action_id == unsent.action_id;
+                                });
+                         })) {
+            _coalesced.fetch_add(1, std::memory_order_relaxed);
+            continue;
          }
+         controller.lanes[selected_lanes[i]].push_front(std::move(unsent));
+         controller.queued++;
+         _stat_queue_depth->add(1);
       }
 
-      if (!sent) {
-         LOG(FATAL) << TAG("action_dispatch_c::burst")
-                    << "Failed to write action to destination\n";
+      uint64_t backoff_ms = _config.backoff_base_ms;
+      for (uint32_t i = 1; i < controller.failures &&
+                           backoff_ms < _config.backoff_max_ms;
+           i++) {
+         backoff_ms *= 2;
       }
+      backoff_ms = std::min<uint64_t>(backoff_ms, _config.backoff_max_ms);
+      controller.retry_at =
+          steady_clock_t::now() + std::chrono::milliseconds(backoff_ms);
+
+      // Start over with a fresh connection on the next attempt
+      controller.reconnect = true;
+
+      LOG(WARNING) << TAG("action_dispatch_c::burst") << "Send to "
+                   << controller_id << " failed, retrying in " << backoff_ms
+                   << "ms\n";
    }
+
+   _controllers_cv.notify_all();
 }
 
-bool action_dispatch_c::dispatch(std::string controller_id,
-                                 std::string action_id, double value) {
+void action_dispatch_c::enqueue(const std::string &controller_id,
+                                const std::string &address, uint32_t port,
+                                const std::string &action_id, double value,
+                                priority_e priority, uint32_t deadline_ms) {
 
-   LOG(TRACE) << TAG("action_dispatch_c::dispatch") << controller_id << " | "
-              << action_id << " | " << value << "\n";
+   auto now = steady_clock_t::now();
+   auto lane = static_cast<size_t>(priority);
+   crate::control::action_v1_c action(stamp(), controller_id, action_id, value);
+
+   if (!deadline_ms) {
+      if (priority == priority_e::CRITICAL) {
+         deadline_ms = _config.critical_deadline_ms;
+      } else if (priority == priority_e::HIGH) {
+         deadline_ms = _config.high_deadline_ms;
+      }
+   }
+
+   std::optional<steady_clock_t::time_point> deadline;
+   if (deadline_ms) {
+      deadline = now + std::chrono::milliseconds(deadline_ms);
+   }
+
+   {
+      const std::lock_guard<std::mutex> lock(_controllers_mutex);
+      auto &controller = _controllers[controller_id];
+      if (controller.address != address || controller.port != port) {
+         controller.address = address;
+         controller.port = port;
+         controller.reconnect = true;
+      }
+
+      auto ready_at = now;
+      if (_config.coalesce_window_ms) {
+
+         // Still waiting to go out, just give it the latest value. If it was
+         // dispatched at a different priority it moves to the new lane
+         for (size_t l = 0; l < NUM_PRIORITIES; l++) {
+            auto &queue = controller.lanes[l];
+            auto pending = std::find_if(
+                queue.begin(), queue.end(),
+                [&action_id](auto &p) { return p.action_id == action_id; });
+            if (pending == queue.end()) {
+               continue;
+            }
+
+            _coalesced.fetch_add(1, std::memory_order_relaxed);
+            if (l == lane) {
+               pending->action = std::move(action);
+               pending->deadline = deadline;
+               return;
+            }
+            ready_at = pending->ready_at;
+            queue.erase(pending);
+            controller.queued--;
+            _stat_queue_depth->add(-1);
+            break;
+         }
+
+         auto last_sent = controller.last_sent.find(action_id);
+         if (last_sent != controller.last_sent.end()) {
+            ready_at = std::max(
+                ready_at, last_sent->second + std::chrono::milliseconds(
+                                                  _config.coalesce_window_ms));
+         }
+      }
+
+      // Make room by shedding from the lowest priority lane first, but never
+      // from a lane at or above this action's. With nothing lower queued the
+      // new action is the one dropped
+      if (controller.queued >= _config.max_queued) {
+         size_t shed = 0;
+         while (shed < lane && controller.lanes[shed].empty()) {
+            shed++;
+         }
+
+         LOG(DEBUG) << TAG("action_dispatch_c::enqueue") << "Queue for "
+                    << controller_id << " is full, dropping an action\n";
+         _dropped_overflow.fetch_add(1, std::memory_order_relaxed);
+         if (shed == lane) {
+            return;
+         }
+         controller.lanes[shed].pop_front();
+         controller.queued--;
+         _stat_queue_depth->add(-1);
+      }
+
+      controller.lanes[lane].push_back(
+          {action_id, std::move(action), ready_at, deadline});
+      controller.queued++;
+      _stat_queue_depth->add(1);
+   }
+   _controllers_cv.notify_one();
+}
+
+std::shared_ptr<const action_dispatch_c::cached_controller_s>
+action_dispatch_c::lookup_controller(const std::string &controller_id) {
+
+   uint64_t generation{0};
+   {
+      const std::lock_guard<std::mutex> lock(_cache_mutex);
+      auto entry = _controller_cache.find(controller_id);
+      if (entry != _controller_cache.end()) {
+         return entry->second;
+      }
+      generation = _cache_generation;
+   }
 
    // Check db for controller
    auto data = _registrar_db->load(controller_id);
 
    if (!data.has_value()) {
-      LOG(FATAL) << TAG("action_dispatch_c::dispatch")
+      LOG(FATAL) << TAG("action_dispatch_c::lookup_controller")
                  << "Given controller id is not regestered: " << controller_id
                  << "\n";
-      return false;
+      return nullptr;
    }
 
    // Ensure its a controller and not a node
    crate::registrar::controller_v1_c controller;
    if (!controller.decode_from(*data)) {
-      LOG(FATAL) << TAG("action_dispatch_c::dispatch")
+      LOG(FATAL) << TAG("action_dispatch_c::lookup_controller")
                  << "Given controller id could not be decoded:  "
                  << controller_id << "\n";
-      return false;
+      return nullptr;
    }
 
    auto [c_id, c_desc, c_ip, c_port, c_action_list] = controller.get_data();
 
+   auto cached = std::make_shared<cached_controller_s>();
+   cached->address = c_ip;
+   cached->port = c_port;
    for (auto &action : c_action_list) {
+      cached->actions.insert(action.id);
+   }
+
+   cache_controller(controller_id, cached, generation);
+   return cached;
+}
 
-      // Find the action that we are going to enqueue
-      if (action_id == action.id) {
+// Only keep an entry if the registrar wasn't written to since `generation`
+// was read before loading it, otherwise what was loaded may already be stale
+bool action_dispatch_c::cache_controller(
+    const std::string &controller_id,
+    std::shared_ptr<const cached_controller_s> cached, uint64_t generation) {
+   const std::lock_guard<std::mutex> lock(_cache_mutex);
+   if (generation != _cache_generation) {
+      return false;
+   }
+   _controller_cache[controller_id] = std::move(cached);
+   return true;
+}
+
+void action_dispatch_c::invalidate_controller(const std::string &controller_id) {
+   const std::lock_guard<std::mutex> lock(_cache_mutex);
+   _controller_cache.erase(controller_id);
+   _cache_generation++;
+}
 
-         // Enqueue the action
-         const std::lock_guard<std::mutex> lock(_action_queue_mutex);
-         _action_queue.push({.address = c_ip,
-                             .port = c_port,
-                             .action = crate::control::action_v1_c(
-                                 stamp(), c_id, action.id, value)});
-         return true;
+bool action_dispatch_c::dispatch(std::string controller_id,
+                                 std::string action_id, double value,
+                                 priority_e priority, uint32_t deadline_ms) {
+
+   LOG(TRACE) << TAG("action_dispatch_c::dispatch") << controller_id << " | "
+              << action_id << " | " << value << " | "
+              << static_cast<int>(priority) << "\n";
+
+   auto controller = lookup_controller(controller_id);
+   if (!controller) {
+      return false;
+   }
+
+   // Find the action that we are going to enqueue
+   if (!controller->actions.contains(action_id)) {
+      LOG(FATAL) << TAG("action_dispatch_c::dispatch")
+                 << "Failed to locate action id [" << action_id
+                 << "] on controller [" << controller_id << "]\n";
+      return false;
+   }
+
+   enqueue(controller_id, controller->address, controller->port, action_id,
+           value, priority, deadline_ms);
+   return true;
+}
+
+std::string action_dispatch_c::report() {
+
+   size_t controllers{0};
+   size_t queued{0};
+   {
+      const std::lock_guard<std::mutex> lock(_controllers_mutex);
+      controllers = _controllers.size();
+      for (auto &[id, controller] : _controllers) {
+         queued += controller.queued;
       }
    }
 
-   LOG(FATAL) << TAG("action_dispatch_c::dispatch")
-              << "Failed to locate action id [" << action_id
-              << "] on controller [" << controller_id << "]\n";
-   return false;
+   static constexpr const char *LANE_NAMES[NUM_PRIORITIES] = {
+       "low", "normal", "high", "critical"};
+
+   std::stringstream ss;
+   ss << "Action dispatch (" << controllers << " controller(s), " << queued
+      << " queued)\n";
+   for (size_t lane = NUM_PRIORITIES; lane-- > 0;) {
+      ss << std::left << std::setw(23)
+         << "sent (" + std::string(LANE_NAMES[lane]) + "):"
+         << _sent[lane].load() << " (" << _deadline_missed[lane].load()
+         << " missed deadline)\n";
+   }
+   ss << "coalesced:             " << _coalesced.load() << "\n"
+      << "throttled bursts:      " << _throttled.load() << "\n"
+      << "dropped (queue full):  " << _dropped_overflow.load() << "\n"
+      << "dropped (send failed): " << _dropped_failed.load() << "\n";
+   return ss.str();
 }
 
 } // namespace services
-} // namespace monolith
\ No newline at end of file
+} // namespace monolith
@@ -2,54 +2,201 @@
 #define MONOLITH_SERVICES_ACTION_DISPATCH_HPP
 
 #include "db/kv.hpp"
+#include "interfaces/reportable_if.hpp"
 #include "interfaces/service_if.hpp"
+#include "stats/stats.hpp"
 #include "networking/types.hpp"
 #include <atomic>
+#include <chrono>
+#include <array>
+#include <condition_variable>
 #include <crate/control/action_v1.hpp>
+#include <crate/networking/message_writer.hpp>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+   ABOUT:
+      Actions are queued per controller and sent by a small pool of worker
+   threads. A worker claims one controller at a time and sends everything
+   queued for it over that controller's writer, which is kept between sends.
+   When a send fails the controller is put into exponential backoff and its
+   actions wait in its queue until the backoff expires, leaving the workers
+   free to serve every other controller. A controller that keeps failing has
+   its actions dropped after the configured number of attempts.
+
+   Controllers are decoded from the registrar once and cached along with a
+   set of their action ids, so dispatching from a rule does not touch the
+   database. Entries are dropped whenever the registrar writes their key.
+
+   Rules tend to dispatch the same action on every reading. Within the
+   coalescing window only one send of a given action goes out per controller,
+   and any action dispatched again before it is sent replaces the queued
+   value instead of adding another send (last value wins). Each controller
+   may also be given a token bucket that limits how fast actions are written
+   to it; actions wait in its queue, still being coalesced, until a token is
+   available. A controller's queue is bounded, once full the oldest queued
+   action in its lowest priority lane is dropped, as long as that lane is
+   below the new action's. Otherwise the new action is dropped.
+
+   Every action is dispatched with a priority and goes into that priority's
+   lane. Lanes are always drained highest first, both when a worker picks the
+   next controller to serve and when it picks what to send. Controllers with
+   the same lane ready are served in turn, each lane resuming just past the
+   controller it last handed to a worker. An action may
+   carry a deadline; one sent after its deadline still goes out but is logged
+   and counted as missed.
+*/
+
 namespace monolith {
+namespace test {
+class action_dispatch_access_c;
+}
+
 namespace services {
 
 //! \brief Action dispatcher (pushes action requests to controllers)
-class action_dispatch_c : public service_if {
+class action_dispatch_c : public service_if, public reportable_if {
  public:
+   //! \brief Action priorities, higher priorities are always sent first
+   enum class priority_e : uint8_t { LOW = 0, NORMAL, HIGH, CRITICAL };
+   static constexpr size_t NUM_PRIORITIES = 4;
+
+   //! \brief Dispatch configuration
+   struct configuration_c {
+      uint32_t workers{4};              //! Threads sending actions
+      uint32_t max_attempts{5};         //! Sends tried before dropping
+      uint32_t backoff_base_ms{100};    //! First backoff after a failure
+      uint32_t backoff_max_ms{30'000};  //! Longest backoff
+      uint32_t coalesce_window_ms{0};   //! Min time between sends of an action
+      double rate_limit_per_sec{0.0};   //! Sends per second per controller
+      uint32_t rate_limit_burst{0};     //! Sends allowed in a burst
+      uint32_t max_queued{1'000};       //! Actions queued per controller
+      uint32_t high_deadline_ms{0};     //! Default deadline of HIGH actions
+      uint32_t critical_deadline_ms{0}; //! Default deadline of CRITICAL actions
+   };
+
    action_dispatch_c() = delete;
 
    //! \brief Create the dispatcher
    //! \param registrar_db The registration database
-   action_dispatch_c(monolith::db::kv_c *registrar_db);
+   //! \param config The dispatch configuration
+   action_dispatch_c(monolith::db::kv_c *registrar_db,
+                     configuration_c config);
+
+   //! \brief Stop the dispatcher and close all controller writers
+   virtual ~action_dispatch_c() override;
 
    //! \brief Queue an action for dispatch
    //! \param controller_id The id of the controller to dispatch to
    //! \param action_id The id of the action to trigger
    //! \param value The value to send along with the action
+   //! \param priority The lane to queue the action in
+   //! \param deadline_ms Time the action should be sent within, 0 uses the
+   //!        configured default for the priority (if any)
    bool dispatch(std::string controller_id, std::string action_id,
-                 double value);
+                 double value, priority_e priority = priority_e::NORMAL,
+                 uint32_t deadline_ms = 0);
 
    // From service_if
    virtual bool start() override final;
    virtual bool stop() override final;
 
+   // From reportable_if
+   virtual std::string report() override final;
+
  private:
+   // Lets the tests reach the queues and the controller cache directly
+   friend class monolith::test::action_dispatch_access_c;
+
    static constexpr uint16_t MAX_BURST = 100;
-   static constexpr uint8_t MAX_RETRIES = 5;
+   static constexpr std::chrono::milliseconds MAX_IDLE_WAIT{500};
 
-   struct queued_action_s {
+   using steady_clock_t = std::chrono::steady_clock;
+
+   struct cached_controller_s {
       std::string address;
       uint32_t port{0};
+      std::unordered_set<std::string> actions;
+   };
+
+   struct pending_action_s {
+      std::string action_id;
       crate::control::action_v1_c action;
+      steady_clock_t::time_point ready_at;
+      std::optional<steady_clock_t::time_point> deadline;
+   };
+
+   using lanes_t = std::array<std::deque<pending_action_s>, NUM_PRIORITIES>;
+
+   struct controller_s {
+      std::string address;
+      uint32_t port{0};
+      lanes_t lanes;   // Indexed by priority
+      size_t queued{0}; // Actions across all lanes
+      std::unordered_map<std::string, steady_clock_t::time_point> last_sent;
+      double tokens{0.0};
+      steady_clock_t::time_point refilled_at;
+      crate::networking::message_writer_c *writer{nullptr};
+      bool busy{false};           // Claimed by a worker
+      bool reconnect{false};      // Address changed since the writer was made
+      uint32_t failures{0};       // Consecutive failed sends
+      steady_clock_t::time_point retry_at;
    };
 
+   configuration_c _config;
    monolith::db::kv_c *_registrar_db{nullptr};
-   std::mutex _action_queue_mutex;
-   std::queue<queued_action_s> _action_queue;
+   uint64_t _registrar_listener_id{0};
+
+   std::mutex _cache_mutex;
+   uint64_t _cache_generation{0};
+   std::unordered_map<std::string, std::shared_ptr<const cached_controller_s>>
+       _controller_cache;
+
+   std::mutex _controllers_mutex;
+   std::condition_variable _controllers_cv;
+   std::unordered_map<std::string, controller_s> _controllers;
+   std::array<std::string, NUM_PRIORITIES> _last_claimed; // Per lane
+   std::vector<std::thread> _workers;
+
+   std::array<std::atomic<uint64_t>, NUM_PRIORITIES> _sent{};
+   std::array<std::atomic<uint64_t>, NUM_PRIORITIES> _deadline_missed{};
+   std::atomic<uint64_t> _coalesced{0};
+   std::atomic<uint64_t> _throttled{0};
+   std::atomic<uint64_t> _dropped_overflow{0};
+   std::atomic<uint64_t> _dropped_failed{0};
+
+   monolith::stats::gauge_c *_stat_queue_depth{nullptr};
+   monolith::stats::histogram_c *_stat_burst_size{nullptr};
+   monolith::stats::histogram_c *_stat_burst_duration{nullptr};
 
+   std::shared_ptr<const cached_controller_s>
+   lookup_controller(const std::string &controller_id);
+   bool cache_controller(const std::string &controller_id,
+                         std::shared_ptr<const cached_controller_s> cached,
+                         uint64_t generation);
+   void invalidate_controller(const std::string &controller_id);
+   void enqueue(const std::string &controller_id, const std::string &address,
+                uint32_t port, const std::string &action_id, double value,
+                priority_e priority, uint32_t deadline_ms);
    void run();
-   void burst();
+   bool rate_limited() const;
+   void refill(controller_s &controller, steady_clock_t::time_point now);
+   std::optional<steady_clock_t::time_point>
+   next_ready(controller_s &controller, steady_clock_t::time_point now,
+              size_t &ready_lane);
+   std::string claim(steady_clock_t::time_point &wake);
+   void burst(const std::string &controller_id);
 };
 
 } // namespace services
 } // namespace monolith
 
-#endif
\ No newline at end of file
+#endif
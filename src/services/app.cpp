@@ -1,11 +1,15 @@
 #include "app.hpp"
+#include "json_response.hpp"
+#include "networking/task_queue.hpp"
+#include "stats/registry.hpp"
+#include "stats/trace.hpp"
 #include "version.hpp"
+#include <algorithm>
 #include <chrono>
 #include <crate/externals/aixlog/logger.hpp>
 #include <crate/metrics/heartbeat_v1.hpp>
 #include <crate/registrar/controller_v1.hpp>
 #include <crate/registrar/node_v1.hpp>
-#include <sstream>
 
 using namespace std::chrono_literals;
 
@@ -27,7 +31,7 @@ void db_cb(metric_db_c::fetch_response_s *response,
    if (response->timeout.load() || response->complete.load()) {
       return;
    }
-   response->fetch_result = query_response;
+   response->fetch_result += query_response;
    response->complete.store(true);
 }
 
@@ -71,17 +75,29 @@ app_c::app_c(monolith::networking::ipv4_host_port_s host_port,
              monolith::services::metric_db_c *database,
              monolith::heartbeats_c *heartbeat_manager,
              monolith::portal::portal_c *portal)
-    : _address(host_port.address), _port(host_port.port),
+    : app_c(host_port, registrar_db, metric_streamer, data_submission,
+            database, heartbeat_manager, portal, configuration_c()) {}
+
+app_c::app_c(monolith::networking::ipv4_host_port_s host_port,
+             monolith::db::kv_c *registrar_db,
+             monolith::services::metric_streamer_c *metric_streamer,
+             monolith::services::data_submission_c *data_submission,
+             monolith::services::metric_db_c *database,
+             monolith::heartbeats_c *heartbeat_manager,
+             monolith::portal::portal_c *portal, configuration_c config)
+    : _config(config), _address(host_port.address), _port(host_port.port),
       _registration_db(registrar_db), _metric_streamer(metric_streamer),
       _data_submission(data_submission), _metric_db(database),
       _heartbeat_manager(heartbeat_manager), _portal(portal) {
    _app_server = new httplib::Server();
+   setup_server();
 }
 
 app_c::~app_c() {
    if (p_running.load()) {
       stop();
    }
+   delete _ingest_server;
    delete _app_server;
 }
 
@@ -114,6 +130,15 @@ bool app_c::start() {
       p_running.store(false);
       return false;
    }
+
+   if (_ingest_server && !_ingest_server->start()) {
+      LOG(INFO) << TAG("app_c::start") << "Failed to start ingest server\n";
+      _app_server->stop();
+      if (p_thread.joinable()) {
+         p_thread.join();
+      }
+      return false;
+   }
    p_running.store(true);
    return true;
 }
@@ -125,6 +150,10 @@ bool app_c::stop() {
       return false;
    }
 
+   if (_ingest_server && _ingest_server->is_running()) {
+      _ingest_server->stop();
+   }
+
    _app_server->stop();
 
    p_running.store(false);
@@ -136,6 +165,51 @@ bool app_c::stop() {
    return true;
 }
 
+void app_c::setup_server() {
+
+   // Leave a core for the services behind the app, but keep enough threads
+   // that a few slow clients can't take the whole server
+   if (!_config.workers) {
+      auto cores = std::thread::hardware_concurrency();
+      _config.workers =
+          std::max<uint32_t>(MIN_AUTO_WORKERS, cores ? cores - 1 : 0);
+   }
+
+   LOG(INFO) << TAG("app_c::setup_server") << "HTTP workers: "
+             << _config.workers << ", max queued: " << _config.max_queued
+             << "\n";
+
+   _app_server->set_keep_alive_max_count(_config.keep_alive_max_count);
+   _app_server->set_keep_alive_timeout(_config.keep_alive_timeout_sec);
+   _app_server->set_read_timeout(_config.read_timeout_sec, 0);
+   _app_server->set_write_timeout(_config.write_timeout_sec, 0);
+   if (_config.payload_max_bytes) {
+      _app_server->set_payload_max_length(_config.payload_max_bytes);
+   }
+
+   auto workers = _config.workers;
+   auto max_queued = _config.max_queued;
+   _app_server->new_task_queue = [workers, max_queued] {
+      return new monolith::networking::bounded_task_queue_c(workers,
+                                                            max_queued);
+   };
+
+   // Nodes can be pointed at the ingest port instead so that their idle
+   // keep-alive connections don't each hold one of the workers above
+   if (_config.ingest_port) {
+      monolith::networking::ingest_server_c::configuration_c ingest_config;
+      ingest_config.reactors = _config.ingest_reactors;
+      ingest_config.idle_timeout_sec = _config.ingest_idle_timeout_sec;
+      _ingest_server = new monolith::networking::ingest_server_c(
+          monolith::networking::ipv4_host_port_s{_address,
+                                                 _config.ingest_port},
+          [this](const httplib::Request &req, httplib::Response &res) {
+             return dispatch(req, res, true);
+          },
+          ingest_config);
+   }
+}
+
 void app_c::serve_static_resources(bool show) {
    _serve_static_resources = show;
 }
@@ -159,237 +233,348 @@ bool app_c::setup_endpoints() {
       }
    }
 
+   // Endpoints may have been set up by a previous start
+   _router = monolith::networking::router_c();
+   _routes.clear();
+
    // Root
-   _app_server->Get("/",
-                    std::bind(&app_c::http_root, this, std::placeholders::_1,
-                              std::placeholders::_2));
+   route("/", &app_c::http_root);
    // Version info
-   _app_server->Get("/version",
-                    std::bind(&app_c::version, this, std::placeholders::_1,
-                              std::placeholders::_2));
+   route("/version", &app_c::version);
+   // Internal instrumentation (prometheus text format)
+   route("/metrics", &app_c::metrics);
+   // Recent slow ingest traces
+   route("/debug/traces", &app_c::debug_traces);
 
    // -------- [Stream Registration Endpoints] --------
 
    // Endpoint to add metric stream destination
-   _app_server->Get(R"(/metric/stream/add/(.*?)/(\d+))",
-                    std::bind(&app_c::metric_stream_add, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/metric/stream/add/:address/:port", &app_c::metric_stream_add);
 
    // Endpoint to delete metric stream destination
-   _app_server->Get(R"(/metric/stream/delete/(.*?)/(\d+))",
-                    std::bind(&app_c::metric_stream_delete, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/metric/stream/delete/:address/:port", &app_c::metric_stream_delete);
+
+   // Endpoint to receive live metrics as server-sent events
+   route("/metric/stream/live", &app_c::metric_stream_live);
 
    // ---------- [Registration DB Endpoints] ----------
 
    // Endpoint to probe for item in database
-   _app_server->Get(R"(/registrar/probe/(.*?))",
-                    std::bind(&app_c::registrar_probe, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/registrar/probe/*key", &app_c::registrar_probe, true);
 
    // Endpoint to submit item to database
-   _app_server->Get(R"(/registrar/add/(.*?)/(.*?))",
-                    std::bind(&app_c::registrar_add, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/registrar/add/:key/*value", &app_c::registrar_add);
 
    // Endpoint to fetch item from database
-   _app_server->Get(R"(/registrar/fetch/(.*?))",
-                    std::bind(&app_c::registrar_fetch, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/registrar/fetch/*key", &app_c::registrar_fetch);
 
    // Endpoint to delete item from database
-   _app_server->Get(R"(/registrar/delete/(.*?))",
-                    std::bind(&app_c::registrar_delete, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/registrar/delete/*key", &app_c::registrar_delete);
 
    // Endpoint to submit item to database
-   _app_server->Get(R"(/metric/submit/(.*?))",
-                    std::bind(&app_c::metric_submit, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/metric/submit/*metric", &app_c::metric_submit, true);
 
    // Endpoint send in a heartbeat
-   _app_server->Get(R"(/metric/heartbeat/(.*?))",
-                    std::bind(&app_c::metric_heartbeat, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/metric/heartbeat/*heartbeat", &app_c::metric_heartbeat, true);
 
    // Endpoint retrieve all nodes that have reported data
-   _app_server->Get(R"(/metric/fetch/nodes)",
-                    std::bind(&app_c::metric_fetch_nodes, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/metric/fetch/nodes", &app_c::metric_fetch_nodes);
 
    // Retrieve all reporting sensors for a node
-   _app_server->Get(R"(/metric/fetch/(.*?)/sensors)",
-                    std::bind(&app_c::metric_fetch_sensors, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/metric/fetch/:node/sensors", &app_c::metric_fetch_sensors);
 
    // Endpoint sensor's values within a range
-   _app_server->Get(R"(/metric/fetch/(.*?)/range/(.*?)/(.*?))",
-                    std::bind(&app_c::metric_fetch_range, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/metric/fetch/:node/range/:start/:end", &app_c::metric_fetch_range);
 
    // Endpoint sensor's values after a timestamp
-   _app_server->Get(R"(/metric/fetch/(.*?)/after/(.*?))",
-                    std::bind(&app_c::metric_fetch_after, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/metric/fetch/:node/after/:time", &app_c::metric_fetch_after);
 
    // Endpoint sensor's values before a timestamp
-   _app_server->Get(R"(/metric/fetch/(.*?)/before/(.*?))",
-                    std::bind(&app_c::metric_fetch_before, this,
-                              std::placeholders::_1, std::placeholders::_2));
+   route("/metric/fetch/:node/before/:time", &app_c::metric_fetch_before);
+
+   /*
+      Our routes are matched by the router before httplib does any routing
+      of its own. Anything the router doesn't know (the portal, static
+      resources) is left for httplib
+   */
+   _app_server->set_pre_routing_handler(
+       [this](const httplib::Request &req, httplib::Response &res) {
+          // Connections that came in while every worker was busy and the
+          // queue was full are turned away rather than left to time out
+          if (monolith::networking::bounded_task_queue_c::rejecting()) {
+             res.status = static_cast<int>(
+                 return_codes_e::SERVICE_UNAVAILABLE_503);
+             res.set_header("Connection", "close");
+             res.set_header("Retry-After", "1");
+             set_json_response(res, return_codes_e::SERVICE_UNAVAILABLE_503,
+                               "server busy");
+             return httplib::Server::HandlerResponse::Handled;
+          }
+
+          return dispatch(req, res, false)
+                     ? httplib::Server::HandlerResponse::Handled
+                     : httplib::Server::HandlerResponse::Unhandled;
+       });
    return true;
 }
 
-std::string app_c::get_json_response(const app_c::return_codes_e rc,
-                                     const std::string msg) {
-   return "{\"status\":" + std::to_string(static_cast<uint32_t>(rc)) +
-          ",\"data\":\"" + msg + "\"}";
-}
-
-std::string app_c::get_raw_json_response(const app_c::return_codes_e rc,
-                                         const std::string json) {
-   return "{\"status\":" + std::to_string(static_cast<uint32_t>(rc)) +
-          ",\"data\":" + json + "}";
-}
+bool app_c::dispatch(const httplib::Request &req, httplib::Response &res,
+                     bool ingest_only) {
 
-bool app_c::valid_http_req(const httplib::Request &req, httplib::Response &res,
-                           size_t expected_items) {
-   if (req.matches.size() < expected_items) {
-      LOG(TRACE) << TAG("app_c::valid_http_req") << "Expected "
-                 << expected_items << ", but got " << req.matches.size()
-                 << "\n";
+   if (req.method != "GET" && req.method != "HEAD") {
+      return false;
+   }
 
-      for (auto i = 0; i < req.matches.size(); i++) {
-         LOG(TRACE) << TAG("<dump>") << req.matches[i] << "\n";
-      }
+   route_params_t params;
+   auto id = _router.match(req.path, params);
+   if (!id.has_value()) {
+      return false;
+   }
 
-      res.set_content(
-          get_json_response(return_codes_e::BAD_REQUEST_400, "Invalid request"),
-          "application/json");
+   auto &route = _routes[*id];
+   if (ingest_only && !route.ingest) {
       return false;
    }
+
+   monolith::stats::scoped_timer_c timer(*route.latency);
+   (this->*route.handler)(req, res, params);
    return true;
 }
 
-void app_c::http_root(const httplib::Request &req, httplib::Response &res) {
+void app_c::route(const std::string &pattern, handler_f handler,
+                  bool ingest) {
+
+   if (!_router.add(pattern, _routes.size())) {
+      LOG(FATAL) << TAG("app_c::route") << "Invalid or duplicate route: "
+                 << pattern << "\n";
+      return;
+   }
+
+   // Routes are timed under their pattern so every request to the same
+   // endpoint lands in the same histogram
+   auto &latency = monolith::stats::registry().histogram(
+       "monolith_http_request_duration_us", "Time taken to handle a request",
+       {{"route", pattern}});
+
+   _routes.push_back({handler, &latency, ingest});
+}
+
+void app_c::set_json_response(httplib::Response &res,
+                              const app_c::return_codes_e rc,
+                              std::string_view msg) {
+   json_response_c response(static_cast<uint32_t>(rc), msg.size() + 2);
+   res.set_content(response.message(msg).take(), "application/json");
+}
+
+void app_c::set_raw_json_response(httplib::Response &res,
+                                  const app_c::return_codes_e rc,
+                                  std::string_view json) {
+   json_response_c response(static_cast<uint32_t>(rc), json.size());
+   res.set_content(response.raw(json).take(), "application/json");
+}
+
+metric_db_c::fetch_response_s *app_c::new_fetch_response() {
+
+   // The database writes its result straight after the envelope's prefix
+   auto response = new metric_db_c::fetch_response_s();
+   json_response_c::open(response->fetch_result,
+                         static_cast<uint32_t>(return_codes_e::OKAY));
+   return response;
+}
+
+void app_c::http_root(const httplib::Request &req, httplib::Response &res,
+                      const route_params_t &params) {
    std::string body = "<h1>Monolith app server</h1><br>"
                       "TODO: Show status of db/streamer/submission server etc";
 
-   res.set_content(body, "text/html");
+   res.set_content(std::move(body), "text/html");
+}
+
+void app_c::metrics(const httplib::Request &req, httplib::Response &res,
+                    const route_params_t &params) {
+   res.set_content(monolith::stats::registry().render_prometheus(),
+                   "text/plain; version=0.0.4");
+}
+
+void app_c::debug_traces(const httplib::Request &req, httplib::Response &res,
+                         const route_params_t &params) {
+   set_raw_json_response(res, return_codes_e::OKAY,
+                         monolith::stats::tracer().render_slow_traces());
 }
 
-void app_c::version(const httplib::Request &req, httplib::Response &res) {
+void app_c::version(const httplib::Request &req, httplib::Response &res,
+                    const route_params_t &params) {
    std::string encoded;
    auto version_info = monolith::get_version_info();
    if (!version_info.encode_to(encoded)) {
       LOG(WARNING) << TAG("app_c::version")
                    << "Failed to encode version info\n";
-      res.set_content(get_json_response(return_codes_e::INTERNAL_SERVER_500,
-                                        "Failed to encode version info"),
-                      "application/json");
+      set_json_response(res, return_codes_e::INTERNAL_SERVER_500,
+                        "Failed to encode version info");
       return;
    }
-   res.set_content(get_raw_json_response(return_codes_e::OKAY, encoded),
-                   "application/json");
+   set_raw_json_response(res, return_codes_e::OKAY, encoded);
 }
 
 void app_c::metric_stream_add(const httplib::Request &req,
-                              httplib::Response &res) {
+                              httplib::Response &res,
+                              const route_params_t &params) {
 
    if (!_metric_streamer) {
-      res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400, "streamer service is disabled"),
-                     "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "streamer service is disabled");
       return;
    }
 
-   if (!valid_http_req(req, res, 3)) {
+   auto port = params.as<uint32_t>(1);
+   if (!port.has_value() || *port == 0) {
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "Invalid port given : " + params.str(1));
       return;
    }
 
-   uint32_t port{0};
-   std::stringstream ts_ss(req.matches[2].str());
-   ts_ss >> port;
-
-   // Should be impossible given how httplib routes things, but its always
-   // best to be sure
-   if (port == 0) {
-      res.set_content(
-          get_json_response(return_codes_e::BAD_REQUEST_400,
-                            "Invalid port given : " + req.matches[2].str()),
-          "application/json");
-   }
-
    // Queue the item to be added
    //
-   _metric_streamer->add_destination(req.matches[1].str(), port);
+   _metric_streamer->add_destination(params.str(0), *port);
 
-   res.set_content(get_json_response(return_codes_e::OKAY, "success"),
-                   "application/json");
+   set_json_response(res, return_codes_e::OKAY, "success");
 }
 
 void app_c::metric_stream_delete(const httplib::Request &req,
-                                 httplib::Response &res) {
+                                 httplib::Response &res,
+                                 const route_params_t &params) {
 
    if (!_metric_streamer) {
-      res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400, "streamer service is disabled"),
-                     "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "streamer service is disabled");
       return;
    }
 
-   if (!valid_http_req(req, res, 3)) {
-      return;
-   }
-
-   uint32_t port{0};
-   std::stringstream ts_ss(req.matches[2].str());
-   ts_ss >> port;
-
-   // Should be impossible given how httplib routes things, but its always
-   // best to be sure
-   if (port == 0) {
-      res.set_content(
-          get_json_response(return_codes_e::BAD_REQUEST_400,
-                            "Invalid port given : " + req.matches[2].str()),
-          "application/json");
+   auto port = params.as<uint32_t>(1);
+   if (!port.has_value() || *port == 0) {
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "Invalid port given : " + params.str(1));
       return;
    }
 
    // Queue the item to be added
    //
-   _metric_streamer->del_destination(req.matches[1].str(), port);
+   _metric_streamer->del_destination(params.str(0), *port);
 
-   res.set_content(get_json_response(return_codes_e::OKAY, "success"),
-                   "application/json");
+   set_json_response(res, return_codes_e::OKAY, "success");
 }
 
-void app_c::registrar_probe(const httplib::Request &req,
-                            httplib::Response &res) {
-   if (!valid_http_req(req, res, 2)) {
-      return;
-   }
+/*
+   Live metrics are sent as server-sent events so browsers and anything
+   behind NAT can receive them over the same connection they asked on.
+   Optional `node` and `sensor` query parameters narrow what gets sent.
+   Each metric is sent as its own `data:` event containing the encoded
+   reading, and a `dropped` event reports how many readings the connection
+   has lost because it could not keep up
+*/
+void app_c::metric_stream_live(const httplib::Request &req,
+                               httplib::Response &res,
+                               const route_params_t &params) {
 
-   auto endpoint = req.matches[0];
-   auto key = std::string(req.matches[1]);
+   if (!_metric_streamer) {
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "streamer service is disabled");
+      return;
+   }
+
+   std::string node_id;
+   if (req.has_param("node")) {
+      node_id = req.get_param_value("node");
+   }
+
+   std::string sensor_id;
+   if (req.has_param("sensor")) {
+      sensor_id = req.get_param_value("sensor");
+   }
+
+   auto subscription = _metric_streamer->subscribe(node_id, sensor_id);
+   if (!subscription) {
+      res.status = static_cast<int>(return_codes_e::SERVICE_UNAVAILABLE_503);
+      set_json_response(res, return_codes_e::SERVICE_UNAVAILABLE_503,
+                        "too many live stream connections");
+      return;
+   }
+
+   LOG(TRACE) << TAG("app_c::metric_stream_live")
+              << "Live stream opened | node: " << node_id
+              << " | sensor: " << sensor_id << "\n";
+
+   res.set_header("Cache-Control", "no-cache");
+
+   auto last_write = std::chrono::steady_clock::now();
+   uint64_t reported_dropped{0};
+
+   res.set_chunked_content_provider(
+       "text/event-stream",
+       [this, subscription, last_write,
+        reported_dropped](size_t offset, httplib::DataSink &sink) mutable {
+          // Let the connection go once the server is on its way down
+          if (!p_running.load()) {
+             sink.done();
+             return true;
+          }
+
+          std::string events;
+          for (auto &metric : subscription->wait(LIVE_STREAM_POLL_INTERVAL)) {
+             std::string encoded;
+             if (metric.encode_to(encoded)) {
+                events += "data: " + encoded + "\n\n";
+             }
+          }
+
+          auto dropped = subscription->dropped();
+          if (dropped != reported_dropped) {
+             events += "event: dropped\ndata: " + std::to_string(dropped) +
+                       "\n\n";
+             reported_dropped = dropped;
+          }
+
+          // Comments keep proxies from deciding an idle feed is dead
+          auto now = std::chrono::steady_clock::now();
+          if (events.empty() &&
+              now - last_write >= LIVE_STREAM_KEEP_ALIVE_INTERVAL) {
+             events = ": keep-alive\n\n";
+          }
+
+          if (events.empty()) {
+             return true;
+          }
+
+          last_write = now;
+          return sink.write(events.data(), events.size());
+       },
+       [this, subscription](bool success) {
+          _metric_streamer->unsubscribe(subscription);
+          LOG(TRACE) << TAG("app_c::metric_stream_live")
+                     << "Live stream closed\n";
+       });
+}
+
+void app_c::registrar_probe(const httplib::Request &req, httplib::Response &res,
+                            const route_params_t &params) {
+
+   auto key = params.str(0);
 
    LOG(TRACE) << TAG("app_c::registrar_probe") << "Got key: " << key << "\n";
 
    if (_registration_db->exists(key)) {
-      res.set_content(get_json_response(return_codes_e::OKAY, "found"),
-                      "application/json");
+      set_json_response(res, return_codes_e::OKAY, "found");
       return;
    }
 
-   res.set_content(get_json_response(return_codes_e::OKAY, "not found"),
-                   "application/json");
+   set_json_response(res, return_codes_e::OKAY, "not found");
 }
 
-void app_c::registrar_add(const httplib::Request &req, httplib::Response &res) {
-   if (!valid_http_req(req, res, 3)) {
-      return;
-   }
+void app_c::registrar_add(const httplib::Request &req, httplib::Response &res,
+                          const route_params_t &params) {
 
-   auto endpoint = req.matches[0];
-   auto key = std::string(req.matches[1]);
-   auto value = std::string(req.matches[2]);
+   auto key = params.str(0);
+   auto value = params.str(1);
 
    LOG(TRACE) << TAG("app_c::registrar_add") << "k:" << key << "|v:" << value
               << "\n";
@@ -400,103 +585,79 @@ void app_c::registrar_add(const httplib::Request &req, httplib::Response &res) {
       // Perhaps its a controller?
       crate::registrar::controller_v1_c decoded_controller;
       if (!decoded_controller.decode_from(value)) {
-         res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400,
-                                           "malformed data"),
-                         "application/json");
+         set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                           "malformed data");
          return;
       }
    }
 
    if (_registration_db->store(key, value)) {
-      res.set_content(get_json_response(return_codes_e::OKAY, "success"),
-                      "application/json");
+      set_json_response(res, return_codes_e::OKAY, "success");
       return;
    }
 
-   res.set_content(
-       get_json_response(return_codes_e::INTERNAL_SERVER_500, "server error"),
-       "application/json");
+   set_json_response(res, return_codes_e::INTERNAL_SERVER_500, "server error");
 }
 
-void app_c::registrar_fetch(const httplib::Request &req,
-                            httplib::Response &res) {
-   if (!valid_http_req(req, res, 2)) {
-      return;
-   }
+void app_c::registrar_fetch(const httplib::Request &req, httplib::Response &res,
+                            const route_params_t &params) {
 
-   auto endpoint = req.matches[0];
-   auto key = std::string(req.matches[1]);
+   auto key = params.str(0);
    LOG(TRACE) << TAG("app_c::registrar_fetch") << "Got key: " << key << "\n";
 
    auto result = _registration_db->load(key);
 
    if (!result.has_value()) {
-      res.set_content(get_json_response(return_codes_e::OKAY, "not found"),
-                      "application/json");
+      set_json_response(res, return_codes_e::OKAY, "not found");
       return;
    }
 
-   res.set_content(*result, "text/plain");
+   res.set_content(std::move(*result), "text/plain");
 }
 
 void app_c::registrar_delete(const httplib::Request &req,
-                             httplib::Response &res) {
-   if (!valid_http_req(req, res, 2)) {
-      return;
-   }
+                             httplib::Response &res,
+                             const route_params_t &params) {
 
-   auto endpoint = req.matches[0];
-   auto key = std::string(req.matches[1]);
+   auto key = params.str(0);
    LOG(TRACE) << TAG("app_c::registrar_delete") << "Got key: " << key << "\n";
 
    if (_registration_db->remove(key)) {
-      res.set_content(get_json_response(return_codes_e::OKAY, "success"),
-                      "application/json");
+      set_json_response(res, return_codes_e::OKAY, "success");
       return;
    }
-   res.set_content(
-       get_json_response(return_codes_e::INTERNAL_SERVER_500, "server error"),
-       "application/json");
+   set_json_response(res, return_codes_e::INTERNAL_SERVER_500, "server error");
 }
 
-void app_c::metric_submit(const httplib::Request &req, httplib::Response &res) {
-   if (!valid_http_req(req, res, 2)) {
-      return;
-   }
+void app_c::metric_submit(const httplib::Request &req, httplib::Response &res,
+                          const route_params_t &params) {
 
-   auto endpoint = req.matches[0];
-   auto metric = std::string(req.matches[1]);
+   auto metric = params.str(0);
    LOG(TRACE) << TAG("app_c::metric_submit") << "Got metric: " << metric
               << "\n";
 
    crate::metrics::sensor_reading_v1_c decoded_metric;
    if (!decoded_metric.decode_from(metric)) {
-      res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400,
-                                        "malformed metric"),
-                      "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "malformed metric");
       return;
    }
 
    _data_submission->submit_data(decoded_metric);
 
-   res.set_content(get_json_response(return_codes_e::OKAY, "success"),
-                   "application/json");
+   set_json_response(res, return_codes_e::OKAY, "success");
 }
 
 void app_c::metric_heartbeat(const httplib::Request &req,
-                             httplib::Response &res) {
-   if (!valid_http_req(req, res, 2)) {
-      return;
-   }
+                             httplib::Response &res,
+                             const route_params_t &params) {
 
-   auto endpoint = req.matches[0];
-   auto suspected_heartbeat = std::string(req.matches[1]);
+   auto suspected_heartbeat = params.str(0);
 
    crate::metrics::heartbeat_v1_c decoded_heartbeat;
    if (!decoded_heartbeat.decode_from(suspected_heartbeat)) {
-      res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400,
-                                        "malformed heartbeat"),
-                      "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "malformed heartbeat");
       return;
    }
 
@@ -505,8 +666,7 @@ void app_c::metric_heartbeat(const httplib::Request &req,
 
    _heartbeat_manager->submit(decoded_heartbeat.get_data());
 
-   res.set_content(get_json_response(return_codes_e::OKAY, "success"),
-                   "application/json");
+   set_json_response(res, return_codes_e::OKAY, "success");
 }
 
 void app_c::handle_fetch(httplib::Response &res, const double timeout,
@@ -516,45 +676,42 @@ void app_c::handle_fetch(httplib::Response &res, const double timeout,
 
    // Check if we've timed out
    if (db_res->timeout.load()) {
-      res.set_content(
-          get_json_response(return_codes_e::GATEWAY_TIMEOUT_504, "timeout"),
-          "application/json");
+      set_json_response(res, return_codes_e::GATEWAY_TIMEOUT_504, "timeout");
       return;
    }
 
    // Ensure we've completed
    if (!db_res->complete.load()) {
-      res.set_content(get_json_response(return_codes_e::INTERNAL_SERVER_500,
-                                        "No fetch completion flag set"),
-                      "application/json");
+      set_json_response(res, return_codes_e::INTERNAL_SERVER_500,
+                        "No fetch completion flag set");
       return;
    }
 
-   // Response from database will be json so we encode  a `raw` json response
-   res.set_content(
-       get_raw_json_response(return_codes_e::OKAY, db_res->fetch_result),
-       "application/json");
+   // Response from database is json written after the envelope's prefix,
+   // close it and hand the buffer over as-is
+   json_response_c::close(db_res->fetch_result);
+   res.set_content(std::move(db_res->fetch_result), "application/json");
 }
 
 void app_c::metric_fetch_nodes(const httplib::Request &req,
-                               httplib::Response &res) {
+                               httplib::Response &res,
+                               const route_params_t &params) {
 
    if (!_metric_db) {
-      res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400, "Metric storage not enabled"), "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "Metric storage not enabled");
       return;
    }
 
-   metric_db_c::fetch_response_s *response =
-       new metric_db_c::fetch_response_s();
+   metric_db_c::fetch_response_s *response = new_fetch_response();
    metric_db_c::fetch_s fetch{.callback = db_cb, .callback_data = response};
 
    // Submit the fetch
    if (!_metric_db->fetch_nodes(fetch)) {
       LOG(WARNING) << TAG("app_c::metric_fetch_nodes")
                    << "Unable to submit fetch\n";
-      res.set_content(get_json_response(return_codes_e::INTERNAL_SERVER_500,
-                                        "Failed to submit fetch"),
-                      "application/json");
+      set_json_response(res, return_codes_e::INTERNAL_SERVER_500,
+                        "Failed to submit fetch");
       delete response;
       return;
    }
@@ -565,29 +722,25 @@ void app_c::metric_fetch_nodes(const httplib::Request &req,
 }
 
 void app_c::metric_fetch_sensors(const httplib::Request &req,
-                                 httplib::Response &res) {
+                                 httplib::Response &res,
+                                 const route_params_t &params) {
    if (!_metric_db) {
-      res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400, "Metric storage not enabled"), "application/json");
-      return;
-   }
-
-   if (!valid_http_req(req, res, 2)) {
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "Metric storage not enabled");
       return;
    }
 
-   auto node_id = req.matches[1];
+   auto node_id = params.str(0);
 
-   metric_db_c::fetch_response_s *response =
-       new metric_db_c::fetch_response_s();
+   metric_db_c::fetch_response_s *response = new_fetch_response();
    metric_db_c::fetch_s fetch{.callback = db_cb, .callback_data = response};
 
    // Submit the fetch
    if (!_metric_db->fetch_sensors(fetch, node_id)) {
       LOG(WARNING) << TAG("app_c::metric_fetch_sensors")
                    << "Unable to submit fetch\n";
-      res.set_content(get_json_response(return_codes_e::INTERNAL_SERVER_500,
-                                        "Failed to submit fetch"),
-                      "application/json");
+      set_json_response(res, return_codes_e::INTERNAL_SERVER_500,
+                        "Failed to submit fetch");
       delete response;
       return;
    }
@@ -598,51 +751,41 @@ void app_c::metric_fetch_sensors(const httplib::Request &req,
 }
 
 void app_c::metric_fetch_range(const httplib::Request &req,
-                               httplib::Response &res) {
+                               httplib::Response &res,
+                               const route_params_t &params) {
 
    if (!_metric_db) {
-      res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400, "Metric storage not enabled"), "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "Metric storage not enabled");
       return;
    }
 
-   if (!valid_http_req(req, res, 4)) {
-      return;
-   }
-
-   auto node_id = req.matches[1].str();
-
-   int64_t start{0};
-   {
-      std::stringstream ts_ss(req.matches[2].str());
-      ts_ss >> start;
-   }
+   auto node_id = params.str(0);
 
-   int64_t end{0};
-   {
-      std::stringstream ts_ss(req.matches[3].str());
-      ts_ss >> end;
+   auto start = params.as<int64_t>(1);
+   auto end = params.as<int64_t>(2);
+   if (!start.has_value() || !end.has_value()) {
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "malformed time range");
+      return;
    }
 
-   if (end <= start) {
+   if (*end <= *start) {
       LOG(WARNING) << TAG("app_c::metric_fetch_range") << "Bad time range\n";
-      res.set_content(
-          get_json_response(return_codes_e::BAD_REQUEST_400,
-                            "end time range must be > start time range"),
-          "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "end time range must be > start time range");
       return;
    }
 
-   metric_db_c::fetch_response_s *response =
-       new metric_db_c::fetch_response_s();
+   metric_db_c::fetch_response_s *response = new_fetch_response();
    metric_db_c::fetch_s fetch{.callback = db_cb, .callback_data = response};
 
    // Submit the fetch
-   if (!_metric_db->fetch_range(fetch, node_id, start, end)) {
+   if (!_metric_db->fetch_range(fetch, node_id, *start, *end)) {
       LOG(WARNING) << TAG("app_c::metric_fetch_range")
                    << "Unable to submit fetch\n";
-      res.set_content(get_json_response(return_codes_e::INTERNAL_SERVER_500,
-                                        "Failed to submit fetch"),
-                      "application/json");
+      set_json_response(res, return_codes_e::INTERNAL_SERVER_500,
+                        "Failed to submit fetch");
       delete response;
       return;
    }
@@ -653,46 +796,41 @@ void app_c::metric_fetch_range(const httplib::Request &req,
 }
 
 void app_c::metric_fetch_after(const httplib::Request &req,
-                               httplib::Response &res) {
+                               httplib::Response &res,
+                               const route_params_t &params) {
    if (!_metric_db) {
-      res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400, "Metric storage not enabled"), "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "Metric storage not enabled");
       return;
    }
 
-   if (!valid_http_req(req, res, 3)) {
-      return;
-   }
-   auto node_id = req.matches[1].str();
+   auto node_id = params.str(0);
 
-   int64_t time{0};
-   {
-      std::stringstream ts_ss(req.matches[2].str());
-      ts_ss >> time;
+   auto time = params.as<int64_t>(1);
+   if (!time.has_value()) {
+      set_json_response(res, return_codes_e::BAD_REQUEST_400, "malformed time");
+      return;
    }
 
    auto now = get_now();
 
-   if (time > now) {
+   if (*time > now) {
       LOG(WARNING) << TAG("app_c::metric_fetch_after")
                    << "Time for `after` is in the future\n";
-      res.set_content(
-          get_json_response(return_codes_e::BAD_REQUEST_400,
-                            "time must be < now (not in the future)"),
-          "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "time must be < now (not in the future)");
       return;
    }
 
-   metric_db_c::fetch_response_s *response =
-       new metric_db_c::fetch_response_s();
+   metric_db_c::fetch_response_s *response = new_fetch_response();
    metric_db_c::fetch_s fetch{.callback = db_cb, .callback_data = response};
 
    // Submit the fetch
-   if (!_metric_db->fetch_after(fetch, node_id, time)) {
+   if (!_metric_db->fetch_after(fetch, node_id, *time)) {
       LOG(WARNING) << TAG("app_c::metric_fetch_after")
                    << "Unable to submit fetch\n";
-      res.set_content(get_json_response(return_codes_e::INTERNAL_SERVER_500,
-                                        "Failed to submit fetch"),
-                      "application/json");
+      set_json_response(res, return_codes_e::INTERNAL_SERVER_500,
+                        "Failed to submit fetch");
       delete response;
       return;
    }
@@ -703,46 +841,41 @@ void app_c::metric_fetch_after(const httplib::Request &req,
 }
 
 void app_c::metric_fetch_before(const httplib::Request &req,
-                                httplib::Response &res) {
+                                httplib::Response &res,
+                                const route_params_t &params) {
    if (!_metric_db) {
-      res.set_content(get_json_response(return_codes_e::BAD_REQUEST_400, "Metric storage not enabled"), "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "Metric storage not enabled");
       return;
    }
 
-   if (!valid_http_req(req, res, 3)) {
-      return;
-   }
-   auto node_id = req.matches[1].str();
+   auto node_id = params.str(0);
 
-   int64_t time{0};
-   {
-      std::stringstream ts_ss(req.matches[2].str());
-      ts_ss >> time;
+   auto time = params.as<int64_t>(1);
+   if (!time.has_value()) {
+      set_json_response(res, return_codes_e::BAD_REQUEST_400, "malformed time");
+      return;
    }
 
    auto now = get_now();
 
-   if (time > now) {
+   if (*time > now) {
       LOG(WARNING) << TAG("app_c::metric_fetch_before")
                    << "Time for `after` is in the future\n";
-      res.set_content(
-          get_json_response(return_codes_e::BAD_REQUEST_400,
-                            "time must be < now (not in the future)"),
-          "application/json");
+      set_json_response(res, return_codes_e::BAD_REQUEST_400,
+                        "time must be < now (not in the future)");
       return;
    }
 
-   metric_db_c::fetch_response_s *response =
-       new metric_db_c::fetch_response_s();
+   metric_db_c::fetch_response_s *response = new_fetch_response();
    metric_db_c::fetch_s fetch{.callback = db_cb, .callback_data = response};
 
    // Submit the fetch
-   if (!_metric_db->fetch_before(fetch, node_id, time)) {
+   if (!_metric_db->fetch_before(fetch, node_id, *time)) {
       LOG(WARNING) << TAG("app_c::metric_fetch_before")
                    << "Unable to submit fetch\n";
-      res.set_content(get_json_response(return_codes_e::INTERNAL_SERVER_500,
-                                        "Failed to submit fetch"),
-                      "application/json");
+      set_json_response(res, return_codes_e::INTERNAL_SERVER_500,
+                        "Failed to submit fetch");
       delete response;
       return;
    }
@@ -2,17 +2,23 @@
 #define MONOLITH_SERVICES_APP_HPP
 
 #include <atomic>
+#include <chrono>
 #include <httplib.h>
+#include <string_view>
 #include <thread>
+#include <vector>
 
 #include "db/kv.hpp"
 #include "heartbeats.hpp"
 #include "interfaces/service_if.hpp"
+#include "networking/ingest_server.hpp"
+#include "networking/router.hpp"
 #include "networking/types.hpp"
 #include "portal/portal.hpp"
 #include "services/data_submission.hpp"
 #include "services/metric_db.hpp"
 #include "services/metric_streamer.hpp"
+#include "stats/stats.hpp"
 
 namespace monolith {
 namespace services {
@@ -20,6 +26,20 @@ namespace services {
 //! \brief Main web application
 class app_c : public service_if {
  public:
+   //! \brief HTTP server configuration
+   struct configuration_c {
+      uint32_t workers{0};                  //! Connection threads (0 = auto)
+      uint32_t max_queued{1'024};           //! Connections waiting for a thread
+      uint32_t keep_alive_max_count{5};     //! Requests served per connection
+      uint32_t keep_alive_timeout_sec{5};   //! Idle time before closing
+      uint32_t read_timeout_sec{5};         //! Time allowed to read a request
+      uint32_t write_timeout_sec{5};        //! Time allowed to write a response
+      uint64_t payload_max_bytes{0};        //! Largest body (0 = no limit)
+      uint32_t ingest_port{0};              //! Epoll ingest listener (0 = off)
+      uint32_t ingest_reactors{2};          //! Threads serving the ingest port
+      uint32_t ingest_idle_timeout_sec{60}; //! Close idle ingest connections
+   };
+
    app_c() = delete;
 
    //! \brief Construct the application
@@ -35,6 +55,16 @@ class app_c : public service_if {
          monolith::heartbeats_c *heartbeat_manager,
          monolith::portal::portal_c *portal);
 
+   //! \brief Construct the application with a server configuration
+   //! \param config The HTTP server configuration
+   app_c(monolith::networking::ipv4_host_port_s host_port,
+         monolith::db::kv_c *registrar_db,
+         monolith::services::metric_streamer_c *metric_streamer,
+         monolith::services::data_submission_c *data_submission,
+         monolith::services::metric_db_c *database,
+         monolith::heartbeats_c *heartbeat_manager,
+         monolith::portal::portal_c *portal, configuration_c config);
+
    //! \brief Indicate that we want to serve static resources
    //! \param show Value to set for showing static resources
    void serve_static_resources(bool show);
@@ -46,14 +76,23 @@ class app_c : public service_if {
    virtual bool stop() override final;
 
  private:
+   static constexpr std::chrono::milliseconds LIVE_STREAM_POLL_INTERVAL =
+       std::chrono::milliseconds(500);
+   static constexpr std::chrono::seconds LIVE_STREAM_KEEP_ALIVE_INTERVAL =
+       std::chrono::seconds(15);
+
    enum class return_codes_e {
       OKAY = 200,
       BAD_REQUEST_400 = 400,
       INTERNAL_SERVER_500 = 500,
       NOT_IMPLEMENTED_501 = 501,
+      SERVICE_UNAVAILABLE_503 = 503,
       GATEWAY_TIMEOUT_504 = 504
    };
 
+   static constexpr uint32_t MIN_AUTO_WORKERS = 8;
+
+   configuration_c _config;
    std::string _address;
    uint32_t _port{0};
    monolith::db::kv_c *_registration_db{nullptr};
@@ -63,48 +102,87 @@ class app_c : public service_if {
    monolith::heartbeats_c *_heartbeat_manager{nullptr};
    monolith::portal::portal_c *_portal{nullptr};
    httplib::Server *_app_server{nullptr};
+   monolith::networking::ingest_server_c *_ingest_server{nullptr};
    bool _serve_static_resources{false};
 
-   bool setup_endpoints();
-   std::string get_json_response(const return_codes_e rc,
-                                 const std::string msg);
-   std::string get_raw_json_response(const app_c::return_codes_e rc,
-                                     const std::string json);
-   bool valid_http_req(const httplib::Request &req, httplib::Response &res,
-                       size_t expected_items);
-   void http_root(const httplib::Request &req, httplib::Response &res);
+   using route_params_t = monolith::networking::route_params_c;
+   using handler_f = void (app_c::*)(const httplib::Request &,
+                                     httplib::Response &,
+                                     const route_params_t &);
 
-   void version(const httplib::Request &req, httplib::Response &res);
+   struct route_s {
+      handler_f handler;
+      monolith::stats::histogram_c *latency;
+      bool ingest; // Also served by the ingest server
+   };
+
+   monolith::networking::router_c _router;
+   std::vector<route_s> _routes; // Indexed by the ids given to the router
+
+   void setup_server();
+   bool setup_endpoints();
+   void route(const std::string &pattern, handler_f handler,
+              bool ingest = false);
+   bool dispatch(const httplib::Request &req, httplib::Response &res,
+                 bool ingest_only);
+   void set_json_response(httplib::Response &res, const return_codes_e rc,
+                          std::string_view msg);
+   void set_raw_json_response(httplib::Response &res, const return_codes_e rc,
+                              std::string_view json);
+   metric_db_c::fetch_response_s *new_fetch_response();
+   void http_root(const httplib::Request &req, httplib::Response &res,
+                  const route_params_t &params);
+
+   void version(const httplib::Request &req, httplib::Response &res,
+                const route_params_t &params);
+   void metrics(const httplib::Request &req, httplib::Response &res,
+                const route_params_t &params);
+   void debug_traces(const httplib::Request &req, httplib::Response &res,
+                     const route_params_t &params);
 
    // Stream receiver registration and de-registration
    //
-   void metric_stream_add(const httplib::Request &req, httplib::Response &res);
+   void metric_stream_add(const httplib::Request &req, httplib::Response &res,
+                          const route_params_t &params);
    void metric_stream_delete(const httplib::Request &req,
-                             httplib::Response &res);
-   void metric_heartbeat(const httplib::Request &req, httplib::Response &res);
+                             httplib::Response &res,
+                             const route_params_t &params);
+   void metric_stream_live(const httplib::Request &req, httplib::Response &res,
+                           const route_params_t &params);
+   void metric_heartbeat(const httplib::Request &req, httplib::Response &res,
+                         const route_params_t &params);
 
    // Registrar endpoints
    //
-   void registrar_probe(const httplib::Request &req, httplib::Response &res);
-   void registrar_add(const httplib::Request &req, httplib::Response &res);
-   void registrar_fetch(const httplib::Request &req, httplib::Response &res);
-   void registrar_delete(const httplib::Request &req, httplib::Response &res);
+   void registrar_probe(const httplib::Request &req, httplib::Response &res,
+                        const route_params_t &params);
+   void registrar_add(const httplib::Request &req, httplib::Response &res,
+                      const route_params_t &params);
+   void registrar_fetch(const httplib::Request &req, httplib::Response &res,
+                        const route_params_t &params);
+   void registrar_delete(const httplib::Request &req, httplib::Response &res,
+                         const route_params_t &params);
 
    // Metric endpoints
    //
-   void metric_submit(const httplib::Request &req, httplib::Response &res);
+   void metric_submit(const httplib::Request &req, httplib::Response &res,
+                      const route_params_t &params);
 
    // Metric fetchs
    //
    void handle_fetch(httplib::Response &http_res, const double timeout,
                      metric_db_c::fetch_response_s *res);
-   void metric_fetch_nodes(const httplib::Request &req, httplib::Response &res);
+   void metric_fetch_nodes(const httplib::Request &req, httplib::Response &res,
+                           const route_params_t &params);
    void metric_fetch_sensors(const httplib::Request &req,
-                             httplib::Response &res);
-   void metric_fetch_range(const httplib::Request &req, httplib::Response &res);
-   void metric_fetch_after(const httplib::Request &req, httplib::Response &res);
-   void metric_fetch_before(const httplib::Request &req,
-                            httplib::Response &res);
+                             httplib::Response &res,
+                             const route_params_t &params);
+   void metric_fetch_range(const httplib::Request &req, httplib::Response &res,
+                           const route_params_t &params);
+   void metric_fetch_after(const httplib::Request &req, httplib::Response &res,
+                           const route_params_t &params);
+   void metric_fetch_before(const httplib::Request &req, httplib::Response &res,
+                            const route_params_t &params);
 };
 
 } // namespace services
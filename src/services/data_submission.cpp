@@ -1,5 +1,7 @@
 #include "data_submission.hpp"
 
+#include "stats/registry.hpp"
+#include "stats/trace.hpp"
 #include <chrono>
 #include <crate/externals/aixlog/logger.hpp>
 #include <crate/metrics/heartbeat_v1.hpp>
@@ -18,7 +20,13 @@ data_submission_c::data_submission_c(
     monolith::heartbeats_c *heartbeat_manager)
     : _registrar(registrar), _stream_server(metric_streamer),
       _database(metric_db), _rule_executor(rule_executor),
-      _heartbeat_manager(heartbeat_manager) {}
+      _heartbeat_manager(heartbeat_manager) {
+
+   _stat_queue_depth = &monolith::stats::queue_depth("data_submission");
+   _stat_burst_size = &monolith::stats::burst_size("data_submission");
+   _stat_burst_duration =
+       &monolith::stats::burst_duration_us("data_submission");
+}
 
 bool data_submission_c::start() {
 
@@ -66,6 +74,7 @@ bool data_submission_c::stop() {
             }
             _metric_queue.pop();
          }
+         _stat_queue_depth->set(0);
       }
    }
 
@@ -97,7 +106,10 @@ void data_submission_c::submit_data(crate::metrics::sensor_reading_v1_c &data) {
    // Put the reading in the queue
    {
       const std::lock_guard<std::mutex> lock(_metric_queue_mutex);
-      _metric_queue.push({.submission_attempts = 0, .metric = data});
+      _metric_queue.push({.submission_attempts = 0,
+                          .metric = data,
+                          .trace = monolith::stats::tracer().begin()});
+      _stat_queue_depth->set(_metric_queue.size());
    }
 }
 
@@ -125,8 +137,12 @@ void data_submission_c::submit_metrics() {
          metrics.push_back(_metric_queue.front());
          _metric_queue.pop();
       }
+      _stat_queue_depth->set(_metric_queue.size());
    }
 
+   _stat_burst_size->record(metrics.size());
+   monolith::stats::scoped_timer_c burst_timer(*_stat_burst_duration);
+
    // Now we have up-to MAX_METRICS_PER_BURST metrics to process. Any metrics
    // that for some reason can't be validated will be returned to the queue for
    // later processing up-to MAX_SUBMISSION_ATTEMPTS times
@@ -141,6 +157,11 @@ void data_submission_c::submit_metrics() {
       // Break apart the metric
       auto [ts, node_id, sensor_id, value] = entry.metric.get_data();
 
+      if (entry.trace) {
+         entry.trace->identify(node_id, sensor_id);
+         entry.trace->mark(monolith::stats::trace_c::stage_e::SUBMISSION_QUEUE);
+      }
+
       // Retrieve the node
 
       // TODO: This decodes the node every time we look for something
@@ -182,13 +203,13 @@ void data_submission_c::submit_metrics() {
       // Store the metric in the local database
       //
       if (_database) {
-         _database->store(entry.metric);
+         _database->store(entry.metric, entry.trace);
       }
 
       // Submit the metric to the rule executor to analyze
       //
       if (_rule_executor) {
-         _rule_executor->submit_metric(entry.metric);
+         _rule_executor->submit_metric(entry.metric, entry.trace);
       }
 
       // Fake a heartbeat as we know they're out there
@@ -201,7 +222,8 @@ void data_submission_c::submit_metrics() {
       // Submit to stream server - it may be stopped or otherwise not accepting
       // metrics so we re enqueue it if thats the case
       //
-      if (_stream_server && !_stream_server->submit_metric(entry.metric)) {
+      if (_stream_server &&
+          !_stream_server->submit_metric(entry.metric, entry.trace)) {
 
          // Check to see if the submission attempts indicate that we need to
          // drop the thing
@@ -230,6 +252,7 @@ void data_submission_c::submit_metrics() {
       for (auto &entry : re_enqueue) {
          _metric_queue.push(entry);
       }
+      _stat_queue_depth->set(_metric_queue.size());
    }
 }
 
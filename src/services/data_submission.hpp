@@ -11,6 +11,8 @@
 #include "services/metric_db.hpp"
 #include "services/metric_streamer.hpp"
 #include "services/rule_executor.hpp"
+#include "stats/stats.hpp"
+#include "stats/trace.hpp"
 
 #include <crate/metrics/reading_v1.hpp>
 
@@ -63,6 +65,7 @@ class data_submission_c : public service_if {
    struct db_entry_queue {
       size_t submission_attempts{0};
       crate::metrics::sensor_reading_v1_c metric;
+      monolith::stats::trace_t trace;
    };
 
    monolith::services::metric_streamer_c *_stream_server{nullptr};
@@ -75,6 +78,10 @@ class data_submission_c : public service_if {
 
    monolith::db::kv_c *_registrar{nullptr};
 
+   monolith::stats::gauge_c *_stat_queue_depth{nullptr};
+   monolith::stats::histogram_c *_stat_burst_size{nullptr};
+   monolith::stats::histogram_c *_stat_burst_duration{nullptr};
+
    void run();
    void check_purge();
    void submit_metrics();
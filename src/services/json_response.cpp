@@ -0,0 +1,53 @@
+#include "json_response.hpp"
+
+#include <charconv>
+
+namespace monolith {
+namespace services {
+
+json_response_c::json_response_c(uint32_t status, size_t payload_hint) {
+   open(_buffer, status, payload_hint);
+}
+
+json_response_c &json_response_c::message(std::string_view message) {
+
+   // Escaping is rare, room is only made for the quotes
+   _buffer.reserve(_buffer.size() + message.size() + 3);
+   _buffer.push_back('"');
+   for (auto c : message) {
+      if (c == '"' || c == '\\') {
+         _buffer.push_back('\\');
+      }
+      _buffer.push_back(c);
+   }
+   _buffer.push_back('"');
+   return *this;
+}
+
+json_response_c &json_response_c::raw(std::string_view json) {
+   _buffer.append(json);
+   return *this;
+}
+
+std::string json_response_c::take() {
+   close(_buffer);
+   return std::move(_buffer);
+}
+
+void json_response_c::open(std::string &into, uint32_t status,
+                           size_t payload_hint) {
+   into.clear();
+   into.reserve(ENVELOPE_SIZE + payload_hint);
+   into.append("{\"status\":");
+
+   char digits[10];
+   auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), status);
+   into.append(digits, end);
+
+   into.append(",\"data\":");
+}
+
+void json_response_c::close(std::string &into) { into.push_back('}'); }
+
+} // namespace services
+} // namespace monolith
@@ -0,0 +1,70 @@
+#ifndef MONOLITH_SERVICES_JSON_RESPONSE_HPP
+#define MONOLITH_SERVICES_JSON_RESPONSE_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+   ABOUT:
+      Every app response is wrapped in the same envelope:
+
+         {"status":<code>,"data":<payload>}
+
+      The writer sizes a single buffer for the envelope and its payload up
+   front and writes both into it, so a response is built with one
+   allocation and is then moved into httplib rather than copied. Payloads
+   that are produced elsewhere (database fetches) can be written straight
+   into the buffer after the envelope's prefix.
+*/
+
+namespace monolith {
+namespace services {
+
+//! \brief Writes an app response envelope and its payload into one buffer
+class json_response_c {
+ public:
+   json_response_c() = delete;
+
+   //! \brief Start a response
+   //! \param status The status to place in the envelope
+   //! \param payload_hint Expected size of the payload, used to size the
+   //!        buffer so it won't need to grow
+   json_response_c(uint32_t status, size_t payload_hint = 0);
+
+   //! \brief Write the payload as a json string
+   //! \param message The message, quotes and backslashes are escaped
+   json_response_c &message(std::string_view message);
+
+   //! \brief Write the payload as-is
+   //! \param json The payload, must already be valid json
+   json_response_c &raw(std::string_view json);
+
+   //! \brief Access the buffer to write a payload into directly
+   std::string &buffer() { return _buffer; }
+
+   //! \brief Close the envelope and take the buffer
+   //! \post The writer is left empty
+   std::string take();
+
+   //! \brief Start an envelope in an existing buffer
+   //! \param into The buffer, cleared and then given the envelope's prefix
+   //! \param status The status to place in the envelope
+   //! \param payload_hint Expected size of the payload
+   static void open(std::string &into, uint32_t status,
+                    size_t payload_hint = 0);
+
+   //! \brief Close an envelope started with open()
+   static void close(std::string &into);
+
+ private:
+   // {"status":NNN,"data": ... }
+   static constexpr size_t ENVELOPE_SIZE = 24;
+
+   std::string _buffer;
+};
+
+} // namespace services
+} // namespace monolith
+
+#endif
@@ -1,7 +1,9 @@
 #include "metric_db.hpp"
+#include "stats/registry.hpp"
 #include <crate/externals/aixlog/logger.hpp>
 
 #include <algorithm>
+#include <type_traits>
 
 namespace monolith {
 namespace services {
@@ -19,7 +21,22 @@ uint64_t get_now() {
 metric_db_c::metric_db_c(const std::string &file,
                uint64_t metric_expiration_time_sec) 
    : _file(file), 
-      _metric_expiration_time_sec(metric_expiration_time_sec) {}
+      _metric_expiration_time_sec(metric_expiration_time_sec) {
+
+   auto &stats = monolith::stats::registry();
+   _stat_queue_depth = &monolith::stats::queue_depth("metric_db");
+   _stat_burst_size = &monolith::stats::burst_size("metric_db");
+   _stat_burst_duration = &monolith::stats::burst_duration_us("metric_db");
+   _stat_insert_duration =
+       &stats.histogram("monolith_db_insert_duration_us",
+                        "Time taken to insert a metric into the database");
+   _stat_fetch_duration =
+       &stats.histogram("monolith_db_fetch_duration_us",
+                        "Time taken to run a fetch against the database");
+
+   _request_ring.resize(INITIAL_QUEUE_CAPACITY);
+   _burst_requests.reserve(MAX_BURST);
+}
 
 metric_db_c::~metric_db_c() { stop(); }
 
@@ -97,13 +114,20 @@ bool metric_db_c::stop() {
 */
 bool metric_db_c::purge_metrics() {
    auto now = get_now();
-   auto purge_time = now - _metric_expiration_time_sec;
-   std::string statement = "delete from metrics where timestamp < " + std::to_string(purge_time) + ";";
-   _db->execute(statement.c_str());
+   purge_metrics_before(now - _metric_expiration_time_sec);
    _last_metric_purge = get_now();
    return true;
 }
 
+/*
+   Delete everything stamped before the given time
+*/
+bool metric_db_c::purge_metrics_before(uint64_t timestamp) {
+   std::string statement = "delete from metrics where timestamp < " + std::to_string(timestamp) + ";";
+   _db->execute(statement.c_str());
+   return true;
+}
+
 void metric_db_c::run() {
 
    while (p_running.load()) {
@@ -125,60 +149,70 @@ void metric_db_c::run() {
 
 void metric_db_c::burst() {
 
-   // Check to see if we should do anything
+   // Move a potential subset of the queued requests out to execute
    {
       const std::lock_guard<std::mutex> lock(_request_queue_mutex);
-      if (_request_queue.empty()) {
+      if (!_request_count) {
          return;
       }
+      while (_burst_requests.size() < MAX_BURST && _request_count) {
+         _burst_requests.push_back(std::move(_request_ring[_request_head]));
+         _request_head = (_request_head + 1) % _request_ring.size();
+         _request_count--;
+      }
+      _stat_queue_depth->set(_request_count);
    }
 
-   // Setup outside of the lock
-   uint16_t queries_num{0};
-   std::vector<request_if *> selected_requests;
-   selected_requests.reserve(MAX_BURST);
-
-   // Retrieve a potential subset of the query queue to execute
-   {
-      const std::lock_guard<std::mutex> lock(_request_queue_mutex);
-      while (queries_num++ < MAX_BURST && !_request_queue.empty()) {
-         selected_requests.push_back(_request_queue.front());
-         _request_queue.pop();
+   _stat_burst_size->record(_burst_requests.size());
+   monolith::stats::scoped_timer_c burst_timer(*_stat_burst_duration);
+
+   for (auto &request : _burst_requests) {
+
+      auto request_start = std::chrono::steady_clock::now();
+
+      std::visit(
+          [this](auto &req) {
+             if constexpr (std::is_same_v<std::decay_t<decltype(req)>,
+                                          submission_s>) {
+                execute(req);
+             } else {
+                fetch_metric(req);
+             }
+          },
+          request);
+
+      auto request_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - request_start)
+                            .count();
+      if (std::holds_alternative<submission_s>(request)) {
+         _stat_insert_duration->record(request_us);
+      } else {
+         _stat_fetch_duration->record(request_us);
       }
    }
 
-   for (auto req : selected_requests) {
-
-      // Determine what the request is attempting to do and route it
-      switch (req->type) {
-      case request_type_e::SUBMIT:
-         store_metric(static_cast<submission_c *>(req)->entry);
-         break;
-      case request_type_e::FETCH_NODES:
-         fetch_metric(static_cast<fetch_nodes_c *>(req));
-         break;
-      case request_type_e::FETCH_SENSORS:
-         fetch_metric(static_cast<fetch_sensors_c *>(req));
-         break;
-      case request_type_e::FETCH_RANGE:
-         fetch_metric(static_cast<fetch_range_c *>(req));
-         break;
-      case request_type_e::FETCH_AFTER:
-         fetch_metric(static_cast<fetch_after_c *>(req));
-         break;
-      case request_type_e::FETCH_BEFORE:
-         fetch_metric(static_cast<fetch_before_c *>(req));
-         break;
-      }
+   // Keeps its capacity for the next burst
+   _burst_requests.clear();
+}
 
-      // Clean up the request
-      delete req;
-      req = nullptr;
+void metric_db_c::execute(submission_s &submission) {
+
+   if (submission.trace) {
+      submission.trace->mark(monolith::stats::trace_c::stage_e::DB_QUEUE);
+   }
+
+   store_metric(submission.entry);
+
+   if (submission.trace) {
+      submission.trace->mark(monolith::stats::trace_c::stage_e::DB_INSERT);
+
+      // Let the trace finish now rather than with the rest of the burst
+      submission.trace.reset();
    }
 }
 
 void metric_db_c::store_metric(
-    crate::metrics::sensor_reading_v1_c metrics_entry) {
+    crate::metrics::sensor_reading_v1_c &metrics_entry) {
 
    auto [ts, node_id, sensor_id, value] = metrics_entry.get_data();
    auto stmt = _db->prepare("INSERT INTO metrics (timestamp, node, sensor, "
@@ -192,61 +226,69 @@ void metric_db_c::store_metric(
                 value);
 }
 
-void metric_db_c::fetch_metric(fetch_nodes_c *fetch) {
+void metric_db_c::fetch_metric(fetch_nodes_s &fetch) {
 
    std::string query = "select distinct node from metrics;";
 
    auto stmt = _db->prepare<std::string>(query.c_str());
 
-   std::string json_response = "[";
+   // Appended to anything the requester already placed in the result
+   auto &json_response = fetch.fetch.callback_data->fetch_result;
+   json_response += "[";
    for (const auto &node_name : stmt.execute_cursor()) {
-      json_response += "\"" + node_name + "\",";
+      json_response.push_back('"');
+      json_response.append(node_name);
+      json_response.append("\",");
    }
 
    // if we don't get anything back then we need to be empty,
    // otherwise we have to pop off the comma
-   if (json_response != "[") {
+   if (json_response.back() == ',') {
       json_response.pop_back();
    }
    json_response += "]";
 
-   fetch->fetch.callback_data->fetch_result = json_response;
-   fetch->fetch.callback_data->complete.store(true);
+   fetch.fetch.callback_data->complete.store(true);
 }
 
-void metric_db_c::fetch_metric(fetch_sensors_c *fetch) {
+void metric_db_c::fetch_metric(fetch_sensors_s &fetch) {
 
    std::string query = "select distinct sensor from metrics where node = \"" +
-                       fetch->node + "\";";
+                       fetch.node + "\";";
 
    auto stmt = _db->prepare<std::string>(query.c_str());
 
-   std::string json_response = "[";
+   // Appended to anything the requester already placed in the result
+   auto &json_response = fetch.fetch.callback_data->fetch_result;
+   json_response += "[";
    for (const auto &sensor_name : stmt.execute_cursor()) {
-      json_response += "\"" + sensor_name + "\",";
+      json_response.push_back('"');
+      json_response.append(sensor_name);
+      json_response.append("\",");
    }
 
    // if we don't get anything back then we need to be empty,
    // otherwise we have to pop off the comma
-   if (json_response != "[") {
+   if (json_response.back() == ',') {
       json_response.pop_back();
    }
    json_response += "]";
 
-   fetch->fetch.callback_data->fetch_result = json_response;
-   fetch->fetch.callback_data->complete.store(true);
+   fetch.fetch.callback_data->complete.store(true);
 }
 
-void metric_db_c::fetch_metric(fetch_range_c *fetch) {
+void metric_db_c::fetch_metric(fetch_range_s &fetch) {
 
-   std::string query = " select * from metrics where node = \"" + fetch->node +
-                       "\" and timestamp > " + std::to_string(fetch->start) +
-                       " and timestamp < " + std::to_string(fetch->end) + ";";
+   std::string query = " select * from metrics where node = \"" + fetch.node +
+                       "\" and timestamp > " + std::to_string(fetch.start) +
+                       " and timestamp < " + std::to_string(fetch.end) + ";";
 
    auto stmt = _db->prepare<int, int32_t, std::string, std::string, double>(
        query.c_str());
 
-   std::string json_response = "[";
+   // Appended to anything the requester already placed in the result
+   auto &json_response = fetch.fetch.callback_data->fetch_result;
+   json_response += "[";
    for (const auto &[id, ts, node, sensor, value] : stmt.execute_cursor()) {
 
       // Construct a reading for easy json
@@ -255,31 +297,33 @@ void metric_db_c::fetch_metric(fetch_range_c *fetch) {
       if (!reading.encode_to(encoded)) {
          json_response += "{\"error\":\"Failed to encode reading\"},";
       } else {
-         json_response += encoded + ",";
+         json_response.append(encoded);
+         json_response.push_back(',');
       }
    }
 
    // if we don't get anything back then we need to be empty,
    // otherwise we have to pop off the comma
-   if (json_response != "[") {
+   if (json_response.back() == ',') {
       json_response.pop_back();
    }
    json_response += "]";
 
-   fetch->fetch.callback_data->fetch_result = json_response;
-   fetch->fetch.callback_data->complete.store(true);
+   fetch.fetch.callback_data->complete.store(true);
 }
 
-void metric_db_c::fetch_metric(fetch_after_c *fetch) {
+void metric_db_c::fetch_metric(fetch_after_s &fetch) {
 
-   std::string query = " select * from metrics where node = \"" + fetch->node +
-                       "\" and timestamp > " + std::to_string(fetch->time) +
+   std::string query = " select * from metrics where node = \"" + fetch.node +
+                       "\" and timestamp > " + std::to_string(fetch.time) +
                        ";";
 
    auto stmt = _db->prepare<int, int32_t, std::string, std::string, double>(
        query.c_str());
 
-   std::string json_response = "[";
+   // Appended to anything the requester already placed in the result
+   auto &json_response = fetch.fetch.callback_data->fetch_result;
+   json_response += "[";
    for (const auto &[id, ts, node, sensor, value] : stmt.execute_cursor()) {
 
       // Construct a reading for easy json
@@ -288,31 +332,33 @@ void metric_db_c::fetch_metric(fetch_after_c *fetch) {
       if (!reading.encode_to(encoded)) {
          json_response += "{\"error\":\"Failed to encode reading\"},";
       } else {
-         json_response += encoded + ",";
+         json_response.append(encoded);
+         json_response.push_back(',');
       }
    }
 
    // if we don't get anything back then we need to be empty,
    // otherwise we have to pop off the comma
-   if (json_response != "[") {
+   if (json_response.back() == ',') {
       json_response.pop_back();
    }
    json_response += "]";
 
-   fetch->fetch.callback_data->fetch_result = json_response;
-   fetch->fetch.callback_data->complete.store(true);
+   fetch.fetch.callback_data->complete.store(true);
 }
 
-void metric_db_c::fetch_metric(fetch_before_c *fetch) {
+void metric_db_c::fetch_metric(fetch_before_s &fetch) {
 
-   std::string query = " select * from metrics where node = \"" + fetch->node +
-                       "\" and timestamp < " + std::to_string(fetch->time) +
+   std::string query = " select * from metrics where node = \"" + fetch.node +
+                       "\" and timestamp < " + std::to_string(fetch.time) +
                        ";";
 
    auto stmt = _db->prepare<int, int32_t, std::string, std::string, double>(
        query.c_str());
 
-   std::string json_response = "[";
+   // Appended to anything the requester already placed in the result
+   auto &json_response = fetch.fetch.callback_data->fetch_result;
+   json_response += "[";
    for (const auto &[id, ts, node, sensor, value] : stmt.execute_cursor()) {
 
       // Construct a reading for easy json
@@ -321,19 +367,19 @@ void metric_db_c::fetch_metric(fetch_before_c *fetch) {
       if (!reading.encode_to(encoded)) {
          json_response += "{\"error\":\"Failed to encode reading\"},";
       } else {
-         json_response += encoded + ",";
+         json_response.append(encoded);
+         json_response.push_back(',');
       }
    }
 
    // if we don't get anything back then we need to be empty,
    // otherwise we have to pop off the comma
-   if (json_response != "[") {
+   if (json_response.back() == ',') {
       json_response.pop_back();
    }
    json_response += "]";
 
-   fetch->fetch.callback_data->fetch_result = json_response;
-   fetch->fetch.callback_data->complete.store(true);
+   fetch.fetch.callback_data->complete.store(true);
 }
 
 bool metric_db_c::check_db() {
@@ -350,79 +396,58 @@ bool metric_db_c::check_db() {
    return true;
 }
 
-bool metric_db_c::store(crate::metrics::sensor_reading_v1_c metrics_entry) {
+bool metric_db_c::enqueue(request_t request) {
 
    if (!check_db()) {
       return false;
    }
 
-   // Enqueue the item to be put into the database
    const std::lock_guard<std::mutex> lock(_request_queue_mutex);
-   _request_queue.push(new submission_c(metrics_entry));
-   return true;
-}
 
-bool metric_db_c::fetch_nodes(fetch_s fetch) {
-
-   if (!check_db()) {
-      return false;
+   // Once full, double the ring, keeping the queued requests in order
+   if (_request_count == _request_ring.size()) {
+      std::vector<request_t> grown(_request_ring.size() * 2);
+      for (size_t i = 0; i < _request_count; i++) {
+         grown[i] = std::move(
+             _request_ring[(_request_head + i) % _request_ring.size()]);
+      }
+      _request_ring = std::move(grown);
+      _request_head = 0;
    }
 
-   // Enqueue the item to be put into the database
-   const std::lock_guard<std::mutex> lock(_request_queue_mutex);
-   _request_queue.push(new fetch_nodes_c(fetch));
+   _request_ring[(_request_head + _request_count) % _request_ring.size()] =
+       std::move(request);
+   _request_count++;
+   _stat_queue_depth->add(1);
    return true;
 }
 
-bool metric_db_c::fetch_sensors(fetch_s fetch, std::string node_id) {
+bool metric_db_c::store(crate::metrics::sensor_reading_v1_c metrics_entry,
+                        monolith::stats::trace_t trace) {
+   return enqueue(submission_s{std::move(metrics_entry), std::move(trace)});
+}
 
-   if (!check_db()) {
-      return false;
-   }
+bool metric_db_c::fetch_nodes(fetch_s fetch) {
+   return enqueue(fetch_nodes_s{fetch});
+}
 
-   // Enqueue the item to be put into the database
-   const std::lock_guard<std::mutex> lock(_request_queue_mutex);
-   _request_queue.push(new fetch_sensors_c(fetch, node_id));
-   return true;
+bool metric_db_c::fetch_sensors(fetch_s fetch, std::string node_id) {
+   return enqueue(fetch_sensors_s{fetch, std::move(node_id)});
 }
 
 bool metric_db_c::fetch_range(fetch_s fetch, std::string node_id, int64_t start,
                               int64_t end) {
-
-   if (!check_db()) {
-      return false;
-   }
-
-   // Enqueue the item to be put into the database
-   const std::lock_guard<std::mutex> lock(_request_queue_mutex);
-   _request_queue.push(new fetch_range_c(fetch, node_id, start, end));
-   return true;
+   return enqueue(fetch_range_s{fetch, std::move(node_id), start, end});
 }
 
 bool metric_db_c::fetch_after(fetch_s fetch, std::string node_id,
                               int64_t time) {
-
-   if (!check_db()) {
-      return false;
-   }
-
-   // Enqueue the item to be put into the database
-   const std::lock_guard<std::mutex> lock(_request_queue_mutex);
-   _request_queue.push(new fetch_after_c(fetch, node_id, time));
-   return true;
+   return enqueue(fetch_after_s{fetch, std::move(node_id), time});
 }
 
 bool metric_db_c::fetch_before(fetch_s fetch, std::string node_id,
                                int64_t time) {
-
-   if (!check_db()) {
-      return false;
-   }
-
-   // Enqueue the item to be put into the database
-   const std::lock_guard<std::mutex> lock(_request_queue_mutex);
-   _request_queue.push(new fetch_before_c(fetch, node_id, time));
-   return true;
+   return enqueue(fetch_before_s{fetch, std::move(node_id), time});
 }
 
 } // namespace services
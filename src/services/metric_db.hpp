@@ -2,22 +2,31 @@
 #define MONOLITH_DB_METRICS_HPP
 
 #include "interfaces/service_if.hpp"
+#include "stats/stats.hpp"
+#include "stats/trace.hpp"
 #include <atomic>
 #include <crate/metrics/reading_v1.hpp>
 #include <functional>
 #include <mutex>
-#include <queue>
 #include <sqlitelib.h>
 #include <string>
+#include <variant>
+#include <vector>
 /*
    ABOUT:
       Long term storage for submitted metrics
 
-      This object is not yet developed. Data submission object calls into store,
-      but it returns out and sends a log message saying its not yet developed.
+      Stores and fetches are queued as requests and run by the database
+   thread in bursts. Requests are held by value in a ring that only
+   allocates when it has to grow, so queuing a reading doesn't touch the
+   heap beyond the reading itself.
 */
 
 namespace monolith {
+namespace bench {
+class metric_db_access_c;
+}
+
 namespace services {
 
 //! \brief Metric database
@@ -27,7 +36,8 @@ class metric_db_c : public service_if {
 
    //! \brief A structure representing the response to a fetch
    struct fetch_response_s {
-      std::string fetch_result; //! The data returned from the fetch
+      std::string fetch_result; //! The data returned from the fetch, appended
+                                //! to anything already held here
       std::atomic<bool> complete{
           false}; //! Will become true when the fetch response is complete
       std::atomic<bool> timeout{
@@ -55,8 +65,10 @@ class metric_db_c : public service_if {
 
    //! \brief Store a metrics entry
    //! \param metrics_entry The metric to store
+   //! \param trace The metric's trace, if it is being traced
    //! \returns true iff the database is open and the metric could be queued
-   bool store(crate::metrics::sensor_reading_v1_c metrics_entry);
+   bool store(crate::metrics::sensor_reading_v1_c metrics_entry,
+              monolith::stats::trace_t trace = nullptr);
 
    bool check_db();
    bool fetch_nodes(fetch_s fetch);
@@ -71,106 +83,81 @@ class metric_db_c : public service_if {
    virtual bool stop() override final;
 
  private:
+   // Lets the microbenchmarks time the storage paths without the thread
+   friend class monolith::bench::metric_db_access_c;
+
    static constexpr uint16_t MAX_BURST = 100;
    static constexpr uint64_t METRIC_PURGE_CHECK_INTERVAL_SEC = 30;
 
-   enum class request_type_e {
-      SUBMIT,
-      FETCH_NODES,
-      FETCH_SENSORS,
-      FETCH_RANGE,
-      FETCH_AFTER,
-      FETCH_BEFORE
-   };
-
-   class request_if {
-    public:
-      request_if() = delete;
-      virtual ~request_if() {}
-      request_if(request_type_e type) : type(type) {}
-      request_type_e type;
-   };
+   static constexpr size_t INITIAL_QUEUE_CAPACITY = 1024;
 
-   class submission_c : public request_if {
-    public:
-      submission_c() = delete;
-      submission_c(crate::metrics::sensor_reading_v1_c metrics_entry)
-          : request_if(request_type_e::SUBMIT), entry(metrics_entry) {}
+   struct submission_s {
       crate::metrics::sensor_reading_v1_c entry;
+      monolith::stats::trace_t trace;
    };
 
-   class fetch_nodes_c : public request_if {
-    public:
-      fetch_nodes_c() = delete;
-      fetch_nodes_c(fetch_s metrics_fetch)
-          : request_if(request_type_e::FETCH_NODES), fetch(metrics_fetch) {}
+   struct fetch_nodes_s {
       fetch_s fetch;
    };
 
-   class fetch_sensors_c : public request_if {
-    public:
-      fetch_sensors_c() = delete;
-      fetch_sensors_c(fetch_s metrics_fetch, std::string node_id)
-          : request_if(request_type_e::FETCH_SENSORS), node(node_id),
-            fetch(metrics_fetch) {}
-      std::string node;
+   struct fetch_sensors_s {
       fetch_s fetch;
+      std::string node;
    };
 
-   class fetch_range_c : public request_if {
-    public:
-      fetch_range_c() = delete;
-      fetch_range_c(fetch_s metrics_fetch, std::string node_id, int64_t start,
-                    int64_t end)
-          : request_if(request_type_e::FETCH_RANGE), node(node_id), start(start),
-            end(end), fetch(metrics_fetch) {}
+   struct fetch_range_s {
+      fetch_s fetch;
       std::string node;
       int64_t start;
       int64_t end;
-      fetch_s fetch;
    };
 
-   class fetch_after_c : public request_if {
-    public:
-      fetch_after_c() = delete;
-      fetch_after_c(fetch_s metrics_fetch, std::string node_id, int64_t time)
-          : request_if(request_type_e::FETCH_AFTER), node(node_id), time(time),
-            fetch(metrics_fetch) {}
+   struct fetch_after_s {
+      fetch_s fetch;
       std::string node;
       int64_t time;
-      fetch_s fetch;
    };
 
-   class fetch_before_c : public request_if {
-    public:
-      fetch_before_c() = delete;
-      fetch_before_c(fetch_s metrics_fetch, std::string node_id, int64_t time)
-          : request_if(request_type_e::FETCH_BEFORE), node(node_id), time(time),
-            fetch(metrics_fetch) {}
+   struct fetch_before_s {
+      fetch_s fetch;
       std::string node;
       int64_t time;
-      fetch_s fetch;
    };
 
+   using request_t = std::variant<submission_s, fetch_nodes_s, fetch_sensors_s,
+                                  fetch_range_s, fetch_after_s, fetch_before_s>;
+
    std::string _file;
    sqlitelib::Sqlite *_db{nullptr};
    std::mutex _request_queue_mutex;
-   std::queue<request_if *> _request_queue;
+   std::vector<request_t> _request_ring; // Grows (doubles) once full
+   size_t _request_head{0};
+   size_t _request_count{0};
+   std::vector<request_t> _burst_requests;
    uint64_t _metric_expiration_time_sec{0};
    uint64_t _last_metric_purge{0};
 
+   monolith::stats::gauge_c *_stat_queue_depth{nullptr};
+   monolith::stats::histogram_c *_stat_burst_size{nullptr};
+   monolith::stats::histogram_c *_stat_burst_duration{nullptr};
+   monolith::stats::histogram_c *_stat_insert_duration{nullptr};
+   monolith::stats::histogram_c *_stat_fetch_duration{nullptr};
+
    bool purge_metrics();
+   bool purge_metrics_before(uint64_t timestamp);
 
+   bool enqueue(request_t request);
    void run();
    void burst();
 
    // Handle the individual types of access to the database
-   void store_metric(crate::metrics::sensor_reading_v1_c metrics_entry);
-   void fetch_metric(fetch_nodes_c *fetch);
-   void fetch_metric(fetch_sensors_c *fetch);
-   void fetch_metric(fetch_range_c *fetch);
-   void fetch_metric(fetch_after_c *fetch);
-   void fetch_metric(fetch_before_c *fetch);
+   void execute(submission_s &submission);
+   void store_metric(crate::metrics::sensor_reading_v1_c &metrics_entry);
+   void fetch_metric(fetch_nodes_s &fetch);
+   void fetch_metric(fetch_sensors_s &fetch);
+   void fetch_metric(fetch_range_s &fetch);
+   void fetch_metric(fetch_after_s &fetch);
+   void fetch_metric(fetch_before_s &fetch);
 };
 
 } // namespace services
@@ -1,4 +1,6 @@
 #include "metric_streamer.hpp"
+#include "stats/registry.hpp"
+#include <algorithm>
 #include <crate/externals/aixlog/logger.hpp>
 #include <crate/metrics/streams/stream_data_v1.hpp>
 #include <crate/networking/message_writer.hpp>
@@ -8,9 +10,74 @@ namespace services {
 
 using namespace std::chrono_literals;
 
-metric_streamer_c::metric_streamer_c() {}
+namespace {
+
+// Estimate the encoded size of a reading without actually encoding it
+//
+uint32_t estimate_reading_size(crate::metrics::sensor_reading_v1_c &metric,
+                               uint32_t overhead) {
+   auto [timestamp, node_id, sensor_id, value] = metric.get_data();
+   return overhead + node_id.size() + sensor_id.size();
+}
+
+} // namespace
+
+metric_streamer_c::metric_streamer_c()
+    : metric_streamer_c(configuration_c()) {}
+
+metric_streamer_c::metric_streamer_c(configuration_c config)
+    : _config(config) {
+
+   // A zero threshold would never let a batch take a single reading
+   if (_config.max_batch_readings == 0) {
+      _config.max_batch_readings = 1;
+   }
+   if (_config.max_batch_bytes == 0) {
+      _config.max_batch_bytes = 1;
+   }
+   if (_config.max_queued_metrics == 0) {
+      _config.max_queued_metrics = 1;
+   }
+
+   if (!_config.spool_path.empty()) {
+      _spool =
+          new monolith::db::spool_c(_config.spool_path, _config.spool_max_bytes);
+   }
+
+   _stat_queue_depth = &monolith::stats::queue_depth("metric_streamer");
+   _stat_burst_size = &monolith::stats::burst_size("metric_streamer");
+   _stat_burst_duration =
+       &monolith::stats::burst_duration_us("metric_streamer");
+   _stat_send_failures = &monolith::stats::registry().counter(
+       "monolith_stream_send_failures_total",
+       "Stream packages that could not be written to a receiver");
+   _stat_dropped = &monolith::stats::registry().counter(
+       "monolith_stream_overflow_total",
+       "Metrics that did not fit in the stream queue",
+       {{"outcome", "dropped"}});
+   _stat_spooled = &monolith::stats::registry().counter(
+       "monolith_stream_overflow_total",
+       "Metrics that did not fit in the stream queue",
+       {{"outcome", "spooled"}});
+}
+
+metric_streamer_c::~metric_streamer_c() {
+   stop();
+   if (_spool) {
+      delete _spool;
+      _spool = nullptr;
+   }
+}
 
 bool metric_streamer_c::start() {
+
+   if (_spool && !_spool->open()) {
+      LOG(ERROR) << TAG("metric_streamer_c::start")
+                 << "Failed to open overflow spool : " << _config.spool_path
+                 << "\n";
+      return false;
+   }
+
    _accepting_metrics.store(true);
    p_running.store(true);
 
@@ -23,6 +90,7 @@ bool metric_streamer_c::stop() {
    _accepting_metrics.store(false);
 
    p_running.store(false);
+   _metric_queue_cv.notify_all();
 
    if (p_thread.joinable()) {
       p_thread.join();
@@ -46,51 +114,237 @@ void metric_streamer_c::del_destination(const std::string &address,
 }
 
 bool metric_streamer_c::submit_metric(
-    crate::metrics::sensor_reading_v1_c metric) {
+    crate::metrics::sensor_reading_v1_c metric,
+    monolith::stats::trace_t trace) {
    if (!_accepting_metrics.load()) {
       LOG(INFO) << TAG("metric_streamer_c::submit_metric")
                 << "Not accepting metrics at this time\n";
       return false;
    }
 
-   const std::lock_guard<std::mutex> lock(_metric_queue_mutex);
-   _metric_queue.push(metric);
+   // Live subscribers get their copy straight away, they never take
+   // anything out of the queue kept for the stream receivers
+   //
+   if (_has_subscribers.load()) {
+      deliver_to_subscribers(metric);
+   }
+
+   bool notify{false};
+   {
+      const std::lock_guard<std::mutex> lock(_metric_queue_mutex);
+
+      // Anything already in the spool is older than this metric, so it has to
+      // go in behind them to keep the stream in order
+      if (spool_waiting()) {
+         std::string encoded;
+         if (metric.encode_to(encoded) && _spool->append(encoded)) {
+            _metrics_spooled++;
+            _stat_spooled->add();
+         } else {
+            _metrics_dropped++;
+            _stat_dropped->add();
+         }
+         return true;
+      }
+
+      auto size = estimate_reading_size(metric, ESTIMATED_READING_OVERHEAD_BYTES);
+      _metric_queue.push_back({.metric = metric,
+                          .estimated_size = size,
+                          .enqueued = std::chrono::steady_clock::now(),
+                          .trace = std::move(trace)});
+      _metric_queue_bytes += size;
+      _stat_queue_depth->set(_metric_queue.size());
+
+      // Only wake the streamer when there is something for it to do: a full
+      // batch, or a first reading whose deadline it has to start waiting on
+      notify = _has_receivers.load() &&
+               (full_batch_queued() || _metric_queue.size() == 1);
+   }
+
+   if (notify) {
+      _metric_queue_cv.notify_one();
+   }
    return true;
 }
 
+metric_streamer_c::live_subscription_c::live_subscription_c(
+    const std::string &node_id, const std::string &sensor_id, size_t capacity)
+    : _node_id(node_id), _sensor_id(sensor_id), _capacity(capacity) {}
+
+bool metric_streamer_c::live_subscription_c::matches(
+    const std::string &node_id, const std::string &sensor_id) {
+   return (_node_id.empty() || _node_id == node_id) &&
+          (_sensor_id.empty() || _sensor_id == sensor_id);
+}
+
+void metric_streamer_c::live_subscription_c::deliver(
+    crate::metrics::sensor_reading_v1_c &metric) {
+   {
+      const std::lock_guard<std::mutex> lock(_buffer_mutex);
+
+      // A slow subscriber loses its oldest metrics, it never holds up the
+      // streamer
+      if (_buffer.size() >= _capacity) {
+         _buffer.pop_front();
+         _dropped++;
+      }
+      _buffer.push_back(metric);
+   }
+   _buffer_cv.notify_one();
+}
+
+std::vector<crate::metrics::sensor_reading_v1_c>
+metric_streamer_c::live_subscription_c::wait(
+    std::chrono::milliseconds timeout) {
+
+   std::vector<crate::metrics::sensor_reading_v1_c> metrics;
+
+   std::unique_lock<std::mutex> lock(_buffer_mutex);
+   _buffer_cv.wait_for(lock, timeout, [this]() { return !_buffer.empty(); });
+
+   metrics.reserve(_buffer.size());
+   while (!_buffer.empty()) {
+      metrics.push_back(_buffer.front());
+      _buffer.pop_front();
+   }
+   return metrics;
+}
+
+uint64_t metric_streamer_c::live_subscription_c::dropped() {
+   const std::lock_guard<std::mutex> lock(_buffer_mutex);
+   return _dropped;
+}
+
+std::shared_ptr<metric_streamer_c::live_subscription_c>
+metric_streamer_c::subscribe(const std::string &node_id,
+                             const std::string &sensor_id) {
+   auto subscription = std::make_shared<live_subscription_c>(
+       node_id, sensor_id, LIVE_SUBSCRIPTION_CAPACITY);
+   {
+      const std::lock_guard<std::mutex> lock(_live_subscriptions_mutex);
+      if (_live_subscriptions.size() >= MAX_LIVE_SUBSCRIPTIONS) {
+         LOG(WARNING) << TAG("metric_streamer_c::subscribe")
+                      << "Maximum number of live subscriptions reached\n";
+         return nullptr;
+      }
+      _live_subscriptions.push_back(subscription);
+   }
+   refresh_has_subscribers();
+   return subscription;
+}
+
+void metric_streamer_c::unsubscribe(
+    std::shared_ptr<live_subscription_c> subscription) {
+   {
+      const std::lock_guard<std::mutex> lock(_live_subscriptions_mutex);
+      std::erase(_live_subscriptions, subscription);
+   }
+   refresh_has_subscribers();
+}
+
+void metric_streamer_c::refresh_has_receivers() {
+   const std::lock_guard<std::mutex> lock(_stream_receivers_mutex);
+   _has_receivers.store(!_stream_receivers.empty());
+}
+
+void metric_streamer_c::refresh_has_subscribers() {
+   const std::lock_guard<std::mutex> lock(_live_subscriptions_mutex);
+   _has_subscribers.store(!_live_subscriptions.empty());
+}
+
+// Delivery never blocks, a full subscriber drops its oldest metric, so it
+// is done with the subscriptions locked rather than copying them for every
+// metric submitted
+//
+void metric_streamer_c::deliver_to_subscribers(
+    crate::metrics::sensor_reading_v1_c &metric) {
+   auto [timestamp, node_id, sensor_id, value] = metric.get_data();
+
+   const std::lock_guard<std::mutex> lock(_live_subscriptions_mutex);
+   for (auto &subscription : _live_subscriptions) {
+      if (subscription->matches(node_id, sensor_id)) {
+         subscription->deliver(metric);
+      }
+   }
+}
+
+metric_streamer_c::overflow_stats_s metric_streamer_c::get_overflow_stats() {
+   const std::lock_guard<std::mutex> lock(_metric_queue_mutex);
+   return {.dropped = _metrics_dropped,
+           .spooled = _metrics_spooled,
+           .spool_pending = _spool ? _spool->size() : 0};
+}
+
+// Expects the metric queue mutex to be held
+//
+bool metric_streamer_c::spool_waiting() { return _spool && !_spool->empty(); }
+
+// Expects the metric queue mutex to be held
+//
+bool metric_streamer_c::full_batch_queued() {
+   return _metric_queue.size() >= _config.max_batch_readings ||
+          _metric_queue_bytes >= _config.max_batch_bytes;
+}
+
+// Expects the metric queue mutex to be held
+//
+bool metric_streamer_c::batch_deadline_reached(
+    std::chrono::steady_clock::time_point now) {
+   if (_metric_queue.empty()) {
+      return false;
+   }
+   return now - _metric_queue.front().enqueued >=
+          std::chrono::milliseconds(_config.max_batch_latency_ms);
+}
+
 void metric_streamer_c::run() {
 
-   auto last_destination_update = std::chrono::high_resolution_clock::now();
-   auto last_metric_data_burst = std::chrono::high_resolution_clock::now();
+   const auto destination_update_interval =
+       std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+           std::chrono::duration<double>(INTERVAL_DESTINATION_UPDATE));
+
+   auto last_destination_update = std::chrono::steady_clock::now();
 
    while (p_running.load()) {
 
       // Check passed time since last destination update to see if we need
       // to go ahead and burst out some stream destination changes
       //
-      std::chrono::duration<double> update_delta =
-          std::chrono::high_resolution_clock::now() - last_destination_update;
-
-      if (update_delta.count() >= INTERVAL_DESTINATION_UPDATE) {
+      if (std::chrono::steady_clock::now() - last_destination_update >=
+          destination_update_interval) {
          perform_destination_updates();
-         last_destination_update = std::chrono::high_resolution_clock::now();
+         last_destination_update = std::chrono::steady_clock::now();
       }
 
-      // Check passed time since last metric data burst to see if we need
-      // to go ahead and burst out some metrics
+      // Sleep until a batch fills up, the oldest reading hits its latency
+      // deadline, or it is time to look at destination updates again -
+      // whichever comes first. Without receivers there is nobody to flush to
+      // so only the destination updates can wake us
       //
-      std::chrono::duration<double> metric_burst_delta =
-          std::chrono::high_resolution_clock::now() - last_metric_data_burst;
+      {
+         std::unique_lock<std::mutex> lock(_metric_queue_mutex);
+
+         auto wake_at = last_destination_update + destination_update_interval;
+         if (_has_receivers.load() && !_metric_queue.empty()) {
+            wake_at = std::min(
+                wake_at,
+                _metric_queue.front().enqueued +
+                    std::chrono::milliseconds(_config.max_batch_latency_ms));
+         }
 
-      if (metric_burst_delta.count() >= INTERVAL_STREAM_METRICS) {
-         perform_metric_streaming();
-         last_metric_data_burst = std::chrono::high_resolution_clock::now();
+         _metric_queue_cv.wait_until(lock, wake_at, [&]() {
+            return !p_running.load() ||
+                   (_has_receivers.load() &&
+                    (full_batch_queued() ||
+                     batch_deadline_reached(std::chrono::steady_clock::now()) ||
+                     (spool_waiting() &&
+                      _metric_queue.size() < _config.max_batch_readings)));
+         });
       }
 
-      // Thread sleep - Everything is in terms of seconds in operation so this
-      // won't hold anything up, but it will keep the thread from grinding
-      //
-      std::this_thread::sleep_for(1ms);
+      refill_from_spool();
+
+      perform_metric_streaming();
 
       // Check to see if we need to purge metrics from memory
       //
@@ -101,14 +355,95 @@ void metric_streamer_c::run() {
 void metric_streamer_c::check_purge() {
 
    const std::lock_guard<std::mutex> lock(_metric_queue_mutex);
-   if (_metric_queue.size() < MAX_QUEUED_METRICS) {
+   if (_metric_queue.size() < _config.max_queued_metrics) {
+      return;
+   }
+
+   // Everything in memory is older than everything in the spool, so the tail
+   // can only be spilled while the spool is empty
+   if (_spool && _spool->empty()) {
+      spill_to_spool(_config.max_queued_metrics / 2);
       return;
    }
 
    uint32_t removed{0};
-   while (removed++ < NUM_DROP_METRICS) {
-      _metric_queue.pop();
+   while (removed++ < NUM_DROP_METRICS && !_metric_queue.empty()) {
+      _metric_queue_bytes -= _metric_queue.front().estimated_size;
+      _metric_queue.pop_front();
+      _metrics_dropped++;
+      _stat_dropped->add();
+   }
+   _stat_queue_depth->set(_metric_queue.size());
+
+   LOG(WARNING) << TAG("metric_streamer_c::check_purge")
+                << "Metric queue full, " << _metrics_dropped
+                << " metrics dropped so far\n";
+}
+
+// Move everything past the first `keep` metrics into the spool, in order.
+// Expects the metric queue mutex to be held
+//
+void metric_streamer_c::spill_to_spool(size_t keep) {
+
+   uint64_t spilled{0};
+   for (auto it = _metric_queue.begin() + keep; it != _metric_queue.end();
+        ++it) {
+      std::string encoded;
+      if (it->metric.encode_to(encoded) && _spool->append(encoded)) {
+         spilled++;
+      } else {
+         _metrics_dropped++;
+         _stat_dropped->add();
+      }
+      _metric_queue_bytes -= it->estimated_size;
+   }
+   _metric_queue.erase(_metric_queue.begin() + keep, _metric_queue.end());
+   _metrics_spooled += spilled;
+   _stat_spooled->add(spilled);
+   _stat_queue_depth->set(_metric_queue.size());
+
+   LOG(WARNING) << TAG("metric_streamer_c::spill_to_spool")
+                << "Metric queue full, spilled " << spilled
+                << " metrics to spool (" << _spool->size() << " pending, "
+                << _metrics_dropped << " dropped so far)\n";
+}
+
+// Once receivers have caught up with what is in memory, pull the spooled
+// metrics back in so they can go out
+//
+void metric_streamer_c::refill_from_spool() {
+
+   if (!_has_receivers.load()) {
+      return;
    }
+
+   const std::lock_guard<std::mutex> lock(_metric_queue_mutex);
+   if (!spool_waiting() ||
+       _metric_queue.size() >= _config.max_batch_readings) {
+      return;
+   }
+
+   const size_t refill_to = std::max<size_t>(_config.max_queued_metrics / 2, 1);
+
+   std::string encoded;
+   while (_metric_queue.size() < refill_to &&
+          _spool->read(encoded)) {
+
+      crate::metrics::sensor_reading_v1_c metric;
+      if (!metric.decode_from(encoded)) {
+         _metrics_dropped++;
+         _stat_dropped->add();
+         continue;
+      }
+
+      // These have already waited long enough, so they are stamped as due
+      auto size = estimate_reading_size(metric, ESTIMATED_READING_OVERHEAD_BYTES);
+      _metric_queue.push_back({.metric = metric,
+                               .estimated_size = size,
+                               .enqueued = {}});
+      _metric_queue_bytes += size;
+   }
+   _stat_queue_depth->set(_metric_queue.size());
 }
 
 // Check if an entry exists within the stream receivers, if it does
@@ -160,6 +495,7 @@ void metric_streamer_c::perform_destination_updates() {
                const std::lock_guard<std::mutex> lock(_stream_receivers_mutex);
                _stream_receivers.push_back(update.entry);
             }
+            refresh_has_receivers();
             LOG(TRACE) << TAG("metric_streamer_c::perform_destination_updates")
                        << "Added: " << update.entry.address << ":"
                        << update.entry.port << "\n";
@@ -175,6 +511,7 @@ void metric_streamer_c::perform_destination_updates() {
                const std::lock_guard<std::mutex> lock(_stream_receivers_mutex);
                _stream_receivers.erase(_stream_receivers.begin() + idx);
             }
+            refresh_has_receivers();
 
             LOG(TRACE) << TAG("metric_streamer_c::perform_destination_updates")
                        << "Deleted: " << update.entry.address << ":"
@@ -189,87 +526,152 @@ void metric_streamer_c::perform_destination_updates() {
 void metric_streamer_c::perform_metric_streaming() {
 
    // If we have nobody to send data to why send data?
+   if (!_has_receivers.load()) {
+      return;
+   }
+
+   // Create a copy of the receivers so we don't hold their mutex while
+   // performing network operations
+   //
+   std::vector<endpoint> receivers;
    {
       const std::lock_guard<std::mutex> lock(_stream_receivers_mutex);
-      if (_stream_receivers.empty()) {
-         //      LOG(INFO) << TAG("metric_streamer_c::perform_metric_streaming")
-         //      << "No receivers present\n";
-         return;
-      }
+      receivers = _stream_receivers;
+   }
+   if (receivers.empty()) {
+      return;
    }
 
-   // If we have no data we have no purpose being here
-   {
-      const std::lock_guard<std::mutex> lock(_metric_queue_mutex);
-      if (_metric_queue.empty()) {
-         //       LOG(INFO) <<
-         //       TAG("metric_streamer_c::perform_metric_streaming")
-         //       << "No metrics present\n";
-         return;
-      }
+   // Anything that has waited out the latency target at the start of this
+   // wakeup goes out even if it only makes up a partial batch. Everything
+   // else only goes out in full batches. Each batch is sent as soon as it
+   // is packaged, and a wakeup only takes so many of them; the next one
+   // comes straight away while anything is still due
+   //
+   const auto now = std::chrono::steady_clock::now();
+   uint64_t readings_pulled{0};
+
+   std::vector<stream_target_s> targets;
+   targets.reserve(receivers.size());
+   for (auto &destination : receivers) {
+      targets.push_back({.destination = destination});
    }
 
-   size_t number_completed{0};
-   crate::metrics::streams::stream_data_v1_c stream_package(_metric_sequence++);
+   std::vector<monolith::stats::trace_t> traces;
 
-   // Retrieve either a subset or all of the metrics, up to
-   // BURST_STREAM_METRIC in an anonymous scope so we don't keep
-   // the mutex too long
-   //
-   {
-      const std::lock_guard<std::mutex> lock(_metric_queue_mutex);
+   for (uint32_t batch = 0; batch < MAX_BATCHES_PER_WAKEUP; batch++) {
 
-      while (number_completed++ < BURST_STREAM_METRIC &&
-             !_metric_queue.empty()) {
+      crate::metrics::streams::stream_data_v1_c stream_package(
+          _metric_sequence);
 
-         stream_package.add_metric(_metric_queue.front());
-         _metric_queue.pop();
+      // Pull a single batch out in an anonymous scope so we don't keep the
+      // mutex while sending
+      //
+      {
+         const std::lock_guard<std::mutex> lock(_metric_queue_mutex);
+
+         if (!full_batch_queued() && !batch_deadline_reached(now)) {
+            break;
+         }
+
+         uint32_t batch_readings{0};
+         uint64_t batch_bytes{0};
+         while (!_metric_queue.empty() &&
+                batch_readings < _config.max_batch_readings &&
+                batch_bytes < _config.max_batch_bytes) {
+
+            auto &entry = _metric_queue.front();
+            batch_readings++;
+            batch_bytes += entry.estimated_size;
+            _metric_queue_bytes -= entry.estimated_size;
+
+            stream_package.add_metric(entry.metric);
+            if (entry.trace) {
+               entry.trace->mark(monolith::stats::trace_c::stage_e::STREAM_QUEUE);
+               traces.push_back(std::move(entry.trace));
+            }
+            _metric_queue.pop_front();
+         }
+         readings_pulled += batch_readings;
+         _stat_queue_depth->set(_metric_queue.size());
       }
-   }
 
-   // Stamp the package to finalize it for sending
-   //
-   stream_package.stamp();
+      _metric_sequence++;
 
-   std::string encoded_package;
-   if (!stream_package.encode_to(encoded_package)) {
-      LOG(ERROR)
-          << TAG("metric_streamer_c::perform_metric_streaming")
-          << "Failed to encode stream package (repercussion: data loss)\n";
-      return;
+      // Stamp the package to finalize it for sending
+      //
+      stream_package.stamp();
+
+      std::string encoded_package;
+      bool sent{false};
+      if (stream_package.encode_to(encoded_package)) {
+         sent = send_package(targets, encoded_package);
+      } else {
+         LOG(ERROR) << TAG("metric_streamer_c::perform_metric_streaming")
+                    << "Failed to encode stream package (repercussion: data "
+                       "loss)\n";
+      }
+
+      // Traces of readings that never made it out stop at the queue stage
+      //
+      if (sent) {
+         for (auto &trace : traces) {
+            trace->mark(monolith::stats::trace_c::stage_e::STREAM_SEND);
+         }
+      }
+      traces.clear();
    }
 
-   // Create a copy of the receivers so we don't hold the mutex while
-   // performing network operations
-   //
-   std::vector<endpoint> receivers;
-   {
-      const std::lock_guard<std::mutex> lock(_stream_receivers_mutex);
-      receivers = _stream_receivers;
+   // Most wakeups find nothing due, only bursts that moved readings count
+   if (readings_pulled) {
+      _stat_burst_size->record(readings_pulled);
+      _stat_burst_duration->record(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - now)
+              .count());
    }
+}
 
-   // Send data to the copy of receivers that we have now
-   //
-   for (auto &destination : receivers) {
+// Write a package to every receiver that hasn't failed yet during this
+// wakeup
+//
+bool metric_streamer_c::send_package(std::vector<stream_target_s> &targets,
+                                     const std::string &encoded_package) {
+
+   bool sent{false};
+   for (auto &target : targets) {
 
-      // Create a writer for the endpoint and try to send off the data
+      if (target.failed) {
+         continue;
+      }
+
+      // Writers are only made once there is something to send and are kept
+      // for the rest of the wakeup
       //
-      bool okay{false};
-      auto writer = crate::networking::message_writer_c(destination.address,
-                                                        destination.port);
+      if (!target.writer) {
+         target.writer = std::make_unique<crate::networking::message_writer_c>(
+             target.destination.address, target.destination.port);
+      }
 
-      writer.write(encoded_package, okay);
+      bool okay{false};
+      target.writer->write(encoded_package, okay);
 
-      // If the data fails to be written there is no action we can take. The
-      // endpoint might be down, we really don't know.
+      // If the data fails to be written there is no action we can take.
+      // The endpoint might be down, we really don't know so we don't
+      // bother it with the rest of the batches
       //
       if (!okay) {
-         LOG(WARNING) << TAG("metric_streamer_c::perform_metric_streaming")
+         target.failed = true;
+         _stat_send_failures->add();
+         LOG(WARNING) << TAG("metric_streamer_c::send_package")
                       << "Writer failed to send data to ["
-                      << destination.address << ":" << destination.port
-                      << "]\n";
+                      << target.destination.address << ":"
+                      << target.destination.port << "]\n";
+         continue;
       }
+      sent = true;
    }
+   return sent;
 }
 
 } // namespace services
@@ -1,9 +1,17 @@
 #ifndef MONOLITH_SERVICES_METRIC_STREAMER_HPP
 #define MONOLITH_SERVICES_METRIC_STREAMER_HPP
 
+#include "db/spool.hpp"
 #include "interfaces/service_if.hpp"
+#include "stats/stats.hpp"
+#include "stats/trace.hpp"
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <crate/metrics/reading_v1.hpp>
+#include <crate/networking/message_writer.hpp>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
@@ -13,11 +21,26 @@
    ABOUT:
       The metric streamer servive takes in metrics from the data_submission
    service and holds disperses them out to registered stream receivers. If no
-   receivers are present the metrics are held in memory (up to
-   MAX_QUEUED_METRICS). Once a single receiver is registered the metrics are
-   dumped to the endpoint. Metrics are sent out as soon as receivers and metrics
-   are present. This means receivers only get live data from the time they
-   register.
+   receivers are present the metrics are held in memory (up to the configured
+   max_queued_metrics). Once a single receiver is registered the metrics are
+   dumped to the endpoint. This means receivers only get live data from the
+   time they register.
+
+   When a spool file is configured, metrics that would not fit in memory are
+   spilled to it instead of being dropped and are streamed back out once the
+   in-memory queue has drained. While the spool holds anything all new
+   metrics go to it as well, so order is kept. Metrics are only dropped when
+   the spool itself is full.
+
+   Metrics are batched before being sent. A batch is flushed as soon as it
+   reaches the configured number of readings or estimated size in bytes, or
+   once the oldest queued reading has waited the configured maximum latency.
+   Every wakeup drains the batches that are ready, sending each one as soon
+   as it is packaged, so a busy instance is not limited to one batch per
+   interval and a quiet one does not sit on a handful of readings waiting
+   for a timer. A wakeup takes at most MAX_BATCHES_PER_WAKEUP batches so a
+   deep backlog is never encoded all at once; the streamer simply wakes
+   again while batches are still due.
 */
 
 namespace monolith {
@@ -28,16 +51,77 @@ namespace services {
 class metric_streamer_c : public service_if {
 
  public:
-   //! \brief Create the server
+   //! \brief Batching configuration
+   struct configuration_c {
+      uint32_t max_batch_readings{100}; //! Readings that trigger a flush
+      uint64_t max_batch_bytes{64 * 1024}; //! Estimated bytes that trigger a
+                                           //! flush
+      uint32_t max_batch_latency_ms{250}; //! Longest a reading may wait
+      uint32_t max_queued_metrics{500'000}; //! Metrics held in memory
+      std::string spool_path; //! Overflow spool file (empty = drop overflow)
+      uint64_t spool_max_bytes{256 * 1024 * 1024}; //! Spool size on disk
+   };
+
+   //! \brief Counters describing what happened to overflowing metrics
+   struct overflow_stats_s {
+      uint64_t dropped{0}; //! Metrics lost to time
+      uint64_t spooled{0}; //! Metrics written to the spool
+      uint64_t spool_pending{0}; //! Metrics currently held by the spool
+   };
+
+   //! \brief An in-process subscription to the live metric stream
+   class live_subscription_c {
+    public:
+      live_subscription_c() = delete;
+
+      //! \brief Create the subscription
+      //! \param node_id Only deliver metrics from this node (empty = any)
+      //! \param sensor_id Only deliver metrics from this sensor (empty = any)
+      //! \param capacity Maximum number of metrics buffered
+      live_subscription_c(const std::string &node_id,
+                          const std::string &sensor_id, size_t capacity);
+
+      //! \brief Wait for metrics to be delivered
+      //! \param timeout Maximum time to wait
+      //! \returns The metrics delivered since the last call (may be empty)
+      std::vector<crate::metrics::sensor_reading_v1_c>
+      wait(std::chrono::milliseconds timeout);
+
+      //! \brief Retrieve the number of metrics dropped because the buffer
+      //!        was full
+      uint64_t dropped();
+
+    private:
+      friend class metric_streamer_c;
+
+      std::string _node_id;
+      std::string _sensor_id;
+      size_t _capacity{0};
+      uint64_t _dropped{0};
+      std::deque<crate::metrics::sensor_reading_v1_c> _buffer;
+      std::mutex _buffer_mutex;
+      std::condition_variable _buffer_cv;
+
+      bool matches(const std::string &node_id, const std::string &sensor_id);
+      void deliver(crate::metrics::sensor_reading_v1_c &metric);
+   };
+
+   //! \brief Create the server with the default batching configuration
    metric_streamer_c();
 
+   //! \brief Create the server
+   //! \param config The batching configuration to use
+   metric_streamer_c(configuration_c config);
+
    //! \brief Submit a metric to be streamed to the registered destinations
    //!        if no destinations are registered the metric will be lost to time
    //! \returns true iff the metric gets enqueues for send
    //! \note  This enqueues the metric to be streamed and may not come out
    //! immediatly,
    //!        but the metric will come out in the order they are put in
-   bool submit_metric(crate::metrics::sensor_reading_v1_c metric);
+   //! \param trace The metric's trace, if it is being traced
+   bool submit_metric(crate::metrics::sensor_reading_v1_c metric,
+                      monolith::stats::trace_t trace = nullptr);
 
    //! \brief Add a streaming destination
    //! \param address The destination address
@@ -45,6 +129,24 @@ class metric_streamer_c : public service_if {
    //! \note This enqueues the destination to be added, and may take a moment
    void add_destination(const std::string &address, uint32_t port);
 
+   //! \brief Subscribe to the live metric stream
+   //! \param node_id Only deliver metrics from this node (empty = any)
+   //! \param sensor_id Only deliver metrics from this sensor (empty = any)
+   //! \returns The subscription, or nullptr if there are already
+   //!          MAX_LIVE_SUBSCRIPTIONS subscribers
+   //! \note Unlike destinations, subscriptions take effect immediately.
+   //!       Subscribers are handed a copy of each metric as it is submitted
+   //!       and never take metrics held for the stream receivers
+   std::shared_ptr<live_subscription_c>
+   subscribe(const std::string &node_id, const std::string &sensor_id);
+
+   //! \brief Remove a subscription
+   //! \param subscription The subscription to remove
+   void unsubscribe(std::shared_ptr<live_subscription_c> subscription);
+
+   //! \brief Retrieve the overflow counters
+   overflow_stats_s get_overflow_stats();
+
    //! \brief Delete a streaming destination
    //! \param address The destination address
    //! \param port The port
@@ -55,6 +157,8 @@ class metric_streamer_c : public service_if {
    virtual bool start() override final;
    virtual bool stop() override final;
 
+   virtual ~metric_streamer_c() override;
+
  private:
    /*
       Because outside influences can add/delete endpoints we need to guard
@@ -63,22 +167,24 @@ class metric_streamer_c : public service_if {
       up-to the BURST_UPDATE_DESTINATION number of updates.
 
       Similarly, we need to make sure that metrics being submitted aren't
-      keeping our mutexes locked for too long so we schedule BURST_STREAM_METRIC
-      number of metrics to be burst out to destinations
+      keeping our mutexes locked for too long so the metric queue is only
+      locked long enough to pull a single batch out at a time
    */
    static constexpr uint8_t BURST_UPDATE_DESTINATION =
        10; // Maximum amount of adds that can happen at a time
-   static constexpr uint8_t BURST_STREAM_METRIC =
-       100; // Maximum number of metrics that can be put into a
-            // single stream send
    static constexpr double INTERVAL_DESTINATION_UPDATE =
        2.5; // Interval update period
-   static constexpr double INTERVAL_STREAM_METRICS =
-       0.25; // Interval send out metrics
-   static constexpr uint32_t MAX_QUEUED_METRICS =
-       500'000; // Maximum number of metrics in memory
    static constexpr uint32_t NUM_DROP_METRICS =
-       1000; // Number of metrics to drop when MAX_QUEUED_METRICS is hit
+       1000; // Number of metrics to drop when max_queued_metrics is hit
+   static constexpr uint32_t ESTIMATED_READING_OVERHEAD_BYTES =
+       64; // Encoding overhead of a reading beyond its id strings
+   static constexpr size_t MAX_LIVE_SUBSCRIPTIONS =
+       4; // Maximum number of in-process subscribers (each live http feed
+          // holds onto an http worker thread for as long as it is open)
+   static constexpr size_t LIVE_SUBSCRIPTION_CAPACITY =
+       10'000; // Metrics buffered per subscriber
+   static constexpr uint32_t MAX_BATCHES_PER_WAKEUP =
+       50; // Batches drained before checking destinations/purging again
 
    // We should only have a handful of endpoints to service (<10) realistically
    // so we don't need a fancy map or anything to ensure we can locate items to
@@ -92,6 +198,14 @@ class metric_streamer_c : public service_if {
    std::vector<endpoint> _stream_receivers;
    std::mutex _stream_receivers_mutex;
 
+   // A receiver being sent to during a single wakeup
+   //
+   struct stream_target_s {
+      endpoint destination;
+      std::unique_ptr<crate::networking::message_writer_c> writer;
+      bool failed{false};
+   };
+
    // The updates add/delete are paired here with an endpoint and enqueued
    // together. Consideration of having two seperate queues, one for add, one
    // for delete, was had but deemed pointless. Here we stuff them together and
@@ -112,16 +226,58 @@ class metric_streamer_c : public service_if {
    // happens
    //
    std::atomic<bool> _accepting_metrics{false};
-   std::queue<crate::metrics::sensor_reading_v1_c>
-       _metric_queue; // Outbount queue
+
+   // Each queued metric carries its estimated encoded size so the byte
+   // threshold can be tracked without re-encoding, and the time it was
+   // queued so the latency deadline is measured from the oldest reading
+   //
+   struct queued_metric_s {
+      crate::metrics::sensor_reading_v1_c metric;
+      uint32_t estimated_size{0};
+      std::chrono::steady_clock::time_point enqueued;
+      monolith::stats::trace_t trace;
+   };
+   std::deque<queued_metric_s> _metric_queue; // Outbount queue
+   uint64_t _metric_queue_bytes{0};           // Estimated bytes queued
    std::mutex _metric_queue_mutex;
+   std::condition_variable _metric_queue_cv;
+   std::atomic<bool> _has_receivers{false};   // Stream receivers registered
+   std::atomic<bool> _has_subscribers{false}; // Live subscriptions open
+
+   std::vector<std::shared_ptr<live_subscription_c>> _live_subscriptions;
+   std::mutex _live_subscriptions_mutex;
    uint64_t _metric_sequence{0}; // Monotonically increasing sequence counter
 
+   configuration_c _config;
+
+   // Overflow handling, the spool is guarded by the metric queue mutex
+   //
+   monolith::db::spool_c *_spool{nullptr};
+   uint64_t _metrics_dropped{0};
+   uint64_t _metrics_spooled{0};
+
+   monolith::stats::gauge_c *_stat_queue_depth{nullptr};
+   monolith::stats::histogram_c *_stat_burst_size{nullptr};
+   monolith::stats::histogram_c *_stat_burst_duration{nullptr};
+   monolith::stats::counter_c *_stat_send_failures{nullptr};
+   monolith::stats::counter_c *_stat_dropped{nullptr};
+   monolith::stats::counter_c *_stat_spooled{nullptr};
+
    void run();
    void check_purge();
+   void spill_to_spool(size_t keep);
+   void refill_from_spool();
+   bool spool_waiting();
    bool contains_endpoint(endpoint &e, size_t &idx);
    void perform_destination_updates();
+   void refresh_has_receivers();
+   void refresh_has_subscribers();
+   void deliver_to_subscribers(crate::metrics::sensor_reading_v1_c &metric);
    void perform_metric_streaming();
+   bool send_package(std::vector<stream_target_s> &targets,
+                     const std::string &encoded_package);
+   bool full_batch_queued();
+   bool batch_deadline_reached(std::chrono::steady_clock::time_point now);
 };
 
 } // namespace services
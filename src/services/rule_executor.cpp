@@ -1,203 +1,67 @@
 #include "rule_executor.hpp"
+#include "stats/registry.hpp"
 #include <crate/externals/aixlog/logger.hpp>
 #include <filesystem>
+#include <functional>
 
-extern "C" {
-#include <lua5.3/lauxlib.h>
-#include <lua5.3/lua.h>
-#include <lua5.3/lualib.h>
-} // extern "C"
-
-using namespace std::chrono_literals;
-
-namespace {
-std::atomic<bool> setup{false};
-std::atomic<bool> file_open{false};
-std::atomic<uint64_t> instance_counter{0};
-lua_State *L{nullptr};
-monolith::alert::alert_manager_c *alert_manager{nullptr};
-monolith::services::action_dispatch_c *action_dispatcher{nullptr};
-
-constexpr char LUA_FUNC_ACCEPT_READING_V1[] = "accept_reading_v1_from_monolith";
-
-// Check return from LUA to ensure that it is LUA_OK
-bool check_lua(lua_State *L, int r) {
-   if (r != LUA_OK) {
-      std::string err = lua_tostring(L, -1);
-      LOG(ERROR) << TAG("check_lua") << "Error: " << err << "\n";
-      return false;
-   }
-   return true;
-}
-
-bool check_file_for_reading_v1(std::string file) {
-
-   lua_State *_L = luaL_newstate();
-   luaL_openlibs(_L);
-
-   // Load the file and check to see it it is okay
-   if (!check_lua(_L, luaL_dofile(_L, file.c_str()))) {
-      return false;
-   }
-
-   //
-   //  Check to make sure required function exist within the script
-   //
-   lua_getglobal(_L, LUA_FUNC_ACCEPT_READING_V1);
-
-   if (!lua_isfunction(_L, -1)) {
-      return false;
-   }
+namespace monolith {
+namespace services {
 
-   lua_close(_L);
-   return true;
-}
+rule_executor_c::rule_executor_c(
+    const std::string &file,
+    monolith::alert::alert_manager_c::configuration_c alert_config,
+    monolith::services::action_dispatch_c *dispatcher,
+    monolith::heartbeats_c *heartbeats, monolith::rules::budget_s budget,
+    size_t num_shards)
+    : _file(file) {
 
-// Send an alert to the alert system
-int lua_monolith_trigger_alert(lua_State *L) {
+   _alert_manager = new monolith::alert::alert_manager_c(alert_config);
+   _environment.alert_manager = _alert_manager;
+   _environment.action_dispatcher = dispatcher;
+   _environment.heartbeats = heartbeats;
+   _environment.budget = budget;
 
-   if (!lua_isnumber(L, 1)) {
-      LOG(ERROR) << TAG("lua_monolith_trigger_alert")
-                 << "Error: Expected first parameter to be a number \n";
-      return -1;
+   if (num_shards == 0) {
+      num_shards = 1;
    }
 
-   if (!lua_isstring(L, 2)) {
-      LOG(ERROR) << TAG("lua_monolith_trigger_alert")
-                 << "Error: Expected second parameter to be a string \n";
-      return -2;
+   for (size_t i = 0; i < num_shards; i++) {
+      _shards.push_back(new shard_s());
    }
 
-   int alert_id = lua_tonumber(L, 1);
-   std::string message = lua_tostring(L, 2);
-   alert_manager->trigger(alert_id, message);
-   return 0;
+   _stat_queue_depth = &monolith::stats::queue_depth("rule_executor");
+   _stat_burst_size = &monolith::stats::burst_size("rule_executor");
+   _stat_burst_duration = &monolith::stats::burst_duration_us("rule_executor");
 }
 
-int lua_monolith_dispatch_action(lua_State *L) {
-
-   if (!lua_isstring(L, 1)) {
-      LOG(ERROR) << TAG("lua_monolith_dispatch_action")
-                 << "Error: Expected first parameter to be a string \n";
-      return -1;
-   }
-
-   if (!lua_isstring(L, 2)) {
-      LOG(ERROR) << TAG("lua_monolith_dispatch_action")
-                 << "Error: Expected second parameter to be a string \n";
-      return -2;
-   }
-
-   if (!lua_isnumber(L, 3)) {
-      LOG(ERROR) << TAG("lua_monolith_dispatch_action")
-                 << "Error: Expected third parameter to be a number \n";
-      return -3;
-   }
-
-   std::string controller_id = lua_tostring(L, 1);
-   std::string action_id = lua_tostring(L, 2);
-   double value = lua_tonumber(L, 3);
+rule_executor_c::~rule_executor_c() {
 
-   LOG(TRACE) << TAG("lua_monolith_dispatch_action")
-              << "Issue action |  cid: " << controller_id
-              << " | aid: " << action_id << " | value: " << value << "\n";
+   stop();
 
-   if (action_dispatcher) {
-      if (!action_dispatcher->dispatch(controller_id, action_id, value)) {
-         LOG(ERROR) << TAG("lua_monolith_dispatch_action")
-                    << "Failed to enqueue action\n";
-         return -4;
-      }
-   } else {
-      LOG(ERROR) << TAG("lua_monolith_dispatch_action")
-                 << "Action dispatcher not set \n";
-      return -5;
+   for (auto shard : _shards) {
+      delete shard->runtime;
+      delete shard;
    }
+   _shards.clear();
 
-   return 0;
-}
-
-/*
-   Setup lua
-*/
-void setup_lua() {
-   L = luaL_newstate();
-   luaL_openlibs(L);
-   lua_register(L, "monolith_trigger_alert", lua_monolith_trigger_alert);
-   lua_register(L, "monolith_dispatch_action", lua_monolith_dispatch_action);
-}
-
-/*
-   Close lua
-*/
-void close_lua() {
-   lua_close(L);
-   L = nullptr;
+   delete _alert_manager;
+   _alert_manager = nullptr;
 }
 
-/*
-   Setup file statics
-*/
-void setup_statics(
-    monolith::alert::alert_manager_c::configuration_c alert_config,
-    monolith::services::action_dispatch_c *dispatcher) {
-   // Check if Lua is setup
-   if (setup.load()) {
-      return;
-   }
-
-   setup_lua();
-
-   alert_manager = new monolith::alert::alert_manager_c(alert_config);
-   action_dispatcher = dispatcher;
-   setup.store(true);
-}
+monolith::rules::runtime_c *rule_executor_c::create_runtime(
+    const monolith::rules::compiled_script_s &script) {
 
-/*
-   Cleanup file statics
-*/
-void cleanup_statics() {
-   if (!setup.load()) {
-      return;
-   }
-
-   close_lua();
-
-   delete alert_manager;
-   alert_manager = nullptr;
-   delete action_dispatcher;
-   action_dispatcher = nullptr;
-   setup.store(false);
-}
-} // namespace
-
-namespace monolith {
-namespace services {
-
-rule_executor_c::rule_executor_c(
-    const std::string &file,
-    monolith::alert::alert_manager_c::configuration_c alert_config,
-    monolith::services::action_dispatch_c *dispatcher)
-    : _file(file) {
-
-   instance_counter.fetch_add(1);
-   setup_statics(alert_config, dispatcher);
-}
-
-rule_executor_c::~rule_executor_c() {
-
-   // Check to see if we are last instance of rule_executor
-   // if we are, we need to clearn up on the way out
-   if (instance_counter.load() == 0) {
-      cleanup_statics();
-   } else {
-      instance_counter.fetch_sub(1);
+   auto runtime = new monolith::rules::runtime_c(&_environment);
+   if (!runtime->load(script)) {
+      delete runtime;
+      return nullptr;
    }
+   return runtime;
 }
 
 bool rule_executor_c::open() {
 
-   if (file_open.load()) {
+   if (_file_open.load()) {
       LOG(WARNING) << TAG("rule_executor_c::open")
                    << "Lua script already open\n";
       return false;
@@ -209,32 +73,50 @@ bool rule_executor_c::open() {
       return false;
    }
 
-   if (!check_file_for_reading_v1(_file)) {
+   // Parse once, every shard loads the same bytecode
+   auto script = _script_cache.compile(_file);
+   if (!script) {
       LOG(FATAL) << TAG("rule_executor_c::open")
-                 << "Given lua script: " << _file
-                 << " does not contain function to receive reading_v1 data ("
-                 << LUA_FUNC_ACCEPT_READING_V1 << ")\n";
+                 << "Failed to compile lua script: " << _file << "\n";
       return false;
    }
 
-   if (!check_lua(L, luaL_dofile(L, _file.c_str()))) {
-      LOG(FATAL) << TAG("rule_executor_c::open")
-                 << "Failed to load lua script: " << _file << "\n";
-      return false;
+   for (auto shard : _shards) {
+      auto runtime = create_runtime(*script);
+      if (!runtime) {
+         LOG(FATAL) << TAG("rule_executor_c::open")
+                    << "Failed to load lua script: " << _file << "\n";
+         return false;
+      }
+
+      const std::lock_guard<std::mutex> lock(shard->runtime_mutex);
+      delete shard->runtime;
+      shard->runtime = runtime;
    }
 
-   file_open.store(true);
+   LOG(INFO) << TAG("rule_executor_c::open") << "Loaded " << _file << " into "
+             << _shards.size() << " runtime(s)\n";
+
+   _file_open.store(true);
 
    return true;
 }
 
-void rule_executor_c::submit_metric(crate::metrics::sensor_reading_v1_c &data) {
+void rule_executor_c::submit_metric(crate::metrics::sensor_reading_v1_c &data,
+                                    monolith::stats::trace_t trace) {
 
    LOG(TRACE) << TAG("rule_executor_c::submit_metric") << "Got metric data\n";
+
+   // Keep all readings from a node on the same shard so any state the
+   // script holds for that node lives in a single runtime
+   auto node_id = std::get<1>(data.get_data());
+   auto shard = _shards[std::hash<std::string>{}(node_id) % _shards.size()];
    {
-      const std::lock_guard<std::mutex> lock(_reading_queue_mutex);
-      _reading_queue.push(data);
+      const std::lock_guard<std::mutex> lock(shard->reading_queue_mutex);
+      shard->reading_queue.push({data, std::move(trace)});
    }
+   _stat_queue_depth->add(1);
+   shard->reading_queue_cv.notify_one();
 }
 
 bool rule_executor_c::start() {
@@ -245,22 +127,19 @@ bool rule_executor_c::start() {
       return true;
    }
 
-   if (!setup.load()) {
-      LOG(WARNING) << TAG("rule_executor_c::start")
-                   << "Setup has not been done\n";
-      return false;
-   }
-
-   if (!file_open.load()) {
+   if (!_file_open.load()) {
       LOG(WARNING) << TAG("rule_executor_c::start")
                    << "Lua file has not yet been opened\n";
       return false;
    }
 
    p_running.store(true);
-   p_thread = std::thread(&rule_executor_c::run, this);
+   for (auto shard : _shards) {
+      shard->thread = std::thread(&rule_executor_c::run, this, shard);
+   }
 
-   LOG(INFO) << TAG("rule_executor_c::start") << "Executor started\n";
+   LOG(INFO) << TAG("rule_executor_c::start") << "Executor started with "
+             << _shards.size() << " shard(s)\n";
 
    return true;
 }
@@ -273,8 +152,11 @@ bool rule_executor_c::stop() {
 
    p_running.store(false);
 
-   if (p_thread.joinable()) {
-      p_thread.join();
+   for (auto shard : _shards) {
+      shard->reading_queue_cv.notify_all();
+      if (shard->thread.joinable()) {
+         shard->thread.join();
+      }
    }
 
    return true;
@@ -282,75 +164,166 @@ bool rule_executor_c::stop() {
 
 bool rule_executor_c::reload() {
 
-   const std::lock_guard<std::mutex> lock(_reading_queue_mutex);
-   close_lua();
-   setup_lua();
-   file_open.store(false);
-   if (!open()) {
-      LOG(FATAL) << TAG("rule_executor_c::reload") << "Failed to re-open lua file\n";
-      stop();
+   const std::lock_guard<std::mutex> reload_lock(_reload_mutex);
+
+   // Build every new runtime before swapping any of them in so a broken
+   // script leaves the currently loaded rules running
+   auto script = _script_cache.compile(_file);
+   if (!script) {
+      LOG(FATAL) << TAG("rule_executor_c::reload")
+                 << "Failed to compile lua script: " << _file << "\n";
       return false;
    }
+
+   std::vector<monolith::rules::runtime_c *> runtimes;
+   for (size_t i = 0; i < _shards.size(); i++) {
+      auto runtime = create_runtime(*script);
+      if (!runtime) {
+         LOG(FATAL) << TAG("rule_executor_c::reload")
+                    << "Failed to re-open lua file\n";
+         for (auto loaded : runtimes) {
+            delete loaded;
+         }
+         return false;
+      }
+      runtimes.push_back(runtime);
+   }
+
+   // Each shard only pauses for the state handoff and a pointer swap.
+   // Readings keep queueing the whole time
+   for (size_t i = 0; i < _shards.size(); i++) {
+      monolith::rules::runtime_c *previous{nullptr};
+      {
+         const std::lock_guard<std::mutex> lock(_shards[i]->runtime_mutex);
+         previous = _shards[i]->runtime;
+         if (previous && !runtimes[i]->migrate_from(*previous)) {
+            LOG(WARNING) << TAG("rule_executor_c::reload")
+                         << "State migration reported an error\n";
+         }
+         _shards[i]->runtime = runtimes[i];
+      }
+      delete previous;
+   }
+
+   LOG(INFO) << TAG("rule_executor_c::reload") << "Reloaded " << _file
+             << "\n";
    return true;
 }
 
-void rule_executor_c::run() {
+std::string rule_executor_c::report() {
 
-   while (p_running.load()) {
-      std::this_thread::sleep_for(500ms);
-      burst();
+   monolith::rules::profiles_t profiles;
+   for (auto shard : _shards) {
+      const std::lock_guard<std::mutex> lock(shard->profiles_mutex);
+      for (auto &[name, profile] : shard->profiles) {
+         profiles[name].merge(profile);
+      }
+   }
+
+   std::string result = "Rule executor (" + std::to_string(_shards.size()) +
+                        " shard(s))\n";
+   if (profiles.empty()) {
+      return result + "No rule handlers have been called\n";
    }
+   return result + monolith::rules::render_profiles(profiles);
 }
 
-void rule_executor_c::burst() {
-   {
-      const std::lock_guard<std::mutex> lock(_reading_queue_mutex);
-      if (_reading_queue.empty()) {
-         return;
+void rule_executor_c::run(shard_s *shard) {
+
+   while (p_running.load()) {
+
+      // Sleep until readings show up or the next timer is due
+      auto wake = std::chrono::steady_clock::now() + MAX_IDLE_WAIT;
+      {
+         const std::lock_guard<std::mutex> lock(shard->runtime_mutex);
+         auto next_timer = shard->runtime->next_timer();
+         if (next_timer.has_value() && *next_timer < wake) {
+            wake = *next_timer;
+         }
+      }
+      {
+         std::unique_lock<std::mutex> lock(shard->reading_queue_mutex);
+         shard->reading_queue_cv.wait_until(lock, wake, [&] {
+            return !shard->reading_queue.empty() || !p_running.load();
+         });
       }
+      burst(shard);
    }
+}
 
-   uint32_t num_items{0};
-   std::vector<crate::metrics::sensor_reading_v1_c> _selected_readings;
-   _selected_readings.reserve(MAX_BURST);
+void rule_executor_c::burst(shard_s *shard) {
 
-   // Select a potential subset of readings to submit
-   {
-      const std::lock_guard<std::mutex> lock(_reading_queue_mutex);
-      while (!_reading_queue.empty() && num_items++ < MAX_BURST) {
-         _selected_readings.push_back(_reading_queue.front());
-         _reading_queue.pop();
+   using stage_e = monolith::stats::trace_c::stage_e;
+
+   std::vector<crate::metrics::sensor_reading_v1_c> selected_readings;
+   std::vector<monolith::stats::trace_t> selected_traces;
+   selected_readings.reserve(MAX_BURST);
+
+   while (true) {
+
+      // Timers fire in line with readings, before each burst. What the
+      // last burst and the timers recorded is published on the way out
+      {
+         const std::lock_guard<std::mutex> lock(shard->runtime_mutex);
+         shard->runtime->run_timers();
+         publish_profiles(shard);
       }
-   }
 
-   // Go over selected readings
-   for (auto &reading : _selected_readings) {
+      // Select a potential subset of readings to submit
+      selected_readings.clear();
+      selected_traces.clear();
+      {
+         const std::lock_guard<std::mutex> lock(shard->reading_queue_mutex);
+         while (!shard->reading_queue.empty() &&
+                selected_readings.size() < MAX_BURST) {
+            auto &queued = shard->reading_queue.front();
+            selected_readings.push_back(std::move(queued.reading));
+            if (queued.trace) {
+               selected_traces.push_back(std::move(queued.trace));
+            }
+            shard->reading_queue.pop();
+         }
+      }
 
-      // Retrieve the lua function we are going to call
-      lua_getglobal(L, LUA_FUNC_ACCEPT_READING_V1);
+      for (auto &trace : selected_traces) {
+         trace->mark(stage_e::RULES_QUEUE);
+      }
 
-      // Double check it exists as a function
-      if (!lua_isfunction(L, -1)) {
-         LOG(FATAL) << TAG("rule_executor_c::burst") << "Expected "
-                    << LUA_FUNC_ACCEPT_READING_V1
-                    << " to exist in given lua script as a function. Dropping "
-                    << _selected_readings.size() << " readings\n";
+      if (selected_readings.empty()) {
          return;
       }
 
-      // Peel the reading apart
-      auto [timestamp, node_id, sensor_id, value] = reading.get_data();
+      // Shards share the gauge, so each only takes off what it pulled
+      _stat_queue_depth->add(-static_cast<int64_t>(selected_readings.size()));
+      _stat_burst_size->record(selected_readings.size());
+      monolith::stats::scoped_timer_c burst_timer(*_stat_burst_duration);
 
-      // Load data into lua
-      lua_pushnumber(L, timestamp);
-      lua_pushstring(L, node_id.c_str());
-      lua_pushstring(L, sensor_id.c_str());
-      lua_pushnumber(L, value);
+      {
+         const std::lock_guard<std::mutex> lock(shard->runtime_mutex);
+         shard->runtime->accept_readings(selected_readings);
+      }
 
-      // Call the function that we got for reading v1s
-      lua_call(L, 4, 1);
+      for (auto &trace : selected_traces) {
+         trace->mark(stage_e::RULES);
+      }
    }
 }
 
+// Must be called with the shard's runtime_mutex held
+void rule_executor_c::publish_profiles(shard_s *shard) {
+
+   auto now = std::chrono::steady_clock::now();
+   if (now - shard->profiles_published < PROFILE_PUBLISH_INTERVAL) {
+      return;
+   }
+   shard->profiles_published = now;
+
+   monolith::rules::profiles_t profiles;
+   shard->runtime->collect_profiles(profiles);
+
+   const std::lock_guard<std::mutex> lock(shard->profiles_mutex);
+   shard->profiles.swap(profiles);
+}
+
 } // namespace services
-} // namespace monolith
\ No newline at end of file
+} // namespace monolith
@@ -2,18 +2,42 @@
 #define MONOLITH_SERVICES_RULE_EXECUTOR_HPP
 
 #include "alert/alert.hpp"
+#include "heartbeats.hpp"
 #include "interfaces/service_if.hpp"
 #include "interfaces/reloadable_if.hpp"
+#include "interfaces/reportable_if.hpp"
+#include "rules/runtime.hpp"
 #include "services/action_dispatch.hpp"
+#include "stats/stats.hpp"
+#include "stats/trace.hpp"
+#include <chrono>
 #include <compare>
+#include <condition_variable>
 #include <crate/metrics/reading_v1.hpp>
+#include <mutex>
 #include <queue>
+#include <vector>
 
 namespace monolith {
+namespace test {
+class rule_executor_access_c;
+}
+
 namespace services {
 
 //! \brief Rule execution object
-class rule_executor_c : public service_if, public reloadable_if {
+//! \note  The rule script is loaded into a number of independent Lua
+//!        runtimes (shards), each driven by its own worker thread.
+//!        Readings are routed to a shard by a hash of their node id so
+//!        every reading from a given node is seen, in order, by the same
+//!        runtime. Any per-node state a script keeps is therefore
+//!        consistent, but state is NOT shared between nodes on different
+//!        shards. Timers a script schedules belong to the runtime that
+//!        scheduled them and fire on that shard's worker, between bursts
+//!        of readings
+class rule_executor_c : public service_if,
+                        public reloadable_if,
+                        public reportable_if {
  public:
    rule_executor_c() = delete;
 
@@ -21,10 +45,16 @@ class rule_executor_c : public service_if, public reloadable_if {
    //! \param file Lua file to load in
    //! \param alert_config The configuration for sending alerts
    //! \param dispatcher The action dispatching object
+   //! \param heartbeats The heartbeat manager scripts can query
+   //! \param budget Limits placed on every call into the script
+   //! \param num_shards The number of Lua runtimes / worker threads to
+   //!        spread readings over (minimum of 1)
    rule_executor_c(
        const std::string &file,
        monolith::alert::alert_manager_c::configuration_c alert_config,
-       monolith::services::action_dispatch_c *dispatcher);
+       monolith::services::action_dispatch_c *dispatcher,
+       monolith::heartbeats_c *heartbeats,
+       monolith::rules::budget_s budget = {}, size_t num_shards = 1);
    virtual ~rule_executor_c() override final;
 
    //! \brief Open the given Lua file
@@ -34,9 +64,11 @@ class rule_executor_c : public service_if, public reloadable_if {
 
    //! \brief Submit a metric to the rule executor
    //! \param data The metric to submit
+   //! \param trace The metric's trace, if it is being traced
    //! \post The metric will be piped into the lua function(s)
    //!       meant to handle metrics
-   void submit_metric(crate::metrics::sensor_reading_v1_c &data);
+   void submit_metric(crate::metrics::sensor_reading_v1_c &data,
+                      monolith::stats::trace_t trace = nullptr);
 
    // From service_if
    virtual bool start() override final;
@@ -45,18 +77,60 @@ class rule_executor_c : public service_if, public reloadable_if {
    // From reloadable_if
    virtual bool reload() override final;
 
+   // From reportable_if
+   //! \brief Per handler call counts, latencies, and budget overruns,
+   //!        combined across all shards
+   //! \note  Reads what each shard last published between bursts, so it
+   //!        never waits on a running script and may be slightly behind
+   virtual std::string report() override final;
+
  private:
+   // Lets the tests look inside each shard's runtime
+   friend class monolith::test::rule_executor_access_c;
+
    static constexpr uint8_t MAX_BURST = 100;
+   static constexpr std::chrono::milliseconds MAX_IDLE_WAIT{500};
+   static constexpr std::chrono::milliseconds PROFILE_PUBLISH_INTERVAL{100};
+
+   struct queued_reading_s {
+      crate::metrics::sensor_reading_v1_c reading;
+      monolith::stats::trace_t trace;
+   };
+
+   // A burst holds the runtime mutex for up to MAX_BURST readings, so the
+   // runtime's profiles are copied out between bursts for report() to read
+   struct shard_s {
+      monolith::rules::runtime_c *runtime{nullptr};
+      std::mutex runtime_mutex;
+      monolith::rules::profiles_t profiles;
+      std::mutex profiles_mutex;
+      std::chrono::steady_clock::time_point profiles_published;
+      std::queue<queued_reading_s> reading_queue;
+      std::mutex reading_queue_mutex;
+      std::condition_variable reading_queue_cv;
+      std::thread thread;
+   };
 
    std::string _file;
-   std::queue<crate::metrics::sensor_reading_v1_c> _reading_queue;
-   std::mutex _reading_queue_mutex;
+   std::atomic<bool> _file_open{false};
+   std::mutex _reload_mutex;
+   monolith::alert::alert_manager_c *_alert_manager{nullptr};
+   monolith::rules::environment_s _environment;
+   std::vector<shard_s *> _shards;
+   monolith::rules::script_cache_c _script_cache;
+
+   monolith::stats::gauge_c *_stat_queue_depth{nullptr};
+   monolith::stats::histogram_c *_stat_burst_size{nullptr};
+   monolith::stats::histogram_c *_stat_burst_duration{nullptr};
 
-   void run();
-   void burst();
+   monolith::rules::runtime_c *
+   create_runtime(const monolith::rules::compiled_script_s &script);
+   void run(shard_s *shard);
+   void burst(shard_s *shard);
+   void publish_profiles(shard_s *shard);
 };
 
 } // namespace services
 } // namespace monolith
 
-#endif
\ No newline at end of file
+#endif
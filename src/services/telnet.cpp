@@ -3,14 +3,16 @@
 
 #include "version.hpp"
 #include "host_info.hpp"
+#include "stats/registry.hpp"
 
 namespace monolith {
 namespace services {
 
 using namespace std::chrono_literals;
 
-telnet_c::telnet_c(std::string access_code, monolith::networking::ipv4_host_port_s host_port, monolith::reloadable_if *rule_executor)
-   : _access_code(access_code), _host_port(host_port), _rule_executor_reload_if(rule_executor) {
+telnet_c::telnet_c(std::string access_code, monolith::networking::ipv4_host_port_s host_port, monolith::reloadable_if *rule_executor,
+   std::vector<monolith::reportable_if*> reportables)
+   : _access_code(access_code), _host_port(host_port), _rule_executor_reload_if(rule_executor), _reportables(reportables) {
 
    _local_server = new server_c(this);
 }
@@ -114,6 +116,20 @@ std::string telnet_c::reload_rules() {
    return "< rule executor not set >";
 }
 
+std::string telnet_c::get_stats() {
+
+   std::string result;
+   for (auto reportable : _reportables) {
+      result += reportable->report() + "\n";
+   }
+
+   result += monolith::stats::registry().render_text();
+   if (result.empty()) {
+      return "< no statistics available >";
+   }
+   return result;
+}
+
 void telnet_c::server_c::on_admin_connect(admin_conn_c& conn) {
    struct sockaddr_in addr;
    conn.get_peer_name(addr);
@@ -227,7 +243,7 @@ std::string telnet_c::server_c::handle_cmd(admin_conn_c& conn, std::vector<std::
          Statistics Info
    */
    if (command[0] == "stats") {
-      return "TODO: Return runtime statistics";
+      return _parent->get_stats();
    }
    
    /*
@@ -6,6 +6,7 @@
 
 #include "interfaces/service_if.hpp"
 #include "interfaces/reloadable_if.hpp"
+#include "interfaces/reportable_if.hpp"
 #include "networking/types.hpp"
 #include <crate/externals/admincmd/admin_cmd_server.hpp>
 
@@ -17,7 +18,8 @@ class telnet_c : public service_if {
  public:
    telnet_c() = delete;
    telnet_c(std::string access_code, monolith::networking::ipv4_host_port_s host_port,
-   monolith::reloadable_if* rule_executor_reload_if);
+   monolith::reloadable_if* rule_executor_reload_if,
+   std::vector<monolith::reportable_if*> reportables = {});
    virtual ~telnet_c() override final;
 
    // From service_if
@@ -55,12 +57,14 @@ class telnet_c : public service_if {
    std::string _access_code;
    monolith::networking::ipv4_host_port_s _host_port;
    monolith::reloadable_if* _rule_executor_reload_if {nullptr};
+   std::vector<monolith::reportable_if*> _reportables;
 
    void run();
    std::string get_banner();
    std::string get_help();
    std::string get_version();
    std::string reload_rules();
+   std::string get_stats();
 };
 
 } // namespace services
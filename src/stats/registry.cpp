@@ -0,0 +1,222 @@
+#include "registry.hpp"
+#include <crate/externals/aixlog/logger.hpp>
+#include <sstream>
+
+namespace monolith {
+namespace stats {
+
+namespace {
+
+std::string escape_label_value(const std::string &value) {
+   std::string escaped;
+   escaped.reserve(value.size());
+   for (auto c : value) {
+      switch (c) {
+      case '\\':
+         escaped += "\\\\";
+         break;
+      case '"':
+         escaped += "\\\"";
+         break;
+      case '\n':
+         escaped += "\\n";
+         break;
+      default:
+         escaped += c;
+      }
+   }
+   return escaped;
+}
+
+// Renders {a="b",c="d"} with an optional trailing label, or nothing at all
+// if there are no labels
+std::string render_labels(const labels_t &labels,
+                          const std::pair<std::string, std::string> *extra =
+                              nullptr) {
+
+   if (labels.empty() && !extra) {
+      return {};
+   }
+
+   std::string result = "{";
+   for (auto &[name, value] : labels) {
+      result += name + "=\"" + escape_label_value(value) + "\",";
+   }
+   if (extra) {
+      result += extra->first + "=\"" + escape_label_value(extra->second) + "\",";
+   }
+   result.back() = '}';
+   return result;
+}
+
+} // namespace
+
+template <class T>
+T &registry_c::get(const std::string &name, const std::string &help,
+                   const labels_t &labels, type_e type,
+                   instruments_t<T> family_s::*instruments,
+                   std::vector<std::unique_ptr<T>> &orphans) {
+
+   const std::lock_guard<std::mutex> lock(_mutex);
+
+   auto [family, created] = _families.try_emplace(name);
+   if (created) {
+      family->second.type = type;
+      family->second.help = help;
+   } else if (family->second.type != type) {
+      LOG(ERROR) << TAG("registry_c::get") << "Metric " << name
+                 << " was already registered with a different type\n";
+      orphans.push_back(std::make_unique<T>());
+      return *orphans.back();
+   }
+
+   auto &instrument = (family->second.*instruments)[render_labels(labels)];
+   if (!instrument) {
+      instrument = std::make_unique<T>();
+   }
+   return *instrument;
+}
+
+counter_c &registry_c::counter(const std::string &name,
+                               const std::string &help,
+                               const labels_t &labels) {
+   return get(name, help, labels, type_e::COUNTER, &family_s::counters,
+              _orphan_counters);
+}
+
+gauge_c &registry_c::gauge(const std::string &name, const std::string &help,
+                           const labels_t &labels) {
+   return get(name, help, labels, type_e::GAUGE, &family_s::gauges,
+              _orphan_gauges);
+}
+
+histogram_c &registry_c::histogram(const std::string &name,
+                                   const std::string &help,
+                                   const labels_t &labels) {
+   return get(name, help, labels, type_e::HISTOGRAM, &family_s::histograms,
+              _orphan_histograms);
+}
+
+std::string registry_c::render_prometheus() {
+
+   const std::lock_guard<std::mutex> lock(_mutex);
+
+   std::stringstream ss;
+   for (auto &[name, family] : _families) {
+      const char *type = family.type == type_e::COUNTER ? "counter"
+                         : family.type == type_e::GAUGE ? "gauge"
+                                                        : "histogram";
+      ss << "# HELP " << name << " " << family.help << "\n"
+         << "# TYPE " << name << " " << type << "\n";
+
+      for (auto &[labels, counter] : family.counters) {
+         ss << name << labels << " " << counter->value() << "\n";
+      }
+
+      for (auto &[labels, gauge] : family.gauges) {
+         ss << name << labels << " " << gauge->value() << "\n";
+      }
+
+      for (auto &[labels, histogram] : family.histograms) {
+
+         // The stored key is already rendered, the le label has to go inside
+         // the braces so it is spliced in
+         auto with_le = [&labels](const std::string &le) {
+            if (labels.empty()) {
+               return "{le=\"" + le + "\"}";
+            }
+            return labels.substr(0, labels.size() - 1) + ",le=\"" + le + "\"}";
+         };
+
+         // Snapshot the buckets so the cumulative counts and the total agree
+         std::array<uint64_t, histogram_c::BUCKETS> counts;
+         size_t highest{0};
+         for (size_t i = 0; i < histogram_c::BUCKETS; i++) {
+            counts[i] = histogram->bucket_count(i);
+            if (counts[i]) {
+               highest = i;
+            }
+         }
+
+         // Buckets are exported at powers of two, up to the first one that
+         // covers every value recorded so far
+         uint64_t cumulative{0};
+         for (size_t i = 0; i < histogram_c::BUCKETS - 1; i++) {
+            cumulative += counts[i];
+            if (i % histogram_c::SUB_BUCKETS != histogram_c::SUB_BUCKETS - 1) {
+               continue;
+            }
+            ss << name << "_bucket"
+               << with_le(std::to_string(histogram_c::bucket_max(i))) << " "
+               << cumulative << "\n";
+            if (i >= highest) {
+               break;
+            }
+         }
+
+         uint64_t total{0};
+         for (auto count : counts) {
+            total += count;
+         }
+         ss << name << "_bucket" << with_le("+Inf") << " " << total << "\n"
+            << name << "_sum" << labels << " " << histogram->sum() << "\n"
+            << name << "_count" << labels << " " << total << "\n";
+      }
+   }
+   return ss.str();
+}
+
+std::string registry_c::render_text() {
+
+   const std::lock_guard<std::mutex> lock(_mutex);
+
+   std::stringstream ss;
+   for (auto &[name, family] : _families) {
+      for (auto &[labels, counter] : family.counters) {
+         ss << name << labels << " " << counter->value() << "\n";
+      }
+
+      for (auto &[labels, gauge] : family.gauges) {
+         ss << name << labels << " " << gauge->value() << "\n";
+      }
+
+      for (auto &[labels, histogram] : family.histograms) {
+         auto count = histogram->count();
+         ss << name << labels << " count=" << count;
+         if (count) {
+            ss << " mean=" << histogram->sum() / count
+               << " p50=" << histogram->percentile(50)
+               << " p90=" << histogram->percentile(90)
+               << " p99=" << histogram->percentile(99);
+         }
+         ss << "\n";
+      }
+   }
+   return ss.str();
+}
+
+registry_c &registry() {
+   static registry_c instance;
+   return instance;
+}
+
+gauge_c &queue_depth(const std::string &service) {
+   return registry().gauge("monolith_queue_depth",
+                           "Items waiting in a service's queue",
+                           {{"service", service}});
+}
+
+histogram_c &burst_size(const std::string &service) {
+   return registry().histogram("monolith_burst_size",
+                               "Items handled per burst of a service",
+                               {{"service", service}});
+}
+
+histogram_c &burst_duration_us(const std::string &service) {
+   return registry().histogram("monolith_burst_duration_us",
+                               "Time taken by a service to handle a burst",
+                               {{"service", service}});
+}
+
+} // namespace stats
+} // namespace monolith
@@ -0,0 +1,96 @@
+#ifndef MONOLITH_STATS_REGISTRY_HPP
+#define MONOLITH_STATS_REGISTRY_HPP
+
+#include "stats.hpp"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace monolith {
+namespace stats {
+
+//! \brief Label name / value pairs that tell apart metrics of one family
+using labels_t = std::vector<std::pair<std::string, std::string>>;
+
+//! \brief Owns every instrument and renders them for export
+//! \note  Instruments are created once and live as long as the registry.
+//!        Asking for the same name and labels again returns the same
+//!        instrument, so holders are expected to look theirs up once and
+//!        keep the reference
+class registry_c {
+ public:
+   //! \brief Get or create a counter
+   //! \param name The metric family name (prometheus naming)
+   //! \param help A description of the family
+   //! \param labels Labels of this counter within the family
+   counter_c &counter(const std::string &name, const std::string &help,
+                      const labels_t &labels = {});
+
+   //! \brief Get or create a gauge
+   //! \param name The metric family name (prometheus naming)
+   //! \param help A description of the family
+   //! \param labels Labels of this gauge within the family
+   gauge_c &gauge(const std::string &name, const std::string &help,
+                  const labels_t &labels = {});
+
+   //! \brief Get or create a histogram
+   //! \param name The metric family name (prometheus naming)
+   //! \param help A description of the family
+   //! \param labels Labels of this histogram within the family
+   histogram_c &histogram(const std::string &name, const std::string &help,
+                          const labels_t &labels = {});
+
+   //! \brief Render everything in the prometheus text exposition format
+   std::string render_prometheus();
+
+   //! \brief Render everything as a human readable summary
+   std::string render_text();
+
+ private:
+   enum class type_e { COUNTER, GAUGE, HISTOGRAM };
+
+   template <class T> using instruments_t = std::map<std::string, std::unique_ptr<T>>;
+
+   struct family_s {
+      type_e type;
+      std::string help;
+      instruments_t<counter_c> counters;
+      instruments_t<gauge_c> gauges;
+      instruments_t<histogram_c> histograms;
+   };
+
+   std::mutex _mutex;
+   std::map<std::string, family_s> _families;
+
+   // Instruments handed out when a name is reused with a different type so
+   // callers always get something valid to update
+   std::vector<std::unique_ptr<counter_c>> _orphan_counters;
+   std::vector<std::unique_ptr<gauge_c>> _orphan_gauges;
+   std::vector<std::unique_ptr<histogram_c>> _orphan_histograms;
+
+   template <class T>
+   T &get(const std::string &name, const std::string &help,
+          const labels_t &labels, type_e type,
+          instruments_t<T> family_s::*instruments,
+          std::vector<std::unique_ptr<T>> &orphans);
+};
+
+//! \brief Get the process wide registry
+registry_c &registry();
+
+//! \brief Gauge of the items waiting in a service's queue
+gauge_c &queue_depth(const std::string &service);
+
+//! \brief Histogram of the number of items a service handles per burst
+histogram_c &burst_size(const std::string &service);
+
+//! \brief Histogram of how long a service takes to handle a burst
+histogram_c &burst_duration_us(const std::string &service);
+
+} // namespace stats
+} // namespace monolith
+
+#endif
@@ -0,0 +1,122 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+namespace monolith {
+namespace stats {
+
+namespace {
+
+// Threads are handed shards round robin the first time they touch a counter
+size_t shard_index() {
+   static std::atomic<size_t> next{0};
+   thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed);
+   return index;
+}
+
+} // namespace
+
+void counter_c::add(uint64_t n) {
+   _shards[shard_index() % SHARDS].value.fetch_add(n,
+                                                   std::memory_order_relaxed);
+}
+
+uint64_t counter_c::value() const {
+   uint64_t total{0};
+   for (auto &shard : _shards) {
+      total += shard.value.load(std::memory_order_relaxed);
+   }
+   return total;
+}
+
+void gauge_c::set(int64_t value) {
+   _value.store(value, std::memory_order_relaxed);
+}
+
+void gauge_c::add(int64_t n) { _value.fetch_add(n, std::memory_order_relaxed); }
+
+int64_t gauge_c::value() const { return _value.load(std::memory_order_relaxed); }
+
+size_t histogram_c::bucket_of(uint64_t value) {
+
+   // Small values get a bucket each
+   if (value < SUB_BUCKETS) {
+      return value;
+   }
+
+   size_t exponent = std::bit_width(value) - 1;
+   if (exponent >= MAX_EXPONENT) {
+      return BUCKETS - 1;
+   }
+
+   size_t sub = (value >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKETS;
+   return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+uint64_t histogram_c::bucket_max(size_t bucket) {
+
+   if (bucket < SUB_BUCKETS) {
+      return bucket;
+   }
+
+   if (bucket >= BUCKETS - 1) {
+      return std::numeric_limits<uint64_t>::max();
+   }
+
+   size_t shift = bucket / SUB_BUCKETS - 1;
+   uint64_t lower = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+   return lower + (1ull << shift) - 1;
+}
+
+void histogram_c::record(uint64_t value) {
+   _buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+   _count.fetch_add(1, std::memory_order_relaxed);
+   _sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t histogram_c::count() const {
+   return _count.load(std::memory_order_relaxed);
+}
+
+uint64_t histogram_c::sum() const { return _sum.load(std::memory_order_relaxed); }
+
+uint64_t histogram_c::bucket_count(size_t bucket) const {
+   return _buckets[bucket].load(std::memory_order_relaxed);
+}
+
+uint64_t histogram_c::percentile(double percentile) const {
+
+   // Buckets are read one at a time while others may be recording so the
+   // total is taken from the buckets themselves to stay consistent
+   std::array<uint64_t, BUCKETS> counts;
+   uint64_t total{0};
+   for (size_t i = 0; i < BUCKETS; i++) {
+      counts[i] = bucket_count(i);
+      total += counts[i];
+   }
+
+   if (total == 0) {
+      return 0;
+   }
+
+   percentile = std::clamp(percentile, 0.0, 100.0);
+   uint64_t target = static_cast<uint64_t>(total * (percentile / 100.0));
+   uint64_t seen{0};
+   for (size_t i = 0; i < BUCKETS; i++) {
+      seen += counts[i];
+      if (seen > target || seen == total) {
+         return bucket_max(i);
+      }
+   }
+   return bucket_max(BUCKETS - 1);
+}
+
+scoped_timer_c::~scoped_timer_c() {
+   _histogram.record(std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - _start)
+                         .count());
+}
+
+} // namespace stats
+} // namespace monolith
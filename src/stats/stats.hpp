@@ -0,0 +1,113 @@
+#ifndef MONOLITH_STATS_STATS_HPP
+#define MONOLITH_STATS_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/*
+   ABOUT:
+      Internal instrumentation types. These are made to be cheap enough to
+   update from the hot paths of every service. None of them take locks;
+   counters are spread over a set of cache line sized shards so threads
+   hammering the same counter don't fight over one line, and histograms are
+   a fixed array of atomic buckets.
+
+   Histograms are log-linear: every power of two is split into SUB_BUCKETS
+   linear buckets, giving a relative error under 1/SUB_BUCKETS for any
+   recorded value with a fixed, small amount of memory.
+*/
+
+namespace monolith {
+namespace stats {
+
+//! \brief Monotonically increasing counter
+class counter_c {
+ public:
+   //! \brief Add to the counter
+   void add(uint64_t n = 1);
+
+   //! \brief Get the current value (sum of all shards)
+   uint64_t value() const;
+
+ private:
+   static constexpr size_t SHARDS = 16;
+
+   struct alignas(64) shard_s {
+      std::atomic<uint64_t> value{0};
+   };
+   std::array<shard_s, SHARDS> _shards;
+};
+
+//! \brief Value that can go up and down
+class gauge_c {
+ public:
+   //! \brief Set the gauge
+   void set(int64_t value);
+
+   //! \brief Add to the gauge (may be negative)
+   void add(int64_t n);
+
+   //! \brief Get the current value
+   int64_t value() const;
+
+ private:
+   std::atomic<int64_t> _value{0};
+};
+
+//! \brief Log-linear histogram of unsigned values
+class histogram_c {
+ public:
+   static constexpr size_t SUB_BUCKET_BITS = 2;
+   static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+   static constexpr size_t MAX_EXPONENT = 40; //! Values >= 2^40 share a bucket
+   static constexpr size_t BUCKETS =
+       (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+   //! \brief Record a value
+   void record(uint64_t value);
+
+   //! \brief Number of values recorded
+   uint64_t count() const;
+
+   //! \brief Sum of all values recorded
+   uint64_t sum() const;
+
+   //! \brief Number of values recorded in a bucket
+   uint64_t bucket_count(size_t bucket) const;
+
+   //! \brief Estimate a percentile
+   //! \param percentile Within [0, 100]
+   //! \returns The largest value of the bucket the percentile falls in
+   uint64_t percentile(double percentile) const;
+
+   //! \brief Get the bucket a value is recorded in
+   static size_t bucket_of(uint64_t value);
+
+   //! \brief Get the largest value recorded in a bucket
+   static uint64_t bucket_max(size_t bucket);
+
+ private:
+   std::array<std::atomic<uint64_t>, BUCKETS> _buckets{};
+   std::atomic<uint64_t> _count{0};
+   std::atomic<uint64_t> _sum{0};
+};
+
+//! \brief Records the microseconds between its creation and destruction
+class scoped_timer_c {
+ public:
+   scoped_timer_c() = delete;
+   explicit scoped_timer_c(histogram_c &histogram)
+       : _histogram(histogram), _start(std::chrono::steady_clock::now()) {}
+   ~scoped_timer_c();
+
+ private:
+   histogram_c &_histogram;
+   std::chrono::steady_clock::time_point _start;
+};
+
+} // namespace stats
+} // namespace monolith
+
+#endif
@@ -0,0 +1,157 @@
+#include "trace.hpp"
+#include "registry.hpp"
+#include <sstream>
+
+namespace monolith {
+namespace stats {
+
+namespace {
+
+std::string escape_json(const std::string &value) {
+   std::string escaped;
+   escaped.reserve(value.size());
+   for (auto c : value) {
+      if (c == '"' || c == '\\') {
+         escaped += '\\';
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+         continue;
+      }
+      escaped += c;
+   }
+   return escaped;
+}
+
+} // namespace
+
+trace_c::trace_c(tracer_c *tracer)
+    : _tracer(tracer), _ingress(std::chrono::steady_clock::now()) {
+
+   _ingress_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::system_clock::now().time_since_epoch())
+                     .count();
+   _stage_us.fill(-1);
+}
+
+trace_c::~trace_c() { _tracer->finish(*this); }
+
+void trace_c::identify(const std::string &node_id,
+                       const std::string &sensor_id) {
+   _node_id = node_id;
+   _sensor_id = sensor_id;
+}
+
+void trace_c::mark(stage_e stage) {
+   auto since_ingress = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - _ingress)
+                            .count();
+   auto idx = static_cast<size_t>(stage);
+   _stage_us[idx] = since_ingress;
+   _tracer->_stage_latency[idx]->record(since_ingress);
+}
+
+const char *trace_c::stage_name(stage_e stage) {
+   switch (stage) {
+   case stage_e::SUBMISSION_QUEUE:
+      return "submission_queue";
+   case stage_e::DB_QUEUE:
+      return "db_queue";
+   case stage_e::DB_INSERT:
+      return "db_insert";
+   case stage_e::RULES_QUEUE:
+      return "rules_queue";
+   case stage_e::RULES:
+      return "rules";
+   case stage_e::STREAM_QUEUE:
+      return "stream_queue";
+   case stage_e::STREAM_SEND:
+      return "stream_send";
+   }
+   return "unknown";
+}
+
+tracer_c::tracer_c() {
+   for (size_t i = 0; i < trace_c::NUM_STAGES; i++) {
+      _stage_latency[i] = &registry().histogram(
+          "monolith_ingest_stage_latency_us",
+          "Time from a sampled reading coming in to it leaving a stage",
+          {{"stage", trace_c::stage_name(static_cast<trace_c::stage_e>(i))}});
+   }
+   _total_latency = &registry().histogram(
+       "monolith_ingest_trace_duration_us",
+       "Time from a sampled reading coming in to every stage being done");
+}
+
+void tracer_c::configure(uint32_t sample_every, uint32_t slow_ms) {
+   _sample_every.store(sample_every);
+   _slow_us.store(static_cast<int64_t>(slow_ms) * 1000);
+}
+
+trace_t tracer_c::begin() {
+
+   auto sample_every = _sample_every.load(std::memory_order_relaxed);
+   if (!sample_every ||
+       _submitted.fetch_add(1, std::memory_order_relaxed) % sample_every) {
+      return nullptr;
+   }
+   return std::make_shared<trace_c>(this);
+}
+
+void tracer_c::finish(const trace_c &trace) {
+
+   auto total_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - trace._ingress)
+                       .count();
+   _total_latency->record(total_us);
+
+   if (total_us < _slow_us.load(std::memory_order_relaxed)) {
+      return;
+   }
+
+   const std::lock_guard<std::mutex> lock(_slow_mutex);
+   _slow.push_front({.node_id = trace._node_id,
+                     .sensor_id = trace._sensor_id,
+                     .ingress_ms = trace._ingress_ms,
+                     .total_us = total_us,
+                     .stage_us = trace._stage_us});
+   if (_slow.size() > MAX_SLOW_TRACES) {
+      _slow.pop_back();
+   }
+}
+
+std::string tracer_c::render_slow_traces() {
+
+   const std::lock_guard<std::mutex> lock(_slow_mutex);
+
+   std::stringstream ss;
+   ss << "[";
+   for (size_t i = 0; i < _slow.size(); i++) {
+      auto &trace = _slow[i];
+      ss << (i ? "," : "") << "{\"node\":\"" << escape_json(trace.node_id)
+         << "\",\"sensor\":\"" << escape_json(trace.sensor_id)
+         << "\",\"ingress_ms\":" << trace.ingress_ms
+         << ",\"total_us\":" << trace.total_us << ",\"stages_us\":{";
+
+      // Stages a reading never reached are left out
+      bool first{true};
+      for (size_t s = 0; s < trace_c::NUM_STAGES; s++) {
+         if (trace.stage_us[s] < 0) {
+            continue;
+         }
+         ss << (first ? "" : ",") << "\""
+            << trace_c::stage_name(static_cast<trace_c::stage_e>(s))
+            << "\":" << trace.stage_us[s];
+         first = false;
+      }
+      ss << "}}";
+   }
+   ss << "]";
+   return ss.str();
+}
+
+tracer_c &tracer() {
+   static tracer_c instance;
+   return instance;
+}
+
+} // namespace stats
+} // namespace monolith
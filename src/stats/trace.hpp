@@ -0,0 +1,126 @@
+#ifndef MONOLITH_STATS_TRACE_HPP
+#define MONOLITH_STATS_TRACE_HPP
+
+#include "stats.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/*
+   ABOUT:
+      Sampled tracing of readings through the ingest pipeline. One in every
+   `sample_every` readings submitted gets a trace stamped with the time it
+   came in. Each stage the reading passes through marks the trace as it
+   leaves, recording the time since ingress into that stage's histogram.
+
+   A reading fans out to several services, so the trace is shared between
+   them and completes when the last one lets go of it. Completed traces that
+   took longer than the slow threshold are kept around to be dumped.
+*/
+
+namespace monolith {
+namespace stats {
+
+class tracer_c;
+
+//! \brief A single sampled reading's trip through the pipeline
+class trace_c {
+ public:
+   //! \brief Points in the pipeline a reading is marked at
+   enum class stage_e : uint8_t {
+      SUBMISSION_QUEUE, //! Left the data submission queue
+      DB_QUEUE,         //! Left the metric database queue
+      DB_INSERT,        //! Written to the metric database
+      RULES_QUEUE,      //! Left a rule executor shard's queue
+      RULES,            //! Handed to the rule script
+      STREAM_QUEUE,     //! Left the streamer queue
+      STREAM_SEND       //! Written to the stream receivers
+   };
+   static constexpr size_t NUM_STAGES = 7;
+
+   trace_c() = delete;
+   explicit trace_c(tracer_c *tracer);
+
+   //! \brief Completes the trace with the tracer that made it
+   ~trace_c();
+
+   //! \brief Record which reading is being traced
+   //! \note  Readings aren't decoded on the way in, so the first stage to
+   //!        look inside fills this in before handing the trace on
+   void identify(const std::string &node_id, const std::string &sensor_id);
+
+   //! \brief Mark that the reading has left a stage
+   //! \note  Each stage must only be marked by one thread
+   void mark(stage_e stage);
+
+   //! \brief Get the name of a stage
+   static const char *stage_name(stage_e stage);
+
+ private:
+   friend class tracer_c;
+
+   tracer_c *_tracer{nullptr};
+   std::string _node_id;
+   std::string _sensor_id;
+   std::chrono::steady_clock::time_point _ingress;
+   int64_t _ingress_ms{0}; // Wall clock, for display only
+   std::array<int64_t, NUM_STAGES> _stage_us; // -1 until reached
+};
+
+//! \brief Shared handle that travels with a reading (null if not sampled)
+using trace_t = std::shared_ptr<trace_c>;
+
+//! \brief Samples readings and collects their traces
+class tracer_c {
+ public:
+   tracer_c();
+
+   //! \brief Configure sampling
+   //! \param sample_every Trace one reading in this many (0 = disabled)
+   //! \param slow_ms Completed traces taking at least this long are kept
+   void configure(uint32_t sample_every, uint32_t slow_ms);
+
+   //! \brief Start a trace for a reading coming in
+   //! \returns A trace if this reading is sampled, nullptr otherwise
+   trace_t begin();
+
+   //! \brief Render the kept slow traces (most recent first) as json
+   std::string render_slow_traces();
+
+ private:
+   friend class trace_c;
+
+   static constexpr size_t MAX_SLOW_TRACES = 64;
+
+   struct completed_s {
+      std::string node_id;
+      std::string sensor_id;
+      int64_t ingress_ms{0};
+      int64_t total_us{0};
+      std::array<int64_t, trace_c::NUM_STAGES> stage_us;
+   };
+
+   std::atomic<uint32_t> _sample_every{0};
+   std::atomic<int64_t> _slow_us{0};
+   std::atomic<uint64_t> _submitted{0};
+
+   std::array<histogram_c *, trace_c::NUM_STAGES> _stage_latency{};
+   histogram_c *_total_latency{nullptr};
+
+   std::mutex _slow_mutex;
+   std::deque<completed_s> _slow;
+
+   void finish(const trace_c &trace);
+};
+
+//! \brief Get the process wide tracer
+tracer_c &tracer();
+
+} // namespace stats
+} // namespace monolith
+
+#endif
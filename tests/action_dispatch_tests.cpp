@@ -0,0 +1,542 @@
+#include "db/kv.hpp"
+#include "services/action_dispatch.hpp"
+#include <chrono>
+#include <crate/common/common.hpp>
+#include <crate/control/action_v1.hpp>
+#include <crate/networking/message_receiver_if.hpp>
+#include <crate/networking/message_server.hpp>
+#include <crate/registrar/controller_v1.hpp>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+using namespace std::chrono_literals;
+
+namespace monolith {
+namespace test {
+
+//! \brief Reaches into the dispatcher so queues can be driven without the
+//!        registrar or the worker threads
+class action_dispatch_access_c {
+ public:
+   using dispatch_t = monolith::services::action_dispatch_c;
+   using priority_e = dispatch_t::priority_e;
+
+   //! \brief Queue an action for a controller at the given address
+   static void enqueue(dispatch_t &dispatch, const std::string &controller_id,
+                       const std::string &address, uint32_t port,
+                       const std::string &action_id, double value,
+                       priority_e priority = priority_e::NORMAL,
+                       uint32_t deadline_ms = 0) {
+      dispatch.enqueue(controller_id, address, port, action_id, value,
+                       priority, deadline_ms);
+   }
+
+   //! \brief Claim the next controller to serve and release it again
+   static std::string claim(dispatch_t &dispatch) {
+      const std::lock_guard<std::mutex> lock(dispatch._controllers_mutex);
+      auto wake = dispatch_t::steady_clock_t::now();
+      auto id = dispatch.claim(wake);
+      if (!id.empty()) {
+         dispatch._controllers[id].busy = false;
+      }
+      return id;
+   }
+
+   //! \brief Send what is ready for a controller, as a worker would
+   static void burst(dispatch_t &dispatch, const std::string &controller_id) {
+      {
+         const std::lock_guard<std::mutex> lock(dispatch._controllers_mutex);
+         auto &controller = dispatch._controllers[controller_id];
+         dispatch.refill(controller, dispatch_t::steady_clock_t::now());
+         controller.busy = true;
+      }
+      dispatch.burst(controller_id);
+   }
+
+   //! \brief Time until a controller in backoff is tried again
+   static std::chrono::milliseconds retry_in(dispatch_t &dispatch,
+                                             const std::string &controller_id) {
+      const std::lock_guard<std::mutex> lock(dispatch._controllers_mutex);
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+          dispatch._controllers[controller_id].retry_at -
+          dispatch_t::steady_clock_t::now());
+   }
+
+   //! \brief Actions queued for a controller
+   static size_t queued(dispatch_t &dispatch,
+                        const std::string &controller_id) {
+      const std::lock_guard<std::mutex> lock(dispatch._controllers_mutex);
+      return dispatch._controllers[controller_id].queued;
+   }
+
+   static uint64_t dropped_failed(dispatch_t &dispatch) {
+      return dispatch._dropped_failed.load();
+   }
+
+   static uint64_t dropped_overflow(dispatch_t &dispatch) {
+      return dispatch._dropped_overflow.load();
+   }
+
+   static uint64_t coalesced(dispatch_t &dispatch) {
+      return dispatch._coalesced.load();
+   }
+
+   static uint64_t sent(dispatch_t &dispatch, priority_e priority) {
+      return dispatch._sent[static_cast<size_t>(priority)].load();
+   }
+
+   static uint64_t deadline_missed(dispatch_t &dispatch, priority_e priority) {
+      return dispatch._deadline_missed[static_cast<size_t>(priority)].load();
+   }
+
+   //! \brief Check if a controller is in the cache
+   static bool cached(dispatch_t &dispatch, const std::string &controller_id) {
+      const std::lock_guard<std::mutex> lock(dispatch._cache_mutex);
+      return dispatch._controller_cache.contains(controller_id);
+   }
+
+   //! \brief Look a controller up, loading it from the registrar if needed
+   //! \returns The actions of the controller, empty if it wasn't found
+   static std::set<std::string> lookup(dispatch_t &dispatch,
+                                       const std::string &controller_id) {
+      auto controller = dispatch.lookup_controller(controller_id);
+      if (!controller) {
+         return {};
+      }
+      return {controller->actions.begin(), controller->actions.end()};
+   }
+
+   //! \brief Read the cache generation, as a lookup does before loading
+   static uint64_t generation(dispatch_t &dispatch) {
+      const std::lock_guard<std::mutex> lock(dispatch._cache_mutex);
+      return dispatch._cache_generation;
+   }
+
+   //! \brief Cache an entry loaded at the given generation
+   static bool cache(dispatch_t &dispatch, const std::string &controller_id,
+                     uint64_t generation) {
+      return dispatch.cache_controller(
+          controller_id, std::make_shared<dispatch_t::cached_controller_s>(),
+          generation);
+   }
+};
+
+} // namespace test
+} // namespace monolith
+
+namespace {
+
+using access_c = monolith::test::action_dispatch_access_c;
+using dispatch_t = monolith::services::action_dispatch_c;
+using priority_e = dispatch_t::priority_e;
+
+static constexpr char ADDRESS[] = "127.0.0.1";
+static constexpr uint32_t CONTROLLER_PORT = 5044;
+static constexpr uint32_t DEAD_CONTROLLER_PORT = 5049; // Nothing listens
+static constexpr char REGISTRAR_DB[] = "test_action_dispatch_registrar.db";
+static constexpr char LOGS[] = "test_action_dispatch";
+
+struct received_action_s {
+   std::string controller_id;
+   std::string action_id;
+   double value{0.0};
+   std::chrono::steady_clock::time_point arrived;
+};
+
+class controller_receiver_c : public crate::networking::message_receiver_if {
+ public:
+   virtual void receive_message(std::string message) override final {
+      crate::control::action_v1_c action;
+      action.decode_from(message);
+      auto [timestamp, controller_id, action_id, value] = action.get_data();
+
+      const std::lock_guard<std::mutex> lock(_mutex);
+      _received.push_back(
+          {controller_id, action_id, value, std::chrono::steady_clock::now()});
+   }
+
+   std::vector<received_action_s> received() {
+      const std::lock_guard<std::mutex> lock(_mutex);
+      return _received;
+   }
+
+ private:
+   std::mutex _mutex;
+   std::vector<received_action_s> _received;
+};
+
+bool wait_for(std::function<bool()> condition,
+              std::chrono::milliseconds timeout) {
+   auto deadline = std::chrono::steady_clock::now() + timeout;
+   while (!condition()) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+         return false;
+      }
+      std::this_thread::sleep_for(5ms);
+   }
+   return true;
+}
+
+monolith::db::kv_c *registrar_db{nullptr};
+controller_receiver_c *receiver{nullptr};
+crate::networking::message_server_c *controller_server{nullptr};
+
+void register_controller(const std::string &controller_id,
+                         const std::vector<std::string> &action_ids) {
+   crate::registrar::controller_v1_c controller;
+   controller.set_id(controller_id);
+   for (auto &action_id : action_ids) {
+      crate::registrar::controller_v1_c::action_s action;
+      action.id = action_id;
+      action.description = "[desc]";
+      controller.add_action(action);
+   }
+
+   std::string encoded;
+   CHECK_TRUE(controller.encode_to(encoded));
+   CHECK_TRUE(registrar_db->store(controller_id, encoded));
+}
+
+} // namespace
+
+TEST_GROUP(action_dispatch_test){
+    void setup(){crate::common::setup_logger(LOGS, AixLog::Severity::error);
+std::filesystem::remove_all(REGISTRAR_DB);
+registrar_db = new monolith::db::kv_c(REGISTRAR_DB);
+receiver = new controller_receiver_c();
+controller_server = new crate::networking::message_server_c(
+    ADDRESS, CONTROLLER_PORT, receiver);
+CHECK_TRUE(controller_server->start());
+}
+
+void teardown() {
+   controller_server->stop();
+   delete controller_server;
+   delete receiver;
+   delete registrar_db;
+   std::filesystem::remove_all(REGISTRAR_DB);
+   std::filesystem::remove_all(std::string(LOGS) + std::string(".log"));
+}
+}
+;
+
+TEST(action_dispatch_test, controllers_take_turns) {
+
+   dispatch_t dispatch(registrar_db, dispatch_t::configuration_c());
+
+   for (auto id : {"a", "b", "c"}) {
+      access_c::enqueue(dispatch, id, ADDRESS, CONTROLLER_PORT, "act", 1.0);
+   }
+
+   // Every controller with something ready is served once before any of
+   // them is served again
+   std::vector<std::string> claimed;
+   for (size_t i = 0; i < 6; i++) {
+      claimed.push_back(access_c::claim(dispatch));
+   }
+   CHECK_EQUAL(3, std::set<std::string>(claimed.begin(), claimed.begin() + 3)
+                      .size());
+   for (size_t i = 3; i < 6; i++) {
+      CHECK_EQUAL(claimed[i - 3], claimed[i]);
+   }
+
+   // A higher lane still goes first, and takes its own turns
+   access_c::enqueue(dispatch, "b", ADDRESS, CONTROLLER_PORT, "urgent", 1.0,
+                     priority_e::HIGH);
+   CHECK_EQUAL(std::string("b"), access_c::claim(dispatch));
+   CHECK_EQUAL(std::string("b"), access_c::claim(dispatch));
+}
+
+TEST(action_dispatch_test, dead_controller_does_not_delay_others) {
+
+   dispatch_t::configuration_c config;
+   config.workers = 1;
+   config.backoff_base_ms = 10'000;
+   config.backoff_max_ms = 10'000;
+
+   dispatch_t dispatch(registrar_db, config);
+   CHECK_TRUE(dispatch.start());
+
+   access_c::enqueue(dispatch, "dead", ADDRESS, DEAD_CONTROLLER_PORT, "act",
+                     1.0);
+
+   // The only worker keeps serving the healthy controller while the dead one
+   // waits out its backoff
+   for (size_t i = 0; i < 10; i++) {
+      access_c::enqueue(dispatch, "live", ADDRESS, CONTROLLER_PORT, "act", i);
+      CHECK_TRUE(
+          wait_for([i] { return receiver->received().size() == i + 1; }, 1s));
+   }
+   CHECK_EQUAL(1, access_c::queued(dispatch, "dead"));
+   CHECK_TRUE(dispatch.stop());
+}
+
+TEST(action_dispatch_test, failed_sends_back_off_exponentially) {
+
+   dispatch_t::configuration_c config;
+   config.max_attempts = 10;
+   config.backoff_base_ms = 100;
+   config.backoff_max_ms = 400;
+
+   dispatch_t dispatch(registrar_db, config);
+   access_c::enqueue(dispatch, "dead", ADDRESS, DEAD_CONTROLLER_PORT, "act",
+                     1.0);
+
+   // Doubles from the base with every failure until it reaches the cap
+   for (auto expected : {100, 200, 400, 400, 400}) {
+      access_c::burst(dispatch, "dead");
+      auto retry_in = access_c::retry_in(dispatch, "dead").count();
+      CHECK_TRUE(retry_in <= expected);
+      CHECK_TRUE(retry_in > expected - 50);
+   }
+   CHECK_EQUAL(1, access_c::queued(dispatch, "dead"));
+   CHECK_EQUAL(0, access_c::dropped_failed(dispatch));
+}
+
+TEST(action_dispatch_test, failed_action_dropped_after_max_attempts) {
+
+   dispatch_t::configuration_c config;
+   config.max_attempts = 3;
+   config.backoff_base_ms = 1;
+
+   dispatch_t dispatch(registrar_db, config);
+   access_c::enqueue(dispatch, "dead", ADDRESS, DEAD_CONTROLLER_PORT, "first",
+                     1.0);
+   access_c::enqueue(dispatch, "dead", ADDRESS, DEAD_CONTROLLER_PORT, "second",
+                     2.0);
+
+   for (size_t attempt = 1; attempt < 3; attempt++) {
+      access_c::burst(dispatch, "dead");
+      CHECK_EQUAL(2, access_c::queued(dispatch, "dead"));
+   }
+
+   // Only the action at the front is given up on, the next starts over
+   access_c::burst(dispatch, "dead");
+   CHECK_EQUAL(1, access_c::queued(dispatch, "dead"));
+   CHECK_EQUAL(1, access_c::dropped_failed(dispatch));
+
+   access_c::burst(dispatch, "dead");
+   CHECK_EQUAL(1, access_c::queued(dispatch, "dead"));
+   CHECK_EQUAL(1, access_c::dropped_failed(dispatch));
+}
+
+TEST(action_dispatch_test, registrar_writes_invalidate_cache) {
+
+   dispatch_t dispatch(registrar_db, dispatch_t::configuration_c());
+
+   register_controller("ctrl", {"open"});
+   CHECK_TRUE(access_c::lookup(dispatch, "ctrl").contains("open"));
+   CHECK_TRUE(access_c::cached(dispatch, "ctrl"));
+   CHECK_TRUE(dispatch.dispatch("ctrl", "open", 1.0));
+
+   // Storing the key again drops the entry, the new actions are picked up
+   register_controller("ctrl", {"close"});
+   CHECK_FALSE(access_c::cached(dispatch, "ctrl"));
+   CHECK_FALSE(dispatch.dispatch("ctrl", "open", 1.0));
+   CHECK_TRUE(dispatch.dispatch("ctrl", "close", 1.0));
+
+   // As does removing it
+   CHECK_TRUE(registrar_db->remove("ctrl"));
+   CHECK_FALSE(access_c::cached(dispatch, "ctrl"));
+   CHECK_FALSE(dispatch.dispatch("ctrl", "close", 1.0));
+
+   // Writes to other keys leave the entry alone
+   register_controller("ctrl", {"open"});
+   CHECK_TRUE(dispatch.dispatch("ctrl", "open", 1.0));
+   register_controller("other", {"open"});
+   CHECK_TRUE(access_c::cached(dispatch, "ctrl"));
+}
+
+TEST(action_dispatch_test, stale_load_is_not_cached) {
+
+   dispatch_t dispatch(registrar_db, dispatch_t::configuration_c());
+
+   // A write landing between reading the generation and caching what was
+   // loaded means the load may have seen the old value
+   auto generation = access_c::generation(dispatch);
+   register_controller("ctrl", {"open"});
+   CHECK_FALSE(access_c::cache(dispatch, "ctrl", generation));
+   CHECK_FALSE(access_c::cached(dispatch, "ctrl"));
+
+   CHECK_TRUE(access_c::cache(dispatch, "ctrl", access_c::generation(dispatch)));
+   CHECK_TRUE(access_c::cached(dispatch, "ctrl"));
+}
+
+TEST(action_dispatch_test, coalesces_within_window) {
+
+   dispatch_t::configuration_c config;
+   config.workers = 1;
+   config.coalesce_window_ms = 500;
+
+   dispatch_t dispatch(registrar_db, config);
+
+   // Dispatched again before it went out, only the last value is kept
+   for (size_t i = 1; i <= 5; i++) {
+      access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "act", i);
+   }
+   CHECK_EQUAL(1, access_c::queued(dispatch, "ctrl"));
+   CHECK_EQUAL(4, access_c::coalesced(dispatch));
+
+   CHECK_TRUE(dispatch.start());
+   CHECK_TRUE(wait_for([] { return receiver->received().size() == 1; }, 1s));
+   DOUBLES_EQUAL(5.0, receiver->received().front().value, 0.001);
+
+   // Dispatched again within the window of that send, they wait it out and
+   // go out as one send of the last value
+   for (size_t i = 6; i <= 10; i++) {
+      access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "act", i);
+   }
+   std::this_thread::sleep_for(200ms);
+   CHECK_EQUAL(1, receiver->received().size());
+
+   CHECK_TRUE(wait_for([] { return receiver->received().size() == 2; }, 1s));
+   std::this_thread::sleep_for(100ms);
+
+   auto received = receiver->received();
+   CHECK_EQUAL(2, received.size());
+   DOUBLES_EQUAL(10.0, received.back().value, 0.001);
+   CHECK_TRUE(received.back().arrived - received.front().arrived >= 450ms);
+   CHECK_TRUE(dispatch.stop());
+}
+
+TEST(action_dispatch_test, send_rate_is_limited) {
+
+   dispatch_t::configuration_c config;
+   config.workers = 2;
+   config.rate_limit_per_sec = 20.0;
+   config.rate_limit_burst = 1;
+
+   dispatch_t dispatch(registrar_db, config);
+   CHECK_TRUE(dispatch.start());
+
+   for (size_t i = 0; i < 10; i++) {
+      access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "act", i);
+   }
+
+   // One goes out straight away, the rest at 20 a second
+   std::this_thread::sleep_for(200ms);
+   CHECK_TRUE(receiver->received().size() <= 6);
+
+   CHECK_TRUE(wait_for([] { return receiver->received().size() == 10; }, 2s));
+   auto received = receiver->received();
+   CHECK_TRUE(received.back().arrived - received.front().arrived >= 400ms);
+
+   // Throttling keeps the order they were dispatched in
+   for (size_t i = 0; i < received.size(); i++) {
+      DOUBLES_EQUAL(static_cast<double>(i), received[i].value, 0.001);
+   }
+   CHECK_TRUE(dispatch.stop());
+}
+
+TEST(action_dispatch_test, full_queue_drops_oldest) {
+
+   dispatch_t::configuration_c config;
+   config.max_queued = 3;
+
+   dispatch_t dispatch(registrar_db, config);
+
+   for (size_t i = 1; i <= 3; i++) {
+      access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT,
+                        "low_" + std::to_string(i), i, priority_e::LOW);
+   }
+
+   // Room is made by dropping the oldest of the queued actions
+   for (size_t i = 4; i <= 5; i++) {
+      access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT,
+                        "normal_" + std::to_string(i), i);
+   }
+   CHECK_EQUAL(3, access_c::queued(dispatch, "ctrl"));
+   CHECK_EQUAL(2, access_c::dropped_overflow(dispatch));
+
+   CHECK_TRUE(dispatch.start());
+   CHECK_TRUE(wait_for([] { return receiver->received().size() == 3; }, 1s));
+
+   std::multiset<double> values;
+   for (auto &action : receiver->received()) {
+      values.insert(action.value);
+   }
+   CHECK_TRUE(values == std::multiset<double>({3.0, 4.0, 5.0}));
+   CHECK_TRUE(dispatch.stop());
+}
+
+TEST(action_dispatch_test, critical_goes_first) {
+
+   dispatch_t::configuration_c config;
+   config.workers = 1;
+
+   dispatch_t dispatch(registrar_db, config);
+
+   access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "low", 1.0,
+                     priority_e::LOW);
+   access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "normal", 2.0,
+                     priority_e::NORMAL);
+   access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "critical",
+                     3.0, priority_e::CRITICAL);
+
+   CHECK_TRUE(dispatch.start());
+   CHECK_TRUE(wait_for([] { return receiver->received().size() == 3; }, 1s));
+
+   auto received = receiver->received();
+   CHECK_EQUAL(std::string("critical"), received[0].action_id);
+   CHECK_EQUAL(std::string("normal"), received[1].action_id);
+   CHECK_EQUAL(std::string("low"), received[2].action_id);
+   CHECK_TRUE(dispatch.stop());
+}
+
+TEST(action_dispatch_test, full_queue_never_sheds_equal_or_higher) {
+
+   dispatch_t::configuration_c config;
+   config.max_queued = 2;
+
+   dispatch_t dispatch(registrar_db, config);
+
+   access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "critical",
+                     1.0, priority_e::CRITICAL);
+   access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "high", 2.0,
+                     priority_e::HIGH);
+
+   // Nothing queued is below either of these, so they are the ones dropped
+   access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "low", 3.0,
+                     priority_e::LOW);
+   access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "high_2", 4.0,
+                     priority_e::HIGH);
+   CHECK_EQUAL(2, access_c::queued(dispatch, "ctrl"));
+   CHECK_EQUAL(2, access_c::dropped_overflow(dispatch));
+
+   access_c::burst(dispatch, "ctrl");
+   auto received = receiver->received();
+   CHECK_EQUAL(2, received.size());
+   CHECK_EQUAL(std::string("critical"), received[0].action_id);
+   CHECK_EQUAL(std::string("high"), received[1].action_id);
+}
+
+TEST(action_dispatch_test, late_sends_count_as_missed) {
+
+   dispatch_t::configuration_c config;
+   config.critical_deadline_ms = 50;
+
+   dispatch_t dispatch(registrar_db, config);
+
+   // One given the configured deadline, one given its own generous one
+   access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "late", 1.0,
+                     priority_e::CRITICAL);
+   access_c::enqueue(dispatch, "ctrl", ADDRESS, CONTROLLER_PORT, "on_time",
+                     2.0, priority_e::CRITICAL, 10'000);
+   std::this_thread::sleep_for(100ms);
+
+   // Late sends still go out
+   access_c::burst(dispatch, "ctrl");
+   CHECK_EQUAL(2, receiver->received().size());
+   CHECK_EQUAL(2, access_c::sent(dispatch, priority_e::CRITICAL));
+   CHECK_EQUAL(1, access_c::deadline_missed(dispatch, priority_e::CRITICAL));
+}
@@ -0,0 +1,194 @@
+#include "networking/ingest_server.hpp"
+#include <arpa/inet.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+using parse_result_e = monolith::networking::ingest_server_c::parse_result_e;
+
+namespace {
+constexpr size_t MAX_BYTES = 1024;
+constexpr uint32_t TEST_PORT = 25590;
+
+int connect_to_server() {
+   auto fd = socket(AF_INET, SOCK_STREAM, 0);
+   sockaddr_in addr{};
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(TEST_PORT);
+   inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+   if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+std::string receive_all(int fd) {
+   std::string received;
+   char buffer[16'384];
+   ssize_t n = 0;
+   while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+      received.append(buffer, n);
+   }
+   return received;
+}
+
+parse_result_e parse(std::string_view data, httplib::Request &req,
+                     bool &keep_alive, size_t &consumed) {
+   return monolith::networking::ingest_server_c::parse_request(
+       data, MAX_BYTES, req, keep_alive, consumed);
+}
+} // namespace
+
+TEST_GROUP(ingest_server_test){};
+
+TEST(ingest_server_test, parse_requests) {
+
+   httplib::Request req;
+   bool keep_alive = false;
+   size_t consumed = 0;
+
+   std::string data = "GET /metric/submit/%7B%22a%22%3A1%7D?x=a+b HTTP/1.1\r\n"
+                      "Host: monolith\r\n\r\n";
+   CHECK_TRUE(parse_result_e::COMPLETE ==
+              parse(data, req, keep_alive, consumed));
+   CHECK_EQUAL(data.size(), consumed);
+   CHECK_EQUAL(std::string("GET"), req.method);
+   CHECK_EQUAL(std::string("/metric/submit/{\"a\":1}"), req.path);
+   CHECK_EQUAL(std::string("a b"), req.params.find("x")->second);
+   CHECK_EQUAL(std::string("monolith"), req.headers.find("Host")->second);
+   CHECK_TRUE(keep_alive);
+
+   // Bodies are read by their length, anything after is the next request
+   req = httplib::Request();
+   data = "POST /a HTTP/1.0\r\nContent-Length: 4\r\n\r\nbodyGET /b";
+   CHECK_TRUE(parse_result_e::COMPLETE ==
+              parse(data, req, keep_alive, consumed));
+   CHECK_EQUAL(std::string("body"), req.body);
+   CHECK_EQUAL(data.size() - 6, consumed);
+   CHECK_FALSE(keep_alive);
+
+   req = httplib::Request();
+   CHECK_TRUE(parse_result_e::INCOMPLETE ==
+              parse("GET /a HTTP/1.1\r\nHost:", req, keep_alive, consumed));
+   CHECK_TRUE(parse_result_e::INCOMPLETE ==
+              parse("GET /a HTTP/1.1\r\nContent-Length: 4\r\n\r\nbo", req,
+                    keep_alive, consumed));
+}
+
+TEST(ingest_server_test, parse_errors) {
+
+   httplib::Request req;
+   bool keep_alive = false;
+   size_t consumed = 0;
+
+   CHECK_TRUE(parse_result_e::BAD_REQUEST ==
+              parse("GET\r\n\r\n", req, keep_alive, consumed));
+   CHECK_TRUE(parse_result_e::BAD_REQUEST ==
+              parse("GET nope HTTP/1.1\r\n\r\n", req, keep_alive, consumed));
+   CHECK_TRUE(parse_result_e::BAD_REQUEST ==
+              parse("GET /a HTTP/2\r\n\r\n", req, keep_alive, consumed));
+   CHECK_TRUE(parse_result_e::BAD_REQUEST ==
+              parse("GET /a HTTP/1.1\r\nContent-Length: x\r\n\r\n", req,
+                    keep_alive, consumed));
+   CHECK_TRUE(parse_result_e::UNSUPPORTED ==
+              parse("GET /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+                    req, keep_alive, consumed));
+   CHECK_TRUE(parse_result_e::TOO_LARGE ==
+              parse(std::string(MAX_BYTES + 1, 'a'), req, keep_alive,
+                    consumed));
+   CHECK_TRUE(parse_result_e::TOO_LARGE ==
+              parse("GET /a HTTP/1.1\r\nContent-Length: 2048\r\n\r\n", req,
+                    keep_alive, consumed));
+}
+
+TEST(ingest_server_test, serves_pipelined_requests) {
+
+   monolith::networking::ingest_server_c server(
+       {"127.0.0.1", TEST_PORT},
+       [](const httplib::Request &req, httplib::Response &res) {
+          if (req.path == "/missing") {
+             return false;
+          }
+          res.status = 200;
+          res.body = req.path;
+          return true;
+       },
+       monolith::networking::ingest_server_c::configuration_c());
+   CHECK_TRUE(server.start());
+
+   auto fd = connect_to_server();
+   CHECK_TRUE(fd >= 0);
+
+   std::string requests = "GET /one HTTP/1.1\r\n\r\n"
+                          "GET /missing HTTP/1.1\r\n\r\n"
+                          "GET /three HTTP/1.1\r\nConnection: close\r\n\r\n";
+   CHECK_EQUAL(static_cast<ssize_t>(requests.size()),
+               send(fd, requests.data(), requests.size(), 0));
+
+   // The server closes the connection after the last response
+   auto received = receive_all(fd);
+   close(fd);
+
+   CHECK_EQUAL(std::string("HTTP/1.1 200 OK\r\n"
+                           "Content-Length: 4\r\n"
+                           "Connection: keep-alive\r\n\r\n"
+                           "/one"
+                           "HTTP/1.1 404 Not Found\r\n"
+                           "Content-Length: 0\r\n"
+                           "Connection: keep-alive\r\n\r\n"
+                           "HTTP/1.1 200 OK\r\n"
+                           "Content-Length: 6\r\n"
+                           "Connection: close\r\n\r\n"
+                           "/three"),
+               received);
+
+   CHECK_TRUE(server.stop());
+}
+
+TEST(ingest_server_test, answers_pipelined_requests_after_half_close) {
+
+   constexpr size_t REQUESTS = 32;
+   constexpr size_t BODY_BYTES = 16'384;
+
+   // Large enough responses that the output backs up part way through
+   monolith::networking::ingest_server_c server(
+       {"127.0.0.1", TEST_PORT},
+       [](const httplib::Request &req, httplib::Response &res) {
+          res.status = 200;
+          res.body = std::string(BODY_BYTES, 'x');
+          return true;
+       },
+       monolith::networking::ingest_server_c::configuration_c());
+   CHECK_TRUE(server.start());
+
+   auto fd = connect_to_server();
+   CHECK_TRUE(fd >= 0);
+
+   std::string requests;
+   for (size_t i = 0; i < REQUESTS; i++) {
+      requests += "GET /metric/heartbeat/a HTTP/1.1\r\n\r\n";
+   }
+   CHECK_EQUAL(static_cast<ssize_t>(requests.size()),
+               send(fd, requests.data(), requests.size(), 0));
+   CHECK_EQUAL(0, shutdown(fd, SHUT_WR));
+
+   // Every request sent before the half close is still answered
+   auto received = receive_all(fd);
+   close(fd);
+
+   size_t responses = 0;
+   for (auto at = received.find("HTTP/1.1 200 OK"); at != std::string::npos;
+        at = received.find("HTTP/1.1 200 OK", at + 1)) {
+      responses++;
+   }
+   CHECK_EQUAL(REQUESTS, responses);
+
+   CHECK_TRUE(server.stop());
+}
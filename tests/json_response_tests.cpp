@@ -0,0 +1,47 @@
+#include "services/json_response.hpp"
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(json_response_test){};
+
+TEST(json_response_test, message) {
+
+   monolith::services::json_response_c response(200, 9);
+   auto json = response.message("success").take();
+   CHECK_EQUAL(std::string("{\"status\":200,\"data\":\"success\"}"), json);
+
+   monolith::services::json_response_c escaped(400);
+   json = escaped.message("a \"quoted\\\" word").take();
+   CHECK_EQUAL(
+       std::string("{\"status\":400,\"data\":\"a \\\"quoted\\\\\\\" word\"}"),
+       json);
+}
+
+TEST(json_response_test, raw) {
+
+   monolith::services::json_response_c response(200);
+   auto json = response.raw("[1,2,3]").take();
+   CHECK_EQUAL(std::string("{\"status\":200,\"data\":[1,2,3]}"), json);
+}
+
+TEST(json_response_test, sized_once) {
+
+   std::string payload(1000, 'x');
+   monolith::services::json_response_c response(200, payload.size() + 2);
+   auto capacity = response.buffer().capacity();
+   auto json = response.message(payload).take();
+   CHECK_EQUAL(capacity, json.capacity());
+}
+
+TEST(json_response_test, open_and_close) {
+
+   // As done for database fetches, the payload is written in place
+   std::string buffer = "left over";
+   monolith::services::json_response_c::open(buffer, 504);
+   buffer += "[\"a\",\"b\"]";
+   monolith::services::json_response_c::close(buffer);
+   CHECK_EQUAL(std::string("{\"status\":504,\"data\":[\"a\",\"b\"]}"), buffer);
+}
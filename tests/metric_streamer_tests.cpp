@@ -0,0 +1,251 @@
+#include "services/metric_streamer.hpp"
+#include <chrono>
+#include <crate/common/common.hpp>
+#include <crate/metrics/streams/stream_data_v1.hpp>
+#include <crate/networking/message_receiver_if.hpp>
+#include <crate/networking/message_server.hpp>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+
+static constexpr char ADDRESS[] = "127.0.0.1";
+static constexpr uint32_t RECEIVE_PORT = 5043;
+static constexpr char LOGS[] = "test_metric_streamer";
+
+// Destinations are applied by the streamer every 2.5 seconds
+static constexpr auto DESTINATION_UPDATE_WAIT = 3s;
+
+class package_receiver_c : public crate::networking::message_receiver_if {
+ public:
+   virtual void receive_message(std::string message) override final {
+      crate::metrics::streams::stream_data_v1_c data;
+      data.decode_from(message);
+      auto [timestamp, sequence, metrics] = data.get_data();
+
+      const std::lock_guard<std::mutex> lock(_mutex);
+      _package_sizes.push_back(metrics.size());
+      _readings += metrics.size();
+   }
+
+   std::vector<size_t> package_sizes() {
+      const std::lock_guard<std::mutex> lock(_mutex);
+      return _package_sizes;
+   }
+
+   size_t readings() {
+      const std::lock_guard<std::mutex> lock(_mutex);
+      return _readings;
+   }
+
+ private:
+   std::mutex _mutex;
+   std::vector<size_t> _package_sizes;
+   size_t _readings{0};
+};
+
+bool wait_for(std::function<bool()> condition,
+              std::chrono::milliseconds timeout) {
+   auto deadline = std::chrono::steady_clock::now() + timeout;
+   while (!condition()) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+         return false;
+      }
+      std::this_thread::sleep_for(10ms);
+   }
+   return true;
+}
+
+void submit_readings(monolith::services::metric_streamer_c &streamer,
+                     size_t count, const std::string &node_id = "node") {
+   for (size_t i = 0; i < count; i++) {
+      crate::metrics::sensor_reading_v1_c reading(
+          0, node_id, "sensor", static_cast<double>(i));
+      reading.stamp();
+      CHECK_TRUE(streamer.submit_metric(reading));
+   }
+}
+
+package_receiver_c *receiver{nullptr};
+crate::networking::message_server_c *receive_server{nullptr};
+
+} // namespace
+
+TEST_GROUP(metric_streamer_test){
+    void setup(){crate::common::setup_logger(LOGS, AixLog::Severity::error);
+receiver = new package_receiver_c();
+receive_server =
+    new crate::networking::message_server_c(ADDRESS, RECEIVE_PORT, receiver);
+CHECK_TRUE(receive_server->start());
+}
+
+void teardown() {
+   receive_server->stop();
+   delete receive_server;
+   delete receiver;
+   std::filesystem::remove_all(std::string(LOGS) + std::string(".log"));
+}
+}
+;
+
+TEST(metric_streamer_test, flushes_full_batches) {
+
+   monolith::services::metric_streamer_c::configuration_c config;
+   config.max_batch_readings = 10;
+   config.max_batch_latency_ms = 60'000;
+
+   monolith::services::metric_streamer_c streamer(config);
+   CHECK_TRUE(streamer.start());
+   streamer.add_destination(ADDRESS, RECEIVE_PORT);
+   std::this_thread::sleep_for(DESTINATION_UPDATE_WAIT);
+
+   // Three full batches go out, the partial one waits for its deadline
+   submit_readings(streamer, 35);
+   CHECK_TRUE(wait_for([] { return receiver->readings() >= 30; }, 2s));
+   std::this_thread::sleep_for(500ms);
+
+   CHECK_EQUAL(30, receiver->readings());
+   for (auto size : receiver->package_sizes()) {
+      CHECK_EQUAL(10, size);
+   }
+   CHECK_TRUE(streamer.stop());
+}
+
+TEST(metric_streamer_test, flushes_on_bytes) {
+
+   monolith::services::metric_streamer_c::configuration_c config;
+   config.max_batch_readings = 1'000;
+   config.max_batch_bytes = 1; // Every reading fills a batch
+   config.max_batch_latency_ms = 60'000;
+
+   monolith::services::metric_streamer_c streamer(config);
+   CHECK_TRUE(streamer.start());
+   streamer.add_destination(ADDRESS, RECEIVE_PORT);
+   std::this_thread::sleep_for(DESTINATION_UPDATE_WAIT);
+
+   submit_readings(streamer, 5);
+   CHECK_TRUE(wait_for([] { return receiver->readings() >= 5; }, 2s));
+
+   auto sizes = receiver->package_sizes();
+   CHECK_EQUAL(5, sizes.size());
+   for (auto size : sizes) {
+      CHECK_EQUAL(1, size);
+   }
+   CHECK_TRUE(streamer.stop());
+}
+
+TEST(metric_streamer_test, flushes_on_latency) {
+
+   monolith::services::metric_streamer_c::configuration_c config;
+   config.max_batch_readings = 1'000;
+   config.max_batch_latency_ms = 500;
+
+   monolith::services::metric_streamer_c streamer(config);
+   CHECK_TRUE(streamer.start());
+   streamer.add_destination(ADDRESS, RECEIVE_PORT);
+   std::this_thread::sleep_for(DESTINATION_UPDATE_WAIT);
+
+   // Nowhere near a full batch, so they only go out once the oldest has
+   // waited out the latency target
+   submit_readings(streamer, 3);
+   std::this_thread::sleep_for(100ms);
+   CHECK_EQUAL(0, receiver->readings());
+
+   CHECK_TRUE(wait_for([] { return receiver->readings() >= 3; }, 2s));
+   auto sizes = receiver->package_sizes();
+   CHECK_EQUAL(1, sizes.size());
+   CHECK_EQUAL(3, sizes.front());
+   CHECK_TRUE(streamer.stop());
+}
+
+TEST(metric_streamer_test, subscribers_get_matching_metrics) {
+
+   monolith::services::metric_streamer_c streamer;
+   CHECK_TRUE(streamer.start());
+
+   auto everything = streamer.subscribe("", "");
+   auto one_node = streamer.subscribe("node_a", "");
+   CHECK_TRUE(everything != nullptr);
+   CHECK_TRUE(one_node != nullptr);
+
+   submit_readings(streamer, 3, "node_a");
+   submit_readings(streamer, 2, "node_b");
+
+   CHECK_EQUAL(5, everything->wait(100ms).size());
+   CHECK_EQUAL(3, one_node->wait(100ms).size());
+
+   // Once unsubscribed nothing more is delivered
+   streamer.unsubscribe(one_node);
+   submit_readings(streamer, 2, "node_a");
+   CHECK_EQUAL(2, everything->wait(100ms).size());
+   CHECK_EQUAL(0, one_node->wait(10ms).size());
+   CHECK_TRUE(streamer.stop());
+}
+
+TEST(metric_streamer_test, slow_subscribers_drop_oldest) {
+
+   monolith::services::metric_streamer_c streamer;
+   CHECK_TRUE(streamer.start());
+
+   // Subscriptions buffer 10'000 metrics
+   auto subscription = streamer.subscribe("", "");
+   CHECK_TRUE(subscription != nullptr);
+   submit_readings(streamer, 10'005);
+
+   auto metrics = subscription->wait(100ms);
+   CHECK_EQUAL(10'000, metrics.size());
+   CHECK_EQUAL(5, subscription->dropped());
+
+   auto [timestamp, node_id, sensor_id, value] = metrics.front().get_data();
+   DOUBLES_EQUAL(5.0, value, 0.001);
+   CHECK_TRUE(streamer.stop());
+}
+
+TEST(metric_streamer_test, subscriptions_are_capped) {
+
+   monolith::services::metric_streamer_c streamer;
+
+   std::vector<
+       std::shared_ptr<monolith::services::metric_streamer_c::live_subscription_c>>
+       subscriptions;
+   for (size_t i = 0; i < 4; i++) {
+      subscriptions.push_back(streamer.subscribe("", ""));
+      CHECK_TRUE(subscriptions.back() != nullptr);
+   }
+   CHECK_TRUE(streamer.subscribe("", "") == nullptr);
+
+   // Closing one makes room for another
+   streamer.unsubscribe(subscriptions.front());
+   CHECK_TRUE(streamer.subscribe("", "") != nullptr);
+}
+
+TEST(metric_streamer_test, subscribers_leave_backlog_for_receivers) {
+
+   monolith::services::metric_streamer_c streamer;
+   CHECK_TRUE(streamer.start());
+
+   // With only a subscriber listening the readings are held for receivers
+   auto subscription = streamer.subscribe("", "");
+   CHECK_TRUE(subscription != nullptr);
+   submit_readings(streamer, 20);
+   CHECK_EQUAL(20, subscription->wait(100ms).size());
+
+   std::this_thread::sleep_for(500ms);
+
+   // The receiver that comes along later still gets every one of them
+   streamer.add_destination(ADDRESS, RECEIVE_PORT);
+   CHECK_TRUE(wait_for([] { return receiver->readings() >= 20; },
+                       DESTINATION_UPDATE_WAIT + 2s));
+   CHECK_EQUAL(20, receiver->readings());
+   CHECK_TRUE(streamer.stop());
+}
@@ -0,0 +1,48 @@
+#include "rules/profile.hpp"
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+TEST_GROUP(profile_test){};
+
+TEST(profile_test, record_and_percentiles) {
+
+   monolith::rules::handler_profile_s profile;
+   CHECK_EQUAL(0, profile.percentile_us(50));
+
+   // 90 fast calls and 10 slow ones
+   for (size_t i = 0; i < 90; i++) {
+      profile.record(3);
+   }
+   for (size_t i = 0; i < 10; i++) {
+      profile.record(1000);
+   }
+
+   CHECK_EQUAL(100, profile.calls);
+   CHECK_EQUAL(1000, profile.max_us);
+   CHECK_EQUAL(90 * 3 + 10 * 1000, profile.total_us);
+   CHECK_EQUAL(4, profile.percentile_us(50));
+   CHECK_EQUAL(1024, profile.percentile_us(99));
+}
+
+TEST(profile_test, merge) {
+
+   monolith::rules::handler_profile_s a;
+   monolith::rules::handler_profile_s b;
+   a.record(10);
+   a.errors = 1;
+   b.record(500);
+   b.over_budget = 2;
+
+   a.merge(b);
+   CHECK_EQUAL(2, a.calls);
+   CHECK_EQUAL(1, a.errors);
+   CHECK_EQUAL(2, a.over_budget);
+   CHECK_EQUAL(500, a.max_us);
+
+   monolith::rules::profiles_t profiles{{"handler", a}};
+   auto table = monolith::rules::render_profiles(profiles);
+   CHECK_TRUE(table.find("handler") != std::string::npos);
+}
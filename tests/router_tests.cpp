@@ -0,0 +1,111 @@
+#include "networking/router.hpp"
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+namespace {
+enum route_e : size_t { ROOT, NODES, SENSORS, RANGE, SUBMIT, ADD };
+}
+
+TEST_GROUP(router_test){};
+
+TEST(router_test, literals_and_params) {
+
+   monolith::networking::router_c router;
+   CHECK_TRUE(router.add("/", ROOT));
+   CHECK_TRUE(router.add("/metric/fetch/nodes", NODES));
+   CHECK_TRUE(router.add("/metric/fetch/:node/sensors", SENSORS));
+   CHECK_TRUE(router.add("/metric/fetch/:node/range/:start/:end", RANGE));
+
+   monolith::networking::route_params_c params;
+
+   auto id = router.match("/", params);
+   CHECK_TRUE(id.has_value());
+   CHECK_EQUAL(ROOT, *id);
+   CHECK_EQUAL(0, params.size());
+
+   // Literals win over parameters
+   id = router.match("/metric/fetch/nodes", params);
+   CHECK_TRUE(id.has_value());
+   CHECK_EQUAL(NODES, *id);
+
+   // .. but a parameter is still tried when the literal leads nowhere
+   id = router.match("/metric/fetch/nodes/sensors", params);
+   CHECK_TRUE(id.has_value());
+   CHECK_EQUAL(SENSORS, *id);
+   CHECK_EQUAL(1, params.size());
+   CHECK_EQUAL(std::string("nodes"), params.str(0));
+
+   id = router.match("/metric/fetch/node-1/range/100/200", params);
+   CHECK_TRUE(id.has_value());
+   CHECK_EQUAL(RANGE, *id);
+   CHECK_EQUAL(3, params.size());
+   CHECK_EQUAL(std::string("node-1"), params.str(0));
+   CHECK_EQUAL(100, *params.as<int64_t>(1));
+   CHECK_EQUAL(200, *params.as<int64_t>(2));
+
+   CHECK_FALSE(router.match("/metric/fetch/node-1", params).has_value());
+   CHECK_FALSE(
+       router.match("/metric/fetch/node-1/range/1", params).has_value());
+   CHECK_FALSE(router.match("/nothing", params).has_value());
+   CHECK_FALSE(router.match("", params).has_value());
+}
+
+TEST(router_test, rest_of_path) {
+
+   monolith::networking::router_c router;
+   CHECK_TRUE(router.add("/metric/submit/*metric", SUBMIT));
+   CHECK_TRUE(router.add("/registrar/add/:key/*value", ADD));
+
+   monolith::networking::route_params_c params;
+
+   auto id = router.match("/metric/submit/{\"a\":\"b/c\"}", params);
+   CHECK_TRUE(id.has_value());
+   CHECK_EQUAL(SUBMIT, *id);
+   CHECK_EQUAL(std::string("{\"a\":\"b/c\"}"), params.str(0));
+
+   id = router.match("/registrar/add/key/value/with/slashes", params);
+   CHECK_TRUE(id.has_value());
+   CHECK_EQUAL(ADD, *id);
+   CHECK_EQUAL(2, params.size());
+   CHECK_EQUAL(std::string("key"), params.str(0));
+   CHECK_EQUAL(std::string("value/with/slashes"), params.str(1));
+
+   // An empty remainder still matches, as the regex routes did
+   id = router.match("/metric/submit/", params);
+   CHECK_TRUE(id.has_value());
+   CHECK_EQUAL(std::string(""), params.str(0));
+}
+
+TEST(router_test, typed_params) {
+
+   monolith::networking::router_c router;
+   CHECK_TRUE(router.add("/port/:port", 0));
+
+   monolith::networking::route_params_c params;
+   CHECK_TRUE(router.match("/port/8080", params).has_value());
+   CHECK_EQUAL(8080, *params.as<uint32_t>(0));
+   CHECK_TRUE(params.as<uint16_t>(0).has_value());
+
+   CHECK_TRUE(router.match("/port/80a", params).has_value());
+   CHECK_FALSE(params.as<uint32_t>(0).has_value());
+
+   CHECK_TRUE(router.match("/port/-1", params).has_value());
+   CHECK_FALSE(params.as<uint32_t>(0).has_value());
+
+   CHECK_TRUE(router.match("/port/70000", params).has_value());
+   CHECK_FALSE(params.as<uint16_t>(0).has_value());
+}
+
+TEST(router_test, invalid_patterns) {
+
+   monolith::networking::router_c router;
+   CHECK_FALSE(router.add("", 0));
+   CHECK_FALSE(router.add("no/leading/slash", 0));
+   CHECK_FALSE(router.add("/rest/*then/more", 0));
+
+   CHECK_TRUE(router.add("/dup/:a", 0));
+   CHECK_FALSE(router.add("/dup/:b", 1));
+}
@@ -0,0 +1,151 @@
+#include "services/rule_executor.hpp"
+#include <chrono>
+#include <crate/common/common.hpp>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+using namespace std::chrono_literals;
+
+namespace monolith {
+namespace test {
+
+//! \brief Reads the handler profiles of the executor's shards
+class rule_executor_access_c {
+ public:
+   using executor_t = monolith::services::rule_executor_c;
+
+   static size_t shards(executor_t &executor) {
+      return executor._shards.size();
+   }
+
+   //! \brief Retrieve a handler's profile from a single shard's runtime
+   static monolith::rules::handler_profile_s
+   profile(executor_t &executor, size_t shard, const std::string &handler) {
+      monolith::rules::profiles_t profiles;
+      {
+         const std::lock_guard<std::mutex> lock(
+             executor._shards[shard]->runtime_mutex);
+         executor._shards[shard]->runtime->collect_profiles(profiles);
+      }
+      auto entry = profiles.find(handler);
+      return entry == profiles.end() ? monolith::rules::handler_profile_s{}
+                                     : entry->second;
+   }
+};
+
+} // namespace test
+} // namespace monolith
+
+namespace {
+
+using access_c = monolith::test::rule_executor_access_c;
+
+static constexpr char SCRIPT_FILE[] = "test_rule_executor.lua";
+static constexpr char LOGS[] = "test_rule_executor";
+static constexpr char READING_HANDLER[] = "accept_reading_v1_from_monolith";
+
+void write_script(const std::string &source) {
+   std::ofstream out(SCRIPT_FILE, std::ios::trunc);
+   out << source;
+}
+
+bool wait_for(std::function<bool()> condition,
+              std::chrono::milliseconds timeout) {
+   auto deadline = std::chrono::steady_clock::now() + timeout;
+   while (!condition()) {
+      if (std::chrono::steady_clock::now() >= deadline) {
+         return false;
+      }
+      std::this_thread::sleep_for(10ms);
+   }
+   return true;
+}
+
+} // namespace
+
+TEST_GROUP(rule_executor_test){
+    void setup(){crate::common::setup_logger(LOGS, AixLog::Severity::error);
+std::filesystem::remove_all(SCRIPT_FILE);
+}
+
+void teardown() {
+   std::filesystem::remove_all(std::string(LOGS) + std::string(".log"));
+   std::filesystem::remove_all(SCRIPT_FILE);
+}
+}
+;
+
+TEST(rule_executor_test, shards_keep_node_readings_together_and_in_order) {
+
+   static constexpr size_t NUM_SHARDS = 4;
+   static constexpr size_t NUM_SUBMITTERS = 4;
+   static constexpr size_t NUM_NODES = 32;
+   static constexpr size_t NUM_READINGS_PER_NODE = 500;
+
+   // Each node's readings count up from 1. A shard that misses one of a
+   // node's readings, sees them out of order, or only sees some of them
+   // because the rest went to another shard finds a gap and errors
+   write_script(R"(
+      local last = {}
+      function accept_reading_v1_from_monolith(t, n, s, v)
+         if v ~= (last[n] or 0) + 1 then
+            error("reading " .. v .. " from " .. n .. " out of order")
+         end
+         last[n] = v
+      end
+   )");
+
+   monolith::services::rule_executor_c executor(
+       SCRIPT_FILE, monolith::alert::alert_manager_c::configuration_c(),
+       nullptr, nullptr, {}, NUM_SHARDS);
+   CHECK_TRUE(executor.open());
+   CHECK_TRUE(executor.start());
+   CHECK_EQUAL(NUM_SHARDS, access_c::shards(executor));
+
+   // Several threads submit at once, each for its own set of nodes, with
+   // every node's readings interleaved with the others'
+   std::vector<std::thread> submitters;
+   for (size_t submitter = 0; submitter < NUM_SUBMITTERS; submitter++) {
+      submitters.emplace_back([&executor, submitter] {
+         for (size_t value = 1; value <= NUM_READINGS_PER_NODE; value++) {
+            for (size_t node = submitter; node < NUM_NODES;
+                 node += NUM_SUBMITTERS) {
+               crate::metrics::sensor_reading_v1_c reading(
+                   value, "node_" + std::to_string(node), "sensor", value);
+               executor.submit_metric(reading);
+            }
+         }
+      });
+   }
+   for (auto &submitter : submitters) {
+      submitter.join();
+   }
+
+   auto handled = [&executor] {
+      uint64_t calls{0};
+      for (size_t shard = 0; shard < NUM_SHARDS; shard++) {
+         calls += access_c::profile(executor, shard, READING_HANDLER).calls;
+      }
+      return calls;
+   };
+   CHECK_TRUE(wait_for(
+       [&] { return handled() == NUM_NODES * NUM_READINGS_PER_NODE; }, 10s));
+   CHECK_TRUE(executor.stop());
+
+   // Every shard did its share of the work, and none saw a gap
+   for (size_t shard = 0; shard < NUM_SHARDS; shard++) {
+      auto profile = access_c::profile(executor, shard, READING_HANDLER);
+      CHECK_TRUE(profile.calls > 0);
+      CHECK_EQUAL(0, profile.errors);
+   }
+   CHECK_EQUAL(NUM_NODES * NUM_READINGS_PER_NODE, handled());
+}
@@ -0,0 +1,249 @@
+#include "rules/runtime.hpp"
+#include "rules/script_cache.hpp"
+#include <crate/common/common.hpp>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+namespace {
+
+static constexpr char SCRIPT_FILE[] = "test_runtime.lua";
+static constexpr char LOGS[] = "test_runtime";
+
+// Scripts fail to load if their top level raises an error, so checks made
+// while loading are written as asserts
+bool load_script(monolith::rules::runtime_c &runtime,
+                 const std::string &source) {
+   {
+      std::ofstream out(SCRIPT_FILE, std::ios::trunc);
+      out << source;
+   }
+   monolith::rules::script_cache_c cache;
+   auto script = cache.compile(SCRIPT_FILE);
+   return script && runtime.load(*script);
+}
+
+std::vector<crate::metrics::sensor_reading_v1_c>
+make_readings(size_t count, const std::string &node_id = "node",
+              const std::string &sensor_id = "sensor") {
+   std::vector<crate::metrics::sensor_reading_v1_c> readings;
+   for (size_t i = 0; i < count; i++) {
+      readings.emplace_back(i, node_id, sensor_id, static_cast<double>(i));
+   }
+   return readings;
+}
+
+monolith::rules::environment_s environment;
+
+} // namespace
+
+TEST_GROUP(runtime_test){
+    void setup(){crate::common::setup_logger(LOGS, AixLog::Severity::error);
+std::filesystem::remove_all(SCRIPT_FILE);
+}
+
+void teardown() {
+   std::filesystem::remove_all(std::string(LOGS) + std::string(".log"));
+   std::filesystem::remove_all(SCRIPT_FILE);
+}
+}
+;
+
+TEST(runtime_test, window_rejects_bad_arguments) {
+
+   monolith::rules::runtime_c runtime(&environment);
+   CHECK_TRUE(load_script(runtime, R"(
+      assert(monolith_window(0) == nil)
+      assert(monolith_window(1.5) == nil)
+      assert(monolith_window(1000001) == nil)
+      assert(monolith_window(10, "hopping") == nil)
+      assert(monolith_window(10, "sliding", 0) == nil)
+      assert(monolith_window(10, "sliding", 1.5) == nil)
+      assert(monolith_window(10, "sliding", 0 / 0) == nil)
+      assert(monolith_window(10, "sliding", "fast") == nil)
+
+      assert(monolith_window(1000000):capacity() == 1000000)
+      assert(monolith_window(10, "tumbling", 1):capacity() == 10)
+
+      function accept_reading_v1_from_monolith(t, n, s, v) end
+   )"));
+}
+
+TEST(runtime_test, batch_only_exposes_count_rows) {
+
+   monolith::rules::runtime_c runtime(&environment);
+   CHECK_TRUE(load_script(runtime, R"(
+      function accept_readings_batch_v1_from_monolith(batch)
+         for _, column in ipairs({"timestamp", "node_id", "sensor_id",
+                                  "value"}) do
+            assert(#batch[column] == batch.count)
+            assert(batch[column][batch.count + 1] == nil)
+         end
+      end
+   )"));
+
+   // A smaller batch after a larger one leaves nothing of the larger behind
+   auto large = make_readings(8);
+   auto small = make_readings(3);
+   auto one = make_readings(1);
+   CHECK_TRUE(runtime.accept_readings(large));
+   CHECK_TRUE(runtime.accept_readings(small));
+   CHECK_TRUE(runtime.accept_readings(large));
+   CHECK_TRUE(runtime.accept_readings(one));
+}
+
+TEST(runtime_test, unsubscribed_readings_never_enter_lua) {
+
+   monolith::rules::runtime_c runtime(&environment);
+   CHECK_TRUE(load_script(runtime, R"(
+      monolith_subscribe("node_a", "temp", function(t, n, s, v)
+         assert(n == "node_a" and s == "temp")
+      end)
+   )"));
+
+   // Nothing subscribed to these, so no handler is called at all
+   auto other_node = make_readings(5, "node_b", "temp");
+   auto other_sensor = make_readings(5, "node_a", "humidity");
+   CHECK_TRUE(runtime.accept_readings(other_node));
+   CHECK_TRUE(runtime.accept_readings(other_sensor));
+
+   monolith::rules::profiles_t profiles;
+   runtime.collect_profiles(profiles);
+   CHECK_TRUE(profiles.empty());
+
+   auto subscribed = make_readings(3, "node_a", "temp");
+   CHECK_TRUE(runtime.accept_readings(subscribed));
+
+   profiles.clear();
+   runtime.collect_profiles(profiles);
+   CHECK_EQUAL(1, profiles.size());
+   CHECK_EQUAL(3, profiles["subscribe:node_a/temp"].calls);
+}
+
+TEST(runtime_test, wildcard_subscriptions_fire_once) {
+
+   monolith::rules::runtime_c runtime(&environment);
+   CHECK_TRUE(load_script(runtime, R"(
+      local function handler(t, n, s, v) end
+      monolith_subscribe("*", "*", handler)
+      monolith_subscribe("node_a", "*", handler)
+      monolith_subscribe("*", "temp", handler)
+   )"));
+
+   auto reading = make_readings(1, "node_a", "temp");
+   CHECK_TRUE(runtime.accept_readings(reading));
+
+   monolith::rules::profiles_t profiles;
+   runtime.collect_profiles(profiles);
+   CHECK_EQUAL(1, profiles["subscribe:*/*"].calls);
+   CHECK_EQUAL(1, profiles["subscribe:node_a/*"].calls);
+   CHECK_EQUAL(1, profiles["subscribe:*/temp"].calls);
+
+   // Ids that are themselves "*" only match the wildcard subscription, and
+   // only once
+   auto wildcard_ids = make_readings(1, "*", "*");
+   CHECK_TRUE(runtime.accept_readings(wildcard_ids));
+
+   profiles.clear();
+   runtime.collect_profiles(profiles);
+   CHECK_EQUAL(2, profiles["subscribe:*/*"].calls);
+   CHECK_EQUAL(1, profiles["subscribe:node_a/*"].calls);
+   CHECK_EQUAL(1, profiles["subscribe:*/temp"].calls);
+}
+
+TEST(runtime_test, migration_carries_state_over) {
+
+   monolith::rules::runtime_c previous(&environment);
+   CHECK_TRUE(load_script(previous, R"(
+      local window = monolith_window(4)
+      window:push(1, 10)
+      window:push(2, 20)
+
+      function export_state()
+         local shared = {1, 2, 3}
+         return {
+            count = 42,
+            ratio = 0.5,
+            name = "pump",
+            enabled = true,
+            nested = {deeper = {"a", "b"}},
+            first = shared,
+            second = shared,
+            window = window,
+         }
+      end
+
+      function accept_reading_v1_from_monolith(t, n, s, v) end
+   )"));
+
+   // migrate_state raises on anything missing, which fails the migration,
+   // and the reading handler checks that it actually ran
+   monolith::rules::runtime_c replacement(&environment);
+   CHECK_TRUE(load_script(replacement, R"(
+      local migrated = false
+
+      function migrate_state(old)
+         assert(old.count == 42 and math.type(old.count) == "integer")
+         assert(old.ratio == 0.5)
+         assert(old.name == "pump")
+         assert(old.enabled == true)
+         assert(old.nested.deeper[1] == "a" and old.nested.deeper[2] == "b")
+         assert(old.first == old.second and #old.first == 3)
+         assert(old.window:count() == 2 and old.window:capacity() == 4)
+         assert(old.window:mean() == 15)
+         migrated = true
+      end
+
+      function accept_reading_v1_from_monolith(t, n, s, v)
+         assert(migrated)
+      end
+   )"));
+
+   CHECK_TRUE(replacement.migrate_from(previous));
+   auto readings = make_readings(1);
+   CHECK_TRUE(replacement.accept_readings(readings));
+}
+
+TEST(runtime_test, migration_reports_values_left_behind) {
+
+   monolith::rules::runtime_c previous(&environment);
+   CHECK_TRUE(load_script(previous, R"(
+      function export_state()
+         return {
+            count = 7,
+            callback = function() end,
+            handle = io.stdout,
+         }
+      end
+
+      function accept_reading_v1_from_monolith(t, n, s, v) end
+   )"));
+
+   // The values that can be copied still arrive, but the migration as a
+   // whole is reported as failed
+   monolith::rules::runtime_c replacement(&environment);
+   CHECK_TRUE(load_script(replacement, R"(
+      local migrated = false
+
+      function migrate_state(old)
+         assert(old.count == 7)
+         assert(old.callback == nil)
+         assert(old.handle == nil)
+         migrated = true
+      end
+
+      function accept_reading_v1_from_monolith(t, n, s, v)
+         assert(migrated)
+      end
+   )"));
+
+   CHECK_FALSE(replacement.migrate_from(previous));
+   auto readings = make_readings(1);
+   CHECK_TRUE(replacement.accept_readings(readings));
+}
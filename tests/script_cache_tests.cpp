@@ -0,0 +1,83 @@
+#include "rules/script_cache.hpp"
+#include <crate/common/common.hpp>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+namespace {
+
+static constexpr char SCRIPT_FILE[] = "test_script_cache.lua";
+static constexpr char LOGS[] = "test_script_cache";
+
+void write_script(const std::string &source) {
+   std::ofstream out(SCRIPT_FILE, std::ios::trunc);
+   out << source;
+}
+
+} // namespace
+
+TEST_GROUP(script_cache_test){
+    void setup(){crate::common::setup_logger(LOGS, AixLog::Severity::error);
+std::filesystem::remove_all(SCRIPT_FILE);
+}
+
+void teardown() {
+   std::filesystem::remove_all(std::string(LOGS) + std::string(".log"));
+   std::filesystem::remove_all(SCRIPT_FILE);
+}
+}
+;
+
+TEST(script_cache_test, compiles_once) {
+
+   monolith::rules::script_cache_c cache;
+   write_script("function accept_reading_v1_from_monolith(t, n, s, v) end\n");
+
+   auto first = cache.compile(SCRIPT_FILE);
+   CHECK_TRUE(first != nullptr);
+   CHECK_FALSE(first->bytecode.empty());
+
+   // Unchanged source comes straight from the cache
+   auto second = cache.compile(SCRIPT_FILE);
+   CHECK_TRUE(first == second);
+   CHECK_EQUAL(1, cache.size());
+
+   // Changed source is compiled again
+   write_script("function accept_reading_v1_from_monolith(t, n, s, v)\n"
+                "   print(v)\n"
+                "end\n");
+   auto third = cache.compile(SCRIPT_FILE);
+   CHECK_TRUE(third != nullptr);
+   CHECK_TRUE(first != third);
+   CHECK_EQUAL(2, cache.size());
+}
+
+TEST(script_cache_test, rejects_bad_scripts) {
+
+   monolith::rules::script_cache_c cache;
+
+   CHECK_TRUE(cache.compile(SCRIPT_FILE) == nullptr);
+
+   write_script("function broken(\n");
+   CHECK_TRUE(cache.compile(SCRIPT_FILE) == nullptr);
+   CHECK_EQUAL(0, cache.size());
+}
+
+TEST(script_cache_test, skips_shebang_line) {
+
+   monolith::rules::script_cache_c cache;
+
+   write_script("#!/usr/bin/env lua\n"
+                "function accept_reading_v1_from_monolith(t, n, s, v) end\n");
+   CHECK_TRUE(cache.compile(SCRIPT_FILE) != nullptr);
+
+   // Only a first line is skipped, `#` anywhere else is still an error
+   write_script("-- rules\n"
+                "#!/usr/bin/env lua\n");
+   CHECK_TRUE(cache.compile(SCRIPT_FILE) == nullptr);
+}
@@ -0,0 +1,146 @@
+#include "db/spool.hpp"
+#include <crate/common/common.hpp>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+namespace {
+
+static constexpr char SPOOL_FILE[] = "test_spool.spool";
+static constexpr char LOGS[] = "test_spool";
+static constexpr uint64_t SPOOL_BYTES = 4096;
+
+} // namespace
+TEST_GROUP(spool_test){
+    void setup(){crate::common::setup_logger(LOGS, AixLog::Severity::error);
+std::filesystem::remove_all(SPOOL_FILE);
+}
+
+void teardown() {
+   std::filesystem::remove_all(std::string(LOGS) + std::string(".log"));
+   std::filesystem::remove_all(SPOOL_FILE);
+}
+}
+;
+
+TEST(spool_test, append_read_in_order) {
+
+   monolith::db::spool_c spool(SPOOL_FILE, SPOOL_BYTES);
+   CHECK_TRUE(spool.open());
+   CHECK_TRUE(spool.empty());
+
+   std::vector<std::string> records;
+   for (size_t i = 0; i < 50; i++) {
+      records.push_back("record_" + std::to_string(i));
+      CHECK_TRUE(spool.append(records.back()));
+   }
+
+   CHECK_EQUAL(records.size(), spool.size());
+
+   for (auto &expected : records) {
+      std::string record;
+      CHECK_TRUE(spool.read(record));
+      CHECK_EQUAL_TEXT(expected, record, "Record read out of order");
+   }
+
+   std::string record;
+   CHECK_FALSE(spool.read(record));
+   CHECK_TRUE(spool.empty());
+}
+
+TEST(spool_test, bounded_and_reusable) {
+
+   monolith::db::spool_c spool(SPOOL_FILE, SPOOL_BYTES);
+   CHECK_TRUE(spool.open());
+
+   // Fill the spool until it refuses more data
+   std::string payload(100, 'x');
+   size_t stored{0};
+   while (spool.append(payload)) {
+      stored++;
+   }
+   CHECK_TRUE(stored > 0);
+   CHECK_TRUE(spool.bytes_used() <= SPOOL_BYTES);
+
+   // Reading a record frees up enough space to take another one
+   std::string record;
+   CHECK_TRUE(spool.read(record));
+   CHECK_TRUE(spool.append(payload));
+   CHECK_EQUAL(stored, spool.size());
+}
+
+TEST(spool_test, survives_reopen) {
+
+   {
+      monolith::db::spool_c spool(SPOOL_FILE, SPOOL_BYTES);
+      CHECK_TRUE(spool.open());
+      CHECK_TRUE(spool.append("first"));
+      CHECK_TRUE(spool.append("second"));
+   }
+
+   monolith::db::spool_c spool(SPOOL_FILE, SPOOL_BYTES);
+   CHECK_TRUE(spool.open());
+   CHECK_EQUAL(2, spool.size());
+
+   std::string record;
+   CHECK_TRUE(spool.read(record));
+   CHECK_EQUAL_TEXT(std::string("first"), record, "Recovered wrong record");
+   CHECK_TRUE(spool.read(record));
+   CHECK_EQUAL_TEXT(std::string("second"), record, "Recovered wrong record");
+}
+
+TEST(spool_test, wraps_around) {
+
+   monolith::db::spool_c spool(SPOOL_FILE, SPOOL_BYTES);
+   CHECK_TRUE(spool.open());
+
+   // Keep the spool part full while records of varying sizes cycle through
+   // it many times over, so appends land on every offset and the writer
+   // keeps wrapping back to the front of the file
+   //
+   size_t appended{0};
+   size_t consumed{0};
+   for (size_t round = 0; round < 200; round++) {
+      while (true) {
+         std::string record(1 + (appended * 37) % 300, 'a' + appended % 26);
+         if (!spool.append(record)) {
+            break;
+         }
+         appended++;
+      }
+      CHECK_TRUE(spool.bytes_used() <= SPOOL_BYTES);
+
+      for (size_t i = 0; i < 3 && !spool.empty(); i++) {
+         std::string record;
+         CHECK_TRUE(spool.read(record));
+         CHECK_EQUAL(1 + (consumed * 37) % 300, record.size());
+         CHECK_EQUAL('a' + consumed % 26, record.front());
+         consumed++;
+      }
+      CHECK_EQUAL(appended - consumed, spool.size());
+   }
+   CHECK_TRUE(appended * 100 > SPOOL_BYTES * 10);
+
+   // Records held across the wrap are recovered in order after a reopen
+   //
+   size_t held = spool.size();
+   {
+      monolith::db::spool_c reopened(SPOOL_FILE, SPOOL_BYTES);
+      CHECK_TRUE(reopened.open());
+      CHECK_EQUAL(held, reopened.size());
+   }
+
+   std::string record;
+   while (spool.read(record)) {
+      CHECK_EQUAL(1 + (consumed * 37) % 300, record.size());
+      consumed++;
+   }
+   CHECK_EQUAL(appended, consumed);
+   CHECK_TRUE(spool.empty());
+   CHECK_EQUAL(0, spool.bytes_used());
+}
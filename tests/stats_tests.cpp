@@ -0,0 +1,133 @@
+#include "stats/registry.hpp"
+#include "stats/stats.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+namespace {
+bool contains(const std::string &haystack, const std::string &needle) {
+   return haystack.find(needle) != std::string::npos;
+}
+} // namespace
+
+TEST_GROUP(stats_test){};
+
+TEST(stats_test, counter_across_threads) {
+
+   monolith::stats::counter_c counter;
+
+   std::vector<std::thread> threads;
+   for (size_t t = 0; t < 8; t++) {
+      threads.emplace_back([&counter]() {
+         for (size_t i = 0; i < 10'000; i++) {
+            counter.add();
+         }
+      });
+   }
+   for (auto &thread : threads) {
+      thread.join();
+   }
+
+   CHECK_EQUAL(80'000, counter.value());
+}
+
+TEST(stats_test, gauge) {
+
+   monolith::stats::gauge_c gauge;
+   gauge.set(10);
+   gauge.add(-3);
+   CHECK_EQUAL(7, gauge.value());
+}
+
+TEST(stats_test, histogram_buckets) {
+
+   using histogram_c = monolith::stats::histogram_c;
+
+   // Small values are exact
+   for (uint64_t v = 0; v < histogram_c::SUB_BUCKETS * 2; v++) {
+      CHECK_EQUAL(v, histogram_c::bucket_max(histogram_c::bucket_of(v)));
+   }
+
+   // Every value lands in a bucket that holds it, buckets never go
+   // backwards, and the error stays within a sub bucket
+   size_t previous{0};
+   for (uint64_t v = 1; v < (1ull << 39); v = v * 3 / 2 + 1) {
+      auto bucket = histogram_c::bucket_of(v);
+      CHECK(bucket >= previous);
+      CHECK(v <= histogram_c::bucket_max(bucket));
+      if (bucket) {
+         CHECK(v > histogram_c::bucket_max(bucket - 1));
+      }
+      CHECK(histogram_c::bucket_max(bucket) - v <=
+            v / histogram_c::SUB_BUCKETS);
+      previous = bucket;
+   }
+
+   // Huge values share the last bucket
+   CHECK_EQUAL(histogram_c::BUCKETS - 1, histogram_c::bucket_of(~0ull));
+}
+
+TEST(stats_test, histogram_percentiles) {
+
+   monolith::stats::histogram_c histogram;
+   CHECK_EQUAL(0, histogram.percentile(50));
+
+   for (size_t i = 0; i < 90; i++) {
+      histogram.record(3);
+   }
+   for (size_t i = 0; i < 10; i++) {
+      histogram.record(1000);
+   }
+
+   CHECK_EQUAL(100, histogram.count());
+   CHECK_EQUAL(90 * 3 + 10 * 1000, histogram.sum());
+   CHECK_EQUAL(3, histogram.percentile(50));
+
+   // 1000 is reported as the top of its bucket
+   auto p99 = histogram.percentile(99);
+   CHECK(p99 >= 1000);
+   CHECK(p99 < 1000 + 1000 / monolith::stats::histogram_c::SUB_BUCKETS);
+}
+
+TEST(stats_test, registry_render) {
+
+   monolith::stats::registry_c registry;
+
+   auto &requests =
+       registry.counter("test_requests_total", "Requests", {{"route", "/a"}});
+   requests.add(3);
+
+   // Same name and labels give back the same counter
+   registry.counter("test_requests_total", "Requests", {{"route", "/a"}}).add();
+   CHECK_EQUAL(4, requests.value());
+
+   registry.gauge("test_depth", "Depth").set(12);
+
+   auto &latency = registry.histogram("test_latency_us", "Latency",
+                                      {{"route", "/\"quoted\""}});
+   latency.record(5);
+   latency.record(100);
+
+   auto text = registry.render_prometheus();
+   CHECK(contains(text, "# TYPE test_requests_total counter\n"));
+   CHECK(contains(text, "test_requests_total{route=\"/a\"} 4\n"));
+   CHECK(contains(text, "# TYPE test_depth gauge\n"));
+   CHECK(contains(text, "test_depth 12\n"));
+   CHECK(contains(text, "# TYPE test_latency_us histogram\n"));
+   CHECK(contains(text,
+                  "test_latency_us_bucket{route=\"/\\\"quoted\\\"\",le=\"7\"} 1\n"));
+   CHECK(contains(text,
+                  "test_latency_us_bucket{route=\"/\\\"quoted\\\"\",le=\"+Inf\"} 2\n"));
+   CHECK(contains(text, "test_latency_us_sum{route=\"/\\\"quoted\\\"\"} 105\n"));
+   CHECK(contains(text, "test_latency_us_count{route=\"/\\\"quoted\\\"\"} 2\n"));
+
+   // A name reused with another type still hands back something usable
+   registry.gauge("test_requests_total", "Requests").set(1);
+   CHECK(contains(registry.render_prometheus(),
+                  "test_requests_total{route=\"/a\"} 4\n"));
+}
@@ -0,0 +1,124 @@
+#include "networking/task_queue.hpp"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+using namespace std::chrono_literals;
+
+namespace {
+size_t open_descriptors() {
+   auto fds = std::filesystem::directory_iterator("/proc/self/fd");
+   return std::distance(fds, std::filesystem::directory_iterator());
+}
+} // namespace
+
+TEST_GROUP(task_queue_test){};
+
+TEST(task_queue_test, runs_tasks_on_workers) {
+
+   std::atomic<int> ran{0};
+   std::atomic<int> rejected{0};
+   {
+      monolith::networking::bounded_task_queue_c queue(4, 0);
+      for (int i = 0; i < 100; i++) {
+         queue.enqueue([&] {
+            if (monolith::networking::bounded_task_queue_c::rejecting()) {
+               rejected++;
+            }
+            ran++;
+         });
+      }
+      queue.shutdown();
+   }
+   CHECK_EQUAL(100, ran.load());
+   CHECK_EQUAL(0, rejected.load());
+}
+
+TEST(task_queue_test, overflow_is_rejected) {
+
+   std::promise<void> release;
+   auto released = release.get_future().share();
+   std::promise<void> started;
+
+   std::atomic<int> ran{0};
+   std::atomic<int> rejected{0};
+   auto task = [&] {
+      if (monolith::networking::bounded_task_queue_c::rejecting()) {
+         rejected++;
+      }
+      ran++;
+   };
+
+   monolith::networking::bounded_task_queue_c queue(1, 1);
+
+   // Hold the only worker so the next task has to wait in the queue
+   queue.enqueue([&] {
+      started.set_value();
+      released.wait();
+   });
+   started.get_future().wait();
+
+   queue.enqueue(task); // Queued
+   queue.enqueue(task); // Over the limit
+
+   // The rejected task doesn't wait for the worker
+   auto deadline = std::chrono::steady_clock::now() + 5s;
+   while (!rejected.load() && std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(1ms);
+   }
+   CHECK_EQUAL(1, rejected.load());
+   CHECK_EQUAL(1, ran.load());
+
+   release.set_value();
+   queue.shutdown();
+   CHECK_EQUAL(2, ran.load());
+   CHECK_EQUAL(1, rejected.load());
+}
+
+TEST(task_queue_test, overflow_is_bounded) {
+
+   constexpr int OFFERED = 500;
+   constexpr size_t BOUND = 100;
+
+   std::promise<void> release;
+   auto released = release.get_future().share();
+   std::atomic<int> offered{0};
+   std::atomic<int> ran{0};
+
+   auto baseline = open_descriptors();
+   {
+      monolith::networking::bounded_task_queue_c queue(1, 1);
+
+      // Every task owns a descriptor like a connection would, and nothing
+      // finishes until released, so the queue stays overflowing
+      std::thread producer([&] {
+         for (int i = 0; i < OFFERED; i++) {
+            auto fd = eventfd(0, 0);
+            queue.enqueue([&, fd] {
+               released.wait();
+               close(fd);
+               ran++;
+            });
+            offered++;
+         }
+      });
+
+      std::this_thread::sleep_for(200ms);
+      CHECK_TRUE(offered.load() < OFFERED);
+      CHECK_TRUE(open_descriptors() - baseline < BOUND);
+
+      release.set_value();
+      producer.join();
+      queue.shutdown();
+   }
+   CHECK_EQUAL(OFFERED, ran.load());
+   CHECK_EQUAL(baseline, open_descriptors());
+}
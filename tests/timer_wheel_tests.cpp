@@ -0,0 +1,79 @@
+#include "rules/timer_wheel.hpp"
+#include <vector>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+namespace {
+
+static constexpr uint64_t TICK_MS = 10;
+
+} // namespace
+
+TEST_GROUP(timer_wheel_test){};
+
+TEST(timer_wheel_test, fires_in_order) {
+
+   monolith::rules::timer_wheel_c wheel(0, TICK_MS);
+
+   auto late = wheel.schedule(0, 500, 0, 2);
+   auto early = wheel.schedule(0, 100, 0, 1);
+   CHECK_EQUAL(2, wheel.size());
+
+   std::vector<monolith::rules::timer_wheel_c::expired_s> expired;
+   wheel.advance(90, expired);
+   CHECK_EQUAL(0, expired.size());
+
+   wheel.advance(1000, expired);
+   CHECK_EQUAL(2, expired.size());
+   CHECK_EQUAL(early, expired[0].id);
+   CHECK_EQUAL(1, expired[0].handler);
+   CHECK_EQUAL(late, expired[1].id);
+   CHECK_EQUAL(2, expired[1].handler);
+   CHECK_EQUAL(0, wheel.size());
+}
+
+TEST(timer_wheel_test, repeating_and_cancel) {
+
+   monolith::rules::timer_wheel_c wheel(0, TICK_MS);
+
+   auto id = wheel.schedule(0, 100, 100, 7);
+
+   std::vector<monolith::rules::timer_wheel_c::expired_s> expired;
+   wheel.advance(1000, expired);
+   CHECK_EQUAL(10, expired.size());
+   CHECK_TRUE(expired[0].repeating);
+   CHECK_TRUE(wheel.pending(id));
+
+   auto handler = wheel.cancel(id);
+   CHECK_TRUE(handler.has_value());
+   CHECK_EQUAL(7, *handler);
+   CHECK_FALSE(wheel.pending(id));
+   CHECK_FALSE(wheel.cancel(id).has_value());
+
+   expired.clear();
+   wheel.advance(2000, expired);
+   CHECK_EQUAL(0, expired.size());
+}
+
+TEST(timer_wheel_test, long_delays_cascade) {
+
+   monolith::rules::timer_wheel_c wheel(0, TICK_MS);
+
+   // Further out than the lowest levels of the wheel span
+   uint64_t delay_ms = 3 * 60 * 60 * 1000;
+   wheel.schedule(0, delay_ms, 0, 1);
+
+   auto next = wheel.next_expiry_ms();
+   CHECK_TRUE(next.has_value());
+   CHECK_EQUAL(delay_ms, *next);
+
+   std::vector<monolith::rules::timer_wheel_c::expired_s> expired;
+   wheel.advance(delay_ms - TICK_MS, expired);
+   CHECK_EQUAL(0, expired.size());
+
+   wheel.advance(delay_ms, expired);
+   CHECK_EQUAL(1, expired.size());
+}
@@ -0,0 +1,66 @@
+#include "stats/trace.hpp"
+#include <string>
+#include <thread>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+using stage_e = monolith::stats::trace_c::stage_e;
+
+TEST_GROUP(trace_test){};
+
+TEST(trace_test, disabled_by_default) {
+
+   monolith::stats::tracer_c tracer;
+   for (size_t i = 0; i < 100; i++) {
+      CHECK_TRUE(tracer.begin() == nullptr);
+   }
+}
+
+TEST(trace_test, samples_one_in_n) {
+
+   monolith::stats::tracer_c tracer;
+   tracer.configure(10, 0);
+
+   size_t sampled{0};
+   for (size_t i = 0; i < 100; i++) {
+      if (tracer.begin()) {
+         sampled++;
+      }
+   }
+   CHECK_EQUAL(10, sampled);
+}
+
+TEST(trace_test, keeps_slow_traces) {
+
+   monolith::stats::tracer_c tracer;
+   tracer.configure(1, 5);
+
+   // Finishes right away, too fast to be kept
+   tracer.begin();
+   CHECK_EQUAL(std::string("[]"), tracer.render_slow_traces());
+
+   {
+      auto trace = tracer.begin();
+      trace->identify("node\"1", "temp");
+      trace->mark(stage_e::SUBMISSION_QUEUE);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+      // Shared with another stage, the trace isn't done until both let go
+      auto copy = trace;
+      trace.reset();
+      CHECK_EQUAL(std::string("[]"), tracer.render_slow_traces());
+      copy->mark(stage_e::RULES);
+   }
+
+   auto dump = tracer.render_slow_traces();
+   CHECK_TRUE(dump.find("\"node\":\"node\\\"1\"") != std::string::npos);
+   CHECK_TRUE(dump.find("\"sensor\":\"temp\"") != std::string::npos);
+   CHECK_TRUE(dump.find("\"submission_queue\":") != std::string::npos);
+   CHECK_TRUE(dump.find("\"rules\":") != std::string::npos);
+
+   // Stages that weren't reached are left out
+   CHECK_TRUE(dump.find("db_insert") == std::string::npos);
+}
@@ -0,0 +1,88 @@
+#include "rules/window.hpp"
+#include <cmath>
+
+// This has to be included last as there is a known issue
+// described here: https://github.com/cpputest/cpputest/issues/982
+//
+#include "CppUTest/TestHarness.h"
+
+namespace {
+
+static constexpr double TOLERANCE = 0.000001;
+
+} // namespace
+
+TEST_GROUP(window_test){};
+
+TEST(window_test, empty_window) {
+
+   monolith::rules::window_c window(
+       monolith::rules::window_c::kind_e::SLIDING, 4);
+
+   CHECK_EQUAL(0, window.count());
+   CHECK_EQUAL(4, window.capacity());
+   CHECK_FALSE(window.full());
+   DOUBLES_EQUAL(0.0, window.mean(), TOLERANCE);
+   DOUBLES_EQUAL(0.0, window.min(), TOLERANCE);
+   DOUBLES_EQUAL(0.0, window.max(), TOLERANCE);
+   DOUBLES_EQUAL(0.0, window.stddev(), TOLERANCE);
+   DOUBLES_EQUAL(0.0, window.rate(), TOLERANCE);
+}
+
+TEST(window_test, sliding_aggregates) {
+
+   monolith::rules::window_c window(
+       monolith::rules::window_c::kind_e::SLIDING, 4);
+
+   // Push 1..10, the window should only hold 7, 8, 9, 10
+   for (size_t i = 1; i <= 10; i++) {
+      CHECK_FALSE(window.push(i * 10, i));
+   }
+
+   CHECK_TRUE(window.full());
+   CHECK_EQUAL(4, window.count());
+   DOUBLES_EQUAL(8.5, window.mean(), TOLERANCE);
+   DOUBLES_EQUAL(7.0, window.min(), TOLERANCE);
+   DOUBLES_EQUAL(10.0, window.max(), TOLERANCE);
+   DOUBLES_EQUAL(std::sqrt(1.25), window.stddev(), TOLERANCE);
+
+   // Value rose by 3 over 30 units of time
+   DOUBLES_EQUAL(0.1, window.rate(), TOLERANCE);
+}
+
+TEST(window_test, tumbling_completes_and_restarts) {
+
+   monolith::rules::window_c window(
+       monolith::rules::window_c::kind_e::TUMBLING, 3);
+
+   CHECK_FALSE(window.push(0, 1));
+   CHECK_FALSE(window.push(1, 2));
+   CHECK_TRUE(window.push(2, 3));
+
+   // Aggregates describe the completed window
+   DOUBLES_EQUAL(2.0, window.mean(), TOLERANCE);
+   DOUBLES_EQUAL(1.0, window.min(), TOLERANCE);
+   DOUBLES_EQUAL(3.0, window.max(), TOLERANCE);
+
+   // The next sample starts a new window
+   CHECK_FALSE(window.push(3, 10));
+   CHECK_EQUAL(1, window.count());
+   DOUBLES_EQUAL(10.0, window.mean(), TOLERANCE);
+}
+
+TEST(window_test, ewma) {
+
+   monolith::rules::window_c window(
+       monolith::rules::window_c::kind_e::SLIDING, 2, 0.5);
+
+   window.push(0, 10);
+   DOUBLES_EQUAL(10.0, window.ewma(), TOLERANCE);
+   window.push(1, 20);
+   DOUBLES_EQUAL(15.0, window.ewma(), TOLERANCE);
+   window.push(2, 20);
+   DOUBLES_EQUAL(17.5, window.ewma(), TOLERANCE);
+
+   window.reset();
+   CHECK_EQUAL(0, window.count());
+   DOUBLES_EQUAL(0.0, window.ewma(), TOLERANCE);
+}